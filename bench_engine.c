@@ -0,0 +1,135 @@
+#include"red_black_tree.h"
+#include<stdio.h>
+#include<string.h>
+#include<time.h>
+
+/*  this file times the operations of red_black_tree.h on a tree of */
+/*  integers, using nothing but that interface, so the same program */
+/*  can be linked against either engine.  The Makefile builds it as */
+/*  bench_engine_rb with red_black_tree.o, bench_engine_bt with */
+/*  bplus_tree.o and bench_engine_hc with hotcold_tree.o; run them */
+/*  with the same parameters to compare them, for example */
+/*  ./bench_engine_bt 1000000.  A third argument of prefix makes the */
+/*  trees keep key prefixes (see RBTreeUsePrefix). */
+
+void IntDest(void* a) {
+  free((int*)a);
+}
+
+int IntComp(const void* a,const void* b) {
+  if( *(int*)a > *(int*)b) return(1);
+  if( *(int*)a < *(int*)b) return(-1);
+  return(0);
+}
+
+void IntPrint(const void* a) {
+  printf("%i",*(int*)a);
+}
+
+void InfoPrint(void* a) {
+  ;
+}
+
+void InfoDest(void *a){
+  ;
+}
+
+double Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return(ts.tv_sec+ts.tv_nsec*1e-9);
+}
+
+int* NewInt(int value) {
+  int* newInt=(int*) malloc(sizeof(int));
+  *newInt=value;
+  return(newInt);
+}
+
+/*  keeps the order of IntComp, so lookups need not read the keys */
+uint64_t IntPrefix(const void* a) {
+  return((uint64_t) ((uint32_t) *(const int*)a ^ 0x80000000u));
+}
+
+static void Report(const char* name, int ops, double seconds) {
+  printf("%-10s %12d %14.0f %10.1f\n",name,ops,ops/seconds,
+	 1e9*seconds/ops);
+}
+
+/*  Builds a tree of size random keys, then times lookups, a mixed */
+/*  read/write workload which keeps the size steady, range scans and */
+/*  a full walk with TreeSuccessor. */
+
+void BenchEngine(int size, int ops, int usePrefix) {
+  rb_red_blk_tree* tree;
+  rb_red_blk_node* x;
+  stk_stack* enumResult;
+  int* keys=(int*) malloc(size*sizeof(int));
+  unsigned int seed=4242;
+  int i, j, key, high, hits=0;
+  long scanned=0, span;
+  double start;
+
+  printf("%-10s %12s %14s %10s\n","operation","count","ops/sec","ns/op");
+  tree=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+  if (usePrefix) RBTreeUsePrefix(tree,IntPrefix);
+  start=Now();
+  for (i=0; i<size; i++) {
+    keys[i]=rand_r(&seed);
+    RBTreeInsert(tree,NewInt(keys[i]),0);
+  }
+  Report("insert",size,Now()-start);
+
+  start=Now();
+  for (i=0; i<ops; i++) {
+    hits+=(RBExactQuery(tree,&keys[rand_r(&seed)%size]) != 0);
+  }
+  Report("lookup",ops,Now()-start);
+  Assert(hits == ops,"lookups missed");
+
+  /* half lookups; the rest replace a random key with a new one */
+  start=Now();
+  for (i=0; i<ops; i++) {
+    j=rand_r(&seed)%size;
+    if (i%2) {
+      RBExactQuery(tree,&keys[j]);
+    } else {
+      if ( (x=RBExactQuery(tree,&keys[j])) ) RBDelete(tree,x);
+      keys[j]=rand_r(&seed);
+      RBTreeInsert(tree,NewInt(keys[j]),0);
+    }
+  }
+  Report("mixed",ops,Now()-start);
+
+  start=Now();
+  for (i=0; i<ops/100; i++) {
+    key=rand_r(&seed);
+    span=key+100L*(RAND_MAX/size); /* about 100 keys */
+    high= (span > RAND_MAX) ? RAND_MAX : (int) span;
+    enumResult=RBEnumerate(tree,&key,&high);
+    while (StackPop(enumResult)) scanned++;
+    free(enumResult);
+  }
+  Report("enumerate",ops/100,Now()-start);
+
+  start=Now();
+  for (x=tree->root->left; x != tree->nil && x->left != tree->nil; x=x->left);
+  for (scanned=0; x != tree->nil; x=TreeSuccessor(tree,x)) scanned++;
+  Report("successor",(int) scanned,Now()-start);
+  Assert(scanned == (long) tree->count,"walk missed nodes");
+
+  start=Now();
+  RBTreeDestroy(tree);
+  Report("destroy",size,Now()-start);
+  free(keys);
+}
+
+int main(int argc, char** argv) {
+  int size=(argc > 1) ? atoi(argv[1]) : 1000000;
+
+  int usePrefix=(argc > 3) && !strcmp(argv[3],"prefix");
+
+  printf("%s, %d keys%s\n",argv[0],size,usePrefix ? ", key prefixes" : "");
+  BenchEngine(size,argc > 2 ? atoi(argv[2]) : size,usePrefix);
+  return 0;
+}
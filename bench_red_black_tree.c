@@ -0,0 +1,1563 @@
+#include"red_black_tree.h"
+#include"flat_combining.h"
+#include"node_cache.h"
+#include"parallel_tree.h"
+#include"tree_snapshot.h"
+#include"tree_checkpoint.h"
+#include"tree_wal.h"
+#include"tree_bgsave.h"
+#include"tree_frozen.h"
+#include"tree_int_index.h"
+#include"tree_string.h"
+#include"tree_inline.h"
+#include"tree_set.h"
+#include"tree_compact.h"
+#include"tree_balance.h"
+#include"tree_alloc.h"
+#include"node_arena.h"
+#include<stdio.h>
+#include<string.h>
+#include<time.h>
+#include<pthread.h>
+#include<stdint.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<malloc.h>
+
+/*  this file has benchmarks for red-black trees of integers.  Run it */
+/*  with the name of a benchmark and optional parameters, for example */
+/*  ./bench_rb concurrent 4 200000 */
+
+void IntDest(void* a) {
+  free((int*)a);
+}
+
+int IntComp(const void* a,const void* b) {
+  if( *(int*)a > *(int*)b) return(1);
+  if( *(int*)a < *(int*)b) return(-1);
+  return(0);
+}
+
+void IntPrint(const void* a) {
+  printf("%i",*(int*)a);
+}
+
+void InfoPrint(void* a) {
+  ;
+}
+
+void InfoDest(void *a){
+  ;
+}
+
+double Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return(ts.tv_sec+ts.tv_nsec*1e-9);
+}
+
+int* NewInt(int value) {
+  int* newInt=(int*) malloc(sizeof(int));
+  *newInt=value;
+  return(newInt);
+}
+
+/*  Concurrent benchmark: every thread runs the same mix of inserts, */
+/*  deletes and queries against one shared tree through one of the */
+/*  three front ends in flat_combining.h */
+
+#define FRONT_MUTEX 0
+#define FRONT_RWLOCK 1
+#define FRONT_FC 2
+
+typedef struct bench_thread {
+  pthread_t thread;
+  int id;
+  int front;
+  int ops;
+  int keyRange;
+  int readPercent;
+  rb_locked_tree* locked;
+  rb_fc_tree* fc;
+} bench_thread;
+
+void* ConcurrentWorker(void* arg) {
+  bench_thread* self=(bench_thread*) arg;
+  unsigned int seed=self->id*7919+1;
+  int i, key, choice;
+
+  for (i=0; i<self->ops; i++) {
+    key=rand_r(&seed)%self->keyRange;
+    choice=rand_r(&seed)%100;
+    if (choice < self->readPercent) {
+      if (self->front == FRONT_FC) {
+	RBFCQuery(self->fc,self->id,&key,NULL);
+      } else {
+	RBLockedQuery(self->locked,&key,NULL);
+      }
+    } else if (choice%2) {
+      if (self->front == FRONT_FC) {
+	RBFCInsert(self->fc,self->id,NewInt(key),0);
+      } else {
+	RBLockedInsert(self->locked,NewInt(key),0);
+      }
+    } else {
+      if (self->front == FRONT_FC) {
+	RBFCDelete(self->fc,self->id,&key);
+      } else {
+	RBLockedDelete(self->locked,&key);
+      }
+    }
+  }
+  return(NULL);
+}
+
+void BenchConcurrent(int nThreads, int opsPerThread) {
+  static const char* names[]={"mutex","rwlock","flat-combining"};
+  static const int readPercents[]={0,50,90};
+  bench_thread threads[RB_FC_MAX_THREADS];
+  rb_red_blk_tree* tree;
+  rb_locked_tree* locked=NULL;
+  rb_fc_tree* fc=NULL;
+  int keyRange=1<<16;
+  int front, mix, i;
+  double start, elapsed;
+
+  if (nThreads > RB_FC_MAX_THREADS) nThreads=RB_FC_MAX_THREADS;
+  printf("%-16s %8s %8s %14s\n","front end","threads","read%","ops/sec");
+  for (mix=0; mix<3; mix++) {
+    for (front=FRONT_MUTEX; front<=FRONT_FC; front++) {
+      tree=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+      for (i=0; i<keyRange; i+=2) RBTreeInsert(tree,NewInt(i),0);
+      if (front == FRONT_FC) {
+	fc=RBFCTreeCreate(tree,nThreads);
+      } else {
+	locked=RBLockedTreeCreate(tree,front == FRONT_RWLOCK ?
+				  RB_LOCK_RWLOCK : RB_LOCK_MUTEX);
+      }
+      start=Now();
+      for (i=0; i<nThreads; i++) {
+	threads[i].id=i;
+	threads[i].front=front;
+	threads[i].ops=opsPerThread;
+	threads[i].keyRange=keyRange;
+	threads[i].readPercent=readPercents[mix];
+	threads[i].locked=locked;
+	threads[i].fc=fc;
+	pthread_create(&threads[i].thread,NULL,ConcurrentWorker,&threads[i]);
+      }
+      for (i=0; i<nThreads; i++) pthread_join(threads[i].thread,NULL);
+      elapsed=Now()-start;
+      printf("%-16s %8d %8d %14.0f",names[front],nThreads,
+	     readPercents[mix],nThreads*(double)opsPerThread/elapsed);
+      if (front == FRONT_FC) {
+	printf("  (%.1f ops/combine)",
+	       fc->combinedOps/(double)(fc->combines ? fc->combines : 1));
+	RBFCTreeDestroy(fc);
+      } else {
+	RBLockedTreeDestroy(locked);
+      }
+      printf("\n");
+    }
+  }
+}
+
+/*  Private tree benchmark: each thread inserts into and then empties */
+/*  its own tree, so the only thing the threads share is the allocator */
+
+typedef struct private_thread {
+  pthread_t thread;
+  int id;
+  int keys;
+  int useNodeCache;
+} private_thread;
+
+void* PrivateWorker(void* arg) {
+  private_thread* self=(private_thread*) arg;
+  unsigned int seed=self->id*7919+1;
+  rb_red_blk_tree* tree;
+  rb_red_blk_node* node;
+  int i, key;
+
+  tree=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+  if (self->useNodeCache) RBTreeUseNodeCache(tree);
+  for (i=0; i<self->keys; i++) {
+    RBTreeInsert(tree,NewInt(rand_r(&seed)),0);
+  }
+  seed=self->id*7919+1;
+  for (i=0; i<self->keys; i++) {
+    key=rand_r(&seed);
+    if ( (node=RBExactQuery(tree,&key)) ) RBDelete(tree,node); /* assignment */
+  }
+  RBTreeDestroy(tree);
+  return(NULL);
+}
+
+void BenchPrivate(int maxThreads, int keysPerThread) {
+  private_thread threads[RB_FC_MAX_THREADS];
+  rb_node_cache_stats stats;
+  int nThreads, cache, i;
+  double start, elapsed;
+
+  if (maxThreads > RB_FC_MAX_THREADS) maxThreads=RB_FC_MAX_THREADS;
+  printf("%-12s %8s %14s %18s\n","allocator","threads","ops/sec",
+	 "ops/sec/thread");
+  for (cache=0; cache<2; cache++) {
+    for (nThreads=1; nThreads<=maxThreads; nThreads*=2) {
+      start=Now();
+      for (i=0; i<nThreads; i++) {
+	threads[i].id=i;
+	threads[i].keys=keysPerThread;
+	threads[i].useNodeCache=cache;
+	pthread_create(&threads[i].thread,NULL,PrivateWorker,&threads[i]);
+      }
+      for (i=0; i<nThreads; i++) pthread_join(threads[i].thread,NULL);
+      elapsed=Now()-start;
+      printf("%-12s %8d %14.0f %18.0f\n",cache ? "node cache" : "SafeMalloc",
+	     nThreads,2.0*nThreads*keysPerThread/elapsed,
+	     2.0*keysPerThread/elapsed);
+    }
+  }
+  NodeCacheGetStats(&stats);
+  printf("node cache: %d threads, %lu allocs, %lu frees, %ld live bytes, "
+	 "%lu slab bytes\n",stats.threads,stats.allocs,stats.frees,
+	 stats.liveBytes,stats.slabBytes);
+}
+
+/*  Batched lookup benchmark: probes a tree of random keys with */
+/*  RBExactQuery one key at a time and with RBExactQueryBatch at */
+/*  several batch sizes */
+
+rb_red_blk_tree* RandomTree(int size, int** keysOut) {
+  rb_red_blk_tree* tree;
+  int* keys=(int*) malloc(size*sizeof(int));
+  unsigned int seed=12345;
+  int i;
+
+  tree=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+  for (i=0; i<size; i++) {
+    keys[i]=rand_r(&seed);
+    RBTreeInsert(tree,NewInt(keys[i]),0);
+  }
+  *keysOut=keys;
+  return(tree);
+}
+
+void BenchBatch(int treeSize, int lookups) {
+  rb_red_blk_tree* tree;
+  rb_red_blk_node** found;
+  void** probes;
+  int* keys;
+  unsigned int seed=777;
+  int batch, i, j, hits;
+  double start, elapsed, base;
+
+  tree=RandomTree(treeSize,&keys);
+  probes=(void**) malloc(lookups*sizeof(void*));
+  found=(rb_red_blk_node**) malloc(lookups*sizeof(rb_red_blk_node*));
+  for (i=0; i<lookups; i++) probes[i]=&keys[rand_r(&seed)%treeSize];
+
+  start=Now();
+  for (hits=0, i=0; i<lookups; i++) hits+=(RBExactQuery(tree,probes[i]) != 0);
+  base=Now()-start;
+  printf("tree of %d keys, window %d\n",treeSize,RB_BATCH_WINDOW);
+  printf("%-10s %14s %10s %8s\n","batch","lookups/sec","ns/lookup","speedup");
+  printf("%-10s %14.0f %10.1f %8.2f  (%d hits)\n","single",lookups/base,
+	 1e9*base/lookups,1.0,hits);
+  for (batch=1; batch<=1024; batch*=4) {
+    start=Now();
+    for (i=0; i<lookups; i+=batch) {
+      RBExactQueryBatch(tree,probes+i,(lookups-i < batch) ? lookups-i : batch,
+			found+i);
+    }
+    elapsed=Now()-start;
+    for (hits=0, j=0; j<lookups; j++) hits+=(found[j] != 0);
+    printf("%-10d %14.0f %10.1f %8.2f  (%d hits)\n",batch,lookups/elapsed,
+	   1e9*elapsed/lookups,base/elapsed,hits);
+  }
+  free(probes);
+  free(found);
+  free(keys);
+  RBTreeDestroy(tree);
+}
+
+/*  Multi-get benchmark: probes a tree with growing numbers of keys, */
+/*  one RBExactQuery at a time, with RBExactQueryBatch and with */
+/*  RBMultiGet */
+
+void BenchMultiGet(int treeSize) {
+  rb_red_blk_tree* tree;
+  rb_red_blk_node** found;
+  void** probes;
+  int* keys;
+  unsigned int seed=4242;
+  int nProbes, divisor, i;
+  double start, single, batch, multi;
+
+  tree=RandomTree(treeSize,&keys);
+  probes=(void**) malloc(treeSize*sizeof(void*));
+  found=(rb_red_blk_node**) malloc(treeSize*sizeof(rb_red_blk_node*));
+  printf("tree of %d keys\n",treeSize);
+  printf("%10s %14s %14s %14s   (ns/probe)\n","probes","RBExactQuery",
+	 "batch","RBMultiGet");
+  for (divisor=1000; divisor>=1; divisor/=10) {
+    nProbes=treeSize/divisor;
+    for (i=0; i<nProbes; i++) probes[i]=&keys[rand_r(&seed)%treeSize];
+    start=Now();
+    for (i=0; i<nProbes; i++) found[i]=RBExactQuery(tree,probes[i]);
+    single=Now()-start;
+    start=Now();
+    RBExactQueryBatch(tree,probes,nProbes,found);
+    batch=Now()-start;
+    start=Now();
+    RBMultiGet(tree,probes,nProbes,found);
+    multi=Now()-start;
+    printf("%10d %14.1f %14.1f %14.1f\n",nProbes,1e9*single/nProbes,
+	   1e9*batch/nProbes,1e9*multi/nProbes);
+  }
+  free(probes);
+  free(found);
+  free(keys);
+  RBTreeDestroy(tree);
+}
+
+/*  Bulk build benchmark: RBTreeInsert one key at a time against */
+/*  RBTreeBuildParallel with growing numbers of threads */
+
+void BenchBuild(int n, int maxThreads) {
+  rb_red_blk_tree* tree;
+  void** keys;
+  unsigned int seed=99;
+  int nThreads, i;
+  double start, elapsed;
+
+  keys=(void**) malloc(n*sizeof(void*));
+  for (i=0; i<n; i++) keys[i]=NewInt(rand_r(&seed));
+  printf("%d unsorted keys\n",n);
+  printf("%-24s %10s %14s\n","method","seconds","keys/sec");
+  start=Now();
+  tree=RBTreeCreate(IntComp,NullFunction,InfoDest,IntPrint,InfoPrint);
+  for (i=0; i<n; i++) RBTreeInsert(tree,keys[i],0);
+  elapsed=Now()-start;
+  printf("%-24s %10.3f %14.0f\n","RBTreeInsert",elapsed,n/elapsed);
+  checkRep(tree);
+  RBTreeDestroy(tree);
+  for (nThreads=1; nThreads<=maxThreads; nThreads*=2) {
+    start=Now();
+    tree=RBTreeBuildParallel(IntComp,NullFunction,InfoDest,IntPrint,InfoPrint,
+			     keys,NULL,n,nThreads);
+    elapsed=Now()-start;
+    printf("RBTreeBuildParallel x%-3d %10.3f %14.0f\n",nThreads,elapsed,
+	   n/elapsed);
+    checkRep(tree);
+    RBTreeDestroy(tree);
+  }
+  for (i=0; i<n; i++) free(keys[i]);
+  free(keys);
+}
+
+/*  Traversal benchmark: sums the keys, checks and destroys a tree */
+/*  sequentially and then with the parallel traversals */
+
+void* KeyAsSum(rb_red_blk_node* x, void* context) {
+  return((void*)(intptr_t)*(int*)x->key);
+}
+
+void* AddSums(void* a, void* b, void* context) {
+  return((void*)((intptr_t)a+(intptr_t)b));
+}
+
+intptr_t SequentialSum(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  if (x == tree->nil) return(0);
+  return(SequentialSum(tree,x->left)+*(int*)x->key+
+	 SequentialSum(tree,x->right));
+}
+
+void BenchTraverse(int n, int maxThreads) {
+  rb_red_blk_tree* tree;
+  int* keys;
+  intptr_t sum;
+  int nThreads;
+  double start, sumTime, checkTime, destroyTime;
+
+  printf("tree of %d keys\n",n);
+  printf("%-12s %12s %12s %12s\n","threads","sum (s)","checkRep (s)",
+	 "destroy (s)");
+  tree=RandomTree(n,&keys);
+  start=Now();
+  sum=SequentialSum(tree,tree->root->left);
+  sumTime=Now()-start;
+  start=Now();
+  checkRep(tree);
+  checkTime=Now()-start;
+  start=Now();
+  RBTreeDestroy(tree);
+  destroyTime=Now()-start;
+  printf("%-12s %12.3f %12.3f %12.3f\n","sequential",sumTime,checkTime,
+	 destroyTime);
+  free(keys);
+  for (nThreads=1; nThreads<=maxThreads; nThreads*=2) {
+    tree=RandomTree(n,&keys);
+    start=Now();
+    Assert(sum == (intptr_t)RBParallelReduce(tree,KeyAsSum,AddSums,0,NULL,
+					     nThreads,0),
+	   "parallel sum differs");
+    sumTime=Now()-start;
+    start=Now();
+    RBParallelCheckRep(tree,nThreads);
+    checkTime=Now()-start;
+    start=Now();
+    RBParallelDestroy(tree,nThreads);
+    destroyTime=Now()-start;
+    printf("%-12d %12.3f %12.3f %12.3f\n",nThreads,sumTime,checkTime,
+	   destroyTime);
+    free(keys);
+  }
+}
+
+/*  Snapshot benchmark: compares restarting by re-inserting every key */
+/*  with saving a snapshot and mapping it back, and lookups in the */
+/*  mapped file with lookups in the tree */
+
+size_t IntSize(const void* a) {
+  return(sizeof(int));
+}
+
+void BenchSnapshot(int n, const char* path) {
+  rb_red_blk_tree* tree;
+  rb_snapshot* snap;
+  int* keys;
+  unsigned int seed=31337;
+  int i, hits;
+  double start, insertTime, saveTime, mapTime, treeTime, snapTime;
+  double validateTime;
+
+  start=Now();
+  tree=RandomTree(n,&keys);
+  insertTime=Now()-start;
+  start=Now();
+  Assert(RBTreeSave(tree,path,IntSize,NULL),"RBTreeSave failed");
+  saveTime=Now()-start;
+  start=Now();
+  snap=RBTreeMapSnapshot(path,IntComp);
+  mapTime=Now()-start;
+  Assert(snap != NULL,"RBTreeMapSnapshot failed");
+  start=Now();
+  for (hits=0, i=0; i<n; i++) {
+    hits+=(RBExactQuery(tree,&keys[rand_r(&seed)%n]) != 0);
+  }
+  treeTime=Now()-start;
+  seed=31337;
+  start=Now();
+  for (i=0; i<n; i++) {
+    hits-=(RBSnapExactQuery(snap,&keys[rand_r(&seed)%n]) != 0);
+  }
+  snapTime=Now()-start;
+  Assert(hits == 0,"snapshot lookups differ");
+  start=Now();
+  Assert(RBSnapshotValidate(snap),"RBSnapshotValidate failed");
+  validateTime=Now()-start;
+  printf("tree of %d keys, snapshot of %lu bytes\n",n,
+	 (unsigned long) snap->size);
+  printf("%-28s %12.3f ms\n","rebuild by RBTreeInsert",1e3*insertTime);
+  printf("%-28s %12.3f ms\n","RBTreeSave",1e3*saveTime);
+  printf("%-28s %12.3f ms\n","RBTreeMapSnapshot",1e3*mapTime);
+  printf("%-28s %12.3f ms\n","RBSnapshotValidate",1e3*validateTime);
+  printf("%-28s %12.1f ns\n","RBExactQuery",1e9*treeTime/n);
+  printf("%-28s %12.1f ns\n","RBSnapExactQuery",1e9*snapTime/n);
+  RBSnapshotClose(snap);
+  unlink(path);
+  free(keys);
+  RBTreeDestroy(tree);
+}
+
+/*  Streaming benchmark: dumps a tree to a file through RBEnumerate */
+/*  and through RBTreeExport, then reads it back with RBTreeInsert and */
+/*  with RBTreeImport */
+
+size_t IntSerialize(const void* key, const void* info, char* buf, size_t room,
+		    void* context) {
+  if (room < sizeof(int)) return(room+1);
+  memcpy(buf,key,sizeof(int));
+  return(sizeof(int));
+}
+
+int IntDeserialize(const char* buf, size_t len, void** key, void** info,
+		   void* context) {
+  int value;
+  if (len != sizeof(int)) return(0);
+  memcpy(&value,buf,sizeof(int));
+  *key=NewInt(value);
+  *info=NULL;
+  return(1);
+}
+
+void BenchStream(int n, const char* path) {
+  rb_red_blk_tree* tree;
+  rb_red_blk_tree* copy;
+  rb_red_blk_node* x;
+  stk_stack* enumResult;
+  FILE* f;
+  int* keys;
+  int low=0;
+  int high=0x7fffffff;
+  int fd, value;
+  double start, enumTime, exportTime, insertTime, importTime;
+
+  tree=RandomTree(n,&keys);
+  start=Now();
+  f=fopen(path,"w");
+  enumResult=RBEnumerate(tree,&low,&high);
+  while ( (x=StackPop(enumResult)) ) fwrite(x->key,sizeof(int),1,f);
+  free(enumResult);
+  fclose(f);
+  enumTime=Now()-start;
+  start=Now();
+  copy=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+  f=fopen(path,"r");
+  while (fread(&value,sizeof(int),1,f) == 1) {
+    RBTreeInsert(copy,NewInt(value),0);
+  }
+  fclose(f);
+  insertTime=Now()-start;
+  RBTreeDestroy(copy);
+  start=Now();
+  fd=open(path,O_WRONLY|O_CREAT|O_TRUNC,0644);
+  Assert(RBTreeExport(tree,fd,IntSerialize,NULL),"RBTreeExport failed");
+  close(fd);
+  exportTime=Now()-start;
+  RBTreeDestroy(tree);
+
+  start=Now();
+  tree=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+  fd=open(path,O_RDONLY);
+  Assert(RBTreeImport(tree,fd,IntDeserialize,NULL),"RBTreeImport failed");
+  close(fd);
+  importTime=Now()-start;
+  Assert(tree->count == (unsigned long) n,"RBTreeImport lost keys");
+  printf("tree of %d keys\n",n);
+  printf("%-24s %10s %14s\n","method","seconds","extra bytes");
+  printf("%-24s %10.3f %14lu\n","RBEnumerate + fwrite",enumTime,
+	 (unsigned long) n*sizeof(stk_stack_node));
+  printf("%-24s %10.3f %14d\n","RBTreeExport",exportTime,RB_STREAM_BUFFER);
+  printf("%-24s %10.3f %14s\n","RBTreeInsert",insertTime,"-");
+  printf("%-24s %10.3f %14d\n","RBTreeImport",importTime,RB_STREAM_BUFFER);
+  unlink(path);
+  free(keys);
+  RBTreeDestroy(tree);
+}
+
+/*  Write-ahead log benchmark: inserts through a durable tree with */
+/*  several group commit sizes, then times recovery from logs of */
+/*  growing length and from a checkpoint */
+
+void RemoveDurable(const char* path) {
+  char name[1024];
+
+  snprintf(name,sizeof(name),"%s.wal",path);
+  unlink(name);
+  snprintf(name,sizeof(name),"%s.ckpt",path);
+  unlink(name);
+}
+
+void BenchWal(int n, const char* path) {
+  rb_durable_tree* d;
+  rb_red_blk_tree* tree;
+  unsigned int seed=2718;
+  int groupSize, length, i;
+  double start, elapsed;
+
+  printf("%d inserts\n",n);
+  printf("%-12s %14s %12s\n","group size","inserts/sec","fsyncs");
+  for (groupSize=1; groupSize<=4096; groupSize*=8) {
+    RemoveDurable(path);
+    tree=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+    d=RBDurableOpen(tree,path,IntSerialize,IntDeserialize,NULL,groupSize,0);
+    Assert(d != NULL,"RBDurableOpen failed");
+    start=Now();
+    for (i=0; i<n; i++) RBDurableInsert(d,NewInt(rand_r(&seed)),0);
+    Assert(RBDurableClose(d),"RBDurableClose failed");
+    elapsed=Now()-start;
+    printf("%-12d %14.0f %12d\n",groupSize,n/elapsed,
+	   (n+groupSize-1)/groupSize);
+    RBTreeDestroy(tree);
+  }
+  printf("%-12s %14s %12s\n","log records","recovery (s)","records/sec");
+  for (length=10000; length<=1000000; length*=10) {
+    RemoveDurable(path);
+    tree=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+    d=RBDurableOpen(tree,path,IntSerialize,IntDeserialize,NULL,4096,0);
+    for (i=0; i<length; i++) RBDurableInsert(d,NewInt(rand_r(&seed)),0);
+    RBDurableClose(d);
+    RBTreeDestroy(tree);
+    tree=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+    start=Now();
+    d=RBDurableOpen(tree,path,IntSerialize,IntDeserialize,NULL,4096,0);
+    elapsed=Now()-start;
+    Assert(d && d->replayed == length,"log replay lost records");
+    printf("%-12d %14.3f %12.0f\n",length,elapsed,length/elapsed);
+    Assert(RBDurableCheckpoint(d),"RBDurableCheckpoint failed");
+    RBDurableClose(d);
+    RBTreeDestroy(tree);
+    tree=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+    start=Now();
+    d=RBDurableOpen(tree,path,IntSerialize,IntDeserialize,NULL,4096,0);
+    elapsed=Now()-start;
+    Assert(d && tree->count == (unsigned long) length,"checkpoint lost keys");
+    printf("%-12s %14.3f %12.0f\n","  checkpoint",elapsed,length/elapsed);
+    RBDurableClose(d);
+    RBTreeDestroy(tree);
+  }
+  RemoveDurable(path);
+}
+
+/*  Background save benchmark: how long a synchronous RBTreeSave */
+/*  blocks writers, against how long fork pauses them and how many */
+/*  pages get copied while they keep inserting and deleting */
+
+int SaveToPath(rb_red_blk_tree* tree, void* path) {
+  return(RBTreeSave(tree,(const char*) path,IntSize,NULL));
+}
+
+void BenchBgSave(int n, const char* path) {
+  rb_red_blk_tree* tree;
+  rb_red_blk_node* x;
+  rb_bgsave* save;
+  int* keys;
+  unsigned int seed=1618;
+  long ops;
+  int flags, i;
+  double start;
+
+  tree=RandomTree(n,&keys);
+  printf("tree of %d keys\n",n);
+  start=Now();
+  Assert(SaveToPath(tree,(void*) path),"RBTreeSave failed");
+  printf("RBTreeSave blocks writers for %.3f s\n",Now()-start);
+  printf("%-16s %10s %10s %12s %14s\n","mode","pause (ms)","save (s)",
+	 "replacements","pages copied");
+  for (flags=0; flags<=RB_BGSAVE_NO_HUGEPAGES; flags++) {
+    save=RBTreeBackgroundSave(tree,SaveToPath,(void*) path,flags,0);
+    Assert(save != NULL,"RBTreeBackgroundSave failed");
+    for (ops=0; RBBackgroundSavePoll(save) == RB_BGSAVE_RUNNING; ) {
+      for (i=0; i<1024; i++, ops++) {
+	/* replace a random key, keeping the size the same */
+	if ( (x=RBExactQuery(tree,&keys[rand_r(&seed)%n])) ) {
+	  RBDelete(tree,x);
+	  RBTreeInsert(tree,NewInt(keys[rand_r(&seed)%n]),0);
+	}
+      }
+    }
+    Assert(save->status == 1,"background save failed");
+    printf("%-16s %10.3f %10.3f %12ld %14ld\n",
+	   flags ? "no hugepages" : "default",1e3*save->forkSeconds,
+	   save->seconds,ops,save->copiedPages);
+    RBBackgroundSaveFree(save);
+  }
+  unlink(path);
+  free(keys);
+  RBTreeDestroy(tree);
+}
+
+/*  Checkpoint benchmark: writes a tree to a file, fsync included, */
+/*  with RBTreeExport and with RBTreeCheckpoint's engines */
+
+void BenchCheckpoint(int n, const char* path) {
+  rb_red_blk_tree* tree;
+  rb_checkpoint_stats stats;
+  int* keys;
+  int fd, nThreads;
+  double start, elapsed;
+  unsigned long bytes;
+
+  tree=RandomTree(n,&keys);
+  printf("tree of %d keys\n",n);
+  printf("%-24s %10s %10s\n","writer","seconds","MB/s");
+  fd=open(path,O_WRONLY|O_CREAT|O_TRUNC,0644);
+  start=Now();
+  Assert(RBTreeExport(tree,fd,IntSerialize,NULL),"RBTreeExport failed");
+  fsync(fd);
+  elapsed=Now()-start;
+  bytes=(unsigned long) lseek(fd,0,SEEK_CUR);
+  close(fd);
+  printf("%-24s %10.3f %10.1f\n","RBTreeExport",elapsed,bytes/elapsed/1e6);
+  for (nThreads=1; nThreads<=4; nThreads*=2) {
+    fd=open(path,O_WRONLY|O_CREAT|O_TRUNC,0644);
+    start=Now();
+    Assert(RBTreeCheckpoint(tree,fd,IntSerialize,NULL,RB_CKPT_THREADS,
+			    nThreads,&stats),"RBTreeCheckpoint failed");
+    fsync(fd);
+    elapsed=Now()-start;
+    close(fd);
+    printf("pwrite x%-16d %10.3f %10.1f\n",nThreads,elapsed,
+	   stats.bytes/elapsed/1e6);
+  }
+  fd=open(path,O_WRONLY|O_CREAT|O_TRUNC,0644);
+  start=Now();
+  Assert(RBTreeCheckpoint(tree,fd,IntSerialize,NULL,RB_CKPT_IO_URING,0,
+			  &stats),"RBTreeCheckpoint failed");
+  fsync(fd);
+  elapsed=Now()-start;
+  close(fd);
+  printf("%-24s %10.3f %10.1f\n",(stats.engine == RB_CKPT_IO_URING) ?
+	 "io_uring" : "io_uring (unavailable)",elapsed,stats.bytes/elapsed/1e6);
+  unlink(path);
+  free(keys);
+  RBTreeDestroy(tree);
+}
+
+/*  Frozen tree benchmark: RBExactQuery on the pointer tree against */
+/*  lookups in its Eytzinger and van Emde Boas copies, from trees which */
+/*  fit in L1 up to trees which only fit in DRAM */
+
+void BenchFrozen(int maxSize, int lookups) {
+  rb_red_blk_tree* tree;
+  rb_frozen_tree* eytzinger;
+  rb_frozen_tree* veb;
+  int* keys;
+  int* probes;
+  unsigned int seed=8080;
+  int size, i, hits;
+  double start, treeTime, eytzingerTime, vebTime;
+
+  probes=(int*) malloc(lookups*sizeof(int));
+  printf("%10s %14s %14s %14s   (ns/lookup)\n","keys","RBExactQuery",
+	 "Eytzinger","vEB");
+  for (size=1024; size<=maxSize; size*=4) {
+    tree=RandomTree(size,&keys);
+    eytzinger=RBTreeFreeze(tree,RB_FROZEN_EYTZINGER,sizeof(int));
+    veb=RBTreeFreeze(tree,RB_FROZEN_VEB,sizeof(int));
+    for (i=0; i<lookups; i++) probes[i]=keys[rand_r(&seed)%size];
+    start=Now();
+    for (hits=0, i=0; i<lookups; i++) {
+      hits+=(RBExactQuery(tree,&probes[i]) != 0);
+    }
+    treeTime=Now()-start;
+    start=Now();
+    for (i=0; i<lookups; i++) {
+      hits-=(RBFrozenExactQuery(eytzinger,&probes[i]) != 0);
+    }
+    eytzingerTime=Now()-start;
+    start=Now();
+    for (i=0; i<lookups; i++) {
+      hits+=(RBFrozenExactQuery(veb,&probes[i]) != 0);
+    }
+    vebTime=Now()-start;
+    Assert(hits == lookups,"frozen lookups differ");
+    printf("%10d %14.1f %14.1f %14.1f\n",size,1e9*treeTime/lookups,
+	   1e9*eytzingerTime/lookups,1e9*vebTime/lookups);
+    RBFrozenDestroy(eytzinger);
+    RBFrozenDestroy(veb);
+    free(keys);
+    RBTreeDestroy(tree);
+  }
+  free(probes);
+}
+
+int32_t BenchIntKey(const void* key) {
+  return(*(const int*) key);
+}
+
+void BenchIntIndex(int maxSize, int lookups) {
+  static const char* names[]={"auto","scalar","SSE2","AVX2"};
+  rb_red_blk_tree* tree;
+  rb_frozen_tree* eytzinger;
+  rb_int_index* index;
+  int* keys;
+  int* probes;
+  unsigned int seed=8181;
+  int size, i, hits, engine;
+  double start;
+
+  probes=(int*) malloc(lookups*sizeof(int));
+  printf("%10s %14s %14s %14s %14s %14s   (ns/lookup)\n","keys",
+	 "RBExactQuery","Eytzinger",names[1],names[2],names[3]);
+  for (size=1024; size<=maxSize; size*=4) {
+    tree=RandomTree(size,&keys);
+    eytzinger=RBTreeFreeze(tree,RB_FROZEN_EYTZINGER,sizeof(int));
+    for (i=0; i<lookups; i++) probes[i]=keys[rand_r(&seed)%size];
+    start=Now();
+    for (hits=0, i=0; i<lookups; i++) {
+      hits+=(RBExactQuery(tree,&probes[i]) != 0);
+    }
+    printf("%10d %14.1f",size,1e9*(Now()-start)/lookups);
+    start=Now();
+    for (i=0; i<lookups; i++) {
+      hits-=(RBFrozenExactQuery(eytzinger,&probes[i]) != 0);
+    }
+    printf(" %14.1f",1e9*(Now()-start)/lookups);
+    for (engine=RB_SIMD_SCALAR; engine<=RB_SIMD_AVX2; engine++) {
+      index=RBIntIndexBuild(tree,BenchIntKey,engine);
+      start=Now();
+      for (i=0; i<lookups; i++) {
+	hits+=(RBIntIndexExactQuery(index,probes[i]) != 0);
+      }
+      if (index->engine == engine) {
+	printf(" %14.1f",1e9*(Now()-start)/lookups);
+      } else {
+	printf(" %14s","-");
+      }
+      hits-=lookups;
+      RBIntIndexDestroy(index);
+    }
+    printf("\n");
+    Assert(hits == 0,"int index lookups differ");
+    RBFrozenDestroy(eytzinger);
+    free(keys);
+    RBTreeDestroy(tree);
+  }
+  free(probes);
+}
+
+/*  Prefix benchmark: the keys live in one array in a different order */
+/*  from the nodes, as heap keys would, so reading one is a miss of its */
+/*  own unless the node's prefix settles the comparison */
+
+uint64_t BenchIntPrefix(const void* a) {
+  return((uint64_t) ((uint32_t) *(const int*) a ^ 0x80000000u));
+}
+
+void BenchPrefix(int maxSize, int lookups) {
+  rb_red_blk_tree* tree;
+  rb_red_blk_node* found[64];
+  int* keys;
+  int* probes;
+  unsigned int seed=9090;
+  int size, i, j, hits, usePrefix;
+  double start, insertTime, lookupTime, batchTime;
+
+  probes=(int*) malloc(lookups*sizeof(int));
+  printf("%10s %8s %12s %12s %12s   (ns/op)\n","keys","prefix","insert",
+	 "lookup","batch");
+  for (size=1024; size<=maxSize; size*=4) {
+    keys=(int*) malloc(size*sizeof(int));
+    for (i=0; i<size; i++) keys[i]=rand_r(&seed);
+    for (i=0; i<lookups; i++) probes[i]=keys[rand_r(&seed)%size];
+    for (usePrefix=0; usePrefix<2; usePrefix++) {
+      tree=RBTreeCreate(IntComp,NullFunction,InfoDest,IntPrint,InfoPrint);
+      if (usePrefix) RBTreeUsePrefix(tree,BenchIntPrefix);
+      start=Now();
+      for (i=0; i<size; i++) {
+	RBTreeInsert(tree,&keys[(i*7919L)%size],0);
+      }
+      insertTime=Now()-start;
+      start=Now();
+      for (hits=0, i=0; i<lookups; i++) {
+	hits+=(RBExactQuery(tree,&probes[i]) != 0);
+      }
+      lookupTime=Now()-start;
+      start=Now();
+      for (i=0; i+64<=lookups; i+=64) {
+	void* batch[64];
+	for (j=0; j<64; j++) batch[j]=&probes[i+j];
+	RBExactQueryBatch(tree,batch,64,found);
+	for (j=0; j<64; j++) hits-=(found[j] != 0);
+      }
+      batchTime=Now()-start;
+      Assert(hits == lookups%64,"prefix lookups differ");
+      printf("%10d %8s %12.1f %12.1f %12.1f\n",size,usePrefix ? "yes" : "no",
+	     1e9*insertTime/size,1e9*lookupTime/lookups,
+	     1e9*batchTime/(lookups-lookups%64));
+      RBTreeDestroy(tree);
+    }
+    free(keys);
+  }
+  free(probes);
+}
+
+int StrComp(const void* a, const void* b) {
+  int c=strcmp((const char*) a,(const char*) b);
+  return( (c > 0) - (c < 0));
+}
+
+void StrPrint(const void* a) {
+  printf("%s",(const char*) a);
+}
+
+/*  Compares a string tree against a tree of strdup'ed keys ordered by */
+/*  strcmp.  Keys are 8 to 23 bytes with a shared 4 byte start, like */
+/*  the names of a typical string index. */
+
+void BenchString(int maxSize, int lookups) {
+  rb_red_blk_tree* tree;
+  char (*keys)[24];
+  int* probes;
+  unsigned int seed=2323;
+  int size, i, j, len, hits, useString;
+  double start, insertTime, lookupTime, destroyTime;
+
+  probes=(int*) malloc(lookups*sizeof(int));
+  printf("%10s %8s %12s %12s %12s   (ns/op)\n","keys","tree","insert",
+	 "lookup","destroy");
+  for (size=1024; size<=maxSize; size*=4) {
+    keys=malloc(size*sizeof(*keys));
+    for (i=0; i<size; i++) {
+      len=8+rand_r(&seed)%16;
+      memcpy(keys[i],"key/",4);
+      for (j=4; j<len; j++) keys[i][j]='a'+rand_r(&seed)%26;
+      keys[i][len]=0;
+    }
+    for (i=0; i<lookups; i++) probes[i]=rand_r(&seed)%size;
+    for (useString=0; useString<2; useString++) {
+      if (useString) {
+	tree=RBStringTreeCreate(InfoDest,InfoPrint);
+      } else {
+	tree=RBTreeCreate(StrComp,free,InfoDest,StrPrint,InfoPrint);
+      }
+      start=Now();
+      for (i=0; i<size; i++) {
+	if (useString) RBStringInsert(tree,keys[i],strlen(keys[i]),0);
+	else RBTreeInsert(tree,strdup(keys[i]),0);
+      }
+      insertTime=Now()-start;
+      start=Now();
+      for (hits=0, i=0; i<lookups; i++) {
+	const char* key=keys[probes[i]];
+	hits+=(useString ? RBStringQuery(tree,key,strlen(key)) :
+	       RBExactQuery(tree,(void*) key)) != 0;
+      }
+      lookupTime=Now()-start;
+      Assert(hits == lookups,"string lookups missed");
+      start=Now();
+      RBTreeDestroy(tree);
+      destroyTime=Now()-start;
+      printf("%10d %8s %12.1f %12.1f %12.1f\n",size,
+	     useString ? "string" : "strdup",1e9*insertTime/size,
+	     1e9*lookupTime/lookups,1e9*destroyTime/size);
+    }
+    free(keys);
+  }
+  free(probes);
+}
+
+/*  Compares a tree of malloc'ed int keys with one whose keys and */
+/*  8 byte values live in the nodes. */
+
+void BenchInline(int maxSize, int lookups) {
+  rb_red_blk_tree* tree;
+  int* keys;
+  int* probes;
+  unsigned int seed=6161;
+  int size, i, hits, useInline;
+  double start, insertTime, lookupTime, destroyTime;
+
+  probes=(int*) malloc(lookups*sizeof(int));
+  printf("%10s %8s %12s %12s %12s   (ns/op)\n","keys","inline","insert",
+	 "lookup","destroy");
+  for (size=1024; size<=maxSize; size*=4) {
+    keys=(int*) malloc(size*sizeof(int));
+    for (i=0; i<size; i++) keys[i]=rand_r(&seed);
+    for (i=0; i<lookups; i++) probes[i]=keys[rand_r(&seed)%size];
+    for (useInline=0; useInline<2; useInline++) {
+      if (useInline) {
+	tree=RBTreeCreateInline(IntComp,sizeof(int),sizeof(long),IntPrint,
+				InfoPrint);
+      } else {
+	tree=RBTreeCreate(IntComp,IntDest,IntDest,IntPrint,InfoPrint);
+      }
+      start=Now();
+      for (i=0; i<size; i++) {
+	long value=i;
+	if (useInline) {
+	  RBInlineInsert(tree,&keys[i],&value);
+	} else {
+	  long* info=(long*) malloc(sizeof(long));
+	  *info=value;
+	  RBTreeInsert(tree,NewInt(keys[i]),info);
+	}
+      }
+      insertTime=Now()-start;
+      start=Now();
+      for (hits=0, i=0; i<lookups; i++) {
+	hits+=(RBExactQuery(tree,&probes[i]) != 0);
+      }
+      lookupTime=Now()-start;
+      Assert(hits == lookups,"inline lookups missed");
+      start=Now();
+      RBTreeDestroy(tree);
+      destroyTime=Now()-start;
+      printf("%10d %8s %12.1f %12.1f %12.1f\n",size,useInline ? "yes" : "no",
+	     1e9*insertTime/size,1e9*lookupTime/lookups,
+	     1e9*destroyTime/size);
+    }
+    free(keys);
+  }
+  free(probes);
+}
+
+/*  Compares a tree of malloc'ed int keys with info 0, the way sets */
+/*  are kept without tree_set.h, with an RBSetCreate set. */
+
+void BenchSet(int maxSize, int lookups) {
+  rb_red_blk_tree* tree;
+  int* keys;
+  int* probes;
+  unsigned int seed=4343;
+  int size, i, hits, useSet;
+  double start, insertTime, lookupTime, eraseTime;
+
+  probes=(int*) malloc(lookups*sizeof(int));
+  printf("%10s %8s %12s %12s %12s   (ns/op)\n","keys","set","insert",
+	 "contains","erase");
+  for (size=1024; size<=maxSize; size*=4) {
+    keys=(int*) malloc(size*sizeof(int));
+    for (i=0; i<size; i++) keys[i]=rand_r(&seed);
+    for (i=0; i<lookups; i++) probes[i]=keys[rand_r(&seed)%size];
+    for (useSet=0; useSet<2; useSet++) {
+      if (useSet) {
+	tree=RBSetCreate(IntComp,sizeof(int),IntPrint);
+      } else {
+	tree=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+      }
+      start=Now();
+      for (i=0; i<size; i++) {
+	if (useSet) RBSetInsert(tree,&keys[i]);
+	else RBTreeInsert(tree,NewInt(keys[i]),0);
+      }
+      insertTime=Now()-start;
+      start=Now();
+      for (hits=0, i=0; i<lookups; i++) {
+	hits+= useSet ? RBSetContains(tree,&probes[i]) :
+	  (RBExactQuery(tree,&probes[i]) != 0);
+      }
+      lookupTime=Now()-start;
+      Assert(hits == lookups,"set lookups missed");
+      start=Now();
+      for (i=0; i<size; i++) {
+	rb_red_blk_node* x;
+	if (useSet) RBSetErase(tree,&keys[i]);
+	else if ( (x=RBExactQuery(tree,&keys[i])) ) RBDelete(tree,x);
+      }
+      eraseTime=Now()-start;
+      printf("%10d %8s %12.1f %12.1f %12.1f\n",size,useSet ? "yes" : "no",
+	     1e9*insertTime/size,1e9*lookupTime/lookups,1e9*eraseTime/size);
+      RBTreeDestroy(tree);
+    }
+    free(keys);
+  }
+  free(probes);
+}
+
+/*  times a walk over the whole tree with TreeSuccessor, per node */
+
+double ScanTime(rb_red_blk_tree* tree) {
+  rb_red_blk_node* x;
+  double start=Now();
+  long n=0;
+
+  for (x=tree->root->left; x != tree->nil && x->left != tree->nil; x=x->left);
+  for (; x != tree->nil; x=TreeSuccessor(tree,x)) n++;
+  Assert(n == (long) tree->count,"scan missed nodes");
+  return((Now()-start)/n);
+}
+
+/*  Scatters the nodes of a tree with rounds of random deletes and */
+/*  inserts, then times scans and lookups before and after an */
+/*  incremental compaction, and the longest compaction step. */
+
+void BenchCompact(int size, int step) {
+  rb_red_blk_tree* tree;
+  rb_compaction* c;
+  int* keys=(int*) malloc(size*sizeof(int));
+  unsigned int seed=5757;
+  int i, j, done, hits;
+  double start, t, longest=0, total=0, lookup[2], scan[2];
+
+  tree=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+  for (i=0; i<size; i++) {
+    keys[i]=rand_r(&seed);
+    RBTreeInsert(tree,NewInt(keys[i]),0);
+  }
+  for (i=0; i<4*size; i++) {
+    j=rand_r(&seed)%size;
+    RBDelete(tree,RBExactQuery(tree,&keys[j]));
+    keys[j]=rand_r(&seed);
+    RBTreeInsert(tree,NewInt(keys[j]),0);
+  }
+  for (i=0; i<2; i++) {
+    scan[i]=ScanTime(tree);
+    start=Now();
+    for (hits=0, j=0; j<size; j++) {
+      hits+=(RBExactQuery(tree,&keys[rand_r(&seed)%size]) != 0);
+    }
+    lookup[i]=(Now()-start)/size;
+    Assert(hits == size,"compact lookups missed");
+    if (i) break;
+    c=RBTreeCompactStart(tree,NULL,NULL);
+    do {
+      start=Now();
+      done=RBTreeCompactStep(c,step);
+      t=Now()-start;
+      total+=t;
+      if (t > longest) longest=t;
+    } while (!done);
+    RBTreeCompactEnd(c);
+  }
+  printf("%d keys after %d delete/insert rounds, steps of %d nodes\n",
+	 size,4*size,step);
+  printf("%-10s %12s %12s\n","","scan ns/node","lookup ns");
+  printf("%-10s %12.1f %12.1f\n","scattered",1e9*scan[0],1e9*lookup[0]);
+  printf("%-10s %12.1f %12.1f\n","compacted",1e9*scan[1],1e9*lookup[1]);
+  printf("compaction %.1f ms in all, longest step %.1f us\n",1e3*total,
+	 1e6*longest);
+  RBTreeDestroy(tree);
+  free(keys);
+}
+
+/*  IntComp, counting its calls in gCompares */
+
+long gCompares;
+
+int CountingComp(const void* a, const void* b) {
+  gCompares++;
+  return(IntComp(a,b));
+}
+
+/*  the number of nodes on the longest path down from x */
+
+int Height(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  int l, r;
+
+  if (x == tree->nil) return(0);
+  l=Height(tree,x->left);
+  r=Height(tree,x->right);
+  return(1+ ((l > r) ? l : r));
+}
+
+/*  Grows a tree by random inserts and deletes, then compares its */
+/*  height, compares per lookup and lookup time before and after */
+/*  RBTreeRebalance, and times the rebalance. */
+
+void BenchRebalance(int size, int lookups) {
+  rb_red_blk_tree* tree;
+  int* keys=(int*) malloc(size*sizeof(int));
+  unsigned int seed=4646;
+  int i, j, hits;
+  double start, rebalance=0, lookup[2];
+  long compares[2];
+  int height[2];
+
+  tree=RBTreeCreate(CountingComp,IntDest,InfoDest,IntPrint,InfoPrint);
+  for (i=0; i<size; i++) {
+    keys[i]=rand_r(&seed);
+    RBTreeInsert(tree,NewInt(keys[i]),0);
+  }
+  for (i=0; i<4*size; i++) {
+    j=rand_r(&seed)%size;
+    RBDelete(tree,RBExactQuery(tree,&keys[j]));
+    keys[j]=rand_r(&seed);
+    RBTreeInsert(tree,NewInt(keys[j]),0);
+  }
+  for (i=0; i<2; i++) {
+    height[i]=Height(tree,tree->root->left);
+    gCompares=0;
+    start=Now();
+    for (hits=0, j=0; j<lookups; j++) {
+      hits+=(RBExactQuery(tree,&keys[rand_r(&seed)%size]) != 0);
+    }
+    lookup[i]=(Now()-start)/lookups;
+    compares[i]=gCompares;
+    Assert(hits == lookups,"rebalance lookups missed");
+    if (i) break;
+    start=Now();
+    RBTreeRebalance(tree);
+    rebalance=Now()-start;
+  }
+  printf("%d keys after %d delete/insert rounds\n",size,4*size);
+  printf("%-11s %7s %16s %10s\n","","height","compares/lookup","lookup ns");
+  printf("%-11s %7d %16.2f %10.1f\n","grown",height[0],
+	 (double) compares[0]/lookups,1e9*lookup[0]);
+  printf("%-11s %7d %16.2f %10.1f\n","rebalanced",height[1],
+	 (double) compares[1]/lookups,1e9*lookup[1]);
+  printf("RBTreeRebalance took %.1f ms\n",1e3*rebalance);
+  RBTreeDestroy(tree);
+  free(keys);
+}
+
+/*  For each balancing scheme, inserts size random keys, looks some */
+/*  up and deletes them all again, reporting the rotations, the */
+/*  height and how long each phase took. */
+
+void BenchBalance(int size, int lookups) {
+  const rb_balance* schemes[]={&RBBalanceRedBlack,&RBBalanceAVL,
+			       &RBBalanceWAVL,&RBBalanceTreap};
+  rb_red_blk_tree* tree;
+  int* keys=(int*) malloc(size*sizeof(int));
+  unsigned int seed;
+  int i, j, hits, height;
+  double start, insert, lookup, delete;
+  unsigned long insertRotations;
+  long compares;
+
+  printf("%d random keys, %d lookups\n",size,lookups);
+  printf("%-10s %8s %8s %7s %8s %9s %8s %8s\n","scheme","ins ns",
+	 "rot/ins","height","cmp/look","lookup ns","del ns","rot/del");
+  for (i=0; i<4; i++) {
+    seed=4747;
+    for (j=0; j<size; j++) keys[j]=rand_r(&seed);
+    tree=RBTreeCreate(CountingComp,IntDest,InfoDest,IntPrint,InfoPrint);
+    RBTreeUseBalance(tree,schemes[i]);
+    start=Now();
+    for (j=0; j<size; j++) RBTreeInsert(tree,NewInt(keys[j]),0);
+    insert=(Now()-start)/size;
+    insertRotations=tree->rotations;
+    height=Height(tree,tree->root->left);
+    gCompares=0;
+    start=Now();
+    for (hits=0, j=0; j<lookups; j++) {
+      hits+=(RBExactQuery(tree,&keys[rand_r(&seed)%size]) != 0);
+    }
+    lookup=(Now()-start)/lookups;
+    compares=gCompares;
+    Assert(hits == lookups,"balance lookups missed");
+    start=Now();
+    for (j=0; j<size; j++) RBDelete(tree,RBExactQuery(tree,&keys[j]));
+    delete=(Now()-start)/size;
+    printf("%-10s %8.1f %8.3f %7d %8.2f %9.1f %8.1f %8.3f\n",
+	   schemes[i]->name,1e9*insert,(double) insertRotations/size,height,
+	   (double) compares/lookups,1e9*lookup,1e9*delete,
+	   (double) (tree->rotations-insertRotations)/size);
+    RBTreeDestroy(tree);
+  }
+  printf("del ns includes the lookup of each key deleted\n");
+  free(keys);
+}
+
+/*  heap bytes in use, counting blocks malloc gets with mmap */
+
+size_t HeapInUse(void) {
+  struct mallinfo2 m=mallinfo2();
+
+  return(m.uordblks+m.hblkhd);
+}
+
+/*  Makes nTrees trees of keysPerTree keys each, first with one */
+/*  RBTreeCreate per tree and then with RBTreeInit over one array, */
+/*  and reports the heap bytes per tree and the time per tree to */
+/*  build and to dispose of them.  The keys are not allocated, so */
+/*  only the trees and their nodes count. */
+
+void BenchSmallTrees(int nTrees, int keysPerTree) {
+  static int keys[64];
+  rb_red_blk_tree** created;
+  rb_red_blk_tree* embedded;
+  rb_red_blk_tree* tree;
+  size_t before, bytes;
+  double start, build, dispose;
+  int mode, i, j;
+
+  if (keysPerTree > 64) keysPerTree=64;
+  for (j=0; j<keysPerTree; j++) keys[j]=j;
+  created=(rb_red_blk_tree**) malloc(nTrees*sizeof(rb_red_blk_tree*));
+  printf("%d trees of %d keys, sizeof(rb_red_blk_tree) is %d\n",nTrees,
+	 keysPerTree,(int) sizeof(rb_red_blk_tree));
+  printf("%-14s %12s %12s %12s\n","","bytes/tree","build ns","dispose ns");
+  for (mode=0; mode<2; mode++) {
+    before=HeapInUse();
+    start=Now();
+    embedded= mode ? (rb_red_blk_tree*)
+      malloc(nTrees*sizeof(rb_red_blk_tree)) : NULL;
+    for (i=0; i<nTrees; i++) {
+      if (mode) {
+	tree=&embedded[i];
+	RBTreeInit(tree,IntComp,NullFunction,NullFunction,IntPrint,InfoPrint);
+      } else {
+	tree=created[i]=RBTreeCreate(IntComp,NullFunction,NullFunction,
+				     IntPrint,InfoPrint);
+      }
+      for (j=0; j<keysPerTree; j++) RBTreeInsert(tree,&keys[j],0);
+    }
+    build=(Now()-start)/nTrees;
+    bytes=HeapInUse()-before;
+    start=Now();
+    for (i=0; i<nTrees; i++) {
+      if (mode) RBTreeClear(&embedded[i]); else RBTreeDestroy(created[i]);
+    }
+    free(embedded);
+    dispose=(Now()-start)/nTrees;
+    printf("%-14s %12.1f %12.1f %12.1f\n",mode ? "RBTreeInit" : "RBTreeCreate",
+	   (double) bytes/nTrees,1e9*build,1e9*dispose);
+  }
+  free(created);
+}
+
+/*  a tenant's arena for BenchAlloc: objects of one size are carved */
+/*  from 1MB chunks and freed ones kept on a list for reuse, and the */
+/*  chunks are only given back when the arena is disposed of */
+
+#define ARENA_CHUNK (1 << 20)
+
+typedef struct bench_arena {
+  char* chunk; /* the chunks are chained through their first word */
+  size_t used;
+  void* freeList;
+} bench_arena;
+
+void* ArenaAlloc(void* context, size_t size) {
+  bench_arena* arena=(bench_arena*) context;
+  char* chunk;
+  void* p;
+
+  size=(size+15) & ~(size_t) 15;
+  if ( (p=arena->freeList) ) { /* assignment */
+    arena->freeList=*(void**) p;
+    return(p);
+  }
+  if (!arena->chunk || arena->used+size > ARENA_CHUNK) {
+    if (!(chunk=(char*) malloc(ARENA_CHUNK))) return(NULL); /* assignment */
+    *(char**) chunk=arena->chunk;
+    arena->chunk=chunk;
+    arena->used=16;
+  }
+  p=arena->chunk+arena->used;
+  arena->used+=size;
+  return(p);
+}
+
+void ArenaFree(void* context, void* p, size_t size) {
+  bench_arena* arena=(bench_arena*) context;
+
+  *(void**) p=arena->freeList;
+  arena->freeList=p;
+}
+
+void ArenaDispose(bench_arena* arena) {
+  char* next;
+
+  for (; arena->chunk; arena->chunk=next) {
+    next=*(char**) arena->chunk;
+    free(arena->chunk);
+  }
+}
+
+/*  Inserts n random keys round robin into one tree per tenant and */
+/*  destroys the trees, with their nodes from malloc, from the node */
+/*  caches and from an arena per tenant through rb_allocator, and */
+/*  reports the time per key and the trees' summed peak bytes.  Then */
+/*  it gives each malloc tree a budget of half its keys and reports */
+/*  how many inserts were refused. */
+
+void BenchAlloc(int n, int tenants) {
+  static const char* names[3]={"malloc","node cache","arena"};
+  rb_red_blk_tree* trees=(rb_red_blk_tree*)
+    malloc(tenants*sizeof(rb_red_blk_tree));
+  bench_arena* arenas=(bench_arena*) calloc(tenants,sizeof(bench_arena));
+  rb_allocator* allocators=(rb_allocator*)
+    malloc(tenants*sizeof(rb_allocator));
+  int* keys=(int*) malloc(n*sizeof(int));
+  rb_mem_stats stats;
+  double start, insert, destroy;
+  long peak, refused;
+  int mode, i;
+
+  for (i=0; i<n; i++) keys[i]=rand();
+  printf("%d keys over %d trees\n",n,tenants);
+  printf("%-12s %12s %12s %14s\n","","insert ns","destroy ns","peak bytes");
+  for (mode=0; mode<4; mode++) {
+    for (i=0; i<tenants; i++) {
+      RBTreeInit(&trees[i],IntComp,NullFunction,NullFunction,IntPrint,
+		 InfoPrint);
+      if (mode == 1) RBTreeUseNodeCache(&trees[i]);
+      if (mode == 2) {
+	allocators[i].Alloc=ArenaAlloc;
+	allocators[i].Free=ArenaFree;
+	allocators[i].context=&arenas[i];
+	RBTreeUseAllocator(&trees[i],&allocators[i]);
+      }
+      if (mode == 3) RBTreeSetBudget(&trees[i],0,n/tenants/2);
+    }
+    start=Now();
+    for (i=0; i<n; i++) RBTreeInsert(&trees[i % tenants],&keys[i],0);
+    insert=(Now()-start)/n;
+    peak=refused=0;
+    for (i=0; i<tenants; i++) {
+      RBTreeGetMemStats(&trees[i],&stats);
+      peak+=stats.peakBytes;
+      refused+=(long) stats.failures;
+    }
+    start=Now();
+    for (i=0; i<tenants; i++) {
+      RBTreeClear(&trees[i]);
+      if (mode == 2) ArenaDispose(&arenas[i]);
+    }
+    destroy=(Now()-start)/n;
+    if (mode < 3) {
+      printf("%-12s %12.1f %12.1f %14ld\n",names[mode],1e9*insert,
+	     1e9*destroy,peak);
+    } else {
+      printf("budget of %d nodes a tree: %ld of %d inserts refused, "
+	     "peak %ld bytes\n",n/tenants/2,refused,n,peak);
+    }
+  }
+  free(trees);
+  free(arenas);
+  free(allocators);
+  free(keys);
+}
+
+/*  keys which are the words themselves, for trees too big to keep */
+/*  a separate int for each key */
+
+int WordComp(const void* a, const void* b) {
+  uintptr_t x=(uintptr_t) a, y=(uintptr_t) b;
+
+  return( (x > y) - (x < y) );
+}
+
+int NextWord(void* context, void** key, void** info) {
+  uintptr_t* next=(uintptr_t*) context;
+
+  *key=(void*) *next;
+  *info=NULL;
+  *next+=2;
+  return(1);
+}
+
+/*  Builds a tree of n keys with the nodes from malloc, from a node */
+/*  arena of 4K pages and from one asking for huge pages, and times */
+/*  random lookups in each.  The trees only outgrow the TLB's reach */
+/*  when they run to gigabytes, so n should be in the tens of */
+/*  millions. */
+
+void BenchHugePages(long n, int lookups) {
+  static const char* names[3]={"malloc","arena 4K","arena huge"};
+  rb_node_arena* arena;
+  rb_node_arena_stats stats;
+  rb_red_blk_tree* tree;
+  unsigned int seed;
+  uintptr_t next, key;
+  double start, build, lookup;
+  long hugePages;
+  int mode, i, hits;
+
+  printf("%ld keys, %d lookups\n",n,lookups);
+  printf("%-11s %10s %10s %11s\n","","build s","lookup ns","huge pages");
+  for (mode=0; mode<3; mode++) {
+    arena=NULL;
+    hugePages=0;
+    tree=RBTreeCreate(WordComp,NullFunction,NullFunction,IntPrint,
+		      InfoPrint);
+    if (mode) {
+      arena=RBNodeArenaCreate(256*RB_HUGE_PAGE,mode == 2);
+      RBTreeUseAllocator(tree,&arena->allocator);
+    }
+    next=2;
+    start=Now();
+    Assert(RBTreeBuildSorted(tree,n,NextWord,&next),"hugepage build failed");
+    build=Now()-start;
+    seed=4646;
+    start=Now();
+    for (hits=0, i=0; i<lookups; i++) {
+      key=2+2*(((uintptr_t) rand_r(&seed) << 16 ^ rand_r(&seed)) % n);
+      hits+=(RBExactQuery(tree,(void*) key) != 0);
+    }
+    lookup=(Now()-start)/lookups;
+    Assert(hits == lookups,"hugepage lookups missed");
+    if (arena) {
+      RBNodeArenaGetStats(arena,&stats);
+      hugePages=stats.hugePages;
+    }
+    printf("%-11s %10.2f %10.1f %11ld\n",names[mode],build,1e9*lookup,
+	   hugePages);
+    RBTreeDestroy(tree);
+    if (arena) RBNodeArenaDestroy(arena);
+  }
+}
+
+int main(int argc, char** argv) {
+  const char* which=(argc > 1) ? argv[1] : "all";
+  int all=!strcmp(which,"all");
+
+  if (all || !strcmp(which,"concurrent")) {
+    BenchConcurrent(argc > 2 ? atoi(argv[2]) : 4,
+		    argc > 3 ? atoi(argv[3]) : 200000);
+  }
+  if (all || !strcmp(which,"private")) {
+    BenchPrivate(argc > 2 ? atoi(argv[2]) : 4,
+		 argc > 3 ? atoi(argv[3]) : 200000);
+  }
+  if (all || !strcmp(which,"batch")) {
+    BenchBatch(argc > 2 ? atoi(argv[2]) : 1000000,
+	       argc > 3 ? atoi(argv[3]) : 1000000);
+  }
+  if (all || !strcmp(which,"multiget")) {
+    BenchMultiGet(argc > 2 ? atoi(argv[2]) : 2000000);
+  }
+  if (all || !strcmp(which,"build")) {
+    BenchBuild(argc > 2 ? atoi(argv[2]) : 2000000,
+	       argc > 3 ? atoi(argv[3]) : 4);
+  }
+  if (all || !strcmp(which,"traverse")) {
+    BenchTraverse(argc > 2 ? atoi(argv[2]) : 2000000,
+		  argc > 3 ? atoi(argv[3]) : 4);
+  }
+  if (all || !strcmp(which,"snapshot")) {
+    BenchSnapshot(argc > 2 ? atoi(argv[2]) : 2000000,
+		  argc > 3 ? argv[3] : "bench_rb.snap");
+  }
+  if (all || !strcmp(which,"stream")) {
+    BenchStream(argc > 2 ? atoi(argv[2]) : 2000000,
+		argc > 3 ? argv[3] : "bench_rb.stream");
+  }
+  if (all || !strcmp(which,"wal")) {
+    BenchWal(argc > 2 ? atoi(argv[2]) : 20000,
+	     argc > 3 ? argv[3] : "bench_rb");
+  }
+  if (all || !strcmp(which,"bgsave")) {
+    BenchBgSave(argc > 2 ? atoi(argv[2]) : 2000000,
+		argc > 3 ? argv[3] : "bench_rb.snap");
+  }
+  if (all || !strcmp(which,"checkpoint")) {
+    BenchCheckpoint(argc > 2 ? atoi(argv[2]) : 4000000,
+		    argc > 3 ? argv[3] : "bench_rb.ckpt");
+  }
+  if (all || !strcmp(which,"frozen")) {
+    BenchFrozen(argc > 2 ? atoi(argv[2]) : 4194304,
+		argc > 3 ? atoi(argv[3]) : 1000000);
+  }
+  if (all || !strcmp(which,"intindex")) {
+    BenchIntIndex(argc > 2 ? atoi(argv[2]) : 4194304,
+		  argc > 3 ? atoi(argv[3]) : 1000000);
+  }
+  if (all || !strcmp(which,"prefix")) {
+    BenchPrefix(argc > 2 ? atoi(argv[2]) : 4194304,
+		argc > 3 ? atoi(argv[3]) : 1000000);
+  }
+  if (all || !strcmp(which,"string")) {
+    BenchString(argc > 2 ? atoi(argv[2]) : 1048576,
+		argc > 3 ? atoi(argv[3]) : 1000000);
+  }
+  if (all || !strcmp(which,"inline")) {
+    BenchInline(argc > 2 ? atoi(argv[2]) : 4194304,
+		argc > 3 ? atoi(argv[3]) : 1000000);
+  }
+  if (all || !strcmp(which,"set")) {
+    BenchSet(argc > 2 ? atoi(argv[2]) : 4194304,
+	     argc > 3 ? atoi(argv[3]) : 1000000);
+  }
+  if (all || !strcmp(which,"compact")) {
+    BenchCompact(argc > 2 ? atoi(argv[2]) : 1000000,
+		 argc > 3 ? atoi(argv[3]) : 1024);
+  }
+  if (all || !strcmp(which,"rebalance")) {
+    BenchRebalance(argc > 2 ? atoi(argv[2]) : 1000000,
+		   argc > 3 ? atoi(argv[3]) : 1000000);
+  }
+  if (all || !strcmp(which,"balance")) {
+    BenchBalance(argc > 2 ? atoi(argv[2]) : 1000000,
+		 argc > 3 ? atoi(argv[3]) : 1000000);
+  }
+  if (all || !strcmp(which,"small")) {
+    BenchSmallTrees(argc > 2 ? atoi(argv[2]) : 1000000,
+		    argc > 3 ? atoi(argv[3]) : 0);
+  }
+  if (all || !strcmp(which,"alloc")) {
+    BenchAlloc(argc > 2 ? atoi(argv[2]) : 2000000,
+	       argc > 3 ? atoi(argv[3]) : 16);
+  }
+  if (all || !strcmp(which,"hugepage")) {
+    BenchHugePages(argc > 2 ? atol(argv[2]) : 32000000,
+		   argc > 3 ? atoi(argv[3]) : 1000000);
+  }
+  return 0;
+}
@@ -0,0 +1,845 @@
+#include "red_black_tree.h"
+#include "tree_alloc.h"
+#include <assert.h>
+#include <string.h>
+
+/*  A second engine behind red_black_tree.h: a B+-tree whose nodes are */
+/*  two cache lines, one holding a node's keys and the other its */
+/*  children, so a lookup misses about once per level of a tree of */
+/*  fanout RB_BPLUS_KEYS+1 instead of once per level of a binary tree. */
+/*  Link bplus_tree.o in place of red_black_tree.o to use it. */
+/**/
+/*  The rb_red_blk_node handles the interface hands out still hold each */
+/*  item's key and info, and stay valid until the item is deleted.  The */
+/*  leaves point to them, and they are chained in key order: right is */
+/*  the next node (nil after the last), parent the previous one */
+/*  (tree->root before the first), left is always nil and red always */
+/*  0.  tree->root->left is the first node, so code which walks a tree */
+/*  in order through left and right, or with TreeSuccessor, sees every */
+/*  item in order; tree->root->info holds the top of the B+-tree, */
+/*  which in an empty tree may be the shared, read-only EmptyLeaf. */
+/**/
+/*  An interior node's keys are pointers to keys of items below it. */
+/*  Every key under child i lies between keys[i-1] and keys[i], both */
+/*  included, so equal keys may be found on either side of a separator */
+/*  equal to them.  Since deleting an item frees its key, RBDelete */
+/*  first points any separator using that key at a neighbour's. */
+/**/
+/*  RBBuildSubtree, RBBalancedRedDepth, TreeDestHelper, checkRepHelper */
+/*  and checkRepNode build or check red-black trees and are not */
+/*  provided, so parallel_tree.c cannot be linked with this engine. */
+/*  Nor are the rotations and RBTreeUseBalance (see tree_balance.h). */
+
+#ifndef RB_BPLUS_KEYS
+#define RB_BPLUS_KEYS 7 /* with the count, the keys fill one cache line */
+#endif
+
+#define RB_BPLUS_MIN (RB_BPLUS_KEYS/2) /* fewest keys outside the top */
+/*  more levels than a tree of RB_BPLUS_MIN+1 way nodes can have */
+#define RB_BPLUS_MAX_HEIGHT 64
+
+typedef struct rb_bplus_node {
+  int n; /* keys in use */
+  int leaf;
+  void* keys[RB_BPLUS_KEYS];
+  /*  an interior node's n+1 children, or a leaf's n nodes */
+  void* ptrs[RB_BPLUS_KEYS+1];
+} rb_bplus_node;
+
+#define BPLUS_TOP(tree) ((rb_bplus_node*) (tree)->root->info)
+
+/*  the top of a tree which has not had an item yet, so that making a */
+/*  tree needs no memory but its own; nothing writes to it */
+
+static const rb_bplus_node EmptyLeaf={0,1};
+#define EMPTY_LEAF ((rb_bplus_node*) &EmptyLeaf)
+
+/*  B+-tree nodes are aligned to cache lines when they come from */
+/*  malloc, and from the tree's allocator otherwise.  Their bytes are */
+/*  counted but not held to the budget (see tree_alloc.h). */
+/*  BPlusNodeTryAlloc returns NULL if there is no memory. */
+
+static rb_bplus_node* BPlusNodeTryAlloc(rb_red_blk_tree* tree, int leaf) {
+  const rb_allocator* allocator=RB_TREE_ALLOCATOR(tree);
+  rb_bplus_node* x;
+  void* p=NULL;
+
+  if (allocator != &RBMallocAllocator) {
+    p=allocator->Alloc(allocator->context,sizeof(rb_bplus_node));
+  } else if (posix_memalign(&p,64,sizeof(rb_bplus_node))) {
+    p=NULL;
+  }
+  if (!(x=(rb_bplus_node*) p)) { /* assignment */
+    RBTreeCountFailure(tree);
+    return(NULL);
+  }
+  RBTreeCharge(tree,sizeof(rb_bplus_node),0,1);
+  x->n=0;
+  x->leaf=leaf;
+  return(x);
+}
+
+static void BPlusNodeFree(rb_red_blk_tree* tree, rb_bplus_node* x) {
+  const rb_allocator* allocator=RB_TREE_ALLOCATOR(tree);
+
+  if (x == EMPTY_LEAF) return;
+  if (allocator != &RBMallocAllocator) {
+    allocator->Free(allocator->context,x,sizeof(rb_bplus_node));
+  } else {
+    free(x);
+  }
+  RBTreeCharge(tree,-(long) sizeof(rb_bplus_node),0,1);
+}
+
+/*  the nil handle of every tree, which nothing writes to */
+
+static const rb_red_blk_node RBNil={0,0,0,(rb_red_blk_node*) &RBNil,
+				    (rb_red_blk_node*) &RBNil,
+				    (rb_red_blk_node*) &RBNil};
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeInit */
+/**/
+/*  INPUTS:  the same as for the red-black engine */
+/**/
+/*  OUTPUT:  none */
+/**/
+/*  EFFECTS:  makes tree an empty tree, whose B+-tree is EmptyLeaf */
+/*            until the first insert allocates a leaf of its own */
+/**/
+/*  Modifies Input: tree */
+/***********************************************************************/
+
+void RBTreeInit(rb_red_blk_tree* tree,
+		int (*CompFunc) (const void*,const void*),
+		void (*DestFunc) (void*),
+		void (*InfoDestFunc) (void*),
+		void (*PrintFunc) (const void*),
+		void (*PrintInfo)(void*)) {
+  rb_red_blk_node* temp;
+
+  tree->Compare=  CompFunc;
+  tree->DestroyKey= DestFunc;
+  tree->PrintKey= PrintFunc;
+  tree->PrintInfo= PrintInfo;
+  tree->DestroyInfo= InfoDestFunc;
+  tree->Normalize=0;
+  tree->nodeSize=sizeof(rb_red_blk_node);
+  tree->extra=NULL;
+  tree->balance=NULL;
+  tree->rotations=0;
+  tree->count=0;
+
+  tree->nil=(rb_red_blk_node*) &RBNil;
+  temp=tree->root=&tree->rootNode;
+  temp->parent=temp->left=temp->right=tree->nil;
+  temp->key=0;
+  temp->red=0;
+  temp->info=EMPTY_LEAF;
+}
+
+rb_red_blk_tree* RBTreeCreate( int (*CompFunc) (const void*,const void*),
+			      void (*DestFunc) (void*),
+			      void (*InfoDestFunc) (void*),
+			      void (*PrintFunc) (const void*),
+			      void (*PrintInfo)(void*)) {
+  rb_red_blk_tree* newTree;
+
+  newTree=(rb_red_blk_tree*) SafeMalloc(sizeof(rb_red_blk_tree));
+  RBTreeInit(newTree,CompFunc,DestFunc,InfoDestFunc,PrintFunc,PrintInfo);
+  return(newTree);
+}
+
+/*  see RBTreeUseAllocator in red_black_tree.c.  The B+-tree nodes */
+/*  come from the allocator as well, so an empty top leaf the old one */
+/*  gave is freed, and the first insert allocates one from the new. */
+
+void RBTreeUseAllocator(rb_red_blk_tree* tree, const rb_allocator* allocator) {
+#ifdef DEBUG_ASSERT
+  Assert(tree->root->left == tree->nil,"tree not empty in RBTreeUseAllocator");
+#endif
+  if (RB_TREE_ALLOCATOR(tree) == allocator) return;
+  BPlusNodeFree(tree,BPLUS_TOP(tree));
+  tree->root->info=EMPTY_LEAF;
+  RBTreeExtra(tree)->allocator=allocator;
+}
+
+/*  The searches here compare the keys in the B+-tree nodes directly, */
+/*  so the handles keep no prefix and Normalize is never called. */
+
+void RBTreeUsePrefix(rb_red_blk_tree* tree,
+		     uint64_t (*Normalize)(const void*)) {
+#ifdef DEBUG_ASSERT
+  Assert(tree->root->left == tree->nil,"tree not empty in RBTreeUsePrefix");
+#endif
+  tree->Normalize=Normalize;
+}
+
+void RBNodeSetKey(rb_red_blk_tree* tree, rb_red_blk_node* x, void* key) {
+  x->key=key;
+}
+
+rb_red_blk_node* RBNodeAlloc(rb_red_blk_tree* tree) {
+  return((rb_red_blk_node*) RBTreeAllocBytes(tree,tree->nodeSize,1));
+}
+
+void RBNodeFree(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  RBTreeFreeBytes(tree,x,tree->nodeSize,1);
+}
+
+/*  frees what x's key and info point to.  Trees which keep them in */
+/*  the node, such as sets and inline trees, have NullFunction there */
+/*  and pay no call at all. */
+
+static void DestroyNodeData(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  if (tree->DestroyKey != NullFunction) tree->DestroyKey(x->key);
+  if (tree->DestroyInfo != NullFunction) tree->DestroyInfo(x->info);
+}
+
+/*  the number of keys in x less than q, or not greater than q if */
+/*  upper is 1 */
+
+static int BPlusIndex(rb_red_blk_tree* tree, rb_bplus_node* x,
+		      const void* q, int upper) {
+  int i=0;
+
+  while ( (i < x->n) && (tree->Compare(x->keys[i],q) < upper) ) i++;
+  return(i);
+}
+
+/*  the leaf a search for q ends in, going left or right of keys equal */
+/*  to q as BPlusIndex does */
+
+static rb_bplus_node* BPlusLeaf(rb_red_blk_tree* tree, const void* q,
+				int upper) {
+  rb_bplus_node* x=BPLUS_TOP(tree);
+
+  while (!x->leaf) {
+    x=(rb_bplus_node*) x->ptrs[BPlusIndex(tree,x,q,upper)];
+    PREFETCH(x->ptrs);
+  }
+  return(x);
+}
+
+/*  the node just before slot i of leaf x, or tree->root if none is */
+
+static rb_red_blk_node* LeafBefore(rb_red_blk_tree* tree, rb_bplus_node* x,
+				   int i) {
+  if (i > 0) return((rb_red_blk_node*) x->ptrs[i-1]);
+  if (x->n) return(((rb_red_blk_node*) x->ptrs[0])->parent);
+  return(tree->root);
+}
+
+/*  the node in slot i of leaf x, or the one after the leaf if i is n */
+
+static rb_red_blk_node* LeafAt(rb_red_blk_tree* tree, rb_bplus_node* x,
+			       int i) {
+  if (i < x->n) return((rb_red_blk_node*) x->ptrs[i]);
+  if (x->n) return(((rb_red_blk_node*) x->ptrs[x->n-1])->right);
+  return(tree->nil);
+}
+
+/*  puts z in the node chain after prev, which may be tree->root */
+
+static void LinkAfter(rb_red_blk_tree* tree, rb_red_blk_node* prev,
+		      rb_red_blk_node* z) {
+  rb_red_blk_node** next= (prev == tree->root) ? &prev->left : &prev->right;
+
+  z->left=tree->nil;
+  z->red=0;
+  z->parent=prev;
+  z->right=*next;
+  if (*next != tree->nil) (*next)->parent=z;
+  *next=z;
+}
+
+static void Unlink(rb_red_blk_tree* tree, rb_red_blk_node* z) {
+  rb_red_blk_node* prev=z->parent;
+
+  if (prev == tree->root) prev->left=z->right; else prev->right=z->right;
+  if (z->right != tree->nil) z->right->parent=prev;
+}
+
+/***********************************************************************/
+/*  FUNCTION:  NodeInsert */
+/**/
+/*    INPUTS:  x is the node to add key to at keys[i], with ptr going */
+/*             to ptrs[i] of a leaf or ptrs[i+1] of an interior node, */
+/*             and right an empty node to split x into if x is full */
+/**/
+/*    OUTPUT:  NULL, or if x was full and had to be split right, now */
+/*             holding its upper half, with the separator for the */
+/*             parent in *up */
+/**/
+/*    Modifies Input: x, up */
+/***********************************************************************/
+
+static rb_bplus_node* NodeInsert(rb_red_blk_tree* tree, rb_bplus_node* x,
+				 int i, void* key, void* ptr,
+				 rb_bplus_node* right, void** up) {
+  void* keys[RB_BPLUS_KEYS+1];
+  void* ptrs[RB_BPLUS_KEYS+2];
+  int p= x->leaf ? i : i+1;
+  int nPtrs= x->leaf ? x->n : x->n+1;
+  int total=x->n+1;
+  int nLeft=total/2;
+
+  if (x->n < RB_BPLUS_KEYS) {
+    memmove(x->keys+i+1,x->keys+i,(x->n-i)*sizeof(void*));
+    memmove(x->ptrs+p+1,x->ptrs+p,(nPtrs-p)*sizeof(void*));
+    x->keys[i]=key;
+    x->ptrs[p]=ptr;
+    x->n++;
+    return(NULL);
+  }
+  memcpy(keys,x->keys,i*sizeof(void*));
+  keys[i]=key;
+  memcpy(keys+i+1,x->keys+i,(x->n-i)*sizeof(void*));
+  memcpy(ptrs,x->ptrs,p*sizeof(void*));
+  ptrs[p]=ptr;
+  memcpy(ptrs+p+1,x->ptrs+p,(nPtrs-p)*sizeof(void*));
+  right->leaf=x->leaf;
+  x->n=nLeft;
+  memcpy(x->keys,keys,nLeft*sizeof(void*));
+  if (x->leaf) {
+    right->n=total-nLeft;
+    memcpy(x->ptrs,ptrs,nLeft*sizeof(void*));
+    memcpy(right->keys,keys+nLeft,right->n*sizeof(void*));
+    memcpy(right->ptrs,ptrs+nLeft,right->n*sizeof(void*));
+    *up=right->keys[0];
+  } else { /* the middle key moves up */
+    right->n=total-nLeft-1;
+    memcpy(x->ptrs,ptrs,(nLeft+1)*sizeof(void*));
+    memcpy(right->keys,keys+nLeft+1,right->n*sizeof(void*));
+    memcpy(right->ptrs,ptrs+nLeft+1,(right->n+1)*sizeof(void*));
+    *up=keys[nLeft];
+  }
+  return(right);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeInsert */
+/**/
+/*  INPUTS:  tree is the tree to insert a node which has a key pointed */
+/*           to by key and info pointed to by info. */
+/**/
+/*  OUTPUT:  the new node, which stays valid until it is deleted, or */
+/*           NULL if the tree's allocator or budget refused it */
+/**/
+/*  Modifies Input: tree */
+/**/
+/*  EFFECTS:  Adds the item to a leaf after any equal keys, splitting */
+/*            full nodes on the way back up; a split of the top node */
+/*            makes the tree one level taller. */
+/***********************************************************************/
+
+rb_red_blk_node * RBTreeInsert(rb_red_blk_tree* tree, void* key, void* info) {
+  rb_red_blk_node* z;
+
+  if (!(z=RBNodeAlloc(tree))) return(NULL); /* assignment */
+  RBNodeSetKey(tree,z,key);
+  z->info=info;
+  if (!RBTreeInsertNode(tree,z)) {
+    RBNodeFree(tree,z);
+    return(NULL);
+  }
+  return(z);
+}
+
+/*  the second half of RBTreeInsert, as in red_black_tree.c.  It */
+/*  finds the leaf first and allocates a node for each full node it */
+/*  will split on the way back up, and a new top if every one is */
+/*  full, so that running out of memory leaves the tree as it was; */
+/*  then it returns NULL and z is the caller's to free.  A tree whose */
+/*  top is still EmptyLeaf first gets a leaf of its own. */
+
+rb_red_blk_node* RBTreeInsertNode(rb_red_blk_tree* tree, rb_red_blk_node* z) {
+  rb_bplus_node* path[RB_BPLUS_MAX_HEIGHT];
+  int index[RB_BPLUS_MAX_HEIGHT];
+  rb_bplus_node* spare[RB_BPLUS_MAX_HEIGHT+1];
+  rb_bplus_node* x=BPLUS_TOP(tree);
+  rb_bplus_node* right=NULL;
+  void* key=z->key;
+  void* ptr=z;
+  void* up;
+  int depth=0, nSpare=0, d;
+
+  if (x == EMPTY_LEAF) {
+    if (!(x=BPlusNodeTryAlloc(tree,1))) return(NULL); /* assignment */
+    tree->root->info=x;
+  }
+  for (;;) {
+    path[depth]=x;
+    index[depth]=BPlusIndex(tree,x,z->key,1);
+    if (x->leaf) break;
+    x=(rb_bplus_node*) x->ptrs[index[depth++]];
+  }
+  for (d=depth; (d >= 0) && (path[d]->n == RB_BPLUS_KEYS); d--) nSpare++;
+  if (d < 0) nSpare++;
+  for (d=0; d<nSpare; d++) {
+    if (!(spare[d]=BPlusNodeTryAlloc(tree,0))) { /* assignment */
+      while (d--) BPlusNodeFree(tree,spare[d]);
+      return(NULL);
+    }
+  }
+  LinkAfter(tree,LeafBefore(tree,x,index[depth]),z);
+  for (d=depth; d >= 0; d--) {
+    x=path[d];
+    right=NodeInsert(tree,x,index[d],key,ptr,
+		     (x->n == RB_BPLUS_KEYS) ? spare[--nSpare] : NULL,&up);
+    if (!right) break;
+    key=up;
+    ptr=right;
+  }
+  if (right) { /* the top split */
+    x=spare[--nSpare];
+    x->n=1;
+    x->keys[0]=up;
+    x->ptrs[0]=BPLUS_TOP(tree);
+    x->ptrs[1]=right;
+    tree->root->info=x;
+  }
+  tree->count++;
+  return(z);
+}
+
+/*  the chain makes these constant time */
+
+rb_red_blk_node* TreeSuccessor(rb_red_blk_tree* tree,rb_red_blk_node* x) {
+  return(x->right);
+}
+
+rb_red_blk_node* TreePredecessor(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  return( (x->parent == tree->root) ? tree->nil : x->parent);
+}
+
+/*  frees every item in the node chain, leaving the tree empty */
+
+static void DestroyItems(rb_red_blk_tree* tree) {
+  rb_red_blk_node* x=tree->root->left;
+  rb_red_blk_node* next;
+
+  while (x != tree->nil) {
+    next=x->right;
+    DestroyNodeData(tree,x);
+    RBNodeFree(tree,x);
+    x=next;
+  }
+  tree->root->left=tree->nil;
+}
+
+static void BPlusDestHelper(rb_red_blk_tree* tree, rb_bplus_node* x) {
+  int i;
+
+  if (!x->leaf) {
+    for (i=0; i<=x->n; i++) {
+      BPlusDestHelper(tree,(rb_bplus_node*) x->ptrs[i]);
+    }
+  }
+  BPlusNodeFree(tree,x);
+}
+
+void RBTreeClear(rb_red_blk_tree* tree) {
+  DestroyItems(tree);
+  BPlusDestHelper(tree,BPLUS_TOP(tree));
+  tree->root->info=NULL;
+  tree->count=0;
+  RBTreeFreeExtra(tree);
+}
+
+/*  the bytes of the B+-tree under x */
+
+static long BPlusBytes(rb_bplus_node* x) {
+  long bytes=sizeof(rb_bplus_node);
+  int i;
+
+  if (x == EMPTY_LEAF) return(0);
+  if (!x->leaf) {
+    for (i=0; i<=x->n; i++) bytes+=BPlusBytes((rb_bplus_node*) x->ptrs[i]);
+  }
+  return(bytes);
+}
+
+long RBTreeHeldBytes(rb_red_blk_tree* tree) {
+  return((long) (tree->count*tree->nodeSize)+BPlusBytes(BPLUS_TOP(tree)));
+}
+
+void RBTreeDestroy(rb_red_blk_tree* tree) {
+  RBTreeClear(tree);
+  free(tree);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeBuildSorted */
+/**/
+/*    INPUTS:  tree is an empty tree, n is the number of items and */
+/*             NextItem/context hand them out in ascending order as */
+/*             described for RBBuildSubtree in red_black_tree.c */
+/**/
+/*    OUTPUT:  1 on success, 0 if n is negative or NextItem or the */
+/*             allocator failed, in which case the tree is still empty */
+/**/
+/*    Modifies Input: tree */
+/**/
+/*    EFFECT:  Fills as few leaves as will hold the items, sharing them */
+/*             out evenly, then builds each level of interior nodes */
+/*             over the one below the same way, in O(n) time without */
+/*             any compares. */
+/***********************************************************************/
+
+int RBTreeBuildSorted(rb_red_blk_tree* tree, long n,
+		      int (*NextItem)(void*, void**, void**), void* context) {
+  rb_bplus_node** level;
+  void** firstKeys; /* the smallest key under each node of level */
+  rb_red_blk_node* prev=tree->root;
+  rb_red_blk_node* z;
+  rb_bplus_node* x;
+  long m, parents, i, j, k, c;
+
+#ifdef DEBUG_ASSERT
+  Assert(tree->root->left == tree->nil,"tree not empty in RBTreeBuildSorted");
+#endif
+  if (n < 0) return(0);
+  if (n <= 0) return(1);
+  m=(n+RB_BPLUS_KEYS-1)/RB_BPLUS_KEYS;
+  level=(rb_bplus_node**) SafeMalloc(m*sizeof(rb_bplus_node*));
+  firstKeys=(void**) SafeMalloc(m*sizeof(void*));
+  for (i=0; i<m; i++) {
+    if (!(level[i]=x=BPlusNodeTryAlloc(tree,1))) { /* assignment */
+      DestroyItems(tree);
+      for (k=0; k<i; k++) BPlusNodeFree(tree,level[k]);
+      free(level);
+      free(firstKeys);
+      return(0);
+    }
+    for (j=0; j<(n*(i+1))/m-(n*i)/m; j++) {
+      z=RBNodeAlloc(tree);
+      if (!z || !NextItem(context,&z->key,&z->info)) {
+	if (z) RBNodeFree(tree,z);
+	DestroyItems(tree);
+	for (k=0; k<=i; k++) BPlusNodeFree(tree,level[k]);
+	free(level);
+	free(firstKeys);
+	return(0);
+      }
+      RBNodeSetKey(tree,z,z->key);
+      LinkAfter(tree,prev,z);
+      prev=z;
+      x->keys[x->n]=z->key;
+      x->ptrs[x->n++]=z;
+    }
+    firstKeys[i]=x->keys[0];
+  }
+  /* parent i takes the next c nodes and is stored over them */
+  for (; m > 1; m=parents) {
+    parents=(m+RB_BPLUS_KEYS)/(RB_BPLUS_KEYS+1);
+    for (i=0, k=0; i<parents; i++) {
+      if (!(x=BPlusNodeTryAlloc(tree,0))) { /* assignment */
+	/* parents 0..i-1 hold nodes 0..k-1 of the level below */
+	for (j=0; j<i; j++) BPlusDestHelper(tree,level[j]);
+	for (j=k; j<m; j++) BPlusDestHelper(tree,level[j]);
+	DestroyItems(tree);
+	free(level);
+	free(firstKeys);
+	return(0);
+      }
+      c=(m*(i+1))/parents-(m*i)/parents;
+      x->n=(int) c-1;
+      for (j=0; j<c; j++) {
+	x->ptrs[j]=level[k+j];
+	if (j) x->keys[j-1]=firstKeys[k+j];
+      }
+      firstKeys[i]=firstKeys[k];
+      level[i]=x;
+      k+=c;
+    }
+  }
+  BPlusNodeFree(tree,BPLUS_TOP(tree));
+  tree->root->info=level[0];
+  tree->count=n;
+  free(level);
+  free(firstKeys);
+  return(1);
+}
+
+/*  Every leaf of a B+-tree is already at the same depth, so there is */
+/*  nothing for RBTreeRebalance to do. */
+
+void RBTreeRebalance(rb_red_blk_tree* tree) {
+}
+
+void RBTreePrint(rb_red_blk_tree* tree) {
+  rb_red_blk_node* x;
+
+  for (x=tree->root->left; x != tree->nil; x=x->right) {
+    printf("info=");
+    tree->PrintInfo(x->info);
+    printf("  key=");
+    tree->PrintKey(x->key);
+    printf("\n");
+  }
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBExactQuery */
+/**/
+/*    INPUTS:  tree is the tree to search and q is a pointer to the key */
+/*             we are searching for */
+/**/
+/*    OUTPUT:  the first node in key order whose key equals q, or 0 */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+rb_red_blk_node* RBExactQuery(rb_red_blk_tree* tree, void* q) {
+  rb_bplus_node* x=BPlusLeaf(tree,q,0);
+  rb_red_blk_node* y=LeafAt(tree,x,BPlusIndex(tree,x,q,0));
+
+  if ( (y == tree->nil) || tree->Compare(y->key,q) ) return(0);
+  return(y);
+}
+
+/*  A lookup touches only a few lines here, so the batched lookups are */
+/*  answered one at a time. */
+
+void RBExactQueryBatch(rb_red_blk_tree* tree, void** keys, int n,
+		       rb_red_blk_node** out_nodes) {
+  int i;
+
+  for (i=0; i<n; i++) out_nodes[i]=RBExactQuery(tree,keys[i]);
+}
+
+void RBMultiGet(rb_red_blk_tree* tree, void** keys, int n,
+		rb_red_blk_node** out_nodes) {
+  RBExactQueryBatch(tree,keys,n,out_nodes);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBEnumerate */
+/**/
+/*    INPUTS:  tree is the tree to look for keys >= low */
+/*             and <= high with respect to the Compare function */
+/**/
+/*    OUTPUT:  stack containing pointers to the nodes between [low,high] */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+stk_stack* RBEnumerate(rb_red_blk_tree* tree, void* low, void* high) {
+  stk_stack* enumResultStack=StackCreate();
+  rb_bplus_node* x=BPlusLeaf(tree,high,1);
+  rb_red_blk_node* y=LeafBefore(tree,x,BPlusIndex(tree,x,high,1));
+
+  while ( (y != tree->root) && (1 != tree->Compare(low,y->key)) ) {
+    StackPush(enumResultStack,y);
+    y=y->parent;
+  }
+  return(enumResultStack);
+}
+
+/*  Points each separator under x which is z's key at another key */
+/*  between the subtrees on either side of it: the first one of the */
+/*  right subtree, or if that is z, the last one of the left. */
+
+static void FixSeparators(rb_red_blk_tree* tree, rb_bplus_node* x,
+			  rb_red_blk_node* z) {
+  rb_bplus_node* y;
+  rb_red_blk_node* first;
+  int lo, hi, i;
+
+  if (x->leaf) return;
+  lo=BPlusIndex(tree,x,z->key,0);
+  hi=BPlusIndex(tree,x,z->key,1);
+  for (i=lo; i<hi; i++) {
+    if (x->keys[i] != z->key) continue;
+    for (y=(rb_bplus_node*) x->ptrs[i+1]; !y->leaf;
+	 y=(rb_bplus_node*) y->ptrs[0]);
+    first=(rb_red_blk_node*) y->ptrs[0];
+    x->keys[i]= (first != z) ? first->key : first->parent->key;
+  }
+  for (i=lo; i<=hi; i++) FixSeparators(tree,(rb_bplus_node*) x->ptrs[i],z);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  Rebalance */
+/**/
+/*    INPUTS:  x is an interior node whose child i has too few keys */
+/**/
+/*    OUTPUT:  none */
+/**/
+/*    EFFECT:  Moves one key into child i from a sibling which can */
+/*             spare it, through the separator between them, or else */
+/*             merges child i with a sibling, taking a key from x. */
+/**/
+/*    Modifies Input: x and its children */
+/***********************************************************************/
+
+static void Rebalance(rb_red_blk_tree* tree, rb_bplus_node* x, int i) {
+  rb_bplus_node* child=(rb_bplus_node*) x->ptrs[i];
+  rb_bplus_node* left= (i > 0) ? (rb_bplus_node*) x->ptrs[i-1] : NULL;
+  rb_bplus_node* right= (i < x->n) ? (rb_bplus_node*) x->ptrs[i+1] : NULL;
+  int leaf=child->leaf;
+
+  if (left && (left->n > RB_BPLUS_MIN)) {
+    memmove(child->keys+1,child->keys,child->n*sizeof(void*));
+    memmove(child->ptrs+1,child->ptrs,(child->n+!leaf)*sizeof(void*));
+    if (leaf) {
+      child->keys[0]=left->keys[left->n-1];
+      child->ptrs[0]=left->ptrs[left->n-1];
+      x->keys[i-1]=child->keys[0];
+    } else {
+      child->keys[0]=x->keys[i-1];
+      child->ptrs[0]=left->ptrs[left->n];
+      x->keys[i-1]=left->keys[left->n-1];
+    }
+    left->n--;
+    child->n++;
+  } else if (right && (right->n > RB_BPLUS_MIN)) {
+    if (leaf) {
+      child->keys[child->n]=right->keys[0];
+      child->ptrs[child->n]=right->ptrs[0];
+      x->keys[i]=right->keys[1];
+    } else {
+      child->keys[child->n]=x->keys[i];
+      child->ptrs[child->n+1]=right->ptrs[0];
+      x->keys[i]=right->keys[0];
+    }
+    child->n++;
+    right->n--;
+    memmove(right->keys,right->keys+1,right->n*sizeof(void*));
+    memmove(right->ptrs,right->ptrs+1,(right->n+!leaf)*sizeof(void*));
+  } else {
+    /* merge child i-1 and i, or i and i+1, into the left one */
+    if (left) {
+      right=child;
+      i--;
+    } else {
+      left=child;
+    }
+    if (!leaf) left->keys[left->n++]=x->keys[i];
+    memcpy(left->keys+left->n,right->keys,right->n*sizeof(void*));
+    memcpy(left->ptrs+left->n,right->ptrs,(right->n+!leaf)*sizeof(void*));
+    left->n+=right->n;
+    BPlusNodeFree(tree,right);
+    x->n--;
+    memmove(x->keys+i,x->keys+i+1,(x->n-i)*sizeof(void*));
+    memmove(x->ptrs+i+1,x->ptrs+i+2,(x->n-i)*sizeof(void*));
+  }
+}
+
+/*  takes z out of the subtree under x, which may leave x with too few */
+/*  keys.  Returns 0 if z is not there. */
+
+static int DeleteHelp(rb_red_blk_tree* tree, rb_bplus_node* x,
+		      rb_red_blk_node* z) {
+  int lo, hi, i;
+
+  if (x->leaf) {
+    for (i=0; (i < x->n) && (x->ptrs[i] != z); i++);
+    if (i == x->n) return(0);
+    x->n--;
+    memmove(x->keys+i,x->keys+i+1,(x->n-i)*sizeof(void*));
+    memmove(x->ptrs+i,x->ptrs+i+1,(x->n-i)*sizeof(void*));
+    return(1);
+  }
+  lo=BPlusIndex(tree,x,z->key,0);
+  hi=BPlusIndex(tree,x,z->key,1);
+  for (i=lo; i<=hi; i++) {
+    if (DeleteHelp(tree,(rb_bplus_node*) x->ptrs[i],z)) {
+      if (((rb_bplus_node*) x->ptrs[i])->n < RB_BPLUS_MIN) {
+	Rebalance(tree,x,i);
+      }
+      return(1);
+    }
+  }
+  return(0);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBDelete */
+/**/
+/*    INPUTS:  tree is the tree to delete node z from */
+/**/
+/*    OUTPUT:  none */
+/**/
+/*    EFFECT:  Takes z out of its leaf and the node chain and frees */
+/*             the key and info of z using DestroyKey and DestroyInfo. */
+/*             Nodes left with too few keys borrow from or merge with */
+/*             a sibling, and a top node left with one child is */
+/*             replaced by it.  With many equal keys every leaf which */
+/*             may hold z is searched. */
+/**/
+/*    Modifies Input: tree, z */
+/***********************************************************************/
+
+void RBDelete(rb_red_blk_tree* tree, rb_red_blk_node* z) {
+  rb_bplus_node* top=BPLUS_TOP(tree);
+  int found;
+
+  tree->count--;
+  FixSeparators(tree,top,z);
+  found=DeleteHelp(tree,top,z);
+#ifdef DEBUG_ASSERT
+  Assert(found,"node not in tree in RBDelete");
+#endif
+  (void) found;
+  if (!top->leaf && (top->n == 0)) {
+    tree->root->info=top->ptrs[0];
+    BPlusNodeFree(tree,top);
+  }
+  Unlink(tree,z);
+  DestroyNodeData(tree,z);
+  RBNodeFree(tree,z);
+}
+
+/*  Checks the subtree under x, whose keys must lie between *low and */
+/*  *high (no bound where NULL), and that its items are the next ones */
+/*  in the node chain, moving *next past them.  Returns its height. */
+
+static int CheckBPlus(rb_red_blk_tree* tree, rb_bplus_node* x,
+		      void** low, void** high, rb_red_blk_node** next,
+		      int top) {
+  rb_red_blk_node* y;
+  int i, height;
+
+  assert (x->n <= RB_BPLUS_KEYS);
+  if (!top) assert (x->n >= RB_BPLUS_MIN);
+  for (i=0; i<x->n; i++) {
+    if (low) assert (tree->Compare(*low,x->keys[i]) != 1);
+    if (high) assert (tree->Compare(x->keys[i],*high) != 1);
+    if (i) assert (tree->Compare(x->keys[i-1],x->keys[i]) != 1);
+  }
+  if (x->leaf) {
+    for (i=0; i<x->n; i++) {
+      y=(rb_red_blk_node*) x->ptrs[i];
+      assert (y == *next);
+      assert (y->key == x->keys[i]);
+      assert ((y->left == tree->nil) && !y->red);
+      assert ((y->right == tree->nil) || (y->right->parent == y));
+      *next=y->right;
+    }
+    return(1);
+  }
+  if (!top) assert (x->n > 0);
+  height=CheckBPlus(tree,(rb_bplus_node*) x->ptrs[0],low,
+		    x->n ? &x->keys[0] : high,next,0);
+  for (i=1; i<=x->n; i++) {
+    assert (height == CheckBPlus(tree,(rb_bplus_node*) x->ptrs[i],
+				 &x->keys[i-1],
+				 (i < x->n) ? &x->keys[i] : high,next,0));
+  }
+  return(height+1);
+}
+
+void checkRep (rb_red_blk_tree *tree)
+{
+  rb_red_blk_node* next=tree->root->left;
+  rb_red_blk_node* x;
+  unsigned long n=0;
+
+  assert ((next == tree->nil) || (next->parent == tree->root));
+  CheckBPlus(tree,BPLUS_TOP(tree),NULL,NULL,&next,1);
+  assert (next == tree->nil);
+  for (x=tree->root->left; x != tree->nil; x=x->right) n++;
+  assert (n == tree->count);
+}
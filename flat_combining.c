@@ -0,0 +1,295 @@
+#include "flat_combining.h"
+#include <sched.h>
+
+/***********************************************************************/
+/*  FUNCTION:  RBLockedTreeCreate */
+/**/
+/*  INPUTS:  tree is a tree made by RBTreeCreate and kind is either */
+/*           RB_LOCK_MUTEX or RB_LOCK_RWLOCK. */
+/**/
+/*  OUTPUT:  a wrapper which owns tree and serializes access to it */
+/**/
+/*  Modifies Input: none */
+/***********************************************************************/
+
+rb_locked_tree* RBLockedTreeCreate(rb_red_blk_tree* tree, int kind) {
+  rb_locked_tree* newLocked;
+
+  newLocked=(rb_locked_tree*) SafeMalloc(sizeof(rb_locked_tree));
+  newLocked->tree=tree;
+  newLocked->kind=kind;
+  pthread_mutex_init(&newLocked->mutex,NULL);
+  pthread_rwlock_init(&newLocked->rwlock,NULL);
+  return(newLocked);
+}
+
+static void LockedWriteLock(rb_locked_tree* locked) {
+  if (locked->kind == RB_LOCK_RWLOCK) {
+    pthread_rwlock_wrlock(&locked->rwlock);
+  } else {
+    pthread_mutex_lock(&locked->mutex);
+  }
+}
+
+static void LockedUnlock(rb_locked_tree* locked) {
+  if (locked->kind == RB_LOCK_RWLOCK) {
+    pthread_rwlock_unlock(&locked->rwlock);
+  } else {
+    pthread_mutex_unlock(&locked->mutex);
+  }
+}
+
+rb_red_blk_node* RBLockedInsert(rb_locked_tree* locked, void* key, void* info) {
+  rb_red_blk_node* newNode;
+
+  LockedWriteLock(locked);
+  newNode=RBTreeInsert(locked->tree,key,info);
+  LockedUnlock(locked);
+  return(newNode);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBLockedDelete */
+/**/
+/*  INPUTS:  locked is the tree to delete from and key points to the */
+/*           key to look for. */
+/**/
+/*  OUTPUT:  1 if a node with that key was found and deleted, 0 */
+/*           otherwise.  The key and info of the deleted node are */
+/*           destroyed with DestroyKey and DestroyInfo as in RBDelete. */
+/**/
+/*  Modifies Input: locked */
+/***********************************************************************/
+
+int RBLockedDelete(rb_locked_tree* locked, void* key) {
+  rb_red_blk_node* node;
+  int found=0;
+
+  LockedWriteLock(locked);
+  if ( (node=RBExactQuery(locked->tree,key)) ) { /* assignment */
+    RBDelete(locked->tree,node);
+    found=1;
+  }
+  LockedUnlock(locked);
+  return(found);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBLockedQuery */
+/**/
+/*  INPUTS:  locked is the tree to search and key points to the key to */
+/*           look for.  If info is not NULL the info of the node found */
+/*           is stored there. */
+/**/
+/*  OUTPUT:  1 if a node with that key was found, 0 otherwise.  Node */
+/*           pointers are not returned because another thread may */
+/*           delete the node as soon as the lock is released. */
+/**/
+/*  Modifies Input: info */
+/***********************************************************************/
+
+int RBLockedQuery(rb_locked_tree* locked, void* key, void** info) {
+  rb_red_blk_node* node;
+
+  if (locked->kind == RB_LOCK_RWLOCK) {
+    pthread_rwlock_rdlock(&locked->rwlock);
+  } else {
+    pthread_mutex_lock(&locked->mutex);
+  }
+  node=RBExactQuery(locked->tree,key);
+  if (node && info) *info=node->info;
+  LockedUnlock(locked);
+  return(node != 0);
+}
+
+void RBLockedTreeDestroy(rb_locked_tree* locked) {
+  RBTreeDestroy(locked->tree);
+  pthread_mutex_destroy(&locked->mutex);
+  pthread_rwlock_destroy(&locked->rwlock);
+  free(locked);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBFCTreeCreate */
+/**/
+/*  INPUTS:  tree is a tree made by RBTreeCreate and nThreads is the */
+/*           number of threads which will use it.  Each of those */
+/*           threads must pass a distinct slot number in */
+/*           [0,nThreads) to the RBFC functions. */
+/**/
+/*  OUTPUT:  a flat combining wrapper which owns tree */
+/**/
+/*  Modifies Input: none */
+/***********************************************************************/
+
+rb_fc_tree* RBFCTreeCreate(rb_red_blk_tree* tree, int nThreads) {
+  rb_fc_tree* newFC;
+  int i;
+
+  Assert( (nThreads > 0) && (nThreads <= RB_FC_MAX_THREADS),
+	  "bad thread count in RBFCTreeCreate");
+  newFC=(rb_fc_tree*) SafeMalloc(sizeof(rb_fc_tree));
+  newFC->tree=tree;
+  atomic_init(&newFC->combinerLock,0);
+  newFC->nSlots=nThreads;
+  newFC->slots=(rb_fc_slot*) aligned_alloc(_Alignof(rb_fc_slot),
+					    nThreads*sizeof(rb_fc_slot));
+  Assert(newFC->slots != NULL,"slot allocation failed in RBFCTreeCreate");
+  for (i=0; i<nThreads; i++) {
+    atomic_init(&newFC->slots[i].op,RB_FC_NONE);
+  }
+  newFC->batch=(rb_fc_slot**) SafeMalloc(nThreads*sizeof(rb_fc_slot*));
+  newFC->combines=0;
+  newFC->combinedOps=0;
+  return(newFC);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  FCCombine */
+/**/
+/*  INPUTS:  fc is a flat combining tree whose combiner lock is held */
+/*           by the caller. */
+/**/
+/*  OUTPUT:  none */
+/**/
+/*  EFFECTS:  Collects every published request, sorts them by key so */
+/*            that consecutive descents share most of their path, */
+/*            applies them to the tree and then marks each slot done. */
+/*            Requests with equal keys keep slot order since the sort */
+/*            is stable.  This should only be called by FCPublish. */
+/**/
+/*  Modifies Input: fc */
+/***********************************************************************/
+
+static void FCCombine(rb_fc_tree* fc) {
+  rb_red_blk_tree* tree=fc->tree;
+  rb_fc_slot** batch=fc->batch;
+  rb_fc_slot* slot;
+  rb_red_blk_node* node;
+  int n=0;
+  int i, j;
+
+  for (i=0; i<fc->nSlots; i++) {
+    if (RB_FC_NONE != atomic_load_explicit(&fc->slots[i].op,
+					   memory_order_acquire)) {
+      batch[n++]=&fc->slots[i];
+    }
+  }
+
+  /* insertion sort: batches are at most RB_FC_MAX_THREADS long and */
+  /* Compare takes no context argument so qsort is no use here */
+  for (i=1; i<n; i++) {
+    slot=batch[i];
+    for (j=i; (j > 0) && (1 == tree->Compare(batch[j-1]->key,slot->key)); j--) {
+      batch[j]=batch[j-1];
+    }
+    batch[j]=slot;
+  }
+
+  for (i=0; i<n; i++) {
+    slot=batch[i];
+    switch(atomic_load_explicit(&slot->op,memory_order_relaxed)) {
+    case RB_FC_INSERT:
+      slot->node=RBTreeInsert(tree,slot->key,slot->info);
+      break;
+    case RB_FC_DELETE:
+      if ( (node=RBExactQuery(tree,slot->key)) ) { /* assignment */
+	RBDelete(tree,node);
+	slot->found=1;
+      } else {
+	slot->found=0;
+      }
+      break;
+    case RB_FC_QUERY:
+      if ( (node=RBExactQuery(tree,slot->key)) ) { /* assignment */
+	slot->info=node->info;
+	slot->found=1;
+      } else {
+	slot->found=0;
+      }
+      break;
+    }
+    atomic_store_explicit(&slot->op,RB_FC_NONE,memory_order_release);
+  }
+  fc->combines++;
+  fc->combinedOps+=n;
+}
+
+/***********************************************************************/
+/*  FUNCTION:  FCPublish */
+/**/
+/*  INPUTS:  fc is the tree, slot is the calling thread's slot and op, */
+/*           key and info describe the request. */
+/**/
+/*  OUTPUT:  the slot, whose result fields are valid once this returns */
+/**/
+/*  EFFECTS:  Publishes the request and then waits until some combiner */
+/*            has applied it, becoming the combiner itself whenever the */
+/*            combiner lock is free. */
+/**/
+/*  Modifies Input: fc */
+/***********************************************************************/
+
+static rb_fc_slot* FCPublish(rb_fc_tree* fc, int slot, int op,
+			     void* key, void* info) {
+  rb_fc_slot* mySlot=&fc->slots[slot];
+  int spins;
+
+#ifdef DEBUG_ASSERT
+  Assert( (slot >= 0) && (slot < fc->nSlots),"bad slot in FCPublish");
+#endif
+  mySlot->key=key;
+  mySlot->info=info;
+  atomic_store_explicit(&mySlot->op,op,memory_order_release);
+  for (spins=0; ; spins++) {
+    if (RB_FC_NONE == atomic_load_explicit(&mySlot->op,memory_order_acquire)) {
+      return(mySlot);
+    }
+    if ( (0 == atomic_load_explicit(&fc->combinerLock,memory_order_relaxed)) &&
+	 (0 == atomic_exchange_explicit(&fc->combinerLock,1,
+					memory_order_acquire)) ) {
+      FCCombine(fc);
+      atomic_store_explicit(&fc->combinerLock,0,memory_order_release);
+    } else if (spins > 16) {
+      /* let the combiner run if it shares our core */
+      sched_yield();
+    }
+  }
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBFCInsert */
+/**/
+/*  INPUTS:  fc is the tree, slot is the calling thread's slot and key */
+/*           and info are handed to RBTreeInsert. */
+/**/
+/*  OUTPUT:  the inserted node, which is only safe to use while no */
+/*           other thread can delete it */
+/**/
+/*  Modifies Input: fc */
+/***********************************************************************/
+
+rb_red_blk_node* RBFCInsert(rb_fc_tree* fc, int slot, void* key, void* info) {
+  return(FCPublish(fc,slot,RB_FC_INSERT,key,info)->node);
+}
+
+/*  RBFCDelete and RBFCQuery behave like RBLockedDelete and */
+/*  RBLockedQuery (see above) */
+
+int RBFCDelete(rb_fc_tree* fc, int slot, void* key) {
+  return(FCPublish(fc,slot,RB_FC_DELETE,key,NULL)->found);
+}
+
+int RBFCQuery(rb_fc_tree* fc, int slot, void* key, void** info) {
+  rb_fc_slot* mySlot=FCPublish(fc,slot,RB_FC_QUERY,key,NULL);
+
+  if (mySlot->found && info) *info=mySlot->info;
+  return(mySlot->found);
+}
+
+void RBFCTreeDestroy(rb_fc_tree* fc) {
+  RBTreeDestroy(fc->tree);
+  free(fc->slots);
+  free(fc->batch);
+  free(fc);
+}
@@ -0,0 +1,68 @@
+#include"red_black_tree.h"
+#include<pthread.h>
+#include<stdatomic.h>
+
+#ifndef INC_FLAT_COMBINING_
+#define INC_FLAT_COMBINING_
+
+/*  This file has three thread-safe front ends for a red-black tree. */
+/*  rb_locked_tree serializes every operation on a plain mutex or lets */
+/*  queries share a reader-writer lock.  rb_fc_tree uses flat */
+/*  combining: each thread publishes its request in its own slot and */
+/*  whichever thread gets the combiner lock applies every pending */
+/*  request to the tree, sorted by key, before releasing it.  All three */
+/*  take ownership of a tree made by RBTreeCreate and destroy it along */
+/*  with themselves. */
+
+#define RB_LOCK_MUTEX 0
+#define RB_LOCK_RWLOCK 1
+
+typedef struct rb_locked_tree {
+  rb_red_blk_tree* tree;
+  int kind; /* RB_LOCK_MUTEX or RB_LOCK_RWLOCK */
+  pthread_mutex_t mutex;
+  pthread_rwlock_t rwlock;
+} rb_locked_tree;
+
+/*  the maximum number of threads a single rb_fc_tree can serve */
+#define RB_FC_MAX_THREADS 64
+
+#define RB_FC_NONE 0
+#define RB_FC_INSERT 1
+#define RB_FC_DELETE 2
+#define RB_FC_QUERY 3
+
+/*  One publication slot per thread.  Each slot gets its own pair of */
+/*  cache lines so that a thread spinning on its own op field does not */
+/*  share a line with its neighbours. */
+typedef struct rb_fc_slot {
+  _Alignas(128) atomic_int op; /* RB_FC_NONE once the request is done */
+  void* key;
+  void* info;
+  rb_red_blk_node* node; /* result of an insert */
+  int found; /* result of a delete or query */
+} rb_fc_slot;
+
+typedef struct rb_fc_tree {
+  rb_red_blk_tree* tree;
+  atomic_int combinerLock;
+  int nSlots;
+  rb_fc_slot* slots;
+  rb_fc_slot** batch; /* scratch space, only touched by the combiner */
+  unsigned long combines; /* statistics, only touched by the combiner */
+  unsigned long combinedOps;
+} rb_fc_tree;
+
+rb_locked_tree* RBLockedTreeCreate(rb_red_blk_tree* tree, int kind);
+rb_red_blk_node* RBLockedInsert(rb_locked_tree*, void* key, void* info);
+int RBLockedDelete(rb_locked_tree*, void* key);
+int RBLockedQuery(rb_locked_tree*, void* key, void** info);
+void RBLockedTreeDestroy(rb_locked_tree*);
+
+rb_fc_tree* RBFCTreeCreate(rb_red_blk_tree* tree, int nThreads);
+rb_red_blk_node* RBFCInsert(rb_fc_tree*, int slot, void* key, void* info);
+int RBFCDelete(rb_fc_tree*, int slot, void* key);
+int RBFCQuery(rb_fc_tree*, int slot, void* key, void** info);
+void RBFCTreeDestroy(rb_fc_tree*);
+
+#endif
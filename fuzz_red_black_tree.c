@@ -4,7 +4,30 @@
 #include <assert.h>
 #include <time.h>
 #include <stdint.h>
+#include <stddef.h>
 #include "container.h"
+#include "parallel_tree.h"
+#include "tree_snapshot.h"
+#include "tree_wal.h"
+#include "tree_bgsave.h"
+#include "tree_frozen.h"
+#include "tree_int_index.h"
+#include "tree_string.h"
+#include "tree_inline.h"
+#include "tree_set.h"
+#include "tree_compact.h"
+#include "tree_balance.h"
+#include "tree_alloc.h"
+#include "node_arena.h"
+#include "flat_combining.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* the engines other than red_black_tree.c, built with one of these */
+#if defined(RB_BPLUS_TREE) || defined(RB_HOTCOLD_TREE)
+#define RB_OTHER_ENGINE
+#endif
 
 #define META_REPS 5000
 #define FUZZ_REPS 1000
@@ -54,6 +77,26 @@ void *randomVoidP (void)
   return (void *)p;
 }
 
+/* keeps the order of IntComp; the coarse one makes prefixes tie */
+uint64_t IntPrefix(const void* a) {
+  return (uint64_t)((uint32_t)*(int*)a ^ 0x80000000u);
+}
+
+uint64_t IntPrefixCoarse(const void* a) {
+  return IntPrefix(a) >> 4;
+}
+
+/* set when the tree under test keeps its keys inline (tree_inline.h) */
+int inlineKeys;
+
+rb_red_blk_node* FuzzInsert(rb_red_blk_tree* tree, int key, void* info) {
+  int* newInt;
+  if (inlineKeys) return RBInlineInsert(tree,&key,info);
+  newInt=(int*) malloc(sizeof(int));
+  *newInt=key;
+  return RBTreeInsert(tree,newInt,info);
+}
+
 int idx;
 
 int nodups;
@@ -76,12 +119,842 @@ void RBTreeVerify(rb_red_blk_tree* tree) {
   assert (idx == -1);
 }
 
+#ifndef RB_OTHER_ENGINE
+/* the number of nodes on the longest path down from x */
+int TreeHeight(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  int l, r;
+  if (x == tree->nil) return 0;
+  l = TreeHeight(tree,x->left);
+  r = TreeHeight(tree,x->right);
+  return 1 + (l > r ? l : r);
+}
+
+void *KeyAsSum(rb_red_blk_node* x, void* context) {
+  return (void *)(intptr_t)*(int *)x->key;
+}
+
+void *AddSums(void* a, void* b, void* context) {
+  return (void *)((intptr_t)a + (intptr_t)b);
+}
+
+/* checks the parallel reduction against a walk over the container */
+void ParallelVerify(rb_red_blk_tree* tree) {
+  intptr_t sum = 0;
+  int i;
+  for (i = containerStart(); i != -1; i = containerNext (i)) {
+    sum += containerGet (i).val;
+  }
+  assert (sum == (intptr_t)RBParallelReduce(tree,KeyAsSum,AddSums,0,0,
+					     1+rand()%4,rand()%2));
+  RBParallelCheckRep(tree,1+rand()%4);
+}
+#endif
+
+size_t IntSize(const void* a) {
+  return sizeof(int);
+}
+
+int SaveToPath(rb_red_blk_tree* tree, void* path) {
+  return RBTreeSave(tree,(const char*)path,IntSize,0);
+}
+
+/* saves the tree, maps it back and checks the snapshot against the */
+/* container.  A background save is checked while the parent adds */
+/* keys the snapshot must not see. */
+void SnapshotVerify(rb_red_blk_tree* tree) {
+  char path[] = "/tmp/fuzz_rb_snapXXXXXX";
+  rb_snapshot* snap;
+  rb_bgsave* save;
+  const rb_snap_node* x;
+  stk_stack* enumResult;
+  int fd, i, low, high;
+
+  fd = mkstemp(path);
+  assert (fd >= 0);
+  close(fd);
+  if (rand()%2 == 0) {
+    assert (RBTreeSave(tree,path,IntSize,0));
+  } else {
+    rb_red_blk_node* added[8];
+    save = RBTreeBackgroundSave(tree,SaveToPath,path,rand()%2,0);
+    assert (save);
+    for (i=0; i<8; i++) {
+      /* keys in the container are never negative */
+      added[i]=FuzzInsert(tree,-1-i,0);
+    }
+    assert (RBBackgroundSaveWait(save));
+    assert (save->copiedPages >= 0);
+    RBBackgroundSaveFree(save);
+    for (i=0; i<8; i++) RBDelete(tree,added[i]);
+  }
+  snap = RBTreeMapSnapshot(path,IntComp);
+  assert (snap);
+  assert (RBSnapshotValidate(snap));
+  assert (snap->header->count == tree->count);
+  x = snap->header->count ? snap->nodes : 0;
+  for (i = containerStart(); i != -1; i = containerNext (i)) {
+    assert (x);
+    assert (containerGet (i).val == *(int *)RBSnapKey(snap,x));
+    assert (RBSnapInfo(snap,x) == 0);
+    x = RBSnapSuccessor(snap,x);
+  }
+  assert (!x);
+  low = randomInt();
+  assert ((RBSnapExactQuery(snap,&low) != 0) == containerFind (low));
+  high = randomInt();
+  i = containerStartVal (low,high);
+  enumResult = RBSnapEnumerate(snap,&low,&high);
+  while ( (x = StackPop(enumResult)) ) {
+    assert (i != -1);
+    assert (containerGet (i).val == *(int *)RBSnapKey(snap,x));
+    i = containerNextVal (high, i);
+  }
+  assert (i == -1);
+  free(enumResult);
+  if (snap->header->count) {
+    /* a right child at or below its parent, or a key running past */
+    /* the end of the file, must be refused by RBSnapshotValidate */
+    uint64_t at = snap->header->nodesOffset +
+      (rand() % snap->header->count)*sizeof(rb_snap_node);
+    uint64_t bad = snap->header->fileSize - rand()%2;
+    uint32_t zero = 0;
+    fd = open(path,O_WRONLY);
+    assert (fd >= 0);
+    if (rand()%2) {
+      assert (pwrite(fd,&zero,sizeof(zero),
+		     at+offsetof(rb_snap_node,right)) == sizeof(zero));
+    } else {
+      assert (pwrite(fd,&bad,sizeof(bad),
+		     at+offsetof(rb_snap_node,key)) == sizeof(bad));
+    }
+    close(fd);
+    RBSnapshotClose(snap);
+    snap = RBTreeMapSnapshot(path,IntComp);
+    assert (snap);
+    assert (!RBSnapshotValidate(snap));
+    RBSnapshotClose(snap);
+  } else {
+    RBSnapshotClose(snap);
+  }
+  unlink(path);
+}
+
+size_t IntSerialize(const void* key, const void* info, char* buf, size_t room,
+		    void* context) {
+  if (room < sizeof(int)+sizeof(void*)) return (room+1);
+  memcpy(buf,key,sizeof(int));
+  memcpy(buf+sizeof(int),&info,sizeof(void*));
+  return (sizeof(int)+sizeof(void*));
+}
+
+int IntDeserialize(const char* buf, size_t len, void** key, void** info,
+		   void* context) {
+  int* newInt;
+  if (len != sizeof(int)+sizeof(void*)) return 0;
+  newInt=(int*) malloc(sizeof(int));
+  memcpy(newInt,buf,sizeof(int));
+  memcpy(info,buf+sizeof(int),sizeof(void*));
+  *key=newInt;
+  return 1;
+}
+
+/* streams the tree through a file into a new tree and checks that, */
+/* writing it with either RBTreeExport or RBTreeCheckpoint */
+void StreamVerify(rb_red_blk_tree* tree) {
+  FILE* f = tmpfile();
+  rb_red_blk_tree* copy;
+  assert (f);
+  if (rand()%2 == 0) {
+    assert (RBTreeExport(tree,fileno(f),IntSerialize,0));
+  } else {
+    rb_checkpoint_stats stats;
+    assert (RBTreeCheckpoint(tree,fileno(f),IntSerialize,0,rand()%3,
+			     1+rand()%3,&stats));
+    assert (stats.bytes == (unsigned long) lseek(fileno(f),0,SEEK_CUR));
+  }
+  copy=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+  if (rand()%4 == 0) {
+    /* a count too big for a long, or bytes after the last record, */
+    /* must fail the import and leave the tree empty */
+    uint64_t huge = (uint64_t) 1 << 63;
+    if (rand()%2) {
+      assert (pwrite(fileno(f),&huge,sizeof(huge),
+		     offsetof(rb_stream_header,count)) == sizeof(huge));
+    } else {
+      assert (write(fileno(f),&huge,1) == 1);
+    }
+    rewind(f);
+    assert (!RBTreeImport(copy,fileno(f),IntDeserialize,0));
+    fclose(f);
+    assert (copy->count == 0);
+    checkRep (copy);
+    RBTreeDestroy(copy);
+    return;
+  }
+  rewind(f);
+  if (rand()%2 == 0) RBTreeUsePrefix(copy,IntPrefixCoarse);
+  assert (RBTreeImport(copy,fileno(f),IntDeserialize,0));
+  fclose(f);
+  assert (copy->count == tree->count);
+  checkRep (copy);
+  RBTreeVerify(copy);
+  RBTreeDestroy(copy);
+}
+
+rb_durable_tree* DurableReopen(rb_durable_tree* d, rb_red_blk_tree** copy,
+			       const char* path) {
+  if (d) {
+    assert (RBDurableClose(d));
+    RBTreeDestroy(*copy);
+  }
+  *copy=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+  d=RBDurableOpen(*copy,path,IntSerialize,IntDeserialize,0,1+rand()%8,
+		  rand()%4 ? 0 : 1+rand()%50);
+  assert (d);
+  return d;
+}
+
+/* copies the tree through a durable tree, with some throwaway */
+/* inserts and deletes, reopens it and checks what was recovered */
+void DurableVerify(rb_red_blk_tree* tree) {
+  char path[] = "/tmp/fuzz_rb_walXXXXXX";
+  char walPath[64];
+  char checkpointPath[64];
+  rb_durable_tree* d = 0;
+  rb_red_blk_tree* copy;
+  rb_red_blk_node* x;
+  rb_red_blk_node* y;
+  void* dupInfo = 0;
+  int* newInt;
+  int fd;
+
+  fd = mkstemp(path);
+  assert (fd >= 0);
+  close(fd);
+  unlink(path);
+  sprintf(walPath,"%s.wal",path);
+  sprintf(checkpointPath,"%s.ckpt",path);
+  d = DurableReopen(d,&copy,path);
+  for (x=tree->root->left; x != tree->nil && x->left != tree->nil; x=x->left);
+  for (; x != tree->nil; x=TreeSuccessor(tree,x)) {
+    newInt=(int*) malloc(sizeof(int));
+    *newInt=*(int *)x->key;
+    RBDurableInsert(d,newInt,x->info);
+    if (rand()%4 == 0) {
+      /* keys in the container are never negative */
+      newInt=(int*) malloc(sizeof(int));
+      *newInt=-1-rand()%8;
+      RBDurableDelete(d,RBDurableInsert(d,newInt,0));
+    }
+    if (rand()%64 == 0) d = DurableReopen(d,&copy,path);
+    if (rand()%64 == 0) assert (RBDurableCheckpoint(d));
+  }
+  if (rand()%2 == 0) {
+    /* of two equal keys, delete the one RBExactQuery does not find; */
+    /* the replay must delete that one too */
+    int dup = -9;
+    for (fd=1; fd<=2; fd++) {
+      newInt=(int*) malloc(sizeof(int));
+      *newInt=dup;
+      RBDurableInsert(d,newInt,(void *)(intptr_t)fd);
+    }
+    x = RBExactQuery(copy,&dup);
+    dupInfo = x->info;
+    y = TreeSuccessor(copy,x);
+    if (y == copy->nil || IntComp(y->key,&dup)) y = TreePredecessor(copy,x);
+    RBDurableDelete(d,y);
+  }
+  assert (RBDurableClose(d));
+  RBTreeDestroy(copy);
+  if (rand()%2 == 0) {
+    /* a record torn by a crash */
+    char junk[5] = {9,0,0,0,1};
+    fd = open(walPath,O_WRONLY|O_APPEND);
+    assert (fd >= 0);
+    assert (write(fd,junk,1+rand()%5) > 0);
+    close(fd);
+  }
+  if ( (tree->count > 1) && (rand()%4 == 0) ) {
+    /* a tree which cannot take everything logged refuses to open */
+    copy=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+    RBTreeSetBudget(copy,0,1);
+    assert (!RBDurableOpen(copy,path,IntSerialize,IntDeserialize,0,1,0));
+    RBTreeDestroy(copy);
+  }
+  d = DurableReopen(0,&copy,path);
+  if (dupInfo) {
+    int dup = -9;
+    x = RBExactQuery(copy,&dup);
+    assert (x && x->info == dupInfo);
+    assert (TreeSuccessor(copy,x) == copy->nil ||
+	    IntComp(TreeSuccessor(copy,x)->key,&dup));
+    assert (TreePredecessor(copy,x) == copy->nil ||
+	    IntComp(TreePredecessor(copy,x)->key,&dup));
+    RBDurableDelete(d,x);
+  }
+  checkRep (copy);
+  RBTreeVerify(copy);
+  assert (RBDurableClose(d));
+  RBTreeDestroy(copy);
+  unlink(walPath);
+  unlink(checkpointPath);
+}
+
+/* freezes the tree and checks lookups and ranges in the frozen copy */
+void FrozenVerify(rb_red_blk_tree* tree) {
+  rb_frozen_tree* f;
+  rb_red_blk_node* x;
+  stk_stack* enumResult;
+  int j, i, low, high;
+  long rank;
+
+  f = RBTreeFreeze(tree,rand()%2,rand()%2 ? sizeof(int) : 0);
+  for (j=0; j<20; j++) {
+    low = randomInt();
+    x = RBFrozenExactQuery(f,&low);
+    assert ((x != 0) == containerFind (low));
+    if (x) assert (*(int *)x->key == low);
+    rank = RBFrozenLowerBound(f,&low);
+    assert (rank >= 0 && rank <= f->n);
+    if (rank < f->n) assert (*(int *)RBFrozenNode(f,rank)->key >= low);
+    if (rank > 0) assert (*(int *)RBFrozenNode(f,rank-1)->key < low);
+    high = randomInt();
+    i = containerStartVal (low,high);
+    enumResult = RBFrozenEnumerate(f,&low,&high);
+    while ( (x = StackPop(enumResult)) ) {
+      assert (i != -1);
+      assert (containerGet (i).val == *(int *)x->key);
+      i = containerNextVal (high, i);
+    }
+    assert (i == -1);
+    free(enumResult);
+  }
+  RBFrozenDestroy(f);
+}
+
+int32_t IntKey(const void* key) {
+  return(*(const int*) key);
+}
+
+void IntIndexVerify(rb_red_blk_tree* tree) {
+  rb_int_index* index;
+  rb_red_blk_node* x;
+  stk_stack* enumResult;
+  int j, i, low, high;
+  long rank;
+
+  index = RBIntIndexBuild(tree,IntKey,rand()%4);
+  for (j=0; j<20; j++) {
+    low = randomInt();
+    x = RBIntIndexExactQuery(index,low);
+    assert ((x != 0) == containerFind (low));
+    if (x) assert (*(int *)x->key == low);
+    rank = RBIntIndexUpperBound(index,low);
+    assert (rank >= 0 && rank <= index->n);
+    if (rank < index->n) assert (*(int *)RBIntIndexNode(index,rank)->key > low);
+    if (rank > 0) assert (*(int *)RBIntIndexNode(index,rank-1)->key <= low);
+    high = randomInt();
+    i = containerStartVal (low,high);
+    enumResult = RBIntIndexEnumerate(index,low,high);
+    while ( (x = StackPop(enumResult)) ) {
+      assert (i != -1);
+      assert (containerGet (i).val == *(int *)x->key);
+      i = containerNextVal (high, i);
+    }
+    assert (i == -1);
+    free(enumResult);
+  }
+  RBIntIndexDestroy(index);
+}
+
+/* zero-padded decimal sorts as the numbers do; the wide form is past */
+/* RB_STRING_INLINE and has its first 8 bytes all the same */
+static size_t IntString(char* buf, int width, int val) {
+  return (size_t) sprintf(buf,"%0*d",width,val);
+}
+
+/* copies the container into a string-keyed tree and checks it */
+void StringVerify(void) {
+  rb_red_blk_tree* s;
+  rb_red_blk_node* x;
+  stk_stack* enumResult;
+  char buf[64], highBuf[64], keyBuf[64];
+  int width = rand()%2 ? 10 : 10+RB_STRING_INLINE;
+  int i, j, low, high;
+  size_t len, highLen;
+
+  s = RBStringTreeCreate(InfoDest,InfoPrint);
+  for (i = containerStart (); i != -1; i = containerNext (i))
+    RBStringInsert(s,buf,IntString(buf,width,containerGet (i).val),0);
+  x = s->root->left;
+  while (x != s->nil && x->left != s->nil) x = x->left;
+  for (i = containerStart (); i != -1; i = containerNext (i)) {
+    assert (x != s->nil);
+    len = IntString(buf,width,containerGet (i).val);
+    assert (RBStringKey(x)->len == len);
+    assert (!memcmp(RBStringData(RBStringKey(x)),buf,len+1));
+    x = TreeSuccessor(s,x);
+  }
+  assert (x == s->nil);
+  for (j=0; j<20; j++) {
+    low = randomInt();
+    len = IntString(buf,width,low);
+    buf[len] = 'x'; /* the query must stop at len */
+    x = RBStringQuery(s,buf,len);
+    assert ((x != 0) == containerFind (low));
+    assert (!RBStringQuery(s,buf,len+1));
+    assert (!RBStringQuery(s,buf,len-1));
+    high = randomInt();
+    highLen = IntString(highBuf,width,high);
+    i = containerStartVal (low,high);
+    enumResult = RBStringEnumerate(s,buf,len,highBuf,highLen);
+    while ( (x = StackPop(enumResult)) ) {
+      assert (i != -1);
+      IntString(keyBuf,width,containerGet (i).val);
+      assert (!strcmp(RBStringData(RBStringKey(x)),keyBuf));
+      i = containerNextVal (high, i);
+    }
+    assert (i == -1);
+    free(enumResult);
+  }
+  for (j=0; j<10 && s->count; j++) {
+    x = s->root->left;
+    while (x != s->nil && x->left != s->nil) x = x->left;
+    RBDelete(s,x);
+  }
+  checkRep (s);
+  RBTreeDestroy(s);
+}
+
+typedef struct inline_value {
+  void* info;
+  int key; /* 12 bytes, so the value size is not a multiple of 8 */
+} inline_value;
+
+/* copies the container into a tree with inline keys and values */
+void InlineVerify(void) {
+  rb_red_blk_tree* t;
+  rb_red_blk_node* x;
+  inline_value v;
+  int i, j, key;
+
+  t = RBTreeCreateInline(IntComp,sizeof(int),
+			 offsetof(inline_value,key)+sizeof(int),
+			 IntPrint,InfoPrint);
+  if (rand()%2 == 0) RBTreeUseNodeCache(t);
+  for (i = containerStart (); i != -1; i = containerNext (i)) {
+    v.info = containerGet (i).info;
+    v.key = containerGet (i).val;
+    RBInlineInsert(t,&v.key,&v);
+  }
+  key = -1; /* keys in the container are never negative */
+  x = RBInlineInsert(t,&key,0);
+  memcpy(&v,x->info,offsetof(inline_value,key)+sizeof(int));
+  assert (v.info == 0 && v.key == 0);
+  RBDelete(t,x);
+  for (j=0; j<20; j++) {
+    key = randomInt();
+    x = RBExactQuery(t,&key);
+    assert ((x != 0) == containerFind (key));
+    if (!x) continue;
+    memcpy(&v,x->info,offsetof(inline_value,key)+sizeof(int));
+    assert (v.key == key && *(int *)x->key == key);
+  }
+  checkRep (t);
+  RBTreeDestroy(t);
+}
+
+/* copies the container into a set, with keys in the info field or */
+/* after the node, and checks membership as keys are erased and put */
+/* back */
+void SetVerify(void) {
+  rb_red_blk_tree* set;
+  int key[3] = {0, 0, 0}; /* IntComp reads only the first */
+  int i, j, distinct = 0;
+
+  set = RBSetCreate(IntComp,rand()%2 ? sizeof(int) : sizeof(key),IntPrint);
+  if (rand()%2 == 0) RBTreeUseNodeCache(set);
+  for (i = containerStart (); i != -1; i = containerNext (i)) {
+    key[0] = containerGet (i).val;
+    distinct += RBSetInsert(set,key);
+    assert (!RBSetInsert(set,key));
+  }
+  assert (set->count == (unsigned long) distinct);
+  for (j=0; j<20; j++) {
+    key[0] = randomInt();
+    assert (RBSetContains(set,key) == containerFind (key[0]));
+    if (rand()%2 == 0) {
+      assert (RBSetErase(set,key) == containerFind (key[0]));
+      assert (!RBSetContains(set,key));
+      assert (!RBSetErase(set,key));
+      if (containerFind (key[0])) assert (RBSetInsert(set,key));
+    }
+  }
+  checkRep (set);
+  RBTreeDestroy(set);
+}
+
+/* spreads the container's keys over a few trees made by RBTreeInit */
+/* in one array, which share a nil, and checks each holds its share */
+/* through deletes and inserts */
+void EmbedVerify(void) {
+  int nTrees = 1 + rand()%8;
+  rb_red_blk_tree* trees = malloc(nTrees*sizeof(rb_red_blk_tree));
+  rb_red_blk_node* x;
+  unsigned long total = 0, counted = 0;
+  int i, t, val, *newInt;
+
+  for (t=0; t<nTrees; t++) {
+    RBTreeInit(&trees[t],IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+    assert (trees[t].nil == trees[0].nil);
+  }
+  for (i = containerStart (); i != -1; i = containerNext (i)) {
+    val = containerGet (i).val;
+    newInt = malloc(sizeof(int));
+    *newInt = val;
+    RBTreeInsert(&trees[(unsigned)val % nTrees],newInt,0);
+    total++;
+  }
+  for (i=0; i<20; i++) {
+    val = randomInt();
+    t = (unsigned)val % nTrees;
+    x = RBExactQuery(&trees[t],&val);
+    assert ((x != 0) == containerFind (val));
+    if (x && rand()%2) { /* and put back, to keep up with the container */
+      RBDelete(&trees[t],x);
+      newInt = malloc(sizeof(int));
+      *newInt = val;
+      RBTreeInsert(&trees[t],newInt,0);
+    }
+  }
+  for (t=0; t<nTrees; t++) {
+    checkRep (&trees[t]);
+    counted += trees[t].count;
+    RBTreeClear(&trees[t]);
+  }
+  assert (counted == total);
+  free(trees);
+}
+
+/* an allocator counting what it hands out, which refuses everything */
+/* after its first limit allocations if limit is not -1 */
+typedef struct counting_arena {
+  long liveBytes;
+  long liveBlocks;
+  long allocs;
+  long limit;
+} counting_arena;
+
+void* ArenaAlloc(void* context, size_t size) {
+  counting_arena* arena = context;
+
+  if (arena->limit != -1 && arena->allocs >= arena->limit) return 0;
+  arena->allocs++;
+  arena->liveBytes += size;
+  arena->liveBlocks++;
+  return malloc(size);
+}
+
+void ArenaFree(void* context, void* p, size_t size) {
+  counting_arena* arena = context;
+
+  arena->liveBytes -= size;
+  arena->liveBlocks--;
+  free(p);
+}
+
+/* hands out the container's values in order for RBTreeBuildSorted */
+int ContainerNextItem(void* context, void** key, void** info) {
+  int* i = context;
+  int* newInt = malloc(sizeof(int));
+
+  *newInt = containerGet (*i).val;
+  *i = containerNext (*i);
+  *key = newInt;
+  *info = 0;
+  return 1;
+}
+
+/* fills a tree with a counting allocator and random budgets from */
+/* the container, checks refused inserts leave it as it was and the */
+/* tree's counts follow the allocator's through deletes */
+void AllocVerify(void) {
+  counting_arena arena = {0, 0, 0, -1};
+  rb_allocator allocator = {ArenaAlloc, ArenaFree, &arena};
+  rb_red_blk_tree* t;
+  rb_red_blk_node* x;
+  rb_mem_stats stats;
+  long maxBytes = 0, maxNodes = 0, refused = 0;
+  unsigned long before;
+  int i, val, *newInt;
+
+  t = RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+  RBTreeUseAllocator(t,&allocator);
+  if (rand()%2) maxNodes = 1 + rand()%64;
+  if (rand()%2) maxBytes = rand()%(64*sizeof(rb_red_blk_node));
+  if (rand()%4 == 0) arena.limit = arena.allocs + rand()%64;
+  RBTreeSetBudget(t,maxBytes,maxNodes);
+  for (i = containerStart (); i != -1; i = containerNext (i)) {
+    val = containerGet (i).val;
+    newInt = malloc(sizeof(int));
+    *newInt = val;
+    before = t->count;
+    if (!RBTreeInsert(t,newInt,0)) {
+      free(newInt);
+      refused++;
+      assert (t->count == before);
+    }
+  }
+  checkRep (t);
+  RBTreeGetMemStats(t,&stats);
+  assert (stats.failures == (unsigned long) refused);
+  assert (stats.liveNodes == (long) t->count);
+  assert (stats.peakNodes >= stats.liveNodes);
+  /* a refused B+-tree insert can get its node but not a split */
+  if (!refused) assert (stats.peakNodes == stats.liveNodes);
+  assert (stats.peakBytes >= stats.liveBytes);
+  if (maxNodes) assert (stats.liveNodes <= maxNodes);
+#ifndef RB_OTHER_ENGINE
+  if (maxBytes) assert (stats.liveBytes <= maxBytes);
+#endif
+  for (i=0; i<20 && t->count; i++) {
+    val = randomInt();
+    if ((x = RBExactQuery(t,&val))) RBDelete(t,x); /* assignment */
+  }
+  checkRep (t);
+  RBTreeGetMemStats(t,&stats);
+  assert (stats.liveNodes == (long) t->count);
+#ifdef RB_HOTCOLD_TREE
+  /* and the slot arrays, which do not come from the allocator */
+  assert (stats.liveBytes > arena.liveBytes);
+#else
+  assert (stats.liveBytes == arena.liveBytes);
+#endif
+  RBTreeDestroy(t);
+  assert (arena.liveBytes == 0 && arena.liveBlocks == 0);
+
+  /* a build which runs out of memory part way leaves the tree empty */
+  t = RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+  RBTreeUseAllocator(t,&allocator);
+  arena.allocs = 0;
+  arena.limit = rand()%2 ? -1 : rand()%128;
+  for (i = containerStart (), val = 0; i != -1; i = containerNext (i)) val++;
+  i = containerStart ();
+  /* and a negative count is refused before anything is built */
+  assert (!RBTreeBuildSorted(t,-1-rand()%4,ContainerNextItem,&i));
+  assert (t->count == 0 && t->root->left == t->nil);
+  if (RBTreeBuildSorted(t,val,ContainerNextItem,&i)) {
+    checkRep (t);
+  } else {
+    assert (t->count == 0 && t->root->left == t->nil);
+  }
+  RBTreeDestroy(t);
+  assert (arena.liveBytes == 0 && arena.liveBlocks == 0);
+}
+
+/* is p inside one of arena's regions? */
+int InArena(rb_node_arena* arena, void* p) {
+  rb_arena_region* r;
+
+  for (r = arena->regions; r; r = r->next) {
+    if ((char *)p >= r->base && (char *)p < r->base + r->used) return 1;
+  }
+  return 0;
+}
+
+/* fills a tree from the container with its nodes in a node arena of */
+/* small regions, so that it takes several, and checks every node is */
+/* in the arena and deleted nodes are reused */
+void NodeArenaVerify(void) {
+  rb_node_arena* arena = RBNodeArenaCreate(4096*(1+rand()%4),rand()%2);
+  rb_node_arena_stats stats;
+  rb_red_blk_tree* t;
+  rb_red_blk_node* x;
+  size_t used;
+  int i, val, *newInt, deleted = 0;
+
+  t = RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+  RBTreeUseAllocator(t,&arena->allocator);
+  for (i = containerStart (); i != -1; i = containerNext (i)) {
+    val = containerGet (i).val;
+    newInt = malloc(sizeof(int));
+    *newInt = val;
+    x = RBTreeInsert(t,newInt,0);
+    assert (x);
+    assert (InArena(arena,x));
+    if (t->nodeSize >= 64) assert ((uintptr_t)x % 64 == 0);
+  }
+  checkRep (t);
+  RBNodeArenaGetStats(arena,&stats);
+  assert (stats.usedBytes <= stats.reservedBytes);
+  assert (stats.hugePages >= 0);
+  if (t->count) assert (stats.regions >= 1);
+  if (arena->hugePages) assert (stats.reservedBytes % RB_HUGE_PAGE == 0);
+  used = stats.usedBytes;
+  for (i=0; i<20 && t->count; i++) {
+    val = randomInt();
+    if ((x = RBExactQuery(t,&val))) { /* assignment */
+      RBDelete(t,x);
+      deleted++;
+    }
+  }
+  /* the deleted nodes' places take as many new ones */
+  for (i=0; i<deleted; i++) {
+    newInt = malloc(sizeof(int));
+    *newInt = randomInt();
+    assert (InArena(arena,RBTreeInsert(t,newInt,0)));
+  }
+  checkRep (t);
+  RBNodeArenaGetStats(arena,&stats);
+#ifdef RB_OTHER_ENGINE
+  /* splits may have wanted more */
+  assert (stats.usedBytes >= used);
+#else
+  assert (stats.usedBytes == used);
+#endif
+  RBTreeDestroy(t);
+  RBNodeArenaDestroy(arena);
+}
+
+#define COMBINING_THREADS 4
+#define COMBINING_KEYS 256
+
+/* one thread of CombiningVerify and the front end it goes through */
+typedef struct combining_worker {
+  rb_fc_tree* fc;
+  rb_locked_tree* locked;
+  int slot;
+} combining_worker;
+
+/* inserts the thread's own keys, deletes the odd ones and checks */
+/* what queries then find */
+void* CombiningWork(void* arg) {
+  combining_worker* w = arg;
+  int base = w->slot*COMBINING_KEYS;
+  int i, val, *newInt;
+  void* info;
+
+  for (i=0; i<COMBINING_KEYS; i++) {
+    newInt = malloc(sizeof(int));
+    *newInt = base+i;
+    info = (void *)(intptr_t)(base+i+1);
+    if (w->fc) assert (RBFCInsert(w->fc,w->slot,newInt,info));
+    else assert (RBLockedInsert(w->locked,newInt,info));
+  }
+  for (i=1; i<COMBINING_KEYS; i+=2) {
+    val = base+i;
+    if (w->fc) {
+      assert (RBFCDelete(w->fc,w->slot,&val) == 1);
+      assert (RBFCDelete(w->fc,w->slot,&val) == 0);
+    } else {
+      assert (RBLockedDelete(w->locked,&val) == 1);
+      assert (RBLockedDelete(w->locked,&val) == 0);
+    }
+  }
+  for (i=0; i<COMBINING_KEYS; i++) {
+    val = base+i;
+    info = 0;
+    if (w->fc) assert (RBFCQuery(w->fc,w->slot,&val,&info) == !(i%2));
+    else assert (RBLockedQuery(w->locked,&val,&info) == !(i%2));
+    if (!(i%2)) assert (info == (void *)(intptr_t)(val+1));
+  }
+  return 0;
+}
+
+/* runs threads on disjoint key ranges through a flat combining or a */
+/* locked tree and checks what the tree holds afterwards */
+void CombiningVerify(void) {
+  rb_red_blk_tree* t = RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,
+				    InfoPrint);
+  combining_worker workers[COMBINING_THREADS];
+  pthread_t threads[COMBINING_THREADS];
+  rb_fc_tree* fc = 0;
+  rb_locked_tree* locked = 0;
+  rb_red_blk_node* x;
+  int kind = rand()%3;
+  int i, val;
+
+  if (kind == 0) fc = RBFCTreeCreate(t,COMBINING_THREADS);
+  else locked = RBLockedTreeCreate(t,kind == 1 ? RB_LOCK_MUTEX :
+				   RB_LOCK_RWLOCK);
+  for (i=0; i<COMBINING_THREADS; i++) {
+    workers[i].fc = fc;
+    workers[i].locked = locked;
+    workers[i].slot = i;
+    assert (!pthread_create(&threads[i],NULL,CombiningWork,&workers[i]));
+  }
+  for (i=0; i<COMBINING_THREADS; i++) pthread_join(threads[i],NULL);
+  checkRep (t);
+  assert (t->count == COMBINING_THREADS*COMBINING_KEYS/2);
+  for (x=t->root->left; x != t->nil && x->left != t->nil; x=x->left);
+  for (val=0; x != t->nil; x=TreeSuccessor(t,x), val+=2) {
+    assert (*(int *)x->key == val);
+    assert (x->info == (void *)(intptr_t)(val+1));
+  }
+  assert (val == COMBINING_THREADS*COMBINING_KEYS);
+  if (fc) RBFCTreeDestroy(fc);
+  else RBLockedTreeDestroy(locked);
+}
+
+#ifndef RB_OTHER_ENGINE
+void CountRelocated(rb_red_blk_node* from, rb_red_blk_node* to,
+		    void* context) {
+  assert (from != to);
+  (*(long *)context)++;
+}
+
+/* compacts the tree in small steps, half the time with inserts and */
+/* deletes between them, and checks it against the container */
+void CompactVerify(rb_red_blk_tree* tree) {
+  rb_compaction* c;
+  rb_red_blk_node* x;
+  rb_mem_stats stats;
+  long relocated = 0, moved;
+  int churn = rand()%2;
+  int val;
+
+  c = RBTreeCompactStart(tree,CountRelocated,&relocated);
+  do {
+    if (!churn) continue;
+    if (rand()%2 == 0 && containerRandom (&val)) {
+      containerDelete (val);
+      x = RBExactQuery(tree,&val);
+      assert (x);
+      RBDelete(tree,x);
+    } else {
+      val = randomInt();
+      if (!(nodups && containerFind (val))) {
+	void* p = randomVoidP();
+	FuzzInsert(tree,val,p);
+	containerInsert(val,p);
+      }
+    }
+    checkRep (tree);
+  } while (!RBTreeCompactStep(c,1+rand()%8));
+  moved = c->moved;
+  RBTreeCompactEnd(c);
+  assert (relocated == moved);
+  checkRep (tree);
+  RBTreeVerify(tree);
+  /* moved nodes are counted in the region instead */
+  RBTreeGetMemStats(tree,&stats);
+  assert (stats.liveNodes == (long) tree->count);
+  if (churn) return;
+  /* every node moved, and they now sit one after another in order */
+  assert (moved == (long) tree->count);
+  for (x=tree->root->left; x != tree->nil && x->left != tree->nil; x=x->left);
+  for (; x != tree->nil && TreeSuccessor(tree,x) != tree->nil;
+       x=TreeSuccessor(tree,x)) {
+    assert ((char *)TreeSuccessor(tree,x) == (char *)x+tree->nodeSize);
+  }
+}
+#endif
+
 static void fuzzit (void)
 {
   stk_stack* enumResult;
   int option=0;
   int newKey,newKey2;
-  int* newInt;
   rb_red_blk_node* newNode;
   rb_red_blk_tree* tree;
   int i;
@@ -89,21 +962,65 @@ static void fuzzit (void)
 
   fuzz_reps = 1+rand()%FUZZ_REPS;
 
-  tree=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
   containerCreate ();
   nodups = rand()%2;
+  inlineKeys = 0;
   if (rand()%2 == 0) {
     FUZZ_RANGE = 1 + rand()%fuzz_reps;
   } else {
     FUZZ_RANGE = 1 + rand()%RAND_MAX;
   }
 
+#ifndef RB_OTHER_ENGINE
+  /* parallel_tree.c builds and checks linked red-black trees, so it */
+  /* is left out when the harness runs against another engine */
+  if (rand()%4 == 0) {
+    /* start from a tree bulk built from random keys */
+    void* keys[100];
+    void* infos[100];
+    int* newInt;
+    int n = rand()%100;
+    if (nodups && n > FUZZ_RANGE) n = FUZZ_RANGE;
+    for (i=0; i<n; i++) {
+      do newKey = randomInt(); while (nodups && containerFind (newKey));
+      newInt=(int*) malloc(sizeof(int));
+      *newInt=newKey;
+      keys[i]=newInt;
+      infos[i]=randomVoidP();
+      containerInsert(newKey,infos[i]);
+    }
+    tree=RBTreeBuildParallel(IntComp,IntDest,InfoDest,IntPrint,InfoPrint,
+			     keys,infos,n,1+rand()%4);
+    checkRep (tree);
+    RBTreeVerify(tree);
+  } else
+#endif
+  {
+    if (rand()%4 == 0) {
+      inlineKeys = 1;
+      tree=RBTreeCreateInline(IntComp,sizeof(int),0,IntPrint,InfoPrint);
+    } else {
+      tree=RBTreeCreate(IntComp,IntDest,InfoDest,IntPrint,InfoPrint);
+    }
+    if (rand()%2 == 0) RBTreeUseNodeCache(tree);
+    if (rand()%2 == 0) {
+      RBTreeUsePrefix(tree,rand()%2 ? IntPrefix : IntPrefixCoarse);
+    }
+#ifndef RB_OTHER_ENGINE
+    if (rand()%2 == 0) {
+      const rb_balance* schemes[] = {&RBBalanceRedBlack, &RBBalanceAVL,
+				     &RBBalanceWAVL, &RBBalanceTreap};
+      RBTreeUseBalance(tree,schemes[rand()%4]);
+    }
+#endif
+  }
+
   for (i=0; i<fuzz_reps; i++) {
 
     checkRep (tree);
 
   again:
-    option = 1 + rand()%7;
+    option = 1 + rand()%9;
     switch(option)
       {
       case 1:
@@ -115,10 +1032,8 @@ static void fuzzit (void)
 	    if (containerFind (newKey)) goto again;
 	  }
 
-	  newInt=(int*) malloc(sizeof(int));
-	  *newInt=newKey;
 	  p = randomVoidP();
-	  RBTreeInsert(tree,newInt,p);
+	  FuzzInsert(tree,newKey,p);
 	  containerInsert(newKey,p);
 	}
 	break;
@@ -211,11 +1126,63 @@ static void fuzzit (void)
 	  RBTreeVerify(tree);
 	}
 	break;
+      case 8:
+	{
+	  int keys[40];
+	  void* keyPtrs[40];
+	  rb_red_blk_node* found[40];
+	  int j, n = rand()%40;
+	  for (j=0; j<n; j++) {
+	    keys[j] = randomInt();
+	    keyPtrs[j] = &keys[j];
+	  }
+	  RBExactQueryBatch(tree,keyPtrs,n,found);
+	  for (j=0; j<n; j++) {
+	    assert (found[j] == RBExactQuery(tree,&keys[j]));
+	    assert ((found[j] != 0) == containerFind (keys[j]));
+	  }
+	  RBMultiGet(tree,keyPtrs,n,found);
+	  for (j=0; j<n; j++) {
+	    assert ((found[j] != 0) == containerFind (keys[j]));
+	    if (found[j]) assert (*(int *)found[j]->key == keys[j]);
+	  }
+	}
+	break;
+      case 9:
+	{
+	  RBTreeRebalance(tree);
+	  RBTreeVerify(tree);
+#ifndef RB_OTHER_ENGINE
+	  /* a tree of height h holds at most 2^h-1 nodes */
+	  int h = 0;
+	  while ((1L << h) - 1 < (long)tree->count) h++;
+	  assert (TreeHeight(tree,tree->root->left) == h);
+#endif
+	}
+	break;
       default:
 	assert (0);
       }
   }
   RBTreeVerify(tree);
+#ifndef RB_OTHER_ENGINE
+  ParallelVerify(tree);
+#endif
+  if (rand()%8 == 0) SnapshotVerify(tree);
+  if (rand()%8 == 0) StreamVerify(tree);
+  if (rand()%8 == 0) DurableVerify(tree);
+  if (rand()%4 == 0) FrozenVerify(tree);
+  if (rand()%4 == 0) IntIndexVerify(tree);
+  if (rand()%4 == 0) StringVerify();
+  if (rand()%4 == 0) InlineVerify();
+  if (rand()%4 == 0) SetVerify();
+  if (rand()%4 == 0) EmbedVerify();
+  if (rand()%4 == 0) AllocVerify();
+  if (rand()%4 == 0) NodeArenaVerify();
+  if (rand()%4 == 0) CombiningVerify();
+#ifndef RB_OTHER_ENGINE
+  if (rand()%4 == 0) CompactVerify(tree);
+#endif
   if (rand()%2 == 0) {
     while (1) {
       int val;
@@ -226,6 +1193,12 @@ static void fuzzit (void)
       RBDelete(tree,newNode);
     }    
   }
+#ifndef RB_OTHER_ENGINE
+  if (rand()%2 == 0) {
+    RBParallelDestroy(tree,1+rand()%4);
+    return;
+  }
+#endif
   RBTreeDestroy(tree);
 }
 
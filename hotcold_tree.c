@@ -0,0 +1,767 @@
+#include "red_black_tree.h"
+#include "tree_alloc.h"
+#include <assert.h>
+#include <string.h>
+
+/*  A third engine behind red_black_tree.h: a red-black tree whose */
+/*  links live in two parallel arrays indexed by slot number instead */
+/*  of in the nodes.  The hot array holds just what a descent reads, */
+/*  the key pointer, its prefix and the two children, in 24 bytes a */
+/*  slot, so a cache line holds most of three search steps where it */
+/*  holds one 56 byte prefixed node of red_black_tree.c.  The cold */
+/*  array holds the parent, the color and the item's node, which only */
+/*  inserts, deletes and the end of a lookup touch.  Link */
+/*  hotcold_tree.o in place of red_black_tree.o to use it. */
+/**/
+/*  As in bplus_tree.c the rb_red_blk_node handles hold each item's */
+/*  key and info, stay valid until the item is deleted, and are */
+/*  chained in key order: right is the next node (nil after the last), */
+/*  parent the previous one (tree->root before the first) and left is */
+/*  always nil.  red holds the item's slot.  tree->root->left is the */
+/*  first node and tree->root->info the slot arrays. */
+/**/
+/*  Slot 0 is the nil sentinel and slot 1 the root sentinel, whose */
+/*  left child is the root of the tree.  Freed slots are reused, */
+/*  chained through their parent field.  RBBuildSubtree, */
+/*  RBBalancedRedDepth, TreeDestHelper, checkRepHelper and checkRepNode */
+/*  work on linked red-black trees and are not provided, so */
+/*  parallel_tree.c cannot be linked with this engine.  Nor are */
+/*  LeftRotate, RightRotate and RBTreeUseBalance (see tree_balance.h). */
+
+#define HC_NIL 0
+#define HC_HEAD 1
+
+typedef struct rb_hot_slot {
+  uint64_t prefix; /* the key's prefix if the tree uses them */
+  void* key;
+  uint32_t child[2]; /* left and right */
+} rb_hot_slot;
+
+typedef struct rb_cold_slot {
+  uint32_t parent; /* or the next free slot */
+  uint32_t red;
+  rb_red_blk_node* node;
+} rb_cold_slot;
+
+typedef struct rb_hotcold {
+  rb_hot_slot* hot;
+  rb_cold_slot* cold;
+  uint32_t size; /* slots allocated */
+  uint32_t used; /* slots ever handed out */
+  uint32_t freeSlots; /* head of the free chain, or HC_NIL */
+} rb_hotcold;
+
+#define HC(tree) ((rb_hotcold*) (tree)->root->info)
+
+/*  The slot arrays are counted in the tree's bytes, though like */
+/*  B+-tree nodes they never come from its allocator or are refused */
+/*  (see tree_alloc.h). */
+
+#define HC_BYTES(size) ((long) (size)*(long) (sizeof(rb_hot_slot)+ \
+					      sizeof(rb_cold_slot)))
+
+static rb_hotcold* HotColdCreate(rb_red_blk_tree* tree) {
+  rb_hotcold* hc=(rb_hotcold*) SafeMalloc(sizeof(rb_hotcold));
+
+  hc->size=64;
+  RBTreeCharge(tree,HC_BYTES(hc->size),0,1);
+  hc->hot=(rb_hot_slot*) SafeMalloc(hc->size*sizeof(rb_hot_slot));
+  hc->cold=(rb_cold_slot*) SafeMalloc(hc->size*sizeof(rb_cold_slot));
+  memset(hc->hot,0,2*sizeof(rb_hot_slot));
+  memset(hc->cold,0,2*sizeof(rb_cold_slot));
+  hc->used=2;
+  hc->freeSlots=HC_NIL;
+  return(hc);
+}
+
+static void HotColdFree(rb_red_blk_tree* tree, rb_hotcold* hc) {
+  RBTreeCharge(tree,-HC_BYTES(hc->size),0,1);
+  free(hc->hot);
+  free(hc->cold);
+  free(hc);
+}
+
+/*  doubles the slot arrays, returning 0 and leaving size as it was */
+/*  if either cannot grow.  The hot array may then have grown alone, */
+/*  which does no harm: the next attempt reallocates it to the same */
+/*  size. */
+
+static int SlotsGrow(rb_red_blk_tree* tree, rb_hotcold* hc) {
+  rb_hot_slot* hot;
+  rb_cold_slot* cold;
+
+  if (hc->size >= 0x80000000u) return(0);
+  hot=(rb_hot_slot*) realloc(hc->hot,2*hc->size*sizeof(rb_hot_slot));
+  if (!hot) return(0);
+  hc->hot=hot;
+  cold=(rb_cold_slot*) realloc(hc->cold,2*hc->size*sizeof(rb_cold_slot));
+  if (!cold) return(0);
+  hc->cold=cold;
+  RBTreeCharge(tree,HC_BYTES(hc->size),0,1);
+  hc->size*=2;
+  return(1);
+}
+
+/*  a slot for node z, its children nil, growing the arrays if need */
+/*  be, or HC_NIL if they cannot grow */
+
+static uint32_t SlotAlloc(rb_red_blk_tree* tree, rb_red_blk_node* z) {
+  rb_hotcold* hc=HC(tree);
+  uint32_t s;
+
+  if (hc->freeSlots != HC_NIL) {
+    s=hc->freeSlots;
+    hc->freeSlots=hc->cold[s].parent;
+  } else {
+    if ( (hc->used == hc->size) && !SlotsGrow(tree,hc) ) {
+      RBTreeCountFailure(tree);
+      return(HC_NIL);
+    }
+    s=hc->used++;
+  }
+  hc->hot[s].prefix= tree->Normalize ? tree->Normalize(z->key) : 0;
+  hc->hot[s].key=z->key;
+  hc->hot[s].child[0]=hc->hot[s].child[1]=HC_NIL;
+  hc->cold[s].node=z;
+  z->red=(int) s;
+  return(s);
+}
+
+static void SlotFree(rb_hotcold* hc, uint32_t s) {
+  hc->hot[s].key=NULL;
+  hc->cold[s].node=NULL;
+  hc->cold[s].parent=hc->freeSlots;
+  hc->freeSlots=s;
+}
+
+/*  the nil handle of every tree, which nothing writes to */
+
+static const rb_red_blk_node RBNil={0,0,0,(rb_red_blk_node*) &RBNil,
+				    (rb_red_blk_node*) &RBNil,
+				    (rb_red_blk_node*) &RBNil};
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeInit */
+/**/
+/*  INPUTS:  the same as for the red-black engine */
+/**/
+/*  OUTPUT:  none */
+/**/
+/*  EFFECTS:  makes tree an empty tree, with room for a few slots.  Unlike */
+/*            the red-black engine's this allocates. */
+/**/
+/*  Modifies Input: tree */
+/***********************************************************************/
+
+void RBTreeInit(rb_red_blk_tree* tree,
+		int (*CompFunc) (const void*,const void*),
+		void (*DestFunc) (void*),
+		void (*InfoDestFunc) (void*),
+		void (*PrintFunc) (const void*),
+		void (*PrintInfo)(void*)) {
+  rb_red_blk_node* temp;
+
+  tree->Compare=  CompFunc;
+  tree->DestroyKey= DestFunc;
+  tree->PrintKey= PrintFunc;
+  tree->PrintInfo= PrintInfo;
+  tree->DestroyInfo= InfoDestFunc;
+  tree->Normalize=0;
+  tree->nodeSize=sizeof(rb_red_blk_node);
+  tree->extra=NULL;
+  tree->balance=NULL;
+  tree->rotations=0;
+  tree->count=0;
+
+  tree->nil=(rb_red_blk_node*) &RBNil;
+  temp=tree->root=&tree->rootNode;
+  temp->parent=temp->left=temp->right=tree->nil;
+  temp->key=0;
+  temp->red=0;
+  temp->info=HotColdCreate(tree);
+}
+
+rb_red_blk_tree* RBTreeCreate( int (*CompFunc) (const void*,const void*),
+			      void (*DestFunc) (void*),
+			      void (*InfoDestFunc) (void*),
+			      void (*PrintFunc) (const void*),
+			      void (*PrintInfo)(void*)) {
+  rb_red_blk_tree* newTree;
+
+  newTree=(rb_red_blk_tree*) SafeMalloc(sizeof(rb_red_blk_tree));
+  RBTreeInit(newTree,CompFunc,DestFunc,InfoDestFunc,PrintFunc,PrintInfo);
+  return(newTree);
+}
+
+/*  see RBTreeUseAllocator in red_black_tree.c; only the handles come */
+/*  from the allocator, the slot arrays are single blocks */
+
+void RBTreeUseAllocator(rb_red_blk_tree* tree, const rb_allocator* allocator) {
+#ifdef DEBUG_ASSERT
+  Assert(tree->root->left == tree->nil,"tree not empty in RBTreeUseAllocator");
+#endif
+  if (!tree->extra && (allocator == &RBMallocAllocator)) return;
+  RBTreeExtra(tree)->allocator=allocator;
+}
+
+/*  as in red_black_tree.c, but the prefixes are kept in the hot */
+/*  slots instead of the handles */
+
+void RBTreeUsePrefix(rb_red_blk_tree* tree,
+		     uint64_t (*Normalize)(const void*)) {
+#ifdef DEBUG_ASSERT
+  Assert(tree->root->left == tree->nil,"tree not empty in RBTreeUsePrefix");
+#endif
+  tree->Normalize=Normalize;
+}
+
+void RBNodeSetKey(rb_red_blk_tree* tree, rb_red_blk_node* x, void* key) {
+  x->key=key;
+}
+
+rb_red_blk_node* RBNodeAlloc(rb_red_blk_tree* tree) {
+  return((rb_red_blk_node*) RBTreeAllocBytes(tree,tree->nodeSize,1));
+}
+
+void RBNodeFree(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  RBTreeFreeBytes(tree,x,tree->nodeSize,1);
+}
+
+/*  see DestroyNodeData in red_black_tree.c */
+
+static void DestroyNodeData(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  if (tree->DestroyKey != NullFunction) tree->DestroyKey(x->key);
+  if (tree->DestroyInfo != NullFunction) tree->DestroyInfo(x->info);
+}
+
+/*  compares the key in slot s with q, as KeyCompare in */
+/*  red_black_tree.c compares a node's */
+
+static int SlotCompare(rb_red_blk_tree* tree, rb_hot_slot* hot, uint32_t s,
+		       const void* q, uint64_t qPrefix) {
+  if (tree->Normalize && (hot[s].prefix != qPrefix)) {
+    return( (hot[s].prefix > qPrefix) ? 1 : -1);
+  }
+  return(tree->Compare(hot[s].key,q));
+}
+
+#define QUERY_PREFIX(tree,q) ((tree)->Normalize ? (tree)->Normalize(q) : 0)
+
+/*  puts z in the node chain after prev, which may be tree->root */
+
+static void LinkAfter(rb_red_blk_tree* tree, rb_red_blk_node* prev,
+		      rb_red_blk_node* z) {
+  rb_red_blk_node** next= (prev == tree->root) ? &prev->left : &prev->right;
+
+  z->left=tree->nil;
+  z->parent=prev;
+  z->right=*next;
+  if (*next != tree->nil) (*next)->parent=z;
+  *next=z;
+}
+
+static void Unlink(rb_red_blk_tree* tree, rb_red_blk_node* z) {
+  rb_red_blk_node* prev=z->parent;
+
+  if (prev == tree->root) prev->left=z->right; else prev->right=z->right;
+  if (z->right != tree->nil) z->right->parent=prev;
+}
+
+/*  Rotates slot x down to side d (0 for a left rotation), its child */
+/*  on the other side taking its place. */
+
+static void Rotate(rb_hotcold* hc, uint32_t x, int d) {
+  rb_hot_slot* hot=hc->hot;
+  rb_cold_slot* cold=hc->cold;
+  uint32_t y=hot[x].child[!d];
+  uint32_t p=cold[x].parent;
+
+  hot[x].child[!d]=hot[y].child[d];
+  if (hot[y].child[d] != HC_NIL) cold[hot[y].child[d]].parent=x;
+  cold[y].parent=p;
+  hot[p].child[hot[p].child[1] == x]=y;
+  hot[y].child[d]=x;
+  cold[x].parent=y;
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeInsert */
+/**/
+/*  INPUTS:  tree is the tree to insert a node which has a key pointed */
+/*           to by key and info pointed to by info. */
+/**/
+/*  OUTPUT:  the new node, which stays valid until it is deleted, or */
+/*           NULL if the tree's allocator or budget refused it */
+/**/
+/*  Modifies Input: tree */
+/**/
+/*  EFFECTS:  Gives the item a slot, inserts the slot after any equal */
+/*            keys and recolors and rotates as red_black_tree.c does */
+/***********************************************************************/
+
+rb_red_blk_node * RBTreeInsert(rb_red_blk_tree* tree, void* key, void* info) {
+  rb_red_blk_node* z;
+
+  if (!(z=RBNodeAlloc(tree))) return(NULL); /* assignment */
+  RBNodeSetKey(tree,z,key);
+  z->info=info;
+  if (!RBTreeInsertNode(tree,z)) {
+    RBNodeFree(tree,z);
+    return(NULL);
+  }
+  return(z);
+}
+
+/*  the second half of RBTreeInsert, as in red_black_tree.c.  If the */
+/*  slot arrays cannot grow it returns NULL and z is the caller's to */
+/*  free. */
+
+rb_red_blk_node* RBTreeInsertNode(rb_red_blk_tree* tree, rb_red_blk_node* z) {
+  rb_hotcold* hc=HC(tree);
+  uint32_t s=SlotAlloc(tree,z);
+  rb_hot_slot* hot=hc->hot;
+  rb_cold_slot* cold=hc->cold;
+  uint32_t x=hot[HC_HEAD].child[0];
+  uint32_t y=HC_HEAD;
+  uint32_t pred=HC_NIL;
+  uint32_t p, g, u;
+  int d=0;
+
+  if (s == HC_NIL) return(NULL);
+  /* the last slot the search passed on its right is z's predecessor */
+  while (x != HC_NIL) {
+    y=x;
+    d= (SlotCompare(tree,hot,x,z->key,hot[s].prefix) != 1);
+    if (d) pred=x;
+    x=hot[x].child[d];
+  }
+  hot[y].child[d]=s;
+  cold[s].parent=y;
+  cold[s].red=1;
+  LinkAfter(tree,(pred == HC_NIL) ? tree->root : cold[pred].node,z);
+
+  for (x=s; cold[cold[x].parent].red; ) {
+    p=cold[x].parent;
+    g=cold[p].parent;
+    d= (hot[g].child[1] == p);
+    u=hot[g].child[!d];
+    if (cold[u].red) {
+      cold[p].red=cold[u].red=0;
+      cold[g].red=1;
+      x=g;
+    } else {
+      if (x == hot[p].child[!d]) {
+	x=p;
+	Rotate(hc,x,d);
+	p=cold[x].parent;
+      }
+      cold[p].red=0;
+      cold[g].red=1;
+      Rotate(hc,g,!d);
+    }
+  }
+  cold[hot[HC_HEAD].child[0]].red=0;
+  tree->count++;
+  return(z);
+}
+
+/*  the chain makes these constant time */
+
+rb_red_blk_node* TreeSuccessor(rb_red_blk_tree* tree,rb_red_blk_node* x) {
+  return(x->right);
+}
+
+rb_red_blk_node* TreePredecessor(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  return( (x->parent == tree->root) ? tree->nil : x->parent);
+}
+
+/*  frees every item in the node chain and every slot */
+
+static void DestroyItems(rb_red_blk_tree* tree) {
+  rb_red_blk_node* x=tree->root->left;
+  rb_red_blk_node* next;
+  rb_hotcold* hc=HC(tree);
+
+  while (x != tree->nil) {
+    next=x->right;
+    DestroyNodeData(tree,x);
+    RBNodeFree(tree,x);
+    x=next;
+  }
+  tree->root->left=tree->nil;
+  hc->hot[HC_HEAD].child[0]=HC_NIL;
+  hc->used=2;
+  hc->freeSlots=HC_NIL;
+}
+
+void RBTreeClear(rb_red_blk_tree* tree) {
+  DestroyItems(tree);
+  HotColdFree(tree,HC(tree));
+  tree->root->info=NULL;
+  tree->count=0;
+  RBTreeFreeExtra(tree);
+}
+
+long RBTreeHeldBytes(rb_red_blk_tree* tree) {
+  return((long) (tree->count*tree->nodeSize)+HC_BYTES(HC(tree)->size));
+}
+
+void RBTreeDestroy(rb_red_blk_tree* tree) {
+  RBTreeClear(tree);
+  free(tree);
+}
+
+/*  Builds the n slots from *next on, in key order, into a balanced */
+/*  subtree whose root is at the given depth; slots at redDepth are */
+/*  red.  Returns the subtree's root. */
+
+static uint32_t BuildSlots(rb_hotcold* hc, uint32_t* next, long n, int depth,
+			   int redDepth) {
+  uint32_t left, s, right;
+
+  if (n == 0) return(HC_NIL);
+  left=BuildSlots(hc,next,(n-1)/2,depth+1,redDepth);
+  s=(*next)++;
+  right=BuildSlots(hc,next,n-1-(n-1)/2,depth+1,redDepth);
+  hc->hot[s].child[0]=left;
+  hc->hot[s].child[1]=right;
+  hc->cold[left].parent=hc->cold[right].parent=s;
+  hc->cold[s].red= (depth == redDepth);
+  return(s);
+}
+
+/*  links slots 2..n+1, n > 0, into a tree of minimum height under */
+/*  the root sentinel.  Its deepest level is red if it is not full. */
+
+static void LinkSlots(rb_hotcold* hc, long n) {
+  uint32_t next=2;
+  int redDepth=0;
+
+  /* a perfect tree of n nodes has no red level */
+  while ((2L << redDepth) <= n+1) redDepth++;
+  hc->hot[HC_HEAD].child[0]=BuildSlots(hc,&next,n,0,redDepth);
+  hc->cold[hc->hot[HC_HEAD].child[0]].parent=HC_HEAD;
+  hc->cold[HC_NIL].red=0;
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeBuildSorted */
+/**/
+/*    INPUTS:  tree is an empty tree, n is the number of items and */
+/*             NextItem/context hand them out in ascending order as */
+/*             described for RBBuildSubtree in red_black_tree.c */
+/**/
+/*    OUTPUT:  1 on success, 0 if n is negative or NextItem, the */
+/*             allocator or the slot arrays failed, in which case the */
+/*             tree is still empty */
+/**/
+/*    Modifies Input: tree */
+/**/
+/*    EFFECT:  Gives the items slots 2..n+1 in key order, then links */
+/*             them into a tree of minimum height whose deepest level, */
+/*             if it is not full, is red.  O(n) time with no compares. */
+/***********************************************************************/
+
+int RBTreeBuildSorted(rb_red_blk_tree* tree, long n,
+		      int (*NextItem)(void*, void**, void**), void* context) {
+  rb_hotcold* hc=HC(tree);
+  rb_red_blk_node* prev=tree->root;
+  rb_red_blk_node* z;
+  long i;
+
+#ifdef DEBUG_ASSERT
+  Assert(tree->root->left == tree->nil,"tree not empty in RBTreeBuildSorted");
+#endif
+  if (n < 0) return(0);
+  if (n <= 0) return(1);
+  hc->used=2; /* the slots of deleted items are free too */
+  hc->freeSlots=HC_NIL;
+  for (i=0; i<n; i++) {
+    z=RBNodeAlloc(tree);
+    if (!z || !NextItem(context,&z->key,&z->info)) {
+      if (z) RBNodeFree(tree,z);
+      DestroyItems(tree);
+      return(0);
+    }
+    RBNodeSetKey(tree,z,z->key);
+    if (SlotAlloc(tree,z) == HC_NIL) {
+      DestroyNodeData(tree,z);
+      RBNodeFree(tree,z);
+      DestroyItems(tree);
+      return(0);
+    }
+    LinkAfter(tree,prev,z);
+    prev=z;
+  }
+  LinkSlots(hc,n);
+  tree->count=n;
+  return(1);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeRebalance */
+/**/
+/*    INPUTS:  tree is the tree to rebalance */
+/**/
+/*    OUTPUT:  none */
+/**/
+/*    Modifies Input: tree */
+/**/
+/*    EFFECT:  Gives the items slots 2..n+1 in key order and links them */
+/*             as RBTreeBuildSorted does, in O(n) time without any */
+/*             allocation or compares.  Besides making the tree as */
+/*             shallow as it can be, this packs the slots the deletes */
+/*             freed, so a descent's slots sit closer together. */
+/***********************************************************************/
+
+void RBTreeRebalance(rb_red_blk_tree* tree) {
+  rb_hotcold* hc=HC(tree);
+  rb_red_blk_node* x;
+  long n=0;
+
+  hc->used=2;
+  hc->freeSlots=HC_NIL;
+  for (x=tree->root->left; x != tree->nil; x=x->right) {
+    SlotAlloc(tree,x); /* never grows the arrays: slots only get fewer */
+    n++;
+  }
+  if (n > 0) LinkSlots(hc,n);
+}
+
+void RBTreePrint(rb_red_blk_tree* tree) {
+  rb_red_blk_node* x;
+
+  for (x=tree->root->left; x != tree->nil; x=x->right) {
+    printf("info=");
+    tree->PrintInfo(x->info);
+    printf("  key=");
+    tree->PrintKey(x->key);
+    printf("  red=%i\n",(int) HC(tree)->cold[x->red].red);
+  }
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBExactQuery */
+/**/
+/*    INPUTS:  tree is the tree to search and q is a pointer to the key */
+/*             we are searching for */
+/**/
+/*    OUTPUT:  returns the a node with key equal to q.  If there are */
+/*             multiple nodes with key equal to q this function returns */
+/*             the one highest in the tree */
+/**/
+/*    EFFECT:  reads only hot slots until it has found the key */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+rb_red_blk_node* RBExactQuery(rb_red_blk_tree* tree, void* q) {
+  rb_hotcold* hc=HC(tree);
+  rb_hot_slot* hot=hc->hot;
+  uint32_t x=hot[HC_HEAD].child[0];
+  uint64_t qPrefix=QUERY_PREFIX(tree,q);
+  int compVal;
+
+  while (x != HC_NIL) {
+    compVal=SlotCompare(tree,hot,x,q,qPrefix);
+    if (compVal == 0) return(hc->cold[x].node);
+    x=hot[x].child[compVal != 1];
+  }
+  return(0);
+}
+
+/*  the hot slots already pack a lookup into few lines, so batched */
+/*  lookups are answered one at a time */
+
+void RBExactQueryBatch(rb_red_blk_tree* tree, void** keys, int n,
+		       rb_red_blk_node** out_nodes) {
+  int i;
+
+  for (i=0; i<n; i++) out_nodes[i]=RBExactQuery(tree,keys[i]);
+}
+
+void RBMultiGet(rb_red_blk_tree* tree, void** keys, int n,
+		rb_red_blk_node** out_nodes) {
+  RBExactQueryBatch(tree,keys,n,out_nodes);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBEnumerate */
+/**/
+/*    INPUTS:  tree is the tree to look for keys >= low */
+/*             and <= high with respect to the Compare function */
+/**/
+/*    OUTPUT:  stack containing pointers to the nodes between [low,high] */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+stk_stack* RBEnumerate(rb_red_blk_tree* tree, void* low, void* high) {
+  stk_stack* enumResultStack=StackCreate();
+  rb_hotcold* hc=HC(tree);
+  rb_hot_slot* hot=hc->hot;
+  uint32_t x=hot[HC_HEAD].child[0];
+  uint32_t last=HC_NIL;
+  uint64_t highPrefix=QUERY_PREFIX(tree,high);
+  rb_red_blk_node* y;
+  int d;
+
+  /* the last slot whose key is <= high */
+  while (x != HC_NIL) {
+    d= (SlotCompare(tree,hot,x,high,highPrefix) != 1);
+    if (d) last=x;
+    x=hot[x].child[d];
+  }
+  y= (last == HC_NIL) ? tree->root : hc->cold[last].node;
+  while ( (y != tree->root) && (1 != tree->Compare(low,y->key)) ) {
+    StackPush(enumResultStack,y);
+    y=y->parent;
+  }
+  return(enumResultStack);
+}
+
+/*  restores the colors after a black slot was taken out above x, as */
+/*  RBDeleteFixUp does in red_black_tree.c */
+
+static void DeleteFixUp(rb_hotcold* hc, uint32_t x) {
+  rb_hot_slot* hot=hc->hot;
+  rb_cold_slot* cold=hc->cold;
+  uint32_t p, w;
+  int d;
+
+  while (!cold[x].red && (x != hot[HC_HEAD].child[0])) {
+    p=cold[x].parent;
+    d= (hot[p].child[0] != x);
+    w=hot[p].child[!d];
+    if (cold[w].red) {
+      cold[w].red=0;
+      cold[p].red=1;
+      Rotate(hc,p,d);
+      w=hot[p].child[!d];
+    }
+    if (!cold[hot[w].child[0]].red && !cold[hot[w].child[1]].red) {
+      cold[w].red=1;
+      x=p;
+    } else {
+      if (!cold[hot[w].child[!d]].red) {
+	cold[hot[w].child[d]].red=0;
+	cold[w].red=1;
+	Rotate(hc,w,!d);
+	w=hot[p].child[!d];
+      }
+      cold[w].red=cold[p].red;
+      cold[p].red=0;
+      cold[hot[w].child[!d]].red=0;
+      Rotate(hc,p,d);
+      x=hot[HC_HEAD].child[0];
+    }
+  }
+  cold[x].red=0;
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBDelete */
+/**/
+/*    INPUTS:  tree is the tree to delete node z from */
+/**/
+/*    OUTPUT:  none */
+/**/
+/*    EFFECT:  Deletes z's slot from the tree as red_black_tree.c */
+/*             deletes a node, moving its successor's slot into its */
+/*             place if it has two children, then takes z out of the */
+/*             node chain and frees it and its key and info. */
+/**/
+/*    Modifies Input: tree, z */
+/***********************************************************************/
+
+void RBDelete(rb_red_blk_tree* tree, rb_red_blk_node* z) {
+  rb_hotcold* hc=HC(tree);
+  rb_hot_slot* hot=hc->hot;
+  rb_cold_slot* cold=hc->cold;
+  uint32_t zs=(uint32_t) z->red;
+  uint32_t y, x, p;
+
+  tree->count--;
+  if ( (hot[zs].child[0] == HC_NIL) || (hot[zs].child[1] == HC_NIL) ) {
+    y=zs;
+  } else {
+    for (y=hot[zs].child[1]; hot[y].child[0] != HC_NIL; y=hot[y].child[0]);
+  }
+  x= (hot[y].child[0] != HC_NIL) ? hot[y].child[0] : hot[y].child[1];
+  p=cold[y].parent;
+  cold[x].parent=p; /* even for nil, which DeleteFixUp may start from */
+  hot[p].child[hot[p].child[1] == y]=x;
+  if (!cold[y].red) DeleteFixUp(hc,x);
+  if (y != zs) {
+    hot[y].child[0]=hot[zs].child[0];
+    hot[y].child[1]=hot[zs].child[1];
+    cold[y].red=cold[zs].red;
+    cold[hot[y].child[0]].parent=cold[hot[y].child[1]].parent=y;
+    p=cold[zs].parent;
+    cold[y].parent=p;
+    hot[p].child[hot[p].child[1] == zs]=y;
+  }
+  cold[HC_NIL].red=0;
+  SlotFree(hc,zs);
+  Unlink(tree,z);
+  DestroyNodeData(tree,z);
+  RBNodeFree(tree,z);
+}
+
+/*  Checks the subtree under slot x, whose keys must lie between the */
+/*  keys of slots low and high (no bound where nil), and that its */
+/*  items are the next ones in the node chain, moving *next past */
+/*  them.  Returns its black height. */
+
+static int CheckSlots(rb_red_blk_tree* tree, rb_hotcold* hc, uint32_t x,
+		      uint32_t low, uint32_t high, rb_red_blk_node** next) {
+  rb_hot_slot* hot=hc->hot;
+  rb_cold_slot* cold=hc->cold;
+  rb_red_blk_node* y;
+  int left, right;
+
+  if (x == HC_NIL) return(0);
+  assert (x < hc->used);
+  if (low != HC_NIL) assert (tree->Compare(hot[low].key,hot[x].key) != 1);
+  if (high != HC_NIL) assert (tree->Compare(hot[x].key,hot[high].key) != 1);
+  if (cold[x].red) {
+    assert (!cold[hot[x].child[0]].red && !cold[hot[x].child[1]].red);
+  }
+  if (hot[x].child[0] != HC_NIL) assert (cold[hot[x].child[0]].parent == x);
+  if (hot[x].child[1] != HC_NIL) assert (cold[hot[x].child[1]].parent == x);
+  left=CheckSlots(tree,hc,hot[x].child[0],low,x,next);
+  y=cold[x].node;
+  assert (y == *next);
+  assert ((uint32_t) y->red == x);
+  assert (y->key == hot[x].key);
+  if (tree->Normalize) assert (hot[x].prefix == tree->Normalize(y->key));
+  assert (y->left == tree->nil);
+  assert ((y->right == tree->nil) || (y->right->parent == y));
+  *next=y->right;
+  right=CheckSlots(tree,hc,hot[x].child[1],x,high,next);
+  assert (left == right);
+  return(left+!cold[x].red);
+}
+
+void checkRep (rb_red_blk_tree *tree)
+{
+  rb_hotcold* hc=HC(tree);
+  rb_red_blk_node* next=tree->root->left;
+  rb_red_blk_node* x;
+  uint32_t s, nFree=0;
+  unsigned long n=0;
+
+  assert (!hc->cold[HC_NIL].red && !hc->cold[HC_HEAD].red);
+  assert (hc->hot[HC_HEAD].child[1] == HC_NIL);
+  assert (!hc->cold[hc->hot[HC_HEAD].child[0]].red);
+  if (hc->hot[HC_HEAD].child[0] != HC_NIL) {
+    assert (hc->cold[hc->hot[HC_HEAD].child[0]].parent == HC_HEAD);
+  }
+  assert ((next == tree->nil) || (next->parent == tree->root));
+  CheckSlots(tree,hc,hc->hot[HC_HEAD].child[0],HC_NIL,HC_NIL,&next);
+  assert (next == tree->nil);
+  for (x=tree->root->left; x != tree->nil; x=x->right) n++;
+  assert (n == tree->count);
+  for (s=hc->freeSlots; s != HC_NIL; s=hc->cold[s].parent) nFree++;
+  assert (hc->used == 2+n+nFree);
+}
@@ -1,4 +1,5 @@
 #include "misc.h"
+#include <stdatomic.h>
 
 /***********************************************************************/
 /*  FUNCTION:  void Assert(int assertion, char* error)  */
@@ -39,19 +40,29 @@ void Assert(int assertion, char* error) {
 /**/
 /*    Modifies Input: none */
 /**/
+/*    Note:  malloc_total is updated atomically so SafeMalloc can be */
+/*           called from several threads at once. */
 /***********************************************************************/
 
-unsigned long malloc_total = 0;
+atomic_ulong malloc_total = 0;
+
+/*  counts size against MALLOC_LIMIT, returning 0 and counting nothing */
+/*  if it would go over */
+
+static int Reserve(size_t size) {
+  if (atomic_fetch_add_explicit(&malloc_total,size,memory_order_relaxed)
+      + size > MALLOC_LIMIT) {
+    atomic_fetch_sub_explicit(&malloc_total,size,memory_order_relaxed);
+    return(0);
+  }
+  return(1);
+}
 
 void * SafeMalloc(size_t size) {
   
   void * result;
 
-  malloc_total += size;
-
-  if (malloc_total > MALLOC_LIMIT) {
-    return(0);
-  }
+  if (!Reserve(size)) return(0);
 
   if ( (result = malloc(size)) ) { /* assignment intentional */
     return(result);
@@ -62,6 +73,27 @@ void * SafeMalloc(size_t size) {
     return(0);
   }
 }
+
+/*  TryMalloc is SafeMalloc for callers which can cope with running */
+/*  out: it returns NULL instead of exiting when malloc fails.  Memory */
+/*  from either may be given back with SafeFree, which counts it off */
+/*  malloc_total again; what is freed with free stays counted. */
+
+void * TryMalloc(size_t size) {
+  void * result;
+
+  if (!Reserve(size)) return(0);
+  if (!(result = malloc(size))) { /* assignment intentional */
+    atomic_fetch_sub_explicit(&malloc_total,size,memory_order_relaxed);
+  }
+  return(result);
+}
+
+void SafeFree(void * p, size_t size) {
+  free(p);
+  atomic_fetch_sub_explicit(&malloc_total,size,memory_order_relaxed);
+}
+
 /*  NullFunction does nothing it is included so that it can be passed */
 /*  as a function to RBTreeCreate when no other suitable function has */
 /*  been defined */
@@ -22,8 +22,19 @@
 
 #define MALLOC_LIMIT 8000000000
 
+/*  PREFETCH asks for the cache line holding addr to be loaded without */
+/*  waiting for it.  It is only a hint, so it expands to nothing on */
+/*  compilers which do not have one. */
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define PREFETCH(addr) ((void)(addr))
+#endif
+
 void Assert(int assertion, char* error);
 void * SafeMalloc(size_t size);
+void * TryMalloc(size_t size);
+void SafeFree(void * p, size_t size);
 
 #endif
 
@@ -0,0 +1,202 @@
+#include "node_arena.h"
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+static size_t RoundUp(size_t n, size_t to) {
+  return((n+to-1)/to*to);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  NewRegion */
+/**/
+/*    INPUTS:  arena is the arena whose current region is full, or */
+/*             which has none yet.  The caller holds its lock. */
+/**/
+/*    OUTPUT:  0 if no address space could be had, 1 otherwise */
+/**/
+/*    EFFECT:  reserves regionSize bytes, rounded up to whole pages, */
+/*             and makes them the current region.  For huge pages */
+/*             the mapping is made a huge page longer and trimmed so */
+/*             that the region starts on a huge page boundary, then */
+/*             madvised.  If the kernel refuses the advice the arena */
+/*             goes on with ordinary pages. */
+/**/
+/*    Modifies Input: arena */
+/***********************************************************************/
+
+static int NewRegion(rb_node_arena* arena) {
+  size_t align= arena->hugePages ? RB_HUGE_PAGE : (size_t) getpagesize();
+  size_t bytes=RoundUp(arena->regionSize,align);
+  rb_arena_region* r;
+  char* p;
+  char* base;
+
+  p=(char*) mmap(NULL,bytes+align,PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,-1,0);
+  if (p == MAP_FAILED) return(0);
+  base=(char*) RoundUp((uintptr_t) p,align);
+  if (base > p) munmap(p,base-p);
+  if (p+align > base) munmap(base+bytes,p+align-base);
+#ifdef MADV_HUGEPAGE
+  if (arena->hugePages && madvise(base,bytes,MADV_HUGEPAGE)) {
+    arena->hugePages=0;
+  }
+#endif
+  r=(rb_arena_region*) malloc(sizeof(rb_arena_region));
+  if (!r) {
+    munmap(base,bytes);
+    return(0);
+  }
+  r->base=base;
+  r->bytes=bytes;
+  r->used=0;
+  r->next=arena->regions;
+  arena->regions=r;
+  return(1);
+}
+
+static void* ArenaAlloc(void* context, size_t size) {
+  rb_node_arena* arena=(rb_node_arena*) context;
+  rb_arena_region* r;
+  size_t at;
+  void* p;
+  int cls;
+
+  if (size > RB_ARENA_MAX_OBJECT) return(NULL);
+  cls= size ? (int) ((size-1)/16) : 0;
+  size=(size_t) (cls+1)*16;
+  pthread_mutex_lock(&arena->lock);
+  if ( (p=arena->freeLists[cls]) ) { /* assignment */
+    arena->freeLists[cls]=*(void**) p;
+    pthread_mutex_unlock(&arena->lock);
+    return(p);
+  }
+  r=arena->regions;
+  at= r ? r->used : 0;
+  if (size >= 64) at=RoundUp(at,64);
+  if (!r || (at+size > r->bytes)) {
+    if (!NewRegion(arena)) {
+      pthread_mutex_unlock(&arena->lock);
+      return(NULL);
+    }
+    r=arena->regions;
+    at=0;
+  }
+  p=r->base+at;
+  r->used=at+size;
+  pthread_mutex_unlock(&arena->lock);
+  return(p);
+}
+
+static void ArenaFree(void* context, void* p, size_t size) {
+  rb_node_arena* arena=(rb_node_arena*) context;
+  int cls= size ? (int) ((size-1)/16) : 0;
+
+  pthread_mutex_lock(&arena->lock);
+  *(void**) p=arena->freeLists[cls];
+  arena->freeLists[cls]=p;
+  pthread_mutex_unlock(&arena->lock);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBNodeArenaCreate */
+/**/
+/*    INPUTS:  regionSize is how many bytes of address space to */
+/*             reserve at a time, and hugePages whether to ask for */
+/*             transparent huge pages */
+/**/
+/*    OUTPUT:  the arena.  Nothing is reserved until the first */
+/*             allocation. */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+rb_node_arena* RBNodeArenaCreate(size_t regionSize, int hugePages) {
+  rb_node_arena* arena=(rb_node_arena*) SafeMalloc(sizeof(rb_node_arena));
+
+  arena->allocator.Alloc=ArenaAlloc;
+  arena->allocator.Free=ArenaFree;
+  arena->allocator.context=arena;
+  arena->regionSize= regionSize ? regionSize : 1;
+#ifdef MADV_HUGEPAGE
+  arena->hugePages=hugePages;
+#else
+  arena->hugePages=0;
+#endif
+  pthread_mutex_init(&arena->lock,NULL);
+  arena->regions=NULL;
+  memset(arena->freeLists,0,sizeof(arena->freeLists));
+  return(arena);
+}
+
+/*  unmaps every region; no tree may be using the arena any more */
+
+void RBNodeArenaDestroy(rb_node_arena* arena) {
+  rb_arena_region* r;
+
+  while ( (r=arena->regions) ) { /* assignment */
+    arena->regions=r->next;
+    munmap(r->base,r->bytes);
+    free(r);
+  }
+  pthread_mutex_destroy(&arena->lock);
+  free(arena);
+}
+
+/*  Sums the AnonHugePages lines of /proc/self/smaps over the arena's */
+/*  regions.  A mapping the kernel has merged with a neighbour's is */
+/*  counted in proportion to how much of it is the arena's. */
+
+static long HugePagesIn(rb_node_arena* arena) {
+#ifdef __linux__
+  FILE* f=fopen("/proc/self/smaps","r");
+  rb_arena_region* r;
+  unsigned long start, end, lo, hi;
+  double share=0, kb=0;
+  char line[256];
+  long pageKb;
+
+  if (!f) return(0);
+  while (fgets(line,sizeof(line),f)) {
+    if (sscanf(line,"%lx-%lx ",&start,&end) == 2) {
+      share=0;
+      for (r=arena->regions; r; r=r->next) {
+	lo= (start > (uintptr_t) r->base) ? start : (uintptr_t) r->base;
+	hi= (end < (uintptr_t) r->base+r->bytes) ? end :
+	  (uintptr_t) r->base+r->bytes;
+	if (hi > lo) share+=(double) (hi-lo)/(end-start);
+      }
+    } else if ( (share > 0) &&
+		(sscanf(line,"AnonHugePages: %ld kB",&pageKb) == 1) ) {
+      kb+=share*pageKb;
+    }
+  }
+  fclose(f);
+  return((long) (kb*1024/RB_HUGE_PAGE+0.5));
+#else
+  return(0);
+#endif
+}
+
+/*  fills stats in; reading the huge page count takes a pass over */
+/*  /proc/self/smaps, so this is not for a hot path */
+
+void RBNodeArenaGetStats(rb_node_arena* arena, rb_node_arena_stats* stats) {
+  rb_arena_region* r;
+
+  pthread_mutex_lock(&arena->lock);
+  memset(stats,0,sizeof(rb_node_arena_stats));
+  for (r=arena->regions; r; r=r->next) {
+    stats->reservedBytes+=r->bytes;
+    stats->usedBytes+=r->used;
+    stats->regions++;
+  }
+  stats->hugePages=HugePagesIn(arena);
+  pthread_mutex_unlock(&arena->lock);
+}
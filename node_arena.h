@@ -0,0 +1,53 @@
+#include"red_black_tree.h"
+#include<pthread.h>
+
+#ifndef INC_NODE_ARENA_
+#define INC_NODE_ARENA_
+
+/*  An rb_allocator which hands out nodes from large regions reserved */
+/*  with mmap, so that the nodes of a big tree sit on few pages and a */
+/*  lookup takes few TLB misses.  With hugePages set each region is */
+/*  aligned to RB_HUGE_PAGE bytes and madvised for transparent huge */
+/*  pages.  The kernel backs it with them as it is touched if it has */
+/*  them to give, and with ordinary pages otherwise; */
+/*  RBNodeArenaGetStats reports how many it actually got. */
+/**/
+/*  Objects of up to RB_ARENA_MAX_OBJECT bytes are carved off the */
+/*  current region in multiples of 16 bytes, those of 64 bytes or */
+/*  more aligned to cache lines.  Freed objects wait on a list for */
+/*  their size and are reused; memory only goes back to the system */
+/*  when the arena is destroyed, after every tree using it.  When a */
+/*  region is full another is reserved.  A lock makes the arena safe */
+/*  to use from several threads, as RBParallelDestroy does. */
+
+#define RB_HUGE_PAGE (2*1024*1024)
+#define RB_ARENA_MAX_OBJECT 256
+
+typedef struct rb_arena_region {
+  char* base;
+  size_t bytes;
+  size_t used; /* bytes carved off so far */
+  struct rb_arena_region* next;
+} rb_arena_region;
+
+typedef struct rb_node_arena {
+  rb_allocator allocator; /* pass &arena->allocator to RBTreeUseAllocator */
+  size_t regionSize;
+  int hugePages; /* set if regions are madvised for huge pages */
+  pthread_mutex_t lock;
+  rb_arena_region* regions; /* the current one first */
+  void* freeLists[RB_ARENA_MAX_OBJECT/16];
+} rb_node_arena;
+
+typedef struct rb_node_arena_stats {
+  size_t reservedBytes;
+  size_t usedBytes; /* carved off, freed objects included */
+  int regions;
+  long hugePages; /* huge pages backing the regions; 0 if unknown */
+} rb_node_arena_stats;
+
+rb_node_arena* RBNodeArenaCreate(size_t regionSize, int hugePages);
+void RBNodeArenaDestroy(rb_node_arena*);
+void RBNodeArenaGetStats(rb_node_arena*, rb_node_arena_stats*);
+
+#endif
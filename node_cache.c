@@ -0,0 +1,324 @@
+#include "node_cache.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*  per-thread state; only the owning thread touches the free lists, */
+/*  the counters are atomic so NodeCacheGetStats can read them while */
+/*  the owner is running */
+typedef struct rb_thread_cache {
+  void* freeList[RB_NODE_CACHE_CLASSES];
+  int freeCount[RB_NODE_CACHE_CLASSES];
+  atomic_long liveBytes;
+  atomic_long liveObjects;
+  atomic_ulong allocs;
+  atomic_ulong frees;
+  atomic_ulong slabBytes;
+  struct rb_thread_cache* next;
+  struct rb_thread_cache* prev;
+} rb_thread_cache;
+
+/*  a chain of free objects of one size class waiting in the depot */
+typedef struct rb_chain {
+  void* head;
+  int count;
+} rb_chain;
+
+typedef struct rb_depot {
+  rb_chain* chains;
+  int n;
+  int capacity;
+} rb_depot;
+
+static pthread_mutex_t gCacheLock=PTHREAD_MUTEX_INITIALIZER;
+static rb_depot gDepot[RB_NODE_CACHE_CLASSES];
+static rb_thread_cache* gThreadCaches=NULL;
+static rb_node_cache_stats gRetired; /* totals from threads which exited */
+static pthread_once_t gKeyOnce=PTHREAD_ONCE_INIT;
+static pthread_key_t gKey;
+static _Thread_local rb_thread_cache* gThreadCache=NULL;
+static _Thread_local int gThreadRetired=0; /* set once RetireCache ran */
+
+/*  Only the owning thread writes its counters, so a plain load and */
+/*  store is enough; it avoids a locked read-modify-write on the hot */
+/*  path. */
+#define BUMP(counter,amount) \
+  atomic_store_explicit(&(counter), \
+    atomic_load_explicit(&(counter),memory_order_relaxed)+(amount), \
+    memory_order_relaxed)
+
+#define READ(counter) atomic_load_explicit(&(counter),memory_order_relaxed)
+
+/***********************************************************************/
+/*  FUNCTION:  DepotPush */
+/**/
+/*    INPUTS:  cls is a size class and head/count describe a chain of */
+/*             free objects of that class. */
+/**/
+/*    OUTPUT:  none */
+/**/
+/*    EFFECT:  hands the chain to the shared depot.  The caller must */
+/*             hold gCacheLock. */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+static void DepotPush(int cls, void* head, int count) {
+  rb_depot* depot=&gDepot[cls];
+
+  if (depot->n == depot->capacity) {
+    depot->capacity=depot->capacity ? 2*depot->capacity : 16;
+    depot->chains=(rb_chain*) realloc(depot->chains,
+				      depot->capacity*sizeof(rb_chain));
+    Assert(depot->chains != NULL,"realloc failed in DepotPush");
+  }
+  depot->chains[depot->n].head=head;
+  depot->chains[depot->n].count=count;
+  depot->n++;
+}
+
+static void FlushCache(rb_thread_cache* tc) {
+  int cls;
+
+  pthread_mutex_lock(&gCacheLock);
+  for (cls=0; cls<RB_NODE_CACHE_CLASSES; cls++) {
+    if (tc->freeCount[cls]) DepotPush(cls,tc->freeList[cls],tc->freeCount[cls]);
+    tc->freeList[cls]=NULL;
+    tc->freeCount[cls]=0;
+  }
+  pthread_mutex_unlock(&gCacheLock);
+}
+
+/*  runs when a thread which used the cache exits.  Other thread */
+/*  specific destructors may still allocate or free nodes after it, so */
+/*  the thread is marked retired and ThreadCache will not build it a */
+/*  new cache. */
+static void RetireCache(void* arg) {
+  rb_thread_cache* tc=(rb_thread_cache*) arg;
+
+  gThreadCache=NULL;
+  gThreadRetired=1;
+  FlushCache(tc);
+  pthread_mutex_lock(&gCacheLock);
+  gRetired.liveBytes+=READ(tc->liveBytes);
+  gRetired.liveObjects+=READ(tc->liveObjects);
+  gRetired.allocs+=READ(tc->allocs);
+  gRetired.frees+=READ(tc->frees);
+  gRetired.slabBytes+=READ(tc->slabBytes);
+  if (tc->prev) tc->prev->next=tc->next; else gThreadCaches=tc->next;
+  if (tc->next) tc->next->prev=tc->prev;
+  pthread_mutex_unlock(&gCacheLock);
+  free(tc);
+}
+
+static void MakeKey(void) {
+  pthread_key_create(&gKey,RetireCache);
+}
+
+/*  returns the calling thread's cache, or NULL if the thread is being */
+/*  torn down or no cache could be allocated */
+static rb_thread_cache* ThreadCache(void) {
+  rb_thread_cache* tc=gThreadCache;
+
+  if (tc || gThreadRetired) return(tc);
+  tc=(rb_thread_cache*) calloc(1,sizeof(rb_thread_cache));
+  if (!tc) return(NULL);
+  pthread_once(&gKeyOnce,MakeKey);
+  pthread_setspecific(gKey,tc);
+  pthread_mutex_lock(&gCacheLock);
+  tc->next=gThreadCaches;
+  if (gThreadCaches) gThreadCaches->prev=tc;
+  gThreadCaches=tc;
+  gRetired.threads++;
+  pthread_mutex_unlock(&gCacheLock);
+  gThreadCache=tc;
+  return(tc);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  Refill */
+/**/
+/*    INPUTS:  tc is the calling thread's cache whose free list for */
+/*             size class cls is empty. */
+/**/
+/*    OUTPUT:  0 if no memory could be found, 1 otherwise */
+/**/
+/*    EFFECT:  takes a chain from the depot, or failing that carves a */
+/*             new slab into objects of the class size. */
+/**/
+/*    Modifies Input: tc */
+/***********************************************************************/
+
+static int Refill(rb_thread_cache* tc, int cls) {
+  size_t objSize=(cls+1)*RB_NODE_CACHE_GRAIN;
+  rb_depot* depot=&gDepot[cls];
+  char* slab;
+  int i, n;
+
+  pthread_mutex_lock(&gCacheLock);
+  if (depot->n) {
+    depot->n--;
+    tc->freeList[cls]=depot->chains[depot->n].head;
+    tc->freeCount[cls]=depot->chains[depot->n].count;
+    pthread_mutex_unlock(&gCacheLock);
+    return(1);
+  }
+  pthread_mutex_unlock(&gCacheLock);
+
+  if (!(slab=(char*) TryMalloc(RB_NODE_SLAB_SIZE))) return(0); /* assignment */
+  BUMP(tc->slabBytes,RB_NODE_SLAB_SIZE);
+  n=RB_NODE_SLAB_SIZE/objSize;
+  for (i=0; i<n-1; i++) {
+    *(void**)(slab+i*objSize)=slab+(i+1)*objSize;
+  }
+  *(void**)(slab+(n-1)*objSize)=NULL;
+  tc->freeList[cls]=slab;
+  tc->freeCount[cls]=n;
+  return(1);
+}
+
+/*  NoCacheAlloc and NoCacheFree serve a thread which has no cache and */
+/*  count what they do in gRetired.  An object of a small class may */
+/*  have been carved from a slab, so rather than going back to free it */
+/*  is left in the depot as a chain of one. */
+
+static void* NoCacheAlloc(size_t size, int cls) {
+  size_t allocSize=cls < RB_NODE_CACHE_CLASSES ?
+    (cls+1)*RB_NODE_CACHE_GRAIN : size;
+  void* result=TryMalloc(allocSize);
+
+  if (result) {
+    pthread_mutex_lock(&gCacheLock);
+    gRetired.liveBytes+=size;
+    gRetired.liveObjects++;
+    gRetired.allocs++;
+    if (cls < RB_NODE_CACHE_CLASSES) gRetired.slabBytes+=allocSize;
+    pthread_mutex_unlock(&gCacheLock);
+  }
+  return(result);
+}
+
+static void NoCacheFree(void* p, size_t size, int cls) {
+  pthread_mutex_lock(&gCacheLock);
+  gRetired.liveBytes-=size;
+  gRetired.liveObjects--;
+  gRetired.frees++;
+  if (cls < RB_NODE_CACHE_CLASSES) {
+    *(void**)p=NULL;
+    DepotPush(cls,p,1);
+  }
+  pthread_mutex_unlock(&gCacheLock);
+  if (cls >= RB_NODE_CACHE_CLASSES) SafeFree(p,size);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  NodeCacheAlloc */
+/**/
+/*    INPUTS:  size is the number of bytes needed */
+/**/
+/*    OUTPUT:  a pointer aligned to RB_NODE_CACHE_GRAIN, or NULL if */
+/*             TryMalloc could not hand out more memory */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+void* NodeCacheAlloc(size_t size) {
+  rb_thread_cache* tc=ThreadCache();
+  int cls=size ? (size-1)/RB_NODE_CACHE_GRAIN : 0;
+  void* result;
+
+  if (!tc) return(NoCacheAlloc(size,cls));
+  if (cls >= RB_NODE_CACHE_CLASSES) {
+    result=TryMalloc(size);
+  } else {
+    if (!tc->freeList[cls] && !Refill(tc,cls)) return(NULL);
+    result=tc->freeList[cls];
+    tc->freeList[cls]=*(void**)result;
+    tc->freeCount[cls]--;
+  }
+  if (result) {
+    BUMP(tc->liveBytes,(long)size);
+    BUMP(tc->liveObjects,1);
+    BUMP(tc->allocs,1);
+  }
+  return(result);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  NodeCacheFree */
+/**/
+/*    INPUTS:  p was returned by NodeCacheAlloc(size), possibly on a */
+/*             different thread */
+/**/
+/*    OUTPUT:  none */
+/**/
+/*    EFFECT:  puts p on the calling thread's free list, handing a full */
+/*             magazine to the depot if the list has grown too long. */
+/**/
+/*    Modifies Input: p */
+/***********************************************************************/
+
+void NodeCacheFree(void* p, size_t size) {
+  rb_thread_cache* tc=ThreadCache();
+  int cls=size ? (size-1)/RB_NODE_CACHE_GRAIN : 0;
+  void* last;
+  int i;
+
+  if (!tc) {
+    NoCacheFree(p,size,cls);
+    return;
+  }
+  BUMP(tc->liveBytes,-(long)size);
+  BUMP(tc->liveObjects,-1);
+  BUMP(tc->frees,1);
+  if (cls >= RB_NODE_CACHE_CLASSES) {
+    SafeFree(p,size);
+    return;
+  }
+  *(void**)p=tc->freeList[cls];
+  tc->freeList[cls]=p;
+  if (++tc->freeCount[cls] > 2*RB_MAGAZINE_SIZE) {
+    last=p;
+    for (i=1; i<RB_MAGAZINE_SIZE; i++) last=*(void**)last;
+    tc->freeList[cls]=*(void**)last;
+    *(void**)last=NULL;
+    tc->freeCount[cls]-=RB_MAGAZINE_SIZE;
+    pthread_mutex_lock(&gCacheLock);
+    DepotPush(cls,p,RB_MAGAZINE_SIZE);
+    pthread_mutex_unlock(&gCacheLock);
+  }
+}
+
+/*  NodeCacheFlush hands every object cached by the calling thread to */
+/*  the depot, e.g. before a thread goes idle for a long time */
+
+void NodeCacheFlush(void) {
+  if (gThreadCache) FlushCache(gThreadCache);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  NodeCacheGetStats */
+/**/
+/*    INPUTS:  stats is where to store the totals */
+/**/
+/*    OUTPUT:  none */
+/**/
+/*    EFFECT:  sums the counters of every thread, living or exited. */
+/*             The result is exact when no other thread is allocating. */
+/**/
+/*    Modifies Input: stats */
+/***********************************************************************/
+
+void NodeCacheGetStats(rb_node_cache_stats* stats) {
+  rb_thread_cache* tc;
+
+  pthread_mutex_lock(&gCacheLock);
+  *stats=gRetired;
+  for (tc=gThreadCaches; tc; tc=tc->next) {
+    stats->liveBytes+=READ(tc->liveBytes);
+    stats->liveObjects+=READ(tc->liveObjects);
+    stats->allocs+=READ(tc->allocs);
+    stats->frees+=READ(tc->frees);
+    stats->slabBytes+=READ(tc->slabBytes);
+  }
+  pthread_mutex_unlock(&gCacheLock);
+}
@@ -0,0 +1,40 @@
+#include"misc.h"
+
+#ifndef INC_NODE_CACHE_
+#define INC_NODE_CACHE_
+
+/*  A thread-aware allocator for tree nodes.  Each thread keeps its own */
+/*  free lists ("magazines") for a handful of small size classes, so */
+/*  the common alloc/free path touches no shared state at all.  When a */
+/*  thread's magazine overflows it hands a full magazine to a shared */
+/*  depot and when it runs dry it takes one back, or carves a new slab */
+/*  from TryMalloc.  Slabs are never returned to the system; cached */
+/*  objects are reused by whichever thread frees them.  A thread whose */
+/*  cache has already been retired at exit goes straight to TryMalloc */
+/*  and the depot instead. */
+/**/
+/*  Memory accounting is also kept per thread and only summed when */
+/*  NodeCacheGetStats is called.  A node allocated by one thread and */
+/*  freed by another leaves one thread's count high and the other's */
+/*  low; the sum is still exact. */
+
+#define RB_NODE_CACHE_GRAIN 16
+#define RB_NODE_CACHE_CLASSES 16 /* objects of up to 256 bytes */
+#define RB_MAGAZINE_SIZE 64
+#define RB_NODE_SLAB_SIZE (64*1024)
+
+typedef struct rb_node_cache_stats {
+  long liveBytes; /* bytes handed out and not yet freed */
+  long liveObjects;
+  unsigned long allocs;
+  unsigned long frees;
+  unsigned long slabBytes; /* bytes obtained from TryMalloc */
+  int threads; /* threads which have used the cache */
+} rb_node_cache_stats;
+
+void* NodeCacheAlloc(size_t size);
+void NodeCacheFree(void* p, size_t size);
+void NodeCacheFlush(void);
+void NodeCacheGetStats(rb_node_cache_stats* stats);
+
+#endif
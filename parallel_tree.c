@@ -0,0 +1,902 @@
+#include "parallel_tree.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sched.h>
+#include <assert.h>
+
+/*  RunJobs calls Work on each of nJobs job records, on nJobs threads */
+/*  counting the calling thread, and returns once they are all done. */
+/*  A job whose thread cannot be created runs on the calling thread. */
+
+static void RunJobs(void* (*Work)(void*), void* jobs, size_t jobSize,
+		    int nJobs) {
+  pthread_t threads[nJobs > 1 ? nJobs-1 : 1];
+  int started[nJobs > 1 ? nJobs-1 : 1];
+  int i;
+
+  for (i=1; i<nJobs; i++) {
+    started[i-1]=!pthread_create(&threads[i-1],NULL,Work,
+				 (char*)jobs+i*jobSize);
+    if (!started[i-1]) Work((char*)jobs+i*jobSize);
+  }
+  Work(jobs);
+  for (i=1; i<nJobs; i++) {
+    if (started[i-1]) pthread_join(threads[i-1],NULL);
+  }
+}
+
+typedef struct rb_sort_job {
+  rb_red_blk_tree* tree;
+  rb_build_item* src;
+  rb_build_item* dst;
+  long n;
+  long lo; /* the range of items or of merged output this job owns */
+  long hi;
+  long width; /* length of the sorted runs being merged */
+} rb_sort_job;
+
+/*  merges count items of the sorted runs a and b into out, starting */
+/*  at a[i] and b[j].  Ties go to a, which keeps the sort stable. */
+
+static void MergeRuns(rb_red_blk_tree* tree, rb_build_item* a, long na,
+		      rb_build_item* b, long nb, long i, long j,
+		      rb_build_item* out, long count) {
+  while (count--) {
+    if ( (j >= nb) || ( (i < na) && (1 != tree->Compare(a[i].key,b[j].key)) ) ) {
+      *out++=a[i++];
+    } else {
+      *out++=b[j++];
+    }
+  }
+}
+
+/***********************************************************************/
+/*  FUNCTION:  CoRank */
+/**/
+/*    INPUTS:  a and b are sorted runs of na and nb items and k is a */
+/*             position in their merge */
+/**/
+/*    OUTPUT:  how many of the first k merged items come from a */
+/**/
+/*    Modifies Input: none */
+/**/
+/*    EFFECT:  binary search, so that several threads can each merge */
+/*             their own slice of the output independently */
+/***********************************************************************/
+
+static long CoRank(rb_red_blk_tree* tree, rb_build_item* a, long na,
+		   rb_build_item* b, long nb, long k) {
+  long lo= (k > nb) ? k-nb : 0;
+  long hi= (k < na) ? k : na;
+  long i, j;
+
+  while (1) {
+    i=lo+(hi-lo)/2;
+    j=k-i;
+    if ( (i > 0) && (j < nb) && (1 == tree->Compare(a[i-1].key,b[j].key)) ) {
+      hi=i-1; /* a[i-1] comes after b[j], so fewer items from a */
+    } else if ( (j > 0) && (i < na) &&
+		(1 != tree->Compare(a[i].key,b[j-1].key)) ) {
+      lo=i+1; /* a[i] comes before b[j-1], so more items from a */
+    } else {
+      return(i);
+    }
+  }
+}
+
+/*  sorts the n items with a bottom-up merge sort, leaving the result */
+/*  in items; scratch must have room for n items */
+
+static void SortRange(rb_red_blk_tree* tree, rb_build_item* items,
+		      rb_build_item* scratch, long n) {
+  rb_build_item* from=items;
+  rb_build_item* to=scratch;
+  rb_build_item* swap;
+  long width, lo, mid, hi;
+
+  for (width=1; width<n; width*=2) {
+    for (lo=0; lo<n; lo+=2*width) {
+      mid= (lo+width < n) ? lo+width : n;
+      hi= (lo+2*width < n) ? lo+2*width : n;
+      MergeRuns(tree,from+lo,mid-lo,from+mid,hi-mid,0,0,to+lo,hi-lo);
+    }
+    swap=from; from=to; to=swap;
+  }
+  if (from != items) memcpy(items,from,n*sizeof(rb_build_item));
+}
+
+static void* SortChunk(void* arg) {
+  rb_sort_job* job=(rb_sort_job*) arg;
+
+  if (job->lo < job->hi) {
+    SortRange(job->tree,job->src+job->lo,job->dst+job->lo,job->hi-job->lo);
+  }
+  return(NULL);
+}
+
+/*  writes merged output positions [lo,hi) for one round of merging */
+/*  runs of the given width from src into dst */
+
+static void* MergeSlice(void* arg) {
+  rb_sort_job* job=(rb_sort_job*) arg;
+  long pos=job->lo;
+  long pairLo, mid, pairHi, end, i;
+
+  while (pos < job->hi) {
+    pairLo=(pos/(2*job->width))*2*job->width;
+    mid= (pairLo+job->width < job->n) ? pairLo+job->width : job->n;
+    pairHi= (pairLo+2*job->width < job->n) ? pairLo+2*job->width : job->n;
+    end= (job->hi < pairHi) ? job->hi : pairHi;
+    i=CoRank(job->tree,job->src+pairLo,mid-pairLo,job->src+mid,pairHi-mid,
+	     pos-pairLo);
+    MergeRuns(job->tree,job->src+pairLo,mid-pairLo,job->src+mid,pairHi-mid,
+	      i,pos-pairLo-i,job->dst+pos,end-pos);
+    pos=end;
+  }
+  return(NULL);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBParallelSort */
+/**/
+/*    INPUTS:  tree supplies the Compare function, items is an array of */
+/*             n items and nThreads is how many threads to use */
+/**/
+/*    OUTPUT:  0 if there was no memory for the merge buffer, in which */
+/*             case items is unchanged, 1 otherwise */
+/**/
+/*    EFFECT:  stable merge sort of items by key.  Each thread first */
+/*             sorts its own chunk; then every round of merging is */
+/*             split evenly across the threads by output position. */
+/**/
+/*    Modifies Input: items */
+/***********************************************************************/
+
+int RBParallelSort(rb_red_blk_tree* tree, rb_build_item* items, long n,
+		   int nThreads) {
+  rb_sort_job jobs[nThreads > 0 ? nThreads : 1];
+  rb_build_item* scratch;
+  rb_build_item* src=items;
+  rb_build_item* dst;
+  rb_build_item* swap;
+  long width;
+  int t;
+
+  if (n < 2) return(1);
+  if (nThreads < 1) nThreads=1;
+  if (nThreads > n) nThreads=n;
+  scratch=(rb_build_item*) TryMalloc(n*sizeof(rb_build_item));
+  if (!scratch) return(0);
+  dst=scratch;
+  width=(n+nThreads-1)/nThreads;
+  for (t=0; t<nThreads; t++) {
+    jobs[t].tree=tree;
+    jobs[t].src=items;
+    jobs[t].dst=scratch;
+    jobs[t].n=n;
+    jobs[t].lo= (t*width < n) ? t*width : n;
+    jobs[t].hi= ((t+1)*width < n) ? (t+1)*width : n;
+  }
+  RunJobs(SortChunk,jobs,sizeof(rb_sort_job),nThreads);
+
+  for (; width<n; width*=2) {
+    for (t=0; t<nThreads; t++) {
+      jobs[t].src=src;
+      jobs[t].dst=dst;
+      jobs[t].width=width;
+      jobs[t].lo=t*n/nThreads;
+      jobs[t].hi=(t+1)*n/nThreads;
+    }
+    RunJobs(MergeSlice,jobs,sizeof(rb_sort_job),nThreads);
+    swap=src; src=dst; dst=swap;
+  }
+  if (src != items) memcpy(items,src,n*sizeof(rb_build_item));
+  SafeFree(scratch,n*sizeof(rb_build_item));
+  return(1);
+}
+
+/*  hands out consecutive items of a sorted array to RBBuildSubtree */
+
+typedef struct rb_array_cursor {
+  rb_build_item* items;
+  long next;
+} rb_array_cursor;
+
+static int ArrayNextItem(void* context, void** key, void** info) {
+  rb_array_cursor* cursor=(rb_array_cursor*) context;
+
+  *key=cursor->items[cursor->next].key;
+  *info=cursor->items[cursor->next].info;
+  cursor->next++;
+  return(1);
+}
+
+/*  one subtree below the top levels, built by whichever thread takes it */
+
+typedef struct rb_build_task {
+  long lo;
+  long n;
+  int depth;
+  rb_red_blk_node* parent;
+  int isLeft; /* hang the subtree on parent->left, else parent->right */
+} rb_build_task;
+
+typedef struct rb_build_job {
+  rb_red_blk_tree* tree;
+  rb_build_item* items;
+  rb_build_task* tasks;
+  int nTasks;
+  int redDepth;
+  atomic_int* nextTask;
+  atomic_int* failed;
+} rb_build_job;
+
+static void* BuildTasks(void* arg) {
+  rb_build_job* job=(rb_build_job*) arg;
+  rb_build_task* task;
+  rb_red_blk_node* sub;
+  rb_array_cursor cursor;
+  int t;
+
+  while ( (t=atomic_fetch_add(job->nextTask,1)) < job->nTasks) {
+    task=&job->tasks[t];
+    cursor.items=job->items+task->lo;
+    cursor.next=0;
+    sub=RBBuildSubtree(job->tree,task->n,task->depth,job->redDepth,
+		       ArrayNextItem,&cursor);
+    if (!sub) {
+      atomic_store(job->failed,1);
+      sub=job->tree->nil;
+    }
+    if (task->isLeft) task->parent->left=sub; else task->parent->right=sub;
+    if (sub != job->tree->nil) sub->parent=task->parent;
+  }
+  return(NULL);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  SplitTop */
+/**/
+/*    INPUTS:  items[lo..lo+n) is the sorted range for the subtree at */
+/*             depth which hangs off parent; levels is how many more */
+/*             levels to build here before handing out tasks */
+/**/
+/*    OUTPUT:  0 if the allocator failed, 1 otherwise */
+/**/
+/*    EFFECT:  builds the top levels of the tree on the calling thread */
+/*             and records every range below them as a task.  Ranges */
+/*             are split exactly as RBBuildSubtree splits them, so the */
+/*             pieces fit together into one balanced tree. */
+/**/
+/*    Modifies Input: tree, tasks, nTasks */
+/***********************************************************************/
+
+static int SplitTop(rb_red_blk_tree* tree, rb_build_item* items, long lo,
+		    long n, int depth, int redDepth, int levels,
+		    rb_red_blk_node* parent, int isLeft,
+		    rb_build_task* tasks, int* nTasks) {
+  rb_red_blk_node* x;
+  long nLeft=(n-1)/2;
+
+  if ( (levels == 0) || (n == 0) ) {
+    tasks[*nTasks].lo=lo;
+    tasks[*nTasks].n=n;
+    tasks[*nTasks].depth=depth;
+    tasks[*nTasks].parent=parent;
+    tasks[*nTasks].isLeft=isLeft;
+    (*nTasks)++;
+    return(1);
+  }
+  if (!(x=RBNodeAlloc(tree))) return(0); /* assignment */
+  RBNodeSetKey(tree,x,items[lo+nLeft].key);
+  x->info=items[lo+nLeft].info;
+  x->red=tree->balance->BuiltLabel(n,depth,redDepth);
+  x->left=x->right=tree->nil;
+  x->parent=parent;
+  if (isLeft) parent->left=x; else parent->right=x;
+  return(SplitTop(tree,items,lo,nLeft,depth+1,redDepth,levels-1,x,1,
+		  tasks,nTasks) &&
+	 SplitTop(tree,items,lo+nLeft+1,n-1-nLeft,depth+1,redDepth,levels-1,
+		  x,0,tasks,nTasks));
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeBuildParallel */
+/**/
+/*    INPUTS:  the functions are as for RBTreeCreate.  keys and infos */
+/*             are arrays of n keys and infos in any order (infos may */
+/*             be NULL, meaning every info is 0) and nThreads is how */
+/*             many threads to use. */
+/**/
+/*    OUTPUT:  a new red-black tree holding every key, or NULL if memory */
+/*             ran out.  In that case none of the keys and infos has */
+/*             been destroyed: they all still belong to the caller. */
+/**/
+/*    Modifies Input: none */
+/**/
+/*    EFFECT:  sorts the items with RBParallelSort and then builds a */
+/*             tree of minimum height from them in linear work: the */
+/*             top few levels on this thread and the subtrees below */
+/*             them on nThreads threads.  Much faster than calling */
+/*             RBTreeInsert n times since nothing is compared twice */
+/*             and nothing is rotated. */
+/***********************************************************************/
+
+rb_red_blk_tree* RBTreeBuildParallel(int (*CompFunc)(const void*, const void*),
+				     void (*DestFunc)(void*),
+				     void (*InfoDestFunc)(void*),
+				     void (*PrintFunc)(const void*),
+				     void (*PrintInfo)(void*),
+				     void** keys, void** infos, long n,
+				     int nThreads) {
+  rb_red_blk_tree* tree;
+  rb_build_item* items;
+  rb_build_task* tasks;
+  rb_build_job* jobs;
+  atomic_int nextTask;
+  atomic_int failed;
+  int levels=0;
+  int nTasks=0;
+  long t;
+
+  tree=RBTreeCreate(CompFunc,DestFunc,InfoDestFunc,PrintFunc,PrintInfo);
+  if (n <= 0) return(tree);
+  if (nThreads < 1) nThreads=1;
+  if (!(items=(rb_build_item*) TryMalloc(n*sizeof(rb_build_item)))) {
+    RBTreeDestroy(tree);
+    return(NULL);
+  }
+  for (t=0; t<n; t++) {
+    items[t].key=keys[t];
+    items[t].info= infos ? infos[t] : 0;
+  }
+  if (!RBParallelSort(tree,items,n,nThreads)) {
+    SafeFree(items,n*sizeof(rb_build_item));
+    RBTreeDestroy(tree);
+    return(NULL);
+  }
+
+  /* four tasks per thread keeps the threads busy when they run at */
+  /* different speeds */
+  while ( ((1L << levels) < 4L*nThreads) && ((1L << levels) < n) ) levels++;
+  tasks=(rb_build_task*) TryMalloc((1 << levels)*sizeof(rb_build_task));
+  jobs=(rb_build_job*) TryMalloc(nThreads*sizeof(rb_build_job));
+  atomic_init(&nextTask,0);
+  atomic_init(&failed,0);
+  /* a failed subtree frees its nodes as it unwinds; keep it from */
+  /* destroying the caller's keys until the whole tree is built */
+  tree->DestroyKey=NullFunction;
+  tree->DestroyInfo=NullFunction;
+  if (!tasks || !jobs ||
+      !SplitTop(tree,items,0,n,0,RBBalancedRedDepth(n),levels,tree->root,1,
+		tasks,&nTasks)) {
+    atomic_store(&failed,1); /* the untouched ranges are simply left out */
+  } else {
+    for (t=0; t<nThreads; t++) {
+      jobs[t].tree=tree;
+      jobs[t].items=items;
+      jobs[t].tasks=tasks;
+      jobs[t].nTasks=nTasks;
+      jobs[t].redDepth=RBBalancedRedDepth(n);
+      jobs[t].nextTask=&nextTask;
+      jobs[t].failed=&failed;
+    }
+    RunJobs(BuildTasks,jobs,sizeof(rb_build_job),nThreads);
+  }
+  tree->count=n;
+  SafeFree(items,n*sizeof(rb_build_item));
+  if (tasks) SafeFree(tasks,(1 << levels)*sizeof(rb_build_task));
+  if (jobs) SafeFree(jobs,nThreads*sizeof(rb_build_job));
+  if (atomic_load(&failed)) {
+    RBTreeDestroy(tree);
+    return(NULL);
+  }
+  tree->DestroyKey=DestFunc;
+  tree->DestroyInfo=InfoDestFunc;
+  return(tree);
+}
+
+/*  The traversals below run on a small work-stealing pool.  Each */
+/*  worker has a deque of tasks, each task being a subtree.  A worker */
+/*  takes tasks from the back of its own deque and, when that is */
+/*  empty, steals from the front of the others', where the biggest */
+/*  subtrees sit.  Near the root a worker pushes the right child of */
+/*  every node it visits as a new task and carries on down the left; */
+/*  below splitDepth it just walks the subtree itself. */
+
+typedef struct rb_ws_task {
+  rb_red_blk_node* node;
+  int depth;
+  int piece; /* index into the piece list, or -1 for a plain subtree */
+} rb_ws_task;
+
+typedef struct rb_ws_deque {
+  pthread_mutex_t lock;
+  rb_ws_task* tasks;
+  int head; /* thieves take from here */
+  int tail; /* the owner pushes and pops here */
+  int capacity;
+} rb_ws_deque;
+
+typedef struct rb_ws_pool rb_ws_pool;
+
+struct rb_ws_pool {
+  rb_red_blk_tree* tree;
+  int nWorkers;
+  int splitDepth;
+  rb_ws_deque* deques;
+  atomic_long pending; /* tasks pushed and not yet finished */
+  /* called for every node of a plain subtree task, after its */
+  /* children have been read, so it may free the node */
+  void (*Visit)(rb_ws_pool*, int worker, rb_red_blk_node*);
+  /* called for a piece task */
+  void (*RunPiece)(rb_ws_pool*, int worker, int piece);
+  void* context;
+};
+
+typedef struct rb_ws_worker {
+  rb_ws_pool* pool;
+  int id;
+} rb_ws_worker;
+
+static void PoolPush(rb_ws_pool* pool, int worker, rb_ws_task task) {
+  rb_ws_deque* deque=&pool->deques[worker];
+
+  atomic_fetch_add(&pool->pending,1);
+  pthread_mutex_lock(&deque->lock);
+  if (deque->tail == deque->capacity) {
+    /* slide the live tasks down or grow the array */
+    if (deque->head > 0) {
+      memmove(deque->tasks,deque->tasks+deque->head,
+	      (deque->tail-deque->head)*sizeof(rb_ws_task));
+      deque->tail-=deque->head;
+      deque->head=0;
+    } else {
+      deque->capacity*=2;
+      deque->tasks=(rb_ws_task*) realloc(deque->tasks,
+					 deque->capacity*sizeof(rb_ws_task));
+      Assert(deque->tasks != NULL,"realloc failed in PoolPush");
+    }
+  }
+  deque->tasks[deque->tail++]=task;
+  pthread_mutex_unlock(&deque->lock);
+}
+
+static int PoolTake(rb_ws_pool* pool, int worker, rb_ws_task* task) {
+  rb_ws_deque* deque=&pool->deques[worker];
+  int i, victim;
+
+  pthread_mutex_lock(&deque->lock);
+  if (deque->tail > deque->head) {
+    *task=deque->tasks[--deque->tail];
+    pthread_mutex_unlock(&deque->lock);
+    return(1);
+  }
+  pthread_mutex_unlock(&deque->lock);
+  for (i=1; i<pool->nWorkers; i++) {
+    victim=(worker+i)%pool->nWorkers;
+    deque=&pool->deques[victim];
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail > deque->head) {
+      *task=deque->tasks[deque->head++];
+      pthread_mutex_unlock(&deque->lock);
+      return(1);
+    }
+    pthread_mutex_unlock(&deque->lock);
+  }
+  return(0);
+}
+
+/*  walks a whole subtree on this worker; children are read before the */
+/*  node is visited */
+
+static void VisitSubtree(rb_ws_pool* pool, int worker, rb_red_blk_node* x) {
+  rb_red_blk_node* nil=pool->tree->nil;
+  rb_red_blk_node* left;
+  rb_red_blk_node* right;
+
+  while (x != nil) {
+    left=x->left;
+    right=x->right;
+    pool->Visit(pool,worker,x);
+    VisitSubtree(pool,worker,left);
+    x=right;
+  }
+}
+
+static void RunTask(rb_ws_pool* pool, int worker, rb_ws_task task) {
+  rb_red_blk_node* nil=pool->tree->nil;
+  rb_red_blk_node* x=task.node;
+  rb_red_blk_node* left;
+  rb_ws_task child;
+
+  if (task.piece >= 0) {
+    pool->RunPiece(pool,worker,task.piece);
+    return;
+  }
+  while ( (x != nil) && (task.depth < pool->splitDepth) ) {
+    left=x->left;
+    child.node=x->right;
+    child.depth=++task.depth;
+    child.piece=-1;
+    if (child.node != nil) PoolPush(pool,worker,child);
+    pool->Visit(pool,worker,x);
+    x=left;
+  }
+  VisitSubtree(pool,worker,x);
+}
+
+static void* PoolWorker(void* arg) {
+  rb_ws_worker* self=(rb_ws_worker*) arg;
+  rb_ws_pool* pool=self->pool;
+  rb_ws_task task;
+
+  while (atomic_load(&pool->pending) > 0) {
+    if (PoolTake(pool,self->id,&task)) {
+      RunTask(pool,self->id,task);
+      atomic_fetch_sub(&pool->pending,1);
+    } else {
+      sched_yield();
+    }
+  }
+  return(NULL);
+}
+
+static void PoolInit(rb_ws_pool* pool, rb_red_blk_tree* tree, int nThreads) {
+  int i;
+
+  if (nThreads < 1) nThreads=1;
+  pool->tree=tree;
+  pool->nWorkers=nThreads;
+  /* enough levels for about sixteen tasks per worker */
+  for (pool->splitDepth=4; (1 << (pool->splitDepth-4)) < nThreads;
+       pool->splitDepth++);
+  pool->deques=(rb_ws_deque*) SafeMalloc(nThreads*sizeof(rb_ws_deque));
+  for (i=0; i<nThreads; i++) {
+    pthread_mutex_init(&pool->deques[i].lock,NULL);
+    pool->deques[i].capacity=64;
+    pool->deques[i].tasks=(rb_ws_task*) SafeMalloc(64*sizeof(rb_ws_task));
+    pool->deques[i].head=pool->deques[i].tail=0;
+  }
+  atomic_init(&pool->pending,0);
+  pool->Visit=NULL;
+  pool->RunPiece=NULL;
+  pool->context=NULL;
+}
+
+/*  runs the pool until every task pushed before the call, and every */
+/*  task those push, has finished */
+
+static void PoolRun(rb_ws_pool* pool) {
+  rb_ws_worker workers[pool->nWorkers];
+  int i;
+
+  for (i=0; i<pool->nWorkers; i++) {
+    workers[i].pool=pool;
+    workers[i].id=i;
+  }
+  RunJobs(PoolWorker,workers,sizeof(rb_ws_worker),pool->nWorkers);
+}
+
+static void PoolFree(rb_ws_pool* pool) {
+  int i;
+
+  for (i=0; i<pool->nWorkers; i++) {
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    free(pool->deques[i].tasks);
+  }
+  free(pool->deques);
+}
+
+/*  the whole tree as a single task for worker 0 to start splitting */
+
+static void PushRoot(rb_ws_pool* pool) {
+  rb_ws_task task;
+
+  task.node=pool->tree->root->left;
+  task.depth=0;
+  task.piece=-1;
+  if (task.node != pool->tree->nil) PoolPush(pool,0,task);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  CollectPieces */
+/**/
+/*    INPUTS:  x is a node at the given depth and levels is how many */
+/*             levels above the pieces remain */
+/**/
+/*    OUTPUT:  none */
+/**/
+/*    EFFECT:  cuts the tree into pieces listed in key order: every */
+/*             node above the cut is a piece by itself and every */
+/*             subtree hanging below the cut is one piece.  The ordered */
+/*             traversals give each piece its own result and combine */
+/*             the results in this order. */
+/**/
+/*    Modifies Input: pieces, nPieces */
+/***********************************************************************/
+
+typedef struct rb_piece {
+  rb_red_blk_node* node;
+  int whole; /* the whole subtree under node, else node by itself */
+  void* result;
+  int blackHeight;
+} rb_piece;
+
+static void CollectPieces(rb_red_blk_tree* tree, rb_red_blk_node* x,
+			  int levels, rb_piece* pieces, int* nPieces) {
+  if (x == tree->nil) return;
+  if (levels == 0) {
+    pieces[*nPieces].node=x;
+    pieces[(*nPieces)++].whole=1;
+    return;
+  }
+  CollectPieces(tree,x->left,levels-1,pieces,nPieces);
+  pieces[*nPieces].node=x;
+  pieces[(*nPieces)++].whole=0;
+  CollectPieces(tree,x->right,levels-1,pieces,nPieces);
+}
+
+static int CutLevels(int nThreads) {
+  int levels=2;
+
+  while ( (1 << (levels-2)) < nThreads ) levels++;
+  return(levels);
+}
+
+/*  pushes every piece as a task, spread over the workers' deques */
+
+static void PushPieces(rb_ws_pool* pool, int nPieces) {
+  rb_ws_task task;
+  int i;
+
+  for (i=0; i<nPieces; i++) {
+    task.node=NULL;
+    task.depth=0;
+    task.piece=i;
+    PoolPush(pool,i%pool->nWorkers,task);
+  }
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBParallelForEach */
+/**/
+/*    INPUTS:  tree is the tree to walk, Visit is called once for every */
+/*             node with context as its second argument and nThreads is */
+/*             how many threads to use */
+/**/
+/*    OUTPUT:  none */
+/**/
+/*    EFFECT:  calls Visit on every node, in no particular order and */
+/*             from several threads at once.  Visit may change the info */
+/*             of the node it is given but not the shape of the tree. */
+/**/
+/*    Modifies Input: whatever Visit modifies */
+/***********************************************************************/
+
+typedef struct rb_foreach_context {
+  void (*Visit)(rb_red_blk_node*, void*);
+  void* context;
+} rb_foreach_context;
+
+static void ForEachVisit(rb_ws_pool* pool, int worker, rb_red_blk_node* x) {
+  rb_foreach_context* fe=(rb_foreach_context*) pool->context;
+
+  fe->Visit(x,fe->context);
+}
+
+void RBParallelForEach(rb_red_blk_tree* tree,
+		       void (*Visit)(rb_red_blk_node*, void*), void* context,
+		       int nThreads) {
+  rb_ws_pool pool;
+  rb_foreach_context fe;
+
+  fe.Visit=Visit;
+  fe.context=context;
+  PoolInit(&pool,tree,nThreads);
+  pool.Visit=ForEachVisit;
+  pool.context=&fe;
+  PushRoot(&pool);
+  PoolRun(&pool);
+  PoolFree(&pool);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBParallelReduce */
+/**/
+/*    INPUTS:  Map turns a node into a value and Combine(a,b,context) */
+/*             combines two values, identity being its identity. */
+/*             context is passed to both.  If ordered is 0 Combine must */
+/*             be associative and commutative; otherwise it only needs */
+/*             to be associative. */
+/**/
+/*    OUTPUT:  the combination of Map over every node */
+/**/
+/*    EFFECT:  In the unordered mode each worker keeps one running */
+/*             value for whatever nodes it happens to visit and the */
+/*             workers' values are combined at the end.  In the ordered */
+/*             mode the tree is cut into pieces near the root, each */
+/*             piece is reduced in key order on its own, and the piece */
+/*             results are merged from left to right, so the result is */
+/*             the same as a sequential in-order reduction. */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+typedef struct rb_reduce_context {
+  void* (*Map)(rb_red_blk_node*, void*);
+  void* (*Combine)(void*, void*, void*);
+  void* identity;
+  void* context;
+  void** partial; /* per worker, unordered mode */
+  rb_piece* pieces; /* ordered mode */
+} rb_reduce_context;
+
+static void ReduceVisit(rb_ws_pool* pool, int worker, rb_red_blk_node* x) {
+  rb_reduce_context* rc=(rb_reduce_context*) pool->context;
+
+  rc->partial[worker]=rc->Combine(rc->partial[worker],
+				  rc->Map(x,rc->context),rc->context);
+}
+
+static void* InorderReduce(rb_red_blk_tree* tree, rb_reduce_context* rc,
+			   rb_red_blk_node* x, void* acc) {
+  while (x != tree->nil) {
+    acc=InorderReduce(tree,rc,x->left,acc);
+    acc=rc->Combine(acc,rc->Map(x,rc->context),rc->context);
+    x=x->right;
+  }
+  return(acc);
+}
+
+static void ReducePiece(rb_ws_pool* pool, int worker, int piece) {
+  rb_reduce_context* rc=(rb_reduce_context*) pool->context;
+  rb_piece* p=&rc->pieces[piece];
+
+  if (p->whole) {
+    p->result=InorderReduce(pool->tree,rc,p->node,rc->identity);
+  } else {
+    p->result=rc->Map(p->node,rc->context);
+  }
+}
+
+void* RBParallelReduce(rb_red_blk_tree* tree,
+		       void* (*Map)(rb_red_blk_node*, void*),
+		       void* (*Combine)(void*, void*, void*),
+		       void* identity, void* context, int nThreads,
+		       int ordered) {
+  rb_ws_pool pool;
+  rb_reduce_context rc;
+  void* result=identity;
+  int nPieces=0;
+  int i;
+
+  PoolInit(&pool,tree,nThreads);
+  rc.Map=Map;
+  rc.Combine=Combine;
+  rc.identity=identity;
+  rc.context=context;
+  rc.partial=NULL;
+  rc.pieces=NULL;
+  pool.context=&rc;
+  if (ordered) {
+    i=CutLevels(pool.nWorkers);
+    rc.pieces=(rb_piece*) SafeMalloc(((2 << i)-1)*sizeof(rb_piece));
+    CollectPieces(tree,tree->root->left,i,rc.pieces,&nPieces);
+    pool.RunPiece=ReducePiece;
+    PushPieces(&pool,nPieces);
+    PoolRun(&pool);
+    for (i=0; i<nPieces; i++) {
+      result=Combine(result,rc.pieces[i].result,context);
+    }
+    free(rc.pieces);
+  } else {
+    rc.partial=(void**) SafeMalloc(pool.nWorkers*sizeof(void*));
+    for (i=0; i<pool.nWorkers; i++) rc.partial[i]=identity;
+    pool.Visit=ReduceVisit;
+    PushRoot(&pool);
+    PoolRun(&pool);
+    for (i=0; i<pool.nWorkers; i++) {
+      result=Combine(result,rc.partial[i],context);
+    }
+    free(rc.partial);
+  }
+  PoolFree(&pool);
+  return(result);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBParallelDestroy */
+/**/
+/*    INPUTS:  tree is the tree to destroy and nThreads is how many */
+/*             threads to use */
+/**/
+/*    OUTPUT:  none */
+/**/
+/*    EFFECT:  does what RBTreeDestroy does, with DestroyKey and */
+/*             DestroyInfo called from several threads at once, so they */
+/*             must be thread-safe, as must the tree's allocator. */
+/**/
+/*    Modifies Input: tree */
+/***********************************************************************/
+
+static void DestroyVisit(rb_ws_pool* pool, int worker, rb_red_blk_node* x) {
+  pool->tree->DestroyKey(x->key);
+  pool->tree->DestroyInfo(x->info);
+  RBNodeFree(pool->tree,x);
+}
+
+void RBParallelDestroy(rb_red_blk_tree* tree, int nThreads) {
+  rb_ws_pool pool;
+
+  PoolInit(&pool,tree,nThreads);
+  pool.Visit=DestroyVisit;
+  PushRoot(&pool);
+  PoolRun(&pool);
+  PoolFree(&pool);
+  tree->root->left=tree->nil;
+  tree->count=0;
+  RBTreeDestroy(tree);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBParallelCheckRep */
+/**/
+/*    INPUTS:  tree is the tree to check and nThreads is how many */
+/*             threads to use */
+/**/
+/*    OUTPUT:  none */
+/**/
+/*    EFFECT:  makes the same assertions as checkRep.  The subtrees */
+/*             below the cut are checked in parallel and report their */
+/*             black heights; CheckTop then checks the nodes above the */
+/*             cut using those heights.  Trees with another balancing */
+/*             scheme (see RBTreeUseBalance) are checked by checkRep. */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+static void CheckPiece(rb_ws_pool* pool, int worker, int piece) {
+  rb_piece* p=&((rb_piece*) pool->context)[piece];
+
+  if (p->whole) p->blackHeight=checkRepHelper(p->node,pool->tree);
+}
+
+static int CheckTop(rb_red_blk_tree* tree, rb_red_blk_node* x, int levels,
+		    rb_piece* pieces, int* next) {
+  int leftHeight, rightHeight;
+
+  assert (x);
+  if (x == tree->nil) return(0);
+  if (levels == 0) return(pieces[(*next)++].blackHeight);
+  leftHeight=CheckTop(tree,x->left,levels-1,pieces,next);
+  (*next)++; /* x's own piece */
+  checkRepNode(x,tree);
+  rightHeight=CheckTop(tree,x->right,levels-1,pieces,next);
+  assert (leftHeight == rightHeight);
+  return(leftHeight+(x->red ? 0 : 1));
+}
+
+void RBParallelCheckRep(rb_red_blk_tree* tree, int nThreads) {
+  rb_ws_pool pool;
+  rb_piece* pieces;
+  int levels, nPieces=0, next=0;
+
+  if (tree->balance != &RBBalanceRedBlack) {
+    checkRep(tree); /* the pieces are checked for red-black trees only */
+    return;
+  }
+  assert (!tree->root->left->red);
+  PoolInit(&pool,tree,nThreads);
+  levels=CutLevels(pool.nWorkers);
+  pieces=(rb_piece*) SafeMalloc(((2 << levels)-1)*sizeof(rb_piece));
+  CollectPieces(tree,tree->root->left,levels,pieces,&nPieces);
+  pool.context=pieces;
+  pool.RunPiece=CheckPiece;
+  PushPieces(&pool,nPieces);
+  PoolRun(&pool);
+  CheckTop(tree,tree->root->left,levels,pieces,&next);
+  free(pieces);
+  PoolFree(&pool);
+}
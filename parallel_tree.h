@@ -0,0 +1,35 @@
+#include"red_black_tree.h"
+
+#ifndef INC_PARALLEL_TREE_
+#define INC_PARALLEL_TREE_
+
+/*  Multithreaded operations on whole red-black trees. */
+
+/*  a key and its info, as sorted by RBTreeBuildParallel */
+typedef struct rb_build_item {
+  void* key;
+  void* info;
+} rb_build_item;
+
+rb_red_blk_tree* RBTreeBuildParallel(int (*CompFunc)(const void*, const void*),
+				     void (*DestFunc)(void*),
+				     void (*InfoDestFunc)(void*),
+				     void (*PrintFunc)(const void*),
+				     void (*PrintInfo)(void*),
+				     void** keys, void** infos, long n,
+				     int nThreads);
+int RBParallelSort(rb_red_blk_tree* tree, rb_build_item* items, long n,
+		   int nThreads);
+
+void RBParallelForEach(rb_red_blk_tree* tree,
+		       void (*Visit)(rb_red_blk_node*, void*), void* context,
+		       int nThreads);
+void* RBParallelReduce(rb_red_blk_tree* tree,
+		       void* (*Map)(rb_red_blk_node*, void*),
+		       void* (*Combine)(void*, void*, void*),
+		       void* identity, void* context, int nThreads,
+		       int ordered);
+void RBParallelDestroy(rb_red_blk_tree* tree, int nThreads);
+void RBParallelCheckRep(rb_red_blk_tree* tree, int nThreads);
+
+#endif
@@ -1,5 +1,61 @@
 #include "red_black_tree.h"
+#include "tree_alloc.h"
 #include <assert.h>
+#include <string.h>
+
+/*  the nil sentinel of every tree.  It is const, so that a write to */
+/*  it faults instead of racing with another thread's tree. */
+
+static const rb_red_blk_node RBNil={0,0,0,(rb_red_blk_node*) &RBNil,
+				    (rb_red_blk_node*) &RBNil,
+				    (rb_red_blk_node*) &RBNil};
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeInit */
+/**/
+/*  INPUTS:  tree points to storage for an rb_red_blk_tree, which must */
+/*  not move while the tree is in use, and the functions are as for */
+/*  RBTreeCreate. */
+/**/
+/*  OUTPUT:  none */
+/**/
+/*  EFFECTS:  Makes tree an empty tree without allocating anything, so */
+/*  a tree can be a member of some other structure or one of an */
+/*  array of many small trees.  Such a tree is disposed of with */
+/*  RBTreeClear instead of RBTreeDestroy. */
+/**/
+/*  Modifies Input: tree */
+/***********************************************************************/
+
+void RBTreeInit(rb_red_blk_tree* tree,
+		int (*CompFunc) (const void*,const void*),
+		void (*DestFunc) (void*),
+		void (*InfoDestFunc) (void*),
+		void (*PrintFunc) (const void*),
+		void (*PrintInfo)(void*)) {
+  rb_red_blk_node* temp;
+
+  tree->Compare=  CompFunc;
+  tree->DestroyKey= DestFunc;
+  tree->PrintKey= PrintFunc;
+  tree->PrintInfo= PrintInfo;
+  tree->DestroyInfo= InfoDestFunc;
+
+  /*  see the comment in the rb_red_blk_tree structure in red_black_tree.h */
+  /*  for information on nil and root */
+  tree->nil=(rb_red_blk_node*) &RBNil;
+  temp=tree->root=&tree->rootNode;
+  temp->parent=temp->left=temp->right=tree->nil;
+  temp->key=0;
+  temp->info=0;
+  temp->red=0;
+  tree->Normalize=0;
+  tree->nodeSize=sizeof(rb_red_blk_node);
+  tree->extra=NULL;
+  tree->balance=&RBBalanceRedBlack;
+  tree->rotations=0;
+  tree->count=0;
+}
 
 /***********************************************************************/
 /*  FUNCTION:  RBTreeCreate */
@@ -16,7 +72,7 @@
 /*  defined and NullFunction can be used.  */
 /**/
 /*  OUTPUT:  This function returns a pointer to the newly created */
-/*  red-black tree. */
+/*  red-black tree, the only memory it allocates. */
 /**/
 /*  Modifies Input: none */
 /***********************************************************************/
@@ -27,28 +83,179 @@ rb_red_blk_tree* RBTreeCreate( int (*CompFunc) (const void*,const void*),
 			      void (*PrintFunc) (const void*),
 			      void (*PrintInfo)(void*)) {
   rb_red_blk_tree* newTree;
-  rb_red_blk_node* temp;
 
   newTree=(rb_red_blk_tree*) SafeMalloc(sizeof(rb_red_blk_tree));
-  newTree->Compare=  CompFunc;
-  newTree->DestroyKey= DestFunc;
-  newTree->PrintKey= PrintFunc;
-  newTree->PrintInfo= PrintInfo;
-  newTree->DestroyInfo= InfoDestFunc;
-
-  /*  see the comment in the rb_red_blk_tree structure in red_black_tree.h */
-  /*  for information on nil and root */
-  temp=newTree->nil= (rb_red_blk_node*) SafeMalloc(sizeof(rb_red_blk_node));
-  temp->parent=temp->left=temp->right=temp;
-  temp->red=0;
-  temp->key=0;
-  temp=newTree->root= (rb_red_blk_node*) SafeMalloc(sizeof(rb_red_blk_node));
-  temp->parent=temp->left=temp->right=newTree->nil;
-  temp->key=0;
-  temp->red=0;
+  RBTreeInit(newTree,CompFunc,DestFunc,InfoDestFunc,PrintFunc,PrintInfo);
   return(newTree);
 }
 
+/***********************************************************************/
+/*  FUNCTION:  RBTreeUseAllocator */
+/**/
+/*  INPUTS:  tree is an empty tree and allocator, which must outlive */
+/*           it, is where its nodes are to come from */
+/**/
+/*  OUTPUT:  none */
+/**/
+/*  EFFECTS:  From now on the nodes of tree are allocated and freed */
+/*            with allocator, and counted (see tree_alloc.h).  Nothing */
+/*            else the tree does is changed. */
+/**/
+/*  Modifies Input: tree */
+/***********************************************************************/
+
+void RBTreeUseAllocator(rb_red_blk_tree* tree, const rb_allocator* allocator) {
+#ifdef DEBUG_ASSERT
+  Assert(tree->root->left == tree->nil,"tree not empty in RBTreeUseAllocator");
+#endif
+  if (!tree->extra && (allocator == &RBMallocAllocator)) return;
+  RBTreeExtra(tree)->allocator=allocator;
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeUsePrefix */
+/**/
+/*  INPUTS:  tree is an empty tree and Normalize maps a key to a 64 bit */
+/*           prefix which keeps the order of Compare: if Compare(a,b) */
+/*           is 1 then Normalize(a) >= Normalize(b), and if it is 0 */
+/*           then Normalize(a) == Normalize(b).  Otherwise differing */
+/*           prefixes would keep keys which Compare calls equal apart, */
+/*           and a search could miss a key which is in the tree. */
+/**/
+/*  OUTPUT:  none */
+/**/
+/*  EFFECTS:  From now on every node is an rb_prefixed_node keeping */
+/*            the prefix of its key, and searches compute the prefix */
+/*            of the key they look for once.  Where two prefixes */
+/*            differ they decide the comparison, so Compare, and the */
+/*            cache miss on the key it reads, is only needed on ties. */
+/*            For strings the first 8 bytes read as a big-endian */
+/*            number make a good prefix.  Trees which never call this */
+/*            have no prefix in their nodes.  nodeSize grows to make */
+/*            room for it, and whatever the tree keeps in its nodes */
+/*            moves up past it, as in tree_inline.c. */
+/**/
+/*  Modifies Input: tree */
+/***********************************************************************/
+
+void RBTreeUsePrefix(rb_red_blk_tree* tree,
+		     uint64_t (*Normalize)(const void*)) {
+#ifdef DEBUG_ASSERT
+  Assert(tree->root->left == tree->nil,"tree not empty in RBTreeUsePrefix");
+#endif
+  if (!tree->Normalize) {
+    tree->nodeSize+=sizeof(rb_prefixed_node)-sizeof(rb_red_blk_node);
+  }
+  tree->Normalize=Normalize;
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeUseBalance */
+/**/
+/*  INPUTS:  tree is an empty tree and balance a balancing scheme, */
+/*           RBBalanceRedBlack or one from tree_balance.h */
+/**/
+/*  OUTPUT:  none */
+/**/
+/*  EFFECTS:  From now on inserts and deletes keep the tree balanced */
+/*            the way balance says, and RBTreeBuildSorted and */
+/*            RBTreeRebalance label nodes for it.  Everything else */
+/*            works on the tree as before. */
+/**/
+/*  Modifies Input: tree */
+/***********************************************************************/
+
+void RBTreeUseBalance(rb_red_blk_tree* tree, const rb_balance* balance) {
+#ifdef DEBUG_ASSERT
+  Assert(tree->root->left == tree->nil,"tree not empty in RBTreeUseBalance");
+#endif
+  tree->balance=balance;
+}
+
+/*  RBNodeAlloc and RBNodeFree get the memory for a node from wherever */
+/*  the tree's nodes come from and give it back there.  Code which */
+/*  builds or rebuilds a tree directly must use them too. */
+
+rb_red_blk_node* RBNodeAlloc(rb_red_blk_tree* tree) {
+  return((rb_red_blk_node*) RBTreeAllocBytes(tree,tree->nodeSize,1));
+}
+
+/*  counts x off the region holding it, returning 0 if it is in none. */
+/*  RBParallelDestroy frees nodes from several threads, so the count */
+/*  is atomic and emptied regions are left for RBTreeReleaseRegions. */
+
+static int RegionRelease(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  rb_region* r;
+
+  for (r=tree->extra->regions; r; r=r->next) {
+    if ( ((char*) x >= r->base) && ((char*) x < r->base+r->bytes) ) {
+      __atomic_sub_fetch(&r->live,1,__ATOMIC_RELAXED);
+      RBTreeCharge(tree,0,-1,1);
+      return(1);
+    }
+  }
+  return(0);
+}
+
+/*  frees the regions none of whose nodes are in use any more */
+
+void RBTreeReleaseRegions(rb_red_blk_tree* tree) {
+  rb_region** r;
+  rb_region* dead;
+
+  if (!tree->extra) return;
+  r=&tree->extra->regions;
+  while (*r) {
+    if ( ((*r)->live == 0) && !(*r)->filling ) {
+      dead=*r;
+      *r=dead->next;
+      RBTreeCharge(tree,-(long) dead->bytes,0,1);
+      free(dead->base);
+      free(dead);
+    } else {
+      r=&(*r)->next;
+    }
+  }
+}
+
+void RBNodeFree(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  if (tree->extra && tree->extra->regions && RegionRelease(tree,x)) return;
+  RBTreeFreeBytes(tree,x,tree->nodeSize,1);
+}
+
+/*  frees what x's key and info point to.  Trees which keep them in */
+/*  the node, such as sets and inline trees, have NullFunction there */
+/*  and pay no call at all. */
+
+static void DestroyNodeData(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  if (tree->DestroyKey != NullFunction) tree->DestroyKey(x->key);
+  if (tree->DestroyInfo != NullFunction) tree->DestroyInfo(x->info);
+}
+
+/*  gives x its key, and the key's prefix if the tree keeps them */
+
+void RBNodeSetKey(rb_red_blk_tree* tree, rb_red_blk_node* x, void* key) {
+  x->key=key;
+  if (tree->Normalize) RB_NODE_PREFIX(x)=tree->Normalize(key);
+}
+
+/*  the prefix a search for q compares against the nodes' prefixes */
+#define QUERY_PREFIX(tree,q) ((tree)->Normalize ? (tree)->Normalize(q) : 0)
+
+/*  Compare(x->key,q), where qPrefix is QUERY_PREFIX(tree,q) and */
+/*  prefixed is whether the tree keeps prefixes.  The key is only read */
+/*  if the prefixes tie.  Searches find prefixed once, and the hottest */
+/*  pass it as a constant to a copy of their loop for each case, so */
+/*  trees without prefixes compare exactly as they did before them. */
+
+static inline int KeyCompare(rb_red_blk_tree* tree, rb_red_blk_node* x,
+			     const void* q, uint64_t qPrefix, int prefixed) {
+  if (prefixed && (RB_NODE_PREFIX(x) != qPrefix)) {
+    return( (RB_NODE_PREFIX(x) > qPrefix) ? 1 : -1);
+  }
+  return(tree->Compare(x->key,q));
+}
+
 /***********************************************************************/
 /*  FUNCTION:  LeftRotate */
 /**/
@@ -97,6 +304,7 @@ void LeftRotate(rb_red_blk_tree* tree, rb_red_blk_node* x) {
   }
   y->left=x;
   x->parent=y;
+  tree->rotations++;
 
 #ifdef DEBUG_ASSERT
   Assert(!tree->nil->red,"nil not red in LeftRotate");
@@ -151,6 +359,7 @@ void RightRotate(rb_red_blk_tree* tree, rb_red_blk_node* y) {
   }
   x->right=y;
   y->parent=x;
+  tree->rotations++;
 
 #ifdef DEBUG_ASSERT
   Assert(!tree->nil->red,"nil not red in RightRotate");
@@ -172,18 +381,20 @@ void RightRotate(rb_red_blk_tree* tree, rb_red_blk_node* y) {
 /*            by the RBTreeInsert function and not by the user */
 /***********************************************************************/
 
-void TreeInsertHelp(rb_red_blk_tree* tree, rb_red_blk_node* z) {
-  /*  This function should only be called by InsertRBTree (see above) */
+/*  TreeInsertHelp's descent, with prefixed constant in each copy */
+
+static inline void InsertDescent(rb_red_blk_tree* tree, rb_red_blk_node* z,
+				 int prefixed) {
   rb_red_blk_node* x;
   rb_red_blk_node* y;
   rb_red_blk_node* nil=tree->nil;
-  
-  z->left=z->right=nil;
+  uint64_t zPrefix= prefixed ? RB_NODE_PREFIX(z) : 0;
+
   y=tree->root;
   x=tree->root->left;
   while( x != nil) {
     y=x;
-    if (1 == tree->Compare(x->key,z->key)) { /* x.key > z.key */
+    if (1 == KeyCompare(tree,x,z->key,zPrefix,prefixed)) { /* x.key > z.key */
       x=x->left;
     } else { /* x,key <= z.key */
       x=x->right;
@@ -191,11 +402,21 @@ void TreeInsertHelp(rb_red_blk_tree* tree, rb_red_blk_node* z) {
   }
   z->parent=y;
   if ( (y == tree->root) ||
-       (1 == tree->Compare(y->key,z->key))) { /* y.key > z.key */
+       (1 == KeyCompare(tree,y,z->key,zPrefix,prefixed))) { /* y.key > z.key */
     y->left=z;
   } else {
     y->right=z;
   }
+}
+
+void TreeInsertHelp(rb_red_blk_tree* tree, rb_red_blk_node* z) {
+  /*  This function should only be called by InsertRBTree (see above) */
+  z->left=z->right=tree->nil;
+  if (tree->Normalize) {
+    InsertDescent(tree,z,1);
+  } else {
+    InsertDescent(tree,z,0);
+  }
 
 #ifdef DEBUG_ASSERT
   Assert(!tree->nil->red,"nil not red in TreeInsertHelp");
@@ -214,7 +435,9 @@ void TreeInsertHelp(rb_red_blk_tree* tree, rb_red_blk_node* z) {
 /*           which is guarunteed to be valid until this node is deleted. */
 /*           What this means is if another data structure stores this */
 /*           pointer then the tree does not need to be searched when this */
-/*           is to be deleted. */
+/*           is to be deleted.  It returns NULL, leaving the tree as it */
+/*           was, if the tree's allocator or budget refused the node */
+/*           (see tree_alloc.h). */
 /**/
 /*  Modifies Input: tree */
 /**/
@@ -223,16 +446,44 @@ void TreeInsertHelp(rb_red_blk_tree* tree, rb_red_blk_node* z) {
 /***********************************************************************/
 
 rb_red_blk_node * RBTreeInsert(rb_red_blk_tree* tree, void* key, void* info) {
-  rb_red_blk_node * y;
   rb_red_blk_node * x;
-  rb_red_blk_node * newNode;
 
-  x=(rb_red_blk_node*) SafeMalloc(sizeof(rb_red_blk_node));
-  x->key=key;
+  if (!(x=RBNodeAlloc(tree))) return(NULL); /* assignment */
+  RBNodeSetKey(tree,x,key);
   x->info=info;
+  return(RBTreeInsertNode(tree,x));
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeInsertNode */
+/**/
+/*  INPUTS:  x comes from RBNodeAlloc(tree) and has its key (set with */
+/*           RBNodeSetKey) and info filled in */
+/**/
+/*  OUTPUT:  x.  The B+-tree engine, which may need memory to link x */
+/*           in, returns NULL if it gets none and leaves x to the */
+/*           caller to free. */
+/**/
+/*  Modifies Input: tree, x */
+/**/
+/*  EFFECTS:  Links x into the tree and rebalances it.  This is the */
+/*            second half of RBTreeInsert, for callers which keep the */
+/*            key inside the node (see nodeSize in red_black_tree.h). */
+/***********************************************************************/
 
+rb_red_blk_node* RBTreeInsertNode(rb_red_blk_tree* tree, rb_red_blk_node* x) {
   TreeInsertHelp(tree,x);
-  newNode=x;
+  tree->count++;
+  tree->balance->InsertFixUp(tree,x);
+  return(x);
+}
+
+/*  recolors and rotates from the new leaf x up to restore the */
+/*  red-black properties, as in _Introduction_To_Algorithms_ */
+
+static void RedBlackInsertFixUp(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  rb_red_blk_node * y;
+
   x->red=1;
   while(x->parent->red) { /* use sentinel instead of checking for root */
     if (x->parent == x->parent->parent->left) {
@@ -270,7 +521,6 @@ rb_red_blk_node * RBTreeInsert(rb_red_blk_tree* tree, void* key, void* info) {
     }
   }
   tree->root->left->red=0;
-  return(newNode);
 
 #ifdef DEBUG_ASSERT
   Assert(!tree->nil->red,"nil not red in RBTreeInsert");
@@ -404,9 +654,8 @@ void TreeDestHelper(rb_red_blk_tree* tree, rb_red_blk_node* x) {
   if (x != nil) {
     TreeDestHelper(tree,x->left);
     TreeDestHelper(tree,x->right);
-    tree->DestroyKey(x->key);
-    tree->DestroyInfo(x->info);
-    free(x);
+    DestroyNodeData(tree,x);
+    RBNodeFree(tree,x);
   }
 }
 
@@ -425,12 +674,246 @@ void TreeDestHelper(rb_red_blk_tree* tree, rb_red_blk_node* x) {
 /***********************************************************************/
 
 void RBTreeDestroy(rb_red_blk_tree* tree) {
-  TreeDestHelper(tree,tree->root->left);
-  free(tree->root);
-  free(tree->nil);
+  RBTreeClear(tree);
   free(tree);
 }
 
+/***********************************************************************/
+/*  FUNCTION:  RBTreeClear */
+/**/
+/*    INPUTS:  tree is a tree made by RBTreeInit or RBTreeCreate */
+/**/
+/*    OUTPUT:  none */
+/**/
+/*    EFFECT:  Destroys every key and info and frees every node and */
+/*             the tree's rb_tree_extra, but not tree itself.  The */
+/*             caller may then free or reuse its storage, or pass it */
+/*             to RBTreeInit again. */
+/**/
+/*    Modifies Input: tree */
+/***********************************************************************/
+
+void RBTreeClear(rb_red_blk_tree* tree) {
+  TreeDestHelper(tree,tree->root->left);
+  tree->root->left=tree->nil;
+  tree->count=0;
+  RBTreeReleaseRegions(tree);
+  RBTreeFreeExtra(tree);
+}
+
+/*  the nodes are all the red-black engine allocates for a tree */
+
+long RBTreeHeldBytes(rb_red_blk_tree* tree) {
+  return((long) (tree->count*tree->nodeSize));
+}
+
+
+/***********************************************************************/
+/*  FUNCTION:  RBBalancedRedDepth */
+/**/
+/*    INPUTS:  n is the number of nodes in a tree built by RBBuildSubtree */
+/**/
+/*    OUTPUT:  the depth whose nodes must be red, or -1 if every node */
+/*             is black */
+/**/
+/*    Modifies Input: none */
+/**/
+/*    Note:  A tree which splits every range at its middle has all of */
+/*           its levels full except possibly the deepest.  Coloring that */
+/*           level red, when it is not full, gives every path from the */
+/*           root to nil the same number of black nodes. */
+/***********************************************************************/
+
+int RBBalancedRedDepth(long n) {
+  int height=0;
+  long full=0; /* nodes in a perfect tree of this height */
+
+  while (full < n) {
+    full=2*full+1;
+    height++;
+  }
+  return( (full == n) ? -1 : height-1);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBBuildSubtree */
+/**/
+/*    INPUTS:  tree is the tree the nodes are for, n is how many nodes */
+/*             to build, depth is the depth of the subtree's top in the */
+/*             final tree and redDepth comes from RBBalancedRedDepth of */
+/*             the final tree's size.  NextItem is called n times and */
+/*             must hand out the keys and infos in ascending order; it */
+/*             returns 0 if there are no more. */
+/**/
+/*    OUTPUT:  the top of a balanced subtree holding the n items, nil */
+/*             if n is 0, or NULL if NextItem or the allocator failed, */
+/*             in which case every node built so far has been */
+/*             destroyed.  The parent of the top node is not set. */
+/**/
+/*    Modifies Input: tree */
+/**/
+/*    EFFECT:  Builds the subtree in order, so the items are consumed */
+/*             in a single pass and only O(log n) extra memory is used. */
+/*             The left half gets (n-1)/2 items; anything building the */
+/*             same tree in pieces must split ranges the same way. */
+/***********************************************************************/
+
+rb_red_blk_node* RBBuildSubtree(rb_red_blk_tree* tree, long n, int depth,
+				int redDepth,
+				int (*NextItem)(void*, void**, void**),
+				void* context) {
+  rb_red_blk_node* nil=tree->nil;
+  rb_red_blk_node* left;
+  rb_red_blk_node* right;
+  rb_red_blk_node* x;
+  long nLeft=(n-1)/2;
+
+  if (n <= 0) return(nil);
+  if (!(left=RBBuildSubtree(tree,nLeft,depth+1,redDepth,NextItem,context))) {
+    return(NULL);
+  }
+  if (!(x=RBNodeAlloc(tree))) { /* assignment */
+    TreeDestHelper(tree,left);
+    return(NULL);
+  }
+  if (!NextItem(context,&x->key,&x->info)) {
+    RBNodeFree(tree,x);
+    TreeDestHelper(tree,left);
+    return(NULL);
+  }
+  RBNodeSetKey(tree,x,x->key);
+  right=RBBuildSubtree(tree,n-1-nLeft,depth+1,redDepth,NextItem,context);
+  if (!right) {
+    x->left=x->right=nil;
+    TreeDestHelper(tree,left);
+    TreeDestHelper(tree,x);
+    return(NULL);
+  }
+  x->left=left;
+  x->right=right;
+  if (left != nil) left->parent=x;
+  if (right != nil) right->parent=x;
+  x->red=tree->balance->BuiltLabel(n,depth,redDepth);
+  return(x);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeBuildSorted */
+/**/
+/*    INPUTS:  tree is an empty tree, n is the number of items and */
+/*             NextItem/context hand them out in ascending order as */
+/*             described for RBBuildSubtree */
+/**/
+/*    OUTPUT:  1 on success, 0 if n is negative or NextItem or the */
+/*             allocator failed, in which case the tree is still empty */
+/**/
+/*    Modifies Input: tree */
+/**/
+/*    EFFECT:  Builds a red-black tree of minimum height from sorted */
+/*             input in O(n) time, without any rotations or compares. */
+/***********************************************************************/
+
+int RBTreeBuildSorted(rb_red_blk_tree* tree, long n,
+		      int (*NextItem)(void*, void**, void**), void* context) {
+  rb_red_blk_node* top;
+
+#ifdef DEBUG_ASSERT
+  Assert(tree->root->left == tree->nil,"tree not empty in RBTreeBuildSorted");
+#endif
+  if (n < 0) return(0);
+  top=RBBuildSubtree(tree,n,0,RBBalancedRedDepth(n),NextItem,context);
+  if (!top) return(0);
+  tree->root->left=top;
+  if (top != tree->nil) top->parent=tree->root;
+  tree->count=n;
+  return(1);
+}
+
+/*  Straightens the subtree at *top into a vine: its nodes in key */
+/*  order, each the right child of the one before and none with a */
+/*  left child.  As in the Day-Stout-Warren algorithm each right */
+/*  rotation moves one more node onto the vine for good, so this takes */
+/*  O(n) time.  Returns the number of nodes; *top becomes the first. */
+
+static long TreeToVine(rb_red_blk_tree* tree, rb_red_blk_node** top) {
+  rb_red_blk_node* nil=tree->nil;
+  rb_red_blk_node** link=top;
+  rb_red_blk_node* x;
+  rb_red_blk_node* y;
+  long n=0;
+
+  while ((x=*link) != nil) {
+    if ((y=x->left) == nil) {
+      n++;
+      link=&x->right;
+    } else {
+      x->left=y->right;
+      y->right=x;
+      *link=y;
+    }
+  }
+  return(n);
+}
+
+/*  Relinks the n vine nodes from *next on into the subtree */
+/*  RBBuildSubtree would build for them: the same shape and colors, */
+/*  but made of the nodes already there.  The parent of the top node */
+/*  is not set. */
+
+static rb_red_blk_node* VineToSubtree(rb_red_blk_tree* tree,
+				      rb_red_blk_node** next, long n,
+				      int depth, int redDepth) {
+  rb_red_blk_node* nil=tree->nil;
+  rb_red_blk_node* left;
+  rb_red_blk_node* right;
+  rb_red_blk_node* x;
+  long nLeft=(n-1)/2;
+
+  if (n <= 0) return(nil);
+  left=VineToSubtree(tree,next,nLeft,depth+1,redDepth);
+  x=*next;
+  *next=x->right;
+  right=VineToSubtree(tree,next,n-1-nLeft,depth+1,redDepth);
+  x->left=left;
+  x->right=right;
+  if (left != nil) left->parent=x;
+  if (right != nil) right->parent=x;
+  x->red=tree->balance->BuiltLabel(n,depth,redDepth);
+  return(x);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeRebalance */
+/**/
+/*    INPUTS:  tree is the tree to rebalance */
+/**/
+/*    OUTPUT:  none */
+/**/
+/*    Modifies Input: tree */
+/**/
+/*    EFFECT:  Relinks the nodes into a red-black tree of minimum */
+/*             height, the one RBTreeBuildSorted would build from the */
+/*             same items, in O(n) time and O(log n) stack, without */
+/*             allocating, freeing or comparing anything.  A tree */
+/*             grown by random inserts and deletes can be up to twice */
+/*             as deep as it need be, so this shortens every lookup */
+/*             of a tree which is done changing for a while.  Nodes */
+/*             keep their addresses, so handles stay valid. */
+/***********************************************************************/
+
+void RBTreeRebalance(rb_red_blk_tree* tree) {
+  rb_red_blk_node* top=tree->root->left;
+  long n;
+
+  n=TreeToVine(tree,&top);
+#ifdef DEBUG_ASSERT
+  Assert(n == (long) tree->count,"count wrong in RBTreeRebalance");
+#endif
+  top=VineToSubtree(tree,&top,n,0,RBBalancedRedDepth(n));
+  tree->root->left=top;
+  if (top != tree->nil) top->parent=tree->root;
+}
+
 
 /***********************************************************************/
 /*  FUNCTION:  RBTreePrint */
@@ -465,12 +948,17 @@ void RBTreePrint(rb_red_blk_tree* tree) {
 /**/
 /***********************************************************************/
   
-rb_red_blk_node* RBExactQuery(rb_red_blk_tree* tree, void* q) {
+/*  RBExactQuery's descent, with prefixed constant in each copy */
+
+static inline rb_red_blk_node* ExactQuery(rb_red_blk_tree* tree, void* q,
+					  int prefixed) {
   rb_red_blk_node* x=tree->root->left;
   rb_red_blk_node* nil=tree->nil;
+  uint64_t qPrefix;
   int compVal;
   if (x == nil) return(0);
-  compVal=tree->Compare(x->key,(int*) q);
+  qPrefix= prefixed ? tree->Normalize(q) : 0;
+  compVal=KeyCompare(tree,x,q,qPrefix,prefixed);
   while(0 != compVal) {/*assignemnt*/
     if (1 == compVal) { /* x->key > q */
       x=x->left;
@@ -478,17 +966,287 @@ rb_red_blk_node* RBExactQuery(rb_red_blk_tree* tree, void* q) {
       x=x->right;
     }
     if ( x == nil) return(0);
-    compVal=tree->Compare(x->key,(int*) q);
+    compVal=KeyCompare(tree,x,q,qPrefix,prefixed);
   }
   return(x);
 }
 
+rb_red_blk_node* RBExactQuery(rb_red_blk_tree* tree, void* q) {
+  if (tree->Normalize) return(ExactQuery(tree,q,1));
+  return(ExactQuery(tree,q,0));
+}
+
+
+/***********************************************************************/
+/*  FUNCTION:  RBExactQueryBatch */
+/**/
+/*    INPUTS:  tree is the tree to search, keys is an array of n */
+/*             pointers to keys and out_nodes has room for n results */
+/**/
+/*    OUTPUT:  out_nodes[i] is set to what RBExactQuery(tree,keys[i]) */
+/*             would return */
+/**/
+/*    Modifies Input: out_nodes */
+/**/
+/*    EFFECT:  On a large tree every level of RBExactQuery is a cache */
+/*             miss which the next level depends on, so a single lookup */
+/*             spends most of its time waiting on memory.  This function */
+/*             keeps up to RB_BATCH_WINDOW lookups in flight and moves */
+/*             them forward in turns.  Each lookup alternates between */
+/*             two steps: prefetch the key of the node it has reached, */
+/*             then compare against that key and prefetch the child it */
+/*             moves to.  By the time a lookup gets its next turn the */
+/*             line it asked for has usually arrived, so the misses of */
+/*             the different lookups overlap.  A finished lookup hands */
+/*             its window slot to the next key. */
+/***********************************************************************/
+
+void RBExactQueryBatch(rb_red_blk_tree* tree, void** keys, int n,
+		       rb_red_blk_node** out_nodes) {
+  rb_red_blk_node* nil=tree->nil;
+  rb_red_blk_node* top=tree->root->left;
+  rb_red_blk_node* node[RB_BATCH_WINDOW];
+  int which[RB_BATCH_WINDOW]; /* index of the key, -1 if slot is idle */
+  int keyReady[RB_BATCH_WINDOW]; /* has the key of node[s] been prefetched */
+  uint64_t prefix[RB_BATCH_WINDOW]; /* QUERY_PREFIX of the key */
+  int prefixed= (tree->Normalize != NULL);
+  int next=0;
+  int active=0;
+  int compVal;
+  int s;
+
+  if (top == nil) {
+    for (s=0; s<n; s++) out_nodes[s]=0;
+    return;
+  }
+  PREFETCH(top);
+  for (s=0; s<RB_BATCH_WINDOW; s++) {
+    if (next < n) {
+      which[s]=next++;
+      prefix[s]=QUERY_PREFIX(tree,keys[which[s]]);
+      node[s]=top;
+      keyReady[s]=0;
+      active++;
+    } else {
+      which[s]=-1;
+    }
+  }
+  while (active) {
+    for (s=0; s<RB_BATCH_WINDOW; s++) {
+      if (which[s] < 0) continue;
+      /* with prefixes the key is only needed when they tie */
+      if ( !keyReady[s] &&
+	   (!prefixed || (RB_NODE_PREFIX(node[s]) == prefix[s])) ) {
+	PREFETCH(node[s]->key);
+	keyReady[s]=1;
+	continue;
+      }
+      compVal=KeyCompare(tree,node[s],keys[which[s]],prefix[s],prefixed);
+      if (0 == compVal) {
+	out_nodes[which[s]]=node[s];
+      } else {
+	node[s]= (1 == compVal) ? node[s]->left : node[s]->right;
+	if (node[s] != nil) {
+	  PREFETCH(node[s]);
+	  keyReady[s]=0;
+	  continue;
+	}
+	out_nodes[which[s]]=0;
+      }
+      /* this lookup is done, start the next one in its slot */
+      if (next < n) {
+	which[s]=next++;
+	prefix[s]=QUERY_PREFIX(tree,keys[which[s]]);
+	node[s]=top;
+	keyReady[s]=0;
+      } else {
+	which[s]=-1;
+	active--;
+      }
+    }
+  }
+}
+
+/***********************************************************************/
+/*  FUNCTION:  SortProbes */
+/**/
+/*    INPUTS:  keys is an array of n pointers to keys, order and scratch */
+/*             each have room for n ints */
+/**/
+/*    OUTPUT:  none */
+/**/
+/*    EFFECT:  fills order with the indices of keys sorted by Compare. */
+/*             This is a bottom-up merge sort rather than qsort because */
+/*             Compare is reached through the tree. */
+/**/
+/*    Modifies Input: order, scratch */
+/**/
+/*    Note:    This function should only be called by RBMultiGet */
+/***********************************************************************/
+
+static void SortProbes(rb_red_blk_tree* tree, void** keys, int* order,
+		       int* scratch, int n) {
+  int* from=order;
+  int* to=scratch;
+  int* swap;
+  int width, lo, mid, hi, i, j, k;
+
+  for (i=0; i<n; i++) order[i]=i;
+  for (width=1; width<n; width*=2) {
+    for (lo=0; lo<n; lo+=2*width) {
+      mid= (lo+width < n) ? lo+width : n;
+      hi= (lo+2*width < n) ? lo+2*width : n;
+      i=lo; j=mid; k=lo;
+      while ( (i < mid) && (j < hi) ) {
+	if (1 == tree->Compare(keys[from[i]],keys[from[j]])) {
+	  to[k++]=from[j++];
+	} else {
+	  to[k++]=from[i++];
+	}
+      }
+      while (i < mid) to[k++]=from[i++];
+      while (j < hi) to[k++]=from[j++];
+    }
+    swap=from; from=to; to=swap;
+  }
+  if (from != order) {
+    for (i=0; i<n; i++) order[i]=from[i];
+  }
+}
+
+/*  the longest path RBMultiGet remembers: twice the height of a */
+/*  perfectly balanced tree holding every addressable node, which is */
+/*  as deep as a red-black, AVL or WAVL tree can get.  A treap has no */
+/*  such bound, so a descent may go deeper; it is then forgotten and */
+/*  the next probe starts from the root. */
+#define RB_MAX_DEPTH (2*8*sizeof(void*))
+
+/***********************************************************************/
+/*  FUNCTION:  RBMultiGet */
+/**/
+/*    INPUTS:  tree is the tree to search, keys is an array of n */
+/*             pointers to keys in any order and out_nodes has room */
+/*             for n results */
+/**/
+/*    OUTPUT:  out_nodes[i] is a node with key equal to keys[i], or 0 */
+/*             if there is none.  When several nodes have that key */
+/*             either one may be returned. */
+/**/
+/*    Modifies Input: out_nodes */
+/**/
+/*    EFFECT:  Sorts the probe keys (unless they already are sorted) */
+/*             and answers them in one coordinated pass.  When there */
+/*             are fewer than RB_MULTIGET_MERGE_GAP tree nodes per probe */
+/*             it walks the tree in order from the first probe and */
+/*             merge-joins the two sorted sequences.  Otherwise each */
+/*             probe starts its descent from the deepest node on the */
+/*             previous probe's path whose subtree still covers it, */
+/*             instead of from the root, so the upper levels are only */
+/*             visited once per batch.  If there is no memory to sort */
+/*             the probes it answers them one at a time instead. */
+/***********************************************************************/
+
+void RBMultiGet(rb_red_blk_tree* tree, void** keys, int n,
+		rb_red_blk_node** out_nodes) {
+  rb_red_blk_node* nil=tree->nil;
+  rb_red_blk_node* path[RB_MAX_DEPTH];
+  rb_red_blk_node* upper[RB_MAX_DEPTH]; /* nearest ancestor we went left at */
+  rb_red_blk_node* x;
+  rb_red_blk_node* y;
+  int* order;
+  int* scratch;
+  int sorted=1;
+  int prefixed= (tree->Normalize != NULL);
+  int lost; /* set once a descent outgrows path */
+  int depth, compVal, i;
+  uint64_t qPrefix;
+  void* q;
+
+  if (n <= 0) return;
+  if (!(order=(int*) TryMalloc(2*(size_t)n*sizeof(int)))) { /* assignment */
+    RBExactQueryBatch(tree,keys,n,out_nodes);
+    return;
+  }
+  scratch=order+n;
+  for (i=1; (i < n) && sorted; i++) {
+    sorted= (1 != tree->Compare(keys[i-1],keys[i]));
+  }
+  if (sorted) {
+    for (i=0; i<n; i++) order[i]=i;
+  } else {
+    SortProbes(tree,keys,order,scratch,n);
+  }
+
+  if (tree->count < (unsigned long) n*RB_MULTIGET_MERGE_GAP) {
+    /* merge join: find the first node >= the smallest probe */
+    x=nil;
+    qPrefix=QUERY_PREFIX(tree,keys[order[0]]);
+    for (y=tree->root->left; y != nil; ) {
+      if (-1 == KeyCompare(tree,y,keys[order[0]],qPrefix,prefixed)) {
+	/* y < key */
+	y=y->right;
+      } else {
+	x=y;
+	y=y->left;
+      }
+    }
+    for (i=0; i<n; i++) {
+      q=keys[order[i]];
+      qPrefix=QUERY_PREFIX(tree,q);
+      compVal=1;
+      while (x != nil) {
+	compVal=KeyCompare(tree,x,q,qPrefix,prefixed);
+	if (-1 != compVal) break;
+	x=TreeSuccessor(tree,x);
+      }
+      out_nodes[order[i]]= ( (x != nil) && (0 == compVal) ) ? x : 0;
+    }
+  } else {
+    /* shared-prefix descents */
+    depth=0;
+    path[0]=tree->root->left;
+    upper[0]=0;
+    for (i=0; i<n; i++) {
+      q=keys[order[i]];
+      qPrefix=QUERY_PREFIX(tree,q);
+      /* probes only grow, so the descent for q passes through the */
+      /* deepest node on the previous path whose nearest left-turn */
+      /* ancestor is still greater than q */
+      while ( (depth > 0) && upper[depth] &&
+	      (1 != KeyCompare(tree,upper[depth],q,qPrefix,prefixed)) ) {
+	depth--;
+      }
+      x=path[depth];
+      lost=0;
+      out_nodes[order[i]]=0;
+      while (x != nil) {
+	compVal=KeyCompare(tree,x,q,qPrefix,prefixed);
+	if (0 == compVal) {
+	  out_nodes[order[i]]=x;
+	  break;
+	}
+	if ( (x= (1 == compVal) ? x->left : x->right) == nil) break;
+	if (lost) continue;
+	if (depth+1 == RB_MAX_DEPTH) {
+	  lost=1;
+	  depth=0;
+	  continue;
+	}
+	path[depth+1]=x;
+	upper[depth+1]= (1 == compVal) ? path[depth] : upper[depth];
+	depth++;
+      }
+    }
+  }
+  SafeFree(order,2*(size_t)n*sizeof(int));
+}
 
 /***********************************************************************/
 /*  FUNCTION:  RBDeleteFixUp */
 /**/
-/*    INPUTS:  tree is the tree to fix and x is the child of the spliced */
-/*             out node in RBTreeDelete. */
+/*    INPUTS:  tree is the tree to fix, x is the child of the spliced */
+/*             out node in RBTreeDelete and p its new parent, which */
+/*             nil, being shared, does not record */
 /**/
 /*    OUTPUT:  none */
 /**/
@@ -500,62 +1258,65 @@ rb_red_blk_node* RBExactQuery(rb_red_blk_tree* tree, void* q) {
 /*    The algorithm from this function is from _Introduction_To_Algorithms_ */
 /***********************************************************************/
 
-void RBDeleteFixUp(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+void RBDeleteFixUp(rb_red_blk_tree* tree, rb_red_blk_node* x,
+		   rb_red_blk_node* p) {
   rb_red_blk_node* root=tree->root->left;
   rb_red_blk_node* w;
 
   while( (!x->red) && (root != x)) {
-    if (x == x->parent->left) {
-      w=x->parent->right;
+    if (x == p->left) {
+      w=p->right;
       if (w->red) {
 	w->red=0;
-	x->parent->red=1;
-	LeftRotate(tree,x->parent);
-	w=x->parent->right;
+	p->red=1;
+	LeftRotate(tree,p);
+	w=p->right;
       }
       if ( (!w->right->red) && (!w->left->red) ) { 
 	w->red=1;
-	x=x->parent;
+	x=p;
+	p=x->parent;
       } else {
 	if (!w->right->red) {
 	  w->left->red=0;
 	  w->red=1;
 	  RightRotate(tree,w);
-	  w=x->parent->right;
+	  w=p->right;
 	}
-	w->red=x->parent->red;
-	x->parent->red=0;
+	w->red=p->red;
+	p->red=0;
 	w->right->red=0;
-	LeftRotate(tree,x->parent);
+	LeftRotate(tree,p);
 	x=root; /* this is to exit while loop */
       }
     } else { /* the code below is has left and right switched from above */
-      w=x->parent->left;
+      w=p->left;
       if (w->red) {
 	w->red=0;
-	x->parent->red=1;
-	RightRotate(tree,x->parent);
-	w=x->parent->left;
+	p->red=1;
+	RightRotate(tree,p);
+	w=p->left;
       }
       if ( (!w->right->red) && (!w->left->red) ) { 
 	w->red=1;
-	x=x->parent;
+	x=p;
+	p=x->parent;
       } else {
 	if (!w->left->red) {
 	  w->right->red=0;
 	  w->red=1;
 	  LeftRotate(tree,w);
-	  w=x->parent->left;
+	  w=p->left;
 	}
-	w->red=x->parent->red;
-	x->parent->red=0;
+	w->red=p->red;
+	p->red=0;
 	w->left->red=0;
-	RightRotate(tree,x->parent);
+	RightRotate(tree,p);
 	x=root; /* this is to exit while loop */
       }
     }
   }
-  x->red=0;
+  if (x != tree->nil) x->red=0;
 
 #ifdef DEBUG_ASSERT
   Assert(!tree->nil->red,"nil not black in RBDeleteFixUp");
@@ -582,12 +1343,19 @@ void RBDeleteFixUp(rb_red_blk_tree* tree, rb_red_blk_node* x) {
 void RBDelete(rb_red_blk_tree* tree, rb_red_blk_node* z){
   rb_red_blk_node* y;
   rb_red_blk_node* x;
+  rb_red_blk_node* p;
   rb_red_blk_node* nil=tree->nil;
   rb_red_blk_node* root=tree->root;
 
+  tree->count--;
+  if (tree->extra && (z == tree->extra->compactNext)) {
+    tree->extra->compactNext=TreeSuccessor(tree,z);
+  }
   y= ((z->left == nil) || (z->right == nil)) ? z : TreeSuccessor(tree,z);
   x= (y->left == nil) ? y->right : y->left;
-  if (root == (x->parent = y->parent)) { /* assignment of y->p to x->p is intentional */
+  p=y->parent;
+  if (x != nil) x->parent=p;
+  if (root == p) {
     root->left=x;
   } else {
     if (y == y->parent->left) {
@@ -603,26 +1371,26 @@ void RBDelete(rb_red_blk_tree* tree, rb_red_blk_node* z){
 #endif
     /* y is the node to splice out and x is its child */
 
-    if (!(y->red)) RBDeleteFixUp(tree,x);
+    tree->balance->DeleteFixUp(tree,x,p,y);
   
-    tree->DestroyKey(z->key);
-    tree->DestroyInfo(z->info);
+    DestroyNodeData(tree,z);
     y->left=z->left;
     y->right=z->right;
     y->parent=z->parent;
     y->red=z->red;
-    z->left->parent=z->right->parent=y;
+    /* the fix-up may have left nil on either side of z */
+    if (z->left != nil) z->left->parent=y;
+    if (z->right != nil) z->right->parent=y;
     if (z == z->parent->left) {
       z->parent->left=y; 
     } else {
       z->parent->right=y;
     }
-    free(z); 
+    RBNodeFree(tree,z);
   } else {
-    tree->DestroyKey(y->key);
-    tree->DestroyInfo(y->info);
-    if (!(y->red)) RBDeleteFixUp(tree,x);
-    free(y);
+    DestroyNodeData(tree,y);
+    tree->balance->DeleteFixUp(tree,x,p,y);
+    RBNodeFree(tree,y);
   }
   
 #ifdef DEBUG_ASSERT
@@ -647,17 +1415,21 @@ stk_stack* RBEnumerate(rb_red_blk_tree* tree, void* low, void* high) {
   rb_red_blk_node* nil=tree->nil;
   rb_red_blk_node* x=tree->root->left;
   rb_red_blk_node* lastBest=nil;
+  uint64_t highPrefix=QUERY_PREFIX(tree,high);
+  uint64_t lowPrefix=QUERY_PREFIX(tree,low);
+  int prefixed= (tree->Normalize != NULL);
 
   enumResultStack=StackCreate();
   while(nil != x) {
-    if ( 1 == (tree->Compare(x->key,high)) ) { /* x->key > high */
+    if ( 1 == KeyCompare(tree,x,high,highPrefix,prefixed) ) { /* x > high */
       x=x->left;
     } else {
       lastBest=x;
       x=x->right;
     }
   }
-  while ( (lastBest != nil) && (1 != tree->Compare(low,lastBest->key))) {
+  while ( (lastBest != nil) &&
+	  (-1 != KeyCompare(tree,lastBest,low,lowPrefix,prefixed)) ) {
     StackPush(enumResultStack,lastBest);
     lastBest=TreePredecessor(tree,lastBest);
   }
@@ -665,14 +1437,9 @@ stk_stack* RBEnumerate(rb_red_blk_tree* tree, void* low, void* high) {
 }
 
 
-int checkRepHelper (rb_red_blk_node *node, rb_red_blk_tree *t)
+/* the checks checkRepHelper makes on a single node and its children */
+void checkRepNode (rb_red_blk_node *node, rb_red_blk_tree *t)
 {
-  int left_black_cnt, right_black_cnt;
-
-  /* by convention sentinel nodes point to nil instead of null */
-  assert (node);
-  if (node == t->nil) return 0;
-  
   /* the tree order must be respected */
   /* parents and children must point to each other */
   if (node->left != t->nil) {
@@ -695,6 +1462,17 @@ int checkRepHelper (rb_red_blk_node *node, rb_red_blk_tree *t)
     assert (!node->left->red);
     assert (!node->right->red);
   }
+}
+
+int checkRepHelper (rb_red_blk_node *node, rb_red_blk_tree *t)
+{
+  int left_black_cnt, right_black_cnt;
+
+  /* by convention sentinel nodes point to nil instead of null */
+  assert (node);
+  if (node == t->nil) return 0;
+  
+  checkRepNode (node, t);
 
   /* every root->leaf path has the same number of black nodes */
   left_black_cnt = checkRepHelper (node->left, t);
@@ -703,10 +1481,30 @@ int checkRepHelper (rb_red_blk_node *node, rb_red_blk_tree *t)
   return left_black_cnt + (node->red ? 0 : 1);
 }
 
-void checkRep (rb_red_blk_tree *tree)
+static void RedBlackCheckRep (rb_red_blk_tree *tree)
 {
   /* root is black by convention */
   assert (!tree->root->left->red);
   checkRepHelper (tree->root->left, tree);
 }
 
+void checkRep (rb_red_blk_tree *tree)
+{
+  tree->balance->CheckRep (tree);
+}
+
+static void RedBlackDeleteFixUp(rb_red_blk_tree* tree, rb_red_blk_node* x,
+				rb_red_blk_node* p, rb_red_blk_node* y) {
+  if (!y->red) RBDeleteFixUp(tree,x,p);
+}
+
+/*  RBBuildSubtree's trees are all black but for a partial bottom level */
+
+static int RedBlackLabel(long n, int depth, int redDepth) {
+  return(depth == redDepth);
+}
+
+const rb_balance RBBalanceRedBlack={"red-black",RedBlackInsertFixUp,
+				    RedBlackDeleteFixUp,RedBlackLabel,
+				    RedBlackCheckRep};
+
@@ -3,6 +3,10 @@
 #endif
 #include"misc.h"
 #include"stack.h"
+#include<stdint.h>
+
+#ifndef INC_RED_BLACK_TREE_
+#define INC_RED_BLACK_TREE_
 
 /*  CONVENTIONS:  All data structures for red-black trees have the prefix */
 /*                "rb_" to prevent name conflicts. */
@@ -23,6 +27,17 @@
 /* checks from the compiled code.  */
 #define DEBUG_ASSERT 1
 
+/* the number of lookups RBExactQueryBatch keeps in flight at once */
+#ifndef RB_BATCH_WINDOW
+#define RB_BATCH_WINDOW 16
+#endif
+
+/* RBMultiGet walks the tree in order instead of descending once per */
+/* key when there are fewer than this many tree nodes per probe key */
+#ifndef RB_MULTIGET_MERGE_GAP
+#define RB_MULTIGET_MERGE_GAP 4
+#endif
+
 typedef struct rb_red_blk_node {
   void* key;
   void* info;
@@ -32,6 +47,104 @@ typedef struct rb_red_blk_node {
   struct rb_red_blk_node* parent;
 } rb_red_blk_node;
 
+/*  a node of a tree which keeps key prefixes (see RBTreeUsePrefix). */
+/*  The prefix follows the node, so only such trees pay for it, and */
+/*  whatever else a tree keeps in its nodes must come after it, as in */
+/*  rb_string_node. */
+typedef struct rb_prefixed_node {
+  rb_red_blk_node node;
+  uint64_t prefix; /* Normalize(key) */
+} rb_prefixed_node;
+
+#define RB_NODE_PREFIX(x) (((rb_prefixed_node*) (x))->prefix)
+
+
+/*  a block of nodes packed together by tree_compact.c.  RBNodeFree */
+/*  counts its nodes off instead of freeing them, and the block is */
+/*  freed once none is left (see RBTreeReleaseRegions). */
+typedef struct rb_region {
+  char* base;
+  size_t bytes;
+  long live; /* nodes in the block still in use */
+  int filling; /* set while a compaction is still moving nodes in */
+  struct rb_region* next;
+} rb_region;
+
+/*  A balancing scheme for the red-black engine (see RBTreeUseBalance). */
+/*  Every scheme keeps a small number per node in the red field, */
+/*  which is 0 in nil, and rebalances with LeftRotate and RightRotate, */
+/*  so searches, enumeration, TreeSuccessor and TreePredecessor work */
+/*  on every tree the same way. */
+/**/
+/*  InsertFixUp is called once x is linked in as a leaf, with its red */
+/*  field not yet set.  DeleteFixUp is called once RBDelete has */
+/*  spliced y out and put its child x, which may be nil, in its place */
+/*  under p; nil is shared and read-only, so its parent is never set. */
+/*  If y was not the node being deleted, y afterwards takes that */
+/*  node's place and red field. */
+/*  BuiltLabel is the red field of a node RBBuildSubtree puts on top */
+/*  of n nodes at the given depth, redDepth being as there. */
+/*  CheckRep asserts the scheme's invariant for checkRep. */
+struct rb_red_blk_tree;
+typedef struct rb_balance {
+  const char* name;
+  void (*InsertFixUp)(struct rb_red_blk_tree*, rb_red_blk_node* x);
+  void (*DeleteFixUp)(struct rb_red_blk_tree*, rb_red_blk_node* x,
+		      rb_red_blk_node* p, rb_red_blk_node* y);
+  int (*BuiltLabel)(long n, int depth, int redDepth);
+  void (*CheckRep)(struct rb_red_blk_tree*);
+} rb_balance;
+
+extern const rb_balance RBBalanceRedBlack;
+
+/*  Where a tree's memory comes from (see RBTreeUseAllocator and */
+/*  tree_alloc.h).  Alloc returns size bytes aligned as malloc's are, */
+/*  or NULL if it has none to give, and Free is passed the size that */
+/*  was asked for.  Both get context, so one pair of functions can */
+/*  serve several arenas.  Trees only keep a pointer to the allocator, */
+/*  which must outlive them.  RBParallelDestroy calls Free for one */
+/*  tree from several threads at once, as RBTreeBuildParallel does */
+/*  Alloc for the trees it makes, so an allocator given to a tree */
+/*  destroyed that way must be thread safe, as the malloc, node cache */
+/*  and node_arena.h allocators are. */
+typedef struct rb_allocator {
+  void* (*Alloc)(void* context, size_t size);
+  void (*Free)(void* context, void* p, size_t size);
+  void* context;
+} rb_allocator;
+
+/*  what a tree has allocated and not freed, and the most it ever had */
+/*  at once (see RBTreeGetMemStats) */
+typedef struct rb_mem_stats {
+  long liveBytes;
+  long peakBytes;
+  long liveNodes;
+  long peakNodes;
+  unsigned long failures; /* allocations refused or failed */
+} rb_mem_stats;
+
+/*  What only some trees need, kept apart so that the others stay */
+/*  small.  A tree gets one when it is first given an allocator or a */
+/*  budget, made inline, or compacted (see RBTreeExtra in */
+/*  tree_alloc.h), and keeps it until RBTreeClear. */
+typedef struct rb_tree_extra {
+  /*  where nodes come from; the most bytes and nodes the tree may */
+  /*  have, 0 for no limit; and what it has (see tree_alloc.h) */
+  const rb_allocator* allocator;
+  long maxBytes;
+  long maxNodes;
+  rb_mem_stats mem;
+  /*  nonzero in trees made by RBTreeCreateInline, which copies keys */
+  /*  of keySize bytes and values of valueSize bytes into each node */
+  /*  (see tree_inline.h) */
+  size_t keySize;
+  size_t valueSize;
+  /*  the blocks compacted nodes live in, and while an incremental */
+  /*  compaction runs the next node it will move, which RBDelete */
+  /*  moves on if it deletes that node (see tree_compact.h) */
+  rb_region* regions;
+  rb_red_blk_node* compactNext;
+} rb_tree_extra;
 
 /* Compare(a,b) should return 1 if *a > *b, -1 if *a < *b, and 0 otherwise */
 /* Destroy(a) takes a pointer to whatever key might be and frees it accordingly */
@@ -41,14 +154,32 @@ typedef struct rb_red_blk_tree {
   void (*DestroyInfo)(void* a);
   void (*PrintKey)(const void* a);
   void (*PrintInfo)(void* a);
-  /*  A sentinel is used for root and for nil.  These sentinels are */
-  /*  created when RBTreeCreate is caled.  root->left should always */
+  /*  A sentinel is used for root and for nil.  root points to */
+  /*  rootNode, in the tree itself, and root->left should always */
   /*  point to the node which is the root of the tree.  nil points to a */
-  /*  node which should always be black but has aribtrary children and */
-  /*  parent and no key or info.  The point of using these sentinels is so */
-  /*  that the root and nil nodes do not require special cases in the code */
+  /*  black node with no key or info which all trees share.  Nothing */
+  /*  ever writes to it, so it is read-only and never has a parent. */
+  /*  The point of using these sentinels is so that the root and nil */
+  /*  nodes do not require special cases in the code */
   rb_red_blk_node* root;             
   rb_red_blk_node* nil;              
+  rb_red_blk_node rootNode;
+  /*  if Normalize is set every node is an rb_prefixed_node keeping */
+  /*  Normalize(key), and searches compare prefixes before calling */
+  /*  Compare (see RBTreeUsePrefix) */
+  uint64_t (*Normalize)(const void* key);
+  /*  bytes RBNodeAlloc gives each node, sizeof(rb_red_blk_node) unless */
+  /*  it was raised before the first insert to keep data after the */
+  /*  node, as tree_string.h does */
+  size_t nodeSize;
+  /*  NULL in a tree whose nodes come from malloc, uncounted and */
+  /*  unlimited, and which is neither inline nor compacted */
+  rb_tree_extra* extra;
+  /*  how inserts and deletes keep the tree balanced, RBBalanceRedBlack */
+  /*  unless RBTreeUseBalance chose another (NULL in other engines) */
+  const rb_balance* balance;
+  unsigned long rotations; /* done by LeftRotate and RightRotate */
+  unsigned long count; /* number of nodes in the tree */
 } rb_red_blk_tree;
 
 rb_red_blk_tree* RBTreeCreate(int  (*CompFunc)(const void*, const void*),
@@ -56,13 +187,50 @@ rb_red_blk_tree* RBTreeCreate(int  (*CompFunc)(const void*, const void*),
 			     void (*InfoDestFunc)(void*), 
 			     void (*PrintFunc)(const void*),
 			     void (*PrintInfo)(void*));
+void RBTreeInit(rb_red_blk_tree*,
+		int (*CompFunc)(const void*, const void*),
+		void (*DestFunc)(void*),
+		void (*InfoDestFunc)(void*),
+		void (*PrintFunc)(const void*),
+		void (*PrintInfo)(void*));
 rb_red_blk_node * RBTreeInsert(rb_red_blk_tree*, void* key, void* info);
+void RBTreeUseNodeCache(rb_red_blk_tree*);
+void RBTreeUseAllocator(rb_red_blk_tree*, const rb_allocator*);
+void RBTreeUsePrefix(rb_red_blk_tree*, uint64_t (*Normalize)(const void*));
+void RBTreeUseBalance(rb_red_blk_tree*, const rb_balance*);
 void RBTreePrint(rb_red_blk_tree*);
 void RBDelete(rb_red_blk_tree* , rb_red_blk_node* );
 void RBTreeDestroy(rb_red_blk_tree*);
+void RBTreeClear(rb_red_blk_tree*);
+void RBTreeRebalance(rb_red_blk_tree*);
 rb_red_blk_node* TreePredecessor(rb_red_blk_tree*,rb_red_blk_node*);
 rb_red_blk_node* TreeSuccessor(rb_red_blk_tree*,rb_red_blk_node*);
 rb_red_blk_node* RBExactQuery(rb_red_blk_tree*, void*);
+void RBExactQueryBatch(rb_red_blk_tree*, void** keys, int n,
+		       rb_red_blk_node** out_nodes);
+void RBMultiGet(rb_red_blk_tree*, void** keys, int n,
+		rb_red_blk_node** out_nodes);
 stk_stack * RBEnumerate(rb_red_blk_tree* tree,void* low, void* high);
 void NullFunction(void*);
 void checkRep (rb_red_blk_tree *tree);
+int checkRepHelper (rb_red_blk_node *node, rb_red_blk_tree *t);
+void checkRepNode (rb_red_blk_node *node, rb_red_blk_tree *t);
+
+/*  for code which builds trees directly; see red_black_tree.c */
+rb_red_blk_node* RBNodeAlloc(rb_red_blk_tree*);
+void RBNodeFree(rb_red_blk_tree*, rb_red_blk_node*);
+void RBTreeReleaseRegions(rb_red_blk_tree*);
+void RBNodeSetKey(rb_red_blk_tree*, rb_red_blk_node*, void* key);
+rb_red_blk_node* RBTreeInsertNode(rb_red_blk_tree*, rb_red_blk_node*);
+void LeftRotate(rb_red_blk_tree*, rb_red_blk_node*);
+void RightRotate(rb_red_blk_tree*, rb_red_blk_node*);
+void TreeDestHelper(rb_red_blk_tree*, rb_red_blk_node*);
+int RBBalancedRedDepth(long n);
+rb_red_blk_node* RBBuildSubtree(rb_red_blk_tree*, long n, int depth,
+				int redDepth,
+				int (*NextItem)(void*, void**, void**),
+				void* context);
+int RBTreeBuildSorted(rb_red_blk_tree*, long n,
+		      int (*NextItem)(void*, void**, void**), void* context);
+
+#endif
@@ -1,5 +1,8 @@
 #include "misc.h"
 
+#ifndef INC_E_STACK_
+#define INC_E_STACK_
+
 /*  CONVENTIONS:  All data structures for stacks have the prefix */
 /*                "stk_" to prevent name conflicts. */
 /*                                                                      */
@@ -39,3 +42,5 @@ stk_stack * StackJoin(stk_stack * stack1, stk_stack * stack2);
 stk_stack * StackCreate();
 void StackPush(stk_stack * theStack, DATA_TYPE newInfoPointer);
 void * StackPop(stk_stack * theStack);
+
+#endif
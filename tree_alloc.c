@@ -0,0 +1,206 @@
+#include "tree_alloc.h"
+#include "node_cache.h"
+#include <string.h>
+
+static void* MallocAlloc(void* context, size_t size) {
+  return(TryMalloc(size));
+}
+
+static void MallocFree(void* context, void* p, size_t size) {
+  SafeFree(p,size);
+}
+
+const rb_allocator RBMallocAllocator={MallocAlloc,MallocFree,NULL};
+
+static void* CacheAlloc(void* context, size_t size) {
+  return(NodeCacheAlloc(size));
+}
+
+static void CacheFree(void* context, void* p, size_t size) {
+  NodeCacheFree(p,size);
+}
+
+const rb_allocator RBNodeCacheAllocator={CacheAlloc,CacheFree,NULL};
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeUseNodeCache */
+/**/
+/*  INPUTS:  tree is an empty tree */
+/**/
+/*  OUTPUT:  none */
+/**/
+/*  EFFECTS:  From now on the nodes of tree are allocated from the */
+/*            per-thread node caches in node_cache.h.  Use this when */
+/*            several threads each insert into their own trees: the */
+/*            caches keep them from contending on malloc and on the */
+/*            memory counter in SafeMalloc.  The caches keep freed */
+/*            nodes for reuse instead of giving them back to malloc. */
+/**/
+/*  Modifies Input: tree */
+/***********************************************************************/
+
+void RBTreeUseNodeCache(rb_red_blk_tree* tree) {
+  RBTreeUseAllocator(tree,&RBNodeCacheAllocator);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeExtra */
+/**/
+/*    INPUTS:  tree is a tree not being changed by another thread */
+/**/
+/*    OUTPUT:  tree's rb_tree_extra */
+/**/
+/*    EFFECT:  makes the block if tree has none yet.  Its allocator is */
+/*             RBMallocAllocator, it has no budget, and its counts */
+/*             start from the bytes and nodes tree already holds. */
+/**/
+/*    Modifies Input: tree */
+/***********************************************************************/
+
+rb_tree_extra* RBTreeExtra(rb_red_blk_tree* tree) {
+  rb_tree_extra* e=tree->extra;
+
+  if (e) return(e);
+  e=(rb_tree_extra*) SafeMalloc(sizeof(rb_tree_extra));
+  memset(e,0,sizeof(rb_tree_extra));
+  e->allocator=&RBMallocAllocator;
+  e->mem.liveBytes=e->mem.peakBytes=RBTreeHeldBytes(tree);
+  e->mem.liveNodes=e->mem.peakNodes=(long) tree->count;
+  tree->extra=e;
+  return(e);
+}
+
+/*  for RBTreeClear, once the tree holds nothing more */
+
+void RBTreeFreeExtra(rb_red_blk_tree* tree) {
+  free(tree->extra);
+  tree->extra=NULL;
+}
+
+void RBTreeCountFailure(rb_red_blk_tree* tree) {
+  if (tree->extra) {
+    __atomic_add_fetch(&tree->extra->mem.failures,1,__ATOMIC_RELAXED);
+  }
+}
+
+/*  RBTreeSetBudget limits tree to maxBytes bytes and maxNodes nodes, */
+/*  0 meaning no limit.  A budget below what the tree holds already */
+/*  only refuses further allocations. */
+
+void RBTreeSetBudget(rb_red_blk_tree* tree, long maxBytes, long maxNodes) {
+  rb_tree_extra* e=RBTreeExtra(tree);
+
+  e->maxBytes=maxBytes;
+  e->maxNodes=maxNodes;
+}
+
+void RBTreeGetMemStats(rb_red_blk_tree* tree, rb_mem_stats* stats) {
+  rb_mem_stats* mem;
+
+  if (!tree->extra) {
+    stats->liveBytes=stats->peakBytes=RBTreeHeldBytes(tree);
+    stats->liveNodes=stats->peakNodes=(long) tree->count;
+    stats->failures=0;
+    return;
+  }
+  mem=&tree->extra->mem;
+  stats->liveBytes=__atomic_load_n(&mem->liveBytes,__ATOMIC_RELAXED);
+  stats->peakBytes=__atomic_load_n(&mem->peakBytes,__ATOMIC_RELAXED);
+  stats->liveNodes=__atomic_load_n(&mem->liveNodes,__ATOMIC_RELAXED);
+  stats->peakNodes=__atomic_load_n(&mem->peakNodes,__ATOMIC_RELAXED);
+  stats->failures=__atomic_load_n(&mem->failures,__ATOMIC_RELAXED);
+}
+
+/*  raises *peak to live if live is higher */
+
+static void RaisePeak(long* peak, long live) {
+  long old=__atomic_load_n(peak,__ATOMIC_RELAXED);
+
+  while ( (live > old) &&
+	  !__atomic_compare_exchange_n(peak,&old,live,1,__ATOMIC_RELAXED,
+				       __ATOMIC_RELAXED) );
+}
+
+/*  adds bytes and nodes to e's counts unless that takes it over */
+/*  its budget and force is not set, returning 0 if so */
+
+static int Reserve(rb_tree_extra* e, long bytes, long nodes, int force) {
+  long liveBytes=__atomic_add_fetch(&e->mem.liveBytes,bytes,
+				    __ATOMIC_RELAXED);
+  long liveNodes=__atomic_add_fetch(&e->mem.liveNodes,nodes,
+				    __ATOMIC_RELAXED);
+
+  if (!force &&
+      ( (e->maxBytes && (bytes > 0) && (liveBytes > e->maxBytes)) ||
+	(e->maxNodes && (nodes > 0) && (liveNodes > e->maxNodes)) )) {
+    __atomic_sub_fetch(&e->mem.liveBytes,bytes,__ATOMIC_RELAXED);
+    __atomic_sub_fetch(&e->mem.liveNodes,nodes,__ATOMIC_RELAXED);
+    __atomic_add_fetch(&e->mem.failures,1,__ATOMIC_RELAXED);
+    return(0);
+  }
+  return(1);
+}
+
+static void RaisePeaks(rb_tree_extra* e) {
+  RaisePeak(&e->mem.peakBytes,
+	    __atomic_load_n(&e->mem.liveBytes,__ATOMIC_RELAXED));
+  RaisePeak(&e->mem.peakNodes,
+	    __atomic_load_n(&e->mem.liveNodes,__ATOMIC_RELAXED));
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeCharge */
+/**/
+/*    INPUTS:  bytes and nodes are what tree is about to hold in */
+/*             addition, or if negative what it has given back; force */
+/*             is set for memory the caller cannot do without */
+/**/
+/*    OUTPUT:  0 if the charge would take tree over its budget and */
+/*             force is not set, 1 otherwise */
+/**/
+/*    EFFECT:  adds bytes and nodes to tree's counts, unless it returns */
+/*             0, in which case it counts a failure instead.  A tree */
+/*             which is not counted has nothing to refuse. */
+/**/
+/*    Modifies Input: tree */
+/***********************************************************************/
+
+int RBTreeCharge(rb_red_blk_tree* tree, long bytes, long nodes, int force) {
+  rb_tree_extra* e=tree->extra;
+
+  if (!e) return(1);
+  if (!Reserve(e,bytes,nodes,force)) return(0);
+  if ( (bytes > 0) || (nodes > 0) ) RaisePeaks(e);
+  return(1);
+}
+
+/*  RBTreeAllocBytes gets size bytes holding nodes nodes from tree's */
+/*  allocator, or NULL if the budget or the allocator refuses them. */
+/*  RBTreeFreeBytes gives them back. */
+
+void* RBTreeAllocBytes(rb_red_blk_tree* tree, size_t size, long nodes) {
+  rb_tree_extra* e=tree->extra;
+  void* p;
+
+  if (!e) return(TryMalloc(size));
+  if (!Reserve(e,(long) size,nodes,0)) return(NULL);
+  if (!(p=e->allocator->Alloc(e->allocator->context,size))) {
+    Reserve(e,-(long) size,-nodes,1);
+    __atomic_add_fetch(&e->mem.failures,1,__ATOMIC_RELAXED);
+    return(NULL);
+  }
+  RaisePeaks(e);
+  return(p);
+}
+
+void RBTreeFreeBytes(rb_red_blk_tree* tree, void* p, size_t size,
+		     long nodes) {
+  rb_tree_extra* e=tree->extra;
+
+  if (!e) {
+    SafeFree(p,size);
+    return;
+  }
+  e->allocator->Free(e->allocator->context,p,size);
+  Reserve(e,-(long) size,-nodes,1);
+}
@@ -0,0 +1,59 @@
+#include"red_black_tree.h"
+
+#ifndef INC_TREE_ALLOC_
+#define INC_TREE_ALLOC_
+
+/*  Each tree gets its nodes from its own rb_allocator, so trees of */
+/*  different tenants can live in different arenas, and may be given */
+/*  a budget of bytes and of nodes.  An insert which would go over */
+/*  the budget, or whose allocator returns NULL, fails: RBTreeInsert */
+/*  returns NULL and leaves the tree as it was. */
+/**/
+/*  The allocator, the budget and the counts live in the tree's */
+/*  rb_tree_extra, which RBTreeUseAllocator and RBTreeSetBudget make. */
+/*  A tree without one takes its nodes from malloc and counts nothing, */
+/*  so the inserts of most trees pay no atomics.  A budget of 0 bytes */
+/*  and 0 nodes has a tree counted without limiting it. */
+/**/
+/*  A counted tree keeps the bytes and nodes it holds, and the most it */
+/*  ever held, as they are allocated and freed, starting from what it */
+/*  held when it got its rb_tree_extra.  The counts are atomic since */
+/*  RBParallelDestroy frees one tree's nodes from several threads. */
+/*  RBTreeGetMemStats reports for a tree which is not counted what */
+/*  it holds now, as both its live and its peak figures. */
+/**/
+/*  Besides the nodes the counts cover the blocks tree_compact.c */
+/*  moves them into and, in the other engines, the B+-tree nodes and */
+/*  the hot/cold slot arrays.  Those are counted but never refused, */
+/*  since an insert cannot back out once it has begun to split or */
+/*  grow them, so they can take a tree somewhat past maxBytes.  The */
+/*  inserts get them before changing anything, though, so when */
+/*  memory itself runs out they fail too. */
+/*  Keys and infos the tree does not hold in its nodes, such as the */
+/*  long keys of tree_string.h, are the caller's and are not counted. */
+/**/
+/*  RBMallocAllocator, every tree's to start with, uses TryMalloc and */
+/*  SafeFree, so nodes count towards MALLOC_LIMIT while they live. */
+/*  RBNodeCacheAllocator uses the per-thread caches of node_cache.h. */
+/*  Both may be called from several threads at once, which any */
+/*  allocator given to a tree destroyed with RBParallelDestroy must */
+/*  allow too (see rb_allocator). */
+
+extern const rb_allocator RBMallocAllocator;
+extern const rb_allocator RBNodeCacheAllocator;
+
+void RBTreeSetBudget(rb_red_blk_tree*, long maxBytes, long maxNodes);
+void RBTreeGetMemStats(rb_red_blk_tree*, rb_mem_stats*);
+
+/*  for the engines and for code which allocates for a tree directly */
+#define RB_TREE_ALLOCATOR(tree) \
+  ((tree)->extra ? (tree)->extra->allocator : &RBMallocAllocator)
+rb_tree_extra* RBTreeExtra(rb_red_blk_tree*);
+void RBTreeFreeExtra(rb_red_blk_tree*);
+long RBTreeHeldBytes(rb_red_blk_tree*); /* each engine's */
+void RBTreeCountFailure(rb_red_blk_tree*);
+int RBTreeCharge(rb_red_blk_tree*, long bytes, long nodes, int force);
+void* RBTreeAllocBytes(rb_red_blk_tree*, size_t size, long nodes);
+void RBTreeFreeBytes(rb_red_blk_tree*, void* p, size_t size, long nodes);
+
+#endif
@@ -0,0 +1,303 @@
+#include "tree_balance.h"
+#include <assert.h>
+
+/*  the height of the subtree RBBuildSubtree makes of n nodes, which */
+/*  splits every range at its middle: the number of bits in n */
+
+static int BuiltHeight(long n, int depth, int redDepth) {
+  int height=0;
+
+  for (; n; n>>=1) height++;
+  return(height);
+}
+
+/*  the order and link checks checkRepNode makes, without its colors */
+
+static void CheckLinks(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  if (x->left != tree->nil) {
+    assert (tree->Compare(x->key,x->left->key) >= 0);
+    assert (x->left->parent == x);
+  }
+  if (x->right != tree->nil) {
+    assert (tree->Compare(x->key,x->right->key) <= 0);
+    assert (x->right->parent == x);
+  }
+}
+
+/*  sets x's height from its children's */
+
+static void SetHeight(rb_red_blk_node* x) {
+  x->red=1+ ((x->left->red > x->right->red) ? x->left->red : x->right->red);
+}
+
+/*  Restores the AVL property at x, whose children are AVL trees */
+/*  differing in height by at most two, with one or two rotations. */
+/*  Returns the top of what was x's subtree, with its height set. */
+
+static rb_red_blk_node* AVLBalanceAt(rb_red_blk_tree* tree,
+				     rb_red_blk_node* x) {
+  rb_red_blk_node* y;
+
+  if (x->left->red > x->right->red+1) {
+    y=x->left;
+    if (y->right->red > y->left->red) {
+      LeftRotate(tree,y);
+      SetHeight(y);
+      y=x->left;
+    }
+    RightRotate(tree,x);
+  } else if (x->right->red > x->left->red+1) {
+    y=x->right;
+    if (y->left->red > y->right->red) {
+      RightRotate(tree,y);
+      SetHeight(y);
+      y=x->right;
+    }
+    LeftRotate(tree,x);
+  } else {
+    SetHeight(x);
+    return(x);
+  }
+  SetHeight(x);
+  SetHeight(y);
+  return(y);
+}
+
+/*  Walks up from x, rebalancing and fixing heights, until it meets a */
+/*  subtree whose height has not changed. */
+
+static void AVLRetrace(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  rb_red_blk_node* top;
+  int oldHeight;
+
+  while (x != tree->root) {
+    oldHeight=x->red;
+    top=AVLBalanceAt(tree,x);
+    if (top->red == oldHeight) return;
+    x=top->parent;
+  }
+}
+
+static void AVLInsertFixUp(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  x->red=1;
+  AVLRetrace(tree,x->parent);
+}
+
+static void AVLDeleteFixUp(rb_red_blk_tree* tree, rb_red_blk_node* x,
+			   rb_red_blk_node* p, rb_red_blk_node* y) {
+  AVLRetrace(tree,p);
+}
+
+static int CheckAVL(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  int left, right;
+
+  if (x == tree->nil) return(0);
+  CheckLinks(tree,x);
+  left=CheckAVL(tree,x->left);
+  right=CheckAVL(tree,x->right);
+  assert ( (left-right <= 1) && (right-left <= 1) );
+  assert (x->red == 1+ ((left > right) ? left : right));
+  return(x->red);
+}
+
+static void AVLCheckRep(rb_red_blk_tree* tree) {
+  assert (!tree->nil->red);
+  CheckAVL(tree,tree->root->left);
+}
+
+const rb_balance RBBalanceAVL={"AVL",AVLInsertFixUp,AVLDeleteFixUp,
+			       BuiltHeight,AVLCheckRep};
+
+/*  WAVL trees, after Haeupler, Sen and Tarjan, "Rank-Balanced Trees". */
+/*  A node's rank difference is its parent's rank less its own. */
+
+static void WAVLInsertFixUp(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  rb_red_blk_node* p=x->parent;
+  rb_red_blk_node* s;
+  rb_red_blk_node* y;
+
+  x->red=1;
+  /* while x has rank difference 0 */
+  while ( (p != tree->root) && (p->red == x->red) ) {
+    s= (x == p->left) ? p->right : p->left;
+    if (p->red-s->red == 1) { /* promote p and carry on above it */
+      p->red++;
+      x=p;
+      p=x->parent;
+      continue;
+    }
+    /* s has rank difference 2, and so does one child of x */
+    if (x == p->left) {
+      y=x->right;
+      if (x->red-y->red == 2) {
+	RightRotate(tree,p);
+	p->red--;
+      } else {
+	LeftRotate(tree,x);
+	RightRotate(tree,p);
+	y->red++;
+	x->red--;
+	p->red--;
+      }
+    } else {
+      y=x->left;
+      if (x->red-y->red == 2) {
+	LeftRotate(tree,p);
+	p->red--;
+      } else {
+	RightRotate(tree,x);
+	LeftRotate(tree,p);
+	y->red++;
+	x->red--;
+	p->red--;
+      }
+    }
+    break;
+  }
+}
+
+static void WAVLDeleteFixUp(rb_red_blk_tree* tree, rb_red_blk_node* x,
+			    rb_red_blk_node* p, rb_red_blk_node* y) {
+  rb_red_blk_node* nil=tree->nil;
+  rb_red_blk_node* s;
+  rb_red_blk_node* t;
+
+  if (p == tree->root) return;
+  if ( (p->left == nil) && (p->right == nil) && (p->red == 2) ) {
+    p->red=1; /* a leaf must have rank 1 */
+    x=p;
+    p=x->parent;
+  }
+  /* while x has rank difference 3 */
+  while ( (p != tree->root) && (p->red-x->red == 3) ) {
+    s= (x == p->left) ? p->right : p->left;
+    if (p->red-s->red == 2) {
+      p->red--;
+      x=p;
+      p=x->parent;
+      continue;
+    }
+    if ( (s->red-s->left->red == 2) && (s->red-s->right->red == 2) ) {
+      p->red--;
+      s->red--;
+      x=p;
+      p=x->parent;
+      continue;
+    }
+    /* s has rank difference 1 and a child of rank difference 1 */
+    if (x == p->left) {
+      t=s->left;
+      if (s->red-s->right->red == 1) {
+	LeftRotate(tree,p);
+	s->red++;
+	p->red--;
+	if ( (p->left == nil) && (p->right == nil) ) p->red--;
+      } else {
+	RightRotate(tree,s);
+	LeftRotate(tree,p);
+	t->red+=2;
+	p->red-=2;
+	s->red--;
+      }
+    } else {
+      t=s->right;
+      if (s->red-s->left->red == 1) {
+	RightRotate(tree,p);
+	s->red++;
+	p->red--;
+	if ( (p->left == nil) && (p->right == nil) ) p->red--;
+      } else {
+	LeftRotate(tree,s);
+	RightRotate(tree,p);
+	t->red+=2;
+	p->red-=2;
+	s->red--;
+      }
+    }
+    break;
+  }
+}
+
+static void CheckWAVL(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  if (x == tree->nil) return;
+  CheckLinks(tree,x);
+  assert ( (x->red-x->left->red == 1) || (x->red-x->left->red == 2) );
+  assert ( (x->red-x->right->red == 1) || (x->red-x->right->red == 2) );
+  if ( (x->left == tree->nil) && (x->right == tree->nil) ) {
+    assert (x->red == 1);
+  }
+  CheckWAVL(tree,x->left);
+  CheckWAVL(tree,x->right);
+}
+
+static void WAVLCheckRep(rb_red_blk_tree* tree) {
+  assert (!tree->nil->red);
+  CheckWAVL(tree,tree->root->left);
+}
+
+const rb_balance RBBalanceWAVL={"WAVL",WAVLInsertFixUp,WAVLDeleteFixUp,
+				BuiltHeight,WAVLCheckRep};
+
+/*  a treap rank: 1 plus the trailing zeros of a hash of x's address, */
+/*  so rank k has probability 2^-k and the rank of a node, like its */
+/*  height in a balanced tree, is at least k for about n/2^(k-1) of */
+/*  n nodes */
+
+static int TreapRank(rb_red_blk_node* x) {
+  uint64_t h=(uint64_t) (uintptr_t) x;
+
+  h^=h >> 33;
+  h*=0xff51afd7ed558ccdULL;
+  h^=h >> 33;
+  h*=0xc4ceb9fe1a85ec53ULL;
+  h^=h >> 33;
+  return(1+__builtin_ctzll(h | (1ULL << 62)));
+}
+
+/*  whether x, a child of p, must be rotated above it: a left child */
+/*  must rank below its parent, a right child no higher */
+
+static int TreapOutranks(rb_red_blk_node* x, rb_red_blk_node* p) {
+  return( (x == p->left) ? (x->red >= p->red) : (x->red > p->red) );
+}
+
+static void TreapInsertFixUp(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  rb_red_blk_node* p;
+
+  x->red=TreapRank(x);
+  while ( ((p=x->parent) != tree->root) && TreapOutranks(x,p) ) {
+    if (x == p->left) {
+      RightRotate(tree,p);
+    } else {
+      LeftRotate(tree,p);
+    }
+  }
+}
+
+/*  Splicing out y keeps the heap order, since its child x ranks no */
+/*  higher than y did.  When y then replaces the deleted node it takes */
+/*  that node's rank, which is still above everything in its new left */
+/*  subtree and no lower than its new right subtree, because y has the */
+/*  smallest key there. */
+
+static void TreapDeleteFixUp(rb_red_blk_tree* tree, rb_red_blk_node* x,
+			     rb_red_blk_node* p, rb_red_blk_node* y) {
+}
+
+static void CheckTreap(rb_red_blk_tree* tree, rb_red_blk_node* x) {
+  if (x == tree->nil) return;
+  CheckLinks(tree,x);
+  assert (x->red >= 1);
+  if (x->left != tree->nil) assert (x->left->red < x->red);
+  if (x->right != tree->nil) assert (x->right->red <= x->red);
+  CheckTreap(tree,x->left);
+  CheckTreap(tree,x->right);
+}
+
+static void TreapCheckRep(rb_red_blk_tree* tree) {
+  assert (!tree->nil->red);
+  CheckTreap(tree,tree->root->left);
+}
+
+const rb_balance RBBalanceTreap={"treap",TreapInsertFixUp,TreapDeleteFixUp,
+				 BuiltHeight,TreapCheckRep};
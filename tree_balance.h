@@ -0,0 +1,29 @@
+#include"red_black_tree.h"
+
+#ifndef INC_TREE_BALANCE_
+#define INC_TREE_BALANCE_
+
+/*  Balancing schemes other than red-black for RBTreeUseBalance.  Each */
+/*  keeps one number per node in the red field, where nil has 0: */
+/**/
+/*  RBBalanceAVL keeps each node's height, a leaf's being 1, and the */
+/*  heights of a node's children within one of each other.  Its trees */
+/*  are at most about 1.44 lg n deep against 2 lg n for red-black, */
+/*  but inserts and deletes rotate more often. */
+/**/
+/*  RBBalanceWAVL keeps a rank, a leaf's being 1, and every node's */
+/*  rank 1 or 2 above each of its children's.  Inserts rebalance as */
+/*  in AVL, so a tree built by inserts alone is an AVL tree, while a */
+/*  delete does at most two rotations, as in red-black trees. */
+/**/
+/*  RBBalanceTreap gives each node a random rank, 1 plus the trailing */
+/*  zeros of a hash of its address, and keeps the tree heap ordered */
+/*  on ranks, with equal ranks allowed only down to the right (as in */
+/*  a zip tree).  Inserts rotate the new node up and deletes need no */
+/*  rotations at all; the expected depth is about 1.5 lg n. */
+
+extern const rb_balance RBBalanceAVL;
+extern const rb_balance RBBalanceWAVL;
+extern const rb_balance RBBalanceTreap;
+
+#endif
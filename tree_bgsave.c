@@ -0,0 +1,161 @@
+#include "tree_bgsave.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+static double Seconds(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return(ts.tv_sec+ts.tv_nsec*1e-9);
+}
+
+static long MinorFaults(void) {
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF,&usage);
+  return(usage.ru_minflt);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeBackgroundSave */
+/**/
+/*    INPUTS:  tree is the tree to save, Save(tree,context) writes it */
+/*             and returns 1 on success, flags are RB_BGSAVE_ flags */
+/*             and maxCopiedPages is how many page copies to allow */
+/*             before giving up, or 0 for no limit */
+/**/
+/*    OUTPUT:  the running save, or NULL if the pipe or fork failed */
+/**/
+/*    EFFECT:  forks a child which calls Save and exits.  The parent */
+/*             returns at once; the tree may be changed as soon as */
+/*             this returns. */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+rb_bgsave* RBTreeBackgroundSave(rb_red_blk_tree* tree,
+				int (*Save)(rb_red_blk_tree*, void*),
+				void* context, int flags, long maxCopiedPages) {
+  rb_bgsave* save;
+  int fds[2];
+  char result;
+
+  if (pipe(fds) != 0) return(NULL);
+  save=(rb_bgsave*) SafeMalloc(sizeof(rb_bgsave));
+  save->status=RB_BGSAVE_RUNNING;
+  save->flags=flags;
+  save->maxCopiedPages=maxCopiedPages;
+  save->copiedPages=0;
+  save->seconds=0;
+  if (flags & RB_BGSAVE_NO_HUGEPAGES) {
+    save->oldThpDisable=prctl(PR_GET_THP_DISABLE,0,0,0,0);
+    if (save->oldThpDisable < 0) save->flags&=~RB_BGSAVE_NO_HUGEPAGES;
+    else prctl(PR_SET_THP_DISABLE,1,0,0,0);
+  }
+  fflush(NULL); /* or the child would write out the parent's buffers too */
+  save->startTime=Seconds();
+  save->pid=fork();
+  if (save->pid == 0) {
+    close(fds[0]);
+    result=(char) (Save(tree,context) != 0);
+    if (write(fds[1],&result,1) != 1) _exit(1);
+    _exit(0);
+  }
+  save->forkSeconds=Seconds()-save->startTime;
+  save->startFaults=MinorFaults();
+  close(fds[1]);
+  if (save->pid < 0) {
+    close(fds[0]);
+    if (save->flags & RB_BGSAVE_NO_HUGEPAGES) {
+      prctl(PR_SET_THP_DISABLE,save->oldThpDisable,0,0,0);
+    }
+    free(save);
+    return(NULL);
+  }
+  save->doneFd=fds[0];
+  fcntl(save->doneFd,F_SETFL,O_NONBLOCK);
+  return(save);
+}
+
+/*  reaps the child and records how the save ended */
+
+static void Finish(rb_bgsave* save, int status) {
+  int waitStatus;
+
+  waitpid(save->pid,&waitStatus,0);
+  save->status=status;
+  save->seconds=Seconds()-save->startTime;
+  close(save->doneFd);
+  save->doneFd=-1;
+  if (save->flags & RB_BGSAVE_NO_HUGEPAGES) {
+    prctl(PR_SET_THP_DISABLE,save->oldThpDisable,0,0,0);
+  }
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBBackgroundSavePoll */
+/**/
+/*    INPUTS:  save is a save started by RBTreeBackgroundSave */
+/**/
+/*    OUTPUT:  RB_BGSAVE_RUNNING while the child is still writing, then */
+/*             1 if the save succeeded and 0 if it failed or was */
+/*             aborted for copying too many pages */
+/**/
+/*    EFFECT:  updates save->copiedPages, and kills the child if it */
+/*             is over save->maxCopiedPages.  Never blocks. */
+/**/
+/*    Modifies Input: save */
+/***********************************************************************/
+
+int RBBackgroundSavePoll(rb_bgsave* save) {
+  char result;
+  ssize_t got;
+
+  if (save->status != RB_BGSAVE_RUNNING) return(save->status);
+  save->copiedPages=MinorFaults()-save->startFaults;
+  got=read(save->doneFd,&result,1);
+  if (got == 1) {
+    Finish(save,result != 0);
+  } else if (got == 0) {
+    Finish(save,0); /* the child died without reporting */
+  } else if (save->maxCopiedPages &&
+	     (save->copiedPages > save->maxCopiedPages)) {
+    kill(save->pid,SIGKILL);
+    Finish(save,0);
+  }
+  return(save->status);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBBackgroundSaveWait */
+/**/
+/*    INPUTS:  save is a save started by RBTreeBackgroundSave */
+/**/
+/*    OUTPUT:  1 if the save succeeded, 0 if not */
+/**/
+/*    EFFECT:  blocks until the child has finished */
+/**/
+/*    Modifies Input: save */
+/***********************************************************************/
+
+int RBBackgroundSaveWait(rb_bgsave* save) {
+  struct pollfd p;
+
+  while (RBBackgroundSavePoll(save) == RB_BGSAVE_RUNNING) {
+    p.fd=save->doneFd;
+    p.events=POLLIN;
+    poll(&p,1,save->maxCopiedPages ? 10 : -1);
+  }
+  return(save->status);
+}
+
+void RBBackgroundSaveFree(rb_bgsave* save) {
+  RBBackgroundSaveWait(save);
+  free(save);
+}
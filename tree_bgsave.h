@@ -0,0 +1,51 @@
+#include"red_black_tree.h"
+#include<sys/types.h>
+
+#ifndef INC_TREE_BGSAVE_
+#define INC_TREE_BGSAVE_
+
+/*  Saves a tree in the background by forking.  The child process gets */
+/*  a copy-on-write image of the tree as it was at the fork and runs */
+/*  the Save function on it, for example RBTreeSave or RBTreeExport, */
+/*  while the parent goes on changing the tree.  The child reports */
+/*  success or failure through a pipe. */
+/**/
+/*  Each page the parent writes to while the child runs is copied by */
+/*  the kernel; copiedPages estimates how many from the parent's minor */
+/*  page faults, which also count the first touch of newly allocated */
+/*  memory.  It is brought up to date, and checked against */
+/*  maxCopiedPages, each time the save is polled. */
+/**/
+/*  The parent should have no other threads running when it calls */
+/*  RBTreeBackgroundSave, since only the calling thread exists in the */
+/*  child. */
+
+/*  stop transparent huge pages for the duration of the save, so */
+/*  kernels which copy a whole huge page on a write copy 4KB instead. */
+/*  The process's previous setting is put back when the save ends. */
+#define RB_BGSAVE_NO_HUGEPAGES 1
+
+#define RB_BGSAVE_RUNNING -1
+
+typedef struct rb_bgsave {
+  pid_t pid;
+  int doneFd; /* becomes readable when the child finishes */
+  int status; /* RB_BGSAVE_RUNNING, then 1 if the save worked, else 0 */
+  int flags;
+  int oldThpDisable; /* the THP setting to put back when it finishes */
+  long maxCopiedPages; /* abort the save past this many, 0 for no limit */
+  long startFaults;
+  long copiedPages;
+  double seconds; /* from the fork until the child finished */
+  double forkSeconds; /* how long the parent was paused by fork */
+  double startTime;
+} rb_bgsave;
+
+rb_bgsave* RBTreeBackgroundSave(rb_red_blk_tree* tree,
+				int (*Save)(rb_red_blk_tree*, void*),
+				void* context, int flags, long maxCopiedPages);
+int RBBackgroundSavePoll(rb_bgsave*);
+int RBBackgroundSaveWait(rb_bgsave*);
+void RBBackgroundSaveFree(rb_bgsave*);
+
+#endif
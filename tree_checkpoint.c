@@ -0,0 +1,453 @@
+#include "tree_checkpoint.h"
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*  io_uring is used through its system calls directly, so only the */
+/*  kernel headers are needed and not liburing */
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define RB_HAVE_IO_URING
+#endif
+#endif
+
+typedef struct rb_ckpt_buffer {
+  char* data;
+  size_t len; /* bytes to write */
+  size_t done; /* bytes written so far */
+  off_t offset; /* where in the file they go */
+  struct iovec iov;
+} rb_ckpt_buffer;
+
+#ifdef RB_HAVE_IO_URING
+typedef struct rb_uring {
+  int fd;
+  unsigned* sqTail;
+  unsigned* sqMask;
+  unsigned* sqArray;
+  unsigned* cqHead;
+  unsigned* cqTail;
+  unsigned* cqMask;
+  struct io_uring_sqe* sqes;
+  struct io_uring_cqe* cqes;
+  void* sqRing;
+  size_t sqRingSize;
+  void* cqRing;
+  size_t cqRingSize;
+  size_t sqesSize;
+} rb_uring;
+#endif
+
+typedef struct rb_ckpt_writer {
+  int fd;
+  int engine;
+  rb_ckpt_buffer buffers[RB_CKPT_BUFFERS];
+  int freeList[RB_CKPT_BUFFERS];
+  int nFree;
+  int current; /* the buffer being filled */
+  off_t nextOffset;
+  unsigned long writes;
+  int failed;
+  /* for RB_CKPT_THREADS */
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  int queue[RB_CKPT_BUFFERS];
+  int queueHead;
+  int queueCount;
+  int stop;
+  int nThreads; /* writer threads running; none means write inline */
+  pthread_t* threads;
+#ifdef RB_HAVE_IO_URING
+  rb_uring ring;
+  int inFlight;
+#endif
+} rb_ckpt_writer;
+
+static double Seconds(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return(ts.tv_sec+ts.tv_nsec*1e-9);
+}
+
+/*  pwrites what is left of b, returning 0 if a write fails */
+
+static int WriteBuffer(rb_ckpt_writer* w, rb_ckpt_buffer* b) {
+  ssize_t written;
+  int ok=1;
+
+  while (ok && (b->done < b->len)) {
+    written=pwrite(w->fd,b->data+b->done,b->len-b->done,b->offset+b->done);
+    if (written > 0) b->done+=written;
+    else ok= (written < 0) && (errno == EINTR);
+  }
+  return(ok);
+}
+
+/*  The thread pool: workers take buffers off the queue, pwrite them and */
+/*  put them back on the free list. */
+
+static void* WriterThread(void* arg) {
+  rb_ckpt_writer* w=(rb_ckpt_writer*) arg;
+  int i, ok;
+
+  pthread_mutex_lock(&w->lock);
+  while (1) {
+    while (!w->queueCount && !w->stop) pthread_cond_wait(&w->work,&w->lock);
+    if (!w->queueCount) break;
+    i=w->queue[w->queueHead];
+    w->queueHead=(w->queueHead+1) % RB_CKPT_BUFFERS;
+    w->queueCount--;
+    pthread_mutex_unlock(&w->lock);
+    ok=WriteBuffer(w,&w->buffers[i]);
+    pthread_mutex_lock(&w->lock);
+    if (!ok) w->failed=1;
+    w->freeList[w->nFree++]=i;
+    pthread_cond_signal(&w->done);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return(NULL);
+}
+
+#ifdef RB_HAVE_IO_URING
+
+static int UringEnter(rb_uring* ring, unsigned toSubmit, unsigned minComplete,
+		      unsigned flags) {
+  int result;
+
+  do {
+    result=(int) syscall(__NR_io_uring_enter,ring->fd,toSubmit,minComplete,
+			 flags,NULL,0);
+  } while ( (result < 0) && (errno == EINTR) );
+  return(result);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  UringSetup */
+/**/
+/*    INPUTS:  ring is the ring to set up with room for entries writes */
+/**/
+/*    OUTPUT:  1 if io_uring is available, 0 if not */
+/**/
+/*    EFFECT:  creates the ring and maps its submission queue, */
+/*             completion queue and submission entries */
+/**/
+/*    Modifies Input: ring */
+/***********************************************************************/
+
+static int UringSetup(rb_uring* ring, unsigned entries) {
+  struct io_uring_params p;
+  char* sq;
+  char* cq;
+
+  memset(&p,0,sizeof(p));
+  ring->fd=(int) syscall(__NR_io_uring_setup,entries,&p);
+  if (ring->fd < 0) return(0);
+  ring->sqRingSize=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+  ring->cqRingSize=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cqRingSize > ring->sqRingSize) {
+      ring->sqRingSize=ring->cqRingSize;
+    }
+    ring->cqRingSize=ring->sqRingSize;
+  }
+  ring->sqRing=mmap(NULL,ring->sqRingSize,PROT_READ|PROT_WRITE,
+		    MAP_SHARED|MAP_POPULATE,ring->fd,IORING_OFF_SQ_RING);
+  if (ring->sqRing == MAP_FAILED) {
+    close(ring->fd);
+    return(0);
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cqRing=ring->sqRing;
+  } else {
+    ring->cqRing=mmap(NULL,ring->cqRingSize,PROT_READ|PROT_WRITE,
+		      MAP_SHARED|MAP_POPULATE,ring->fd,IORING_OFF_CQ_RING);
+  }
+  ring->sqesSize=p.sq_entries*sizeof(struct io_uring_sqe);
+  ring->sqes=(struct io_uring_sqe*) mmap(NULL,ring->sqesSize,
+					 PROT_READ|PROT_WRITE,
+					 MAP_SHARED|MAP_POPULATE,ring->fd,
+					 IORING_OFF_SQES);
+  if ( (ring->cqRing == MAP_FAILED) || (ring->sqes == MAP_FAILED) ) {
+    if (ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) {
+      munmap(ring->cqRing,ring->cqRingSize);
+    }
+    if (ring->sqes != MAP_FAILED) munmap(ring->sqes,ring->sqesSize);
+    munmap(ring->sqRing,ring->sqRingSize);
+    close(ring->fd);
+    return(0);
+  }
+  sq=(char*) ring->sqRing;
+  cq=(char*) ring->cqRing;
+  ring->sqTail=(unsigned*) (sq+p.sq_off.tail);
+  ring->sqMask=(unsigned*) (sq+p.sq_off.ring_mask);
+  ring->sqArray=(unsigned*) (sq+p.sq_off.array);
+  ring->cqHead=(unsigned*) (cq+p.cq_off.head);
+  ring->cqTail=(unsigned*) (cq+p.cq_off.tail);
+  ring->cqMask=(unsigned*) (cq+p.cq_off.ring_mask);
+  ring->cqes=(struct io_uring_cqe*) (cq+p.cq_off.cqes);
+  return(1);
+}
+
+static void UringTeardown(rb_uring* ring) {
+  munmap(ring->sqes,ring->sqesSize);
+  if (ring->cqRing != ring->sqRing) munmap(ring->cqRing,ring->cqRingSize);
+  munmap(ring->sqRing,ring->sqRingSize);
+  close(ring->fd);
+}
+
+/*  queues a write of what is left of buffer i and submits it */
+
+static void UringSubmit(rb_ckpt_writer* w, int i) {
+  rb_uring* ring=&w->ring;
+  rb_ckpt_buffer* b=&w->buffers[i];
+  unsigned tail=*ring->sqTail;
+  unsigned index=tail & *ring->sqMask;
+  struct io_uring_sqe* sqe=&ring->sqes[index];
+
+  b->iov.iov_base=b->data+b->done;
+  b->iov.iov_len=b->len-b->done;
+  memset(sqe,0,sizeof(*sqe));
+  sqe->opcode=IORING_OP_WRITEV; /* the oldest write opcode */
+  sqe->fd=w->fd;
+  sqe->addr=(unsigned long) &b->iov;
+  sqe->len=1;
+  sqe->off=b->offset+b->done;
+  sqe->user_data=i;
+  ring->sqArray[index]=index;
+  __atomic_store_n(ring->sqTail,tail+1,__ATOMIC_RELEASE);
+  if (UringEnter(ring,1,0,0) != 1) {
+    /* not submitted; take the entry back so it cannot run later */
+    __atomic_store_n(ring->sqTail,tail,__ATOMIC_RELEASE);
+    w->failed=1;
+    w->freeList[w->nFree++]=i;
+    return;
+  }
+  w->inFlight++;
+}
+
+/*  waits for at least one write to finish and handles every finished */
+/*  one, resubmitting the rest of a short write */
+
+static void UringReap(rb_ckpt_writer* w) {
+  rb_uring* ring=&w->ring;
+  struct io_uring_cqe* cqe;
+  rb_ckpt_buffer* b;
+  unsigned head, tail;
+  int i;
+
+  if (UringEnter(ring,0,1,IORING_ENTER_GETEVENTS) < 0) {
+    /* the ring is unusable; give up on what is in flight */
+    w->failed=1;
+    return;
+  }
+  head=*ring->cqHead;
+  tail=__atomic_load_n(ring->cqTail,__ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    cqe=&ring->cqes[head & *ring->cqMask];
+    i=(int) cqe->user_data;
+    b=&w->buffers[i];
+    w->inFlight--;
+    if (cqe->res > 0) b->done+=cqe->res;
+    if ( (cqe->res == -EINTR) || ((cqe->res > 0) && (b->done < b->len)) ) {
+      UringSubmit(w,i);
+    } else {
+      if (b->done < b->len) w->failed=1;
+      w->freeList[w->nFree++]=i;
+    }
+  }
+  __atomic_store_n(ring->cqHead,head,__ATOMIC_RELEASE);
+}
+
+#endif
+
+/*  hands buffer i to the writers, or writes it here if no writer */
+/*  thread could be started */
+
+static void Submit(rb_ckpt_writer* w, int i) {
+#ifdef RB_HAVE_IO_URING
+  if (w->engine == RB_CKPT_IO_URING) {
+    UringSubmit(w,i);
+    return;
+  }
+#endif
+  if (!w->nThreads) {
+    if (!WriteBuffer(w,&w->buffers[i])) w->failed=1;
+    w->freeList[w->nFree++]=i;
+    return;
+  }
+  pthread_mutex_lock(&w->lock);
+  w->queue[(w->queueHead+w->queueCount) % RB_CKPT_BUFFERS]=i;
+  w->queueCount++;
+  pthread_cond_signal(&w->work);
+  pthread_mutex_unlock(&w->lock);
+}
+
+/*  returns a free buffer, waiting for a write to finish if need be */
+
+static int Acquire(rb_ckpt_writer* w) {
+  int i;
+
+#ifdef RB_HAVE_IO_URING
+  if (w->engine == RB_CKPT_IO_URING) {
+    while (!w->nFree && w->inFlight && !w->failed) UringReap(w);
+    return(w->nFree ? w->freeList[--w->nFree] : -1);
+  }
+#endif
+  pthread_mutex_lock(&w->lock);
+  while (!w->nFree) pthread_cond_wait(&w->done,&w->lock);
+  i=w->freeList[--w->nFree];
+  pthread_mutex_unlock(&w->lock);
+  return(i);
+}
+
+/*  whether a write has failed.  The writer threads set failed under */
+/*  the lock; io_uring completions are reaped on this thread. */
+
+static int Failed(rb_ckpt_writer* w) {
+  int failed;
+
+#ifdef RB_HAVE_IO_URING
+  if (w->engine == RB_CKPT_IO_URING) return(w->failed);
+#endif
+  pthread_mutex_lock(&w->lock);
+  failed=w->failed;
+  pthread_mutex_unlock(&w->lock);
+  return(failed);
+}
+
+/*  the Flush function for RBTreeExportBuffers */
+
+static char* SubmitBuffer(void* sink, char* data, size_t used, int last) {
+  rb_ckpt_writer* w=(rb_ckpt_writer*) sink;
+  rb_ckpt_buffer* b=&w->buffers[w->current];
+
+  b->len=used;
+  b->done=0;
+  b->offset=w->nextOffset;
+  w->nextOffset+=used;
+  w->writes++;
+  Submit(w,w->current);
+  if (last) return(data);
+  if (Failed(w) || ((w->current=Acquire(w)) < 0)) return(NULL); /* assignment */
+  return(w->buffers[w->current].data);
+}
+
+/*  waits for every write and stops the writers */
+
+static void Drain(rb_ckpt_writer* w) {
+  int i;
+
+#ifdef RB_HAVE_IO_URING
+  if (w->engine == RB_CKPT_IO_URING) {
+    while (w->inFlight && !w->failed) UringReap(w);
+    if (w->inFlight) {
+      /* a failed ring may still be writing into the buffers */
+      UringTeardown(&w->ring);
+      w->engine=-1;
+    }
+    return;
+  }
+#endif
+  pthread_mutex_lock(&w->lock);
+  w->stop=1;
+  pthread_cond_broadcast(&w->work);
+  pthread_mutex_unlock(&w->lock);
+  for (i=0; i<w->nThreads; i++) pthread_join(w->threads[i],NULL);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeCheckpoint */
+/**/
+/*    INPUTS:  tree is the tree to write to fd, Serialize/context turn */
+/*             one key and info into bytes as for RBTreeExport, engine */
+/*             is an RB_CKPT_ engine, nThreads is the number of pwrite */
+/*             threads used without io_uring and stats, if not NULL, */
+/*             is filled in.  If no thread can be started the buffers */
+/*             are written on the calling thread instead. */
+/**/
+/*    OUTPUT:  1 on success, 0 on a failed write or a record larger */
+/*             than RB_CKPT_BUFFER */
+/**/
+/*    EFFECT:  writes the same stream RBTreeExport would, overlapping */
+/*             the traversal with up to RB_CKPT_BUFFERS-1 writes.  Asking */
+/*             for RB_CKPT_IO_URING where it is not available gets the */
+/*             threads instead; stats->engine says which ran. */
+/**/
+/*    Modifies Input: fd */
+/***********************************************************************/
+
+int RBTreeCheckpoint(rb_red_blk_tree* tree, int fd,
+		     size_t (*Serialize)(const void*, const void*, char*,
+					 size_t, void*),
+		     void* context, int engine, int nThreads,
+		     rb_checkpoint_stats* stats) {
+  rb_ckpt_writer w;
+  off_t start;
+  double startTime=Seconds();
+  int i, ok;
+
+  if ( (start=lseek(fd,0,SEEK_CUR)) < 0) return(0); /* assignment */
+  memset(&w,0,sizeof(w));
+  w.fd=fd;
+  w.nextOffset=start;
+  for (i=0; i<RB_CKPT_BUFFERS; i++) {
+    if (posix_memalign((void**) &w.buffers[i].data,4096,RB_CKPT_BUFFER)) {
+      while (i--) free(w.buffers[i].data);
+      return(0);
+    }
+    w.freeList[w.nFree++]=i;
+  }
+  w.engine=RB_CKPT_THREADS;
+#ifdef RB_HAVE_IO_URING
+  if ( (engine != RB_CKPT_THREADS) && UringSetup(&w.ring,RB_CKPT_BUFFERS) ) {
+    w.engine=RB_CKPT_IO_URING;
+  }
+#endif
+  if (w.engine == RB_CKPT_THREADS) {
+    pthread_mutex_init(&w.lock,NULL);
+    pthread_cond_init(&w.work,NULL);
+    pthread_cond_init(&w.done,NULL);
+    if (nThreads <= 0) nThreads=2;
+    w.threads=(pthread_t*) TryMalloc(nThreads*sizeof(pthread_t));
+    /* count only the threads which started; Drain joins those */
+    while (w.threads && (w.nThreads < nThreads) &&
+	   !pthread_create(&w.threads[w.nThreads],NULL,WriterThread,&w)) {
+      w.nThreads++;
+    }
+  }
+  if (stats) stats->engine=w.engine;
+
+  w.current=w.freeList[--w.nFree];
+  ok=RBTreeExportBuffers(tree,Serialize,context,SubmitBuffer,&w,
+			 w.buffers[w.current].data,RB_CKPT_BUFFER);
+  Drain(&w);
+  ok= ok && !w.failed;
+
+#ifdef RB_HAVE_IO_URING
+  if (w.engine == RB_CKPT_IO_URING) UringTeardown(&w.ring);
+#endif
+  if (w.engine == RB_CKPT_THREADS) {
+    if (w.threads) SafeFree(w.threads,nThreads*sizeof(pthread_t));
+    pthread_mutex_destroy(&w.lock);
+    pthread_cond_destroy(&w.work);
+    pthread_cond_destroy(&w.done);
+  }
+  if (w.engine >= 0) {
+    for (i=0; i<RB_CKPT_BUFFERS; i++) free(w.buffers[i].data);
+  }
+  ok= ok && (lseek(fd,w.nextOffset,SEEK_SET) == w.nextOffset);
+  if (stats) {
+    stats->bytes=w.nextOffset-start;
+    stats->writes=w.writes;
+    stats->seconds=Seconds()-startTime;
+  }
+  return(ok);
+}
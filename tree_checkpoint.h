@@ -0,0 +1,41 @@
+#include"tree_stream.h"
+
+#ifndef INC_TREE_CHECKPOINT_
+#define INC_TREE_CHECKPOINT_
+
+/*  Writes a tree to a file in the format of tree_stream.h without */
+/*  waiting for each write.  The calling thread walks the tree and */
+/*  fills RB_CKPT_BUFFER byte, page aligned buffers; each full buffer */
+/*  is written at its offset in the file while the next one is filled. */
+/*  The writes go through io_uring where the kernel has it, otherwise */
+/*  through a few threads calling pwrite. */
+/**/
+/*  The file must support pwrite (a regular file, not a pipe).  The */
+/*  stream starts at fd's current offset, which is left at its end. */
+
+#ifndef RB_CKPT_BUFFER
+#define RB_CKPT_BUFFER (1024*1024)
+#endif
+
+#ifndef RB_CKPT_BUFFERS
+#define RB_CKPT_BUFFERS 8 /* buffers being filled or written */
+#endif
+
+#define RB_CKPT_AUTO 0 /* io_uring if it works, else threads */
+#define RB_CKPT_IO_URING 1
+#define RB_CKPT_THREADS 2
+
+typedef struct rb_checkpoint_stats {
+  int engine; /* RB_CKPT_IO_URING or RB_CKPT_THREADS */
+  unsigned long bytes;
+  unsigned long writes; /* buffers submitted */
+  double seconds;
+} rb_checkpoint_stats;
+
+int RBTreeCheckpoint(rb_red_blk_tree* tree, int fd,
+		     size_t (*Serialize)(const void*, const void*, char*,
+					 size_t, void*),
+		     void* context, int engine, int nThreads,
+		     rb_checkpoint_stats* stats);
+
+#endif
@@ -0,0 +1,143 @@
+#include "tree_compact.h"
+#include "tree_alloc.h"
+#include <string.h>
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeCompactStart */
+/**/
+/*    INPUTS:  tree is a red-black tree with no compaction running, */
+/*             and Relocated/context are as described in */
+/*             tree_compact.h, or NULL */
+/**/
+/*    OUTPUT:  the compaction, to pass to RBTreeCompactStep and then */
+/*             RBTreeCompactEnd */
+/**/
+/*    EFFECT:  Frees regions left empty by earlier compactions and */
+/*             allocates one with room for every node in the tree.  No */
+/*             node moves yet. */
+/**/
+/*    Modifies Input: tree */
+/***********************************************************************/
+
+rb_compaction* RBTreeCompactStart(rb_red_blk_tree* tree,
+				  void (*Relocated)(rb_red_blk_node*,
+						    rb_red_blk_node*, void*),
+				  void* context) {
+  rb_compaction* c=(rb_compaction*) SafeMalloc(sizeof(rb_compaction));
+  rb_tree_extra* e=RBTreeExtra(tree);
+  rb_red_blk_node* x;
+  void* base=NULL;
+
+  Assert(!e->compactNext,"compaction already running in RBTreeCompactStart");
+  RBTreeReleaseRegions(tree);
+  c->tree=tree;
+  c->capacity=(long) tree->count;
+  c->moved=0;
+  c->Relocated=Relocated;
+  c->context=context;
+  c->region=NULL;
+  if (c->capacity) {
+    if (posix_memalign(&base,64,c->capacity*tree->nodeSize)) {
+      Assert(0,"posix_memalign failed in RBTreeCompactStart");
+    }
+    c->region=(rb_region*) SafeMalloc(sizeof(rb_region));
+    c->region->base=(char*) base;
+    c->region->bytes=c->capacity*tree->nodeSize;
+    c->region->live=0;
+    c->region->filling=1;
+    c->region->next=e->regions;
+    e->regions=c->region;
+    RBTreeCharge(tree,(long) c->region->bytes,0,1);
+  }
+  for (x=tree->root->left; x != tree->nil && x->left != tree->nil; x=x->left);
+  e->compactNext=x;
+  return(c);
+}
+
+/*  a pointer p inside node x, moved along with x to to */
+
+static void* Rebase(rb_red_blk_tree* tree, rb_red_blk_node* x,
+		    rb_red_blk_node* to, void* p) {
+  if ( ((char*) p < (char*) x) || ((char*) p >= (char*) x+tree->nodeSize) ) {
+    return(p);
+  }
+  return((char*) to+((char*) p-(char*) x));
+}
+
+/*  copies x to to, points its neighbours at the copy and frees x */
+
+static void MoveNode(rb_compaction* c, rb_red_blk_node* x,
+		     rb_red_blk_node* to) {
+  rb_red_blk_tree* tree=c->tree;
+
+  memcpy(to,x,tree->nodeSize);
+  to->key=Rebase(tree,x,to,x->key);
+  to->info=Rebase(tree,x,to,x->info);
+  if (x->parent->left == x) {
+    x->parent->left=to;
+  } else {
+    x->parent->right=to;
+  }
+  if (x->left != tree->nil) x->left->parent=to;
+  if (x->right != tree->nil) x->right->parent=to;
+  RBNodeFree(tree,x);
+  if (c->Relocated) c->Relocated(x,to,c->context);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeCompactStep */
+/**/
+/*    INPUTS:  c is a compaction and maxNodes the most nodes to move */
+/**/
+/*    OUTPUT:  1 once every node has been moved, or the region is full */
+/*             because nodes were inserted since the start; 0 if there */
+/*             is more to do */
+/**/
+/*    EFFECT:  moves the next nodes in key order into the region */
+/**/
+/*    Modifies Input: c and its tree */
+/***********************************************************************/
+
+int RBTreeCompactStep(rb_compaction* c, long maxNodes) {
+  rb_red_blk_tree* tree=c->tree;
+  rb_tree_extra* e=tree->extra;
+  rb_red_blk_node* x;
+  rb_red_blk_node* to;
+  long i;
+
+  for (i=0; i<maxNodes; i++) {
+    x=e->compactNext;
+    if ( (x == tree->nil) || (c->moved == c->capacity) ) return(1);
+    e->compactNext=TreeSuccessor(tree,x);
+    to=(rb_red_blk_node*) (c->region->base+c->moved*tree->nodeSize);
+    c->moved++;
+    c->region->live++;
+    RBTreeCharge(tree,0,1,1);
+    MoveNode(c,x,to);
+  }
+  return( (e->compactNext == tree->nil) || (c->moved == c->capacity) );
+}
+
+/*  ends c, finished or not; nodes not yet moved stay where they are */
+
+void RBTreeCompactEnd(rb_compaction* c) {
+  c->tree->extra->compactNext=NULL;
+  if (c->region) c->region->filling=0;
+  RBTreeReleaseRegions(c->tree);
+  free(c);
+}
+
+/*  compacts the whole tree at once, returning how many nodes moved */
+
+long RBTreeCompact(rb_red_blk_tree* tree,
+		   void (*Relocated)(rb_red_blk_node*, rb_red_blk_node*,
+				     void*),
+		   void* context) {
+  rb_compaction* c=RBTreeCompactStart(tree,Relocated,context);
+  long moved;
+
+  while (!RBTreeCompactStep(c,1024));
+  moved=c->moved;
+  RBTreeCompactEnd(c);
+  return(moved);
+}
@@ -0,0 +1,50 @@
+#include"red_black_tree.h"
+
+#ifndef INC_TREE_COMPACT_
+#define INC_TREE_COMPACT_
+
+/*  Compaction copies a tree's nodes, in key order, into one new block */
+/*  (an rb_region) and relinks them there, so that after long insert */
+/*  and delete churn a scan or a descent walks through adjacent memory */
+/*  again.  A node is moved with memcpy; a key or info pointing inside */
+/*  the node, as in tree_inline.h and tree_set.h trees, is pointed at */
+/*  the copy. */
+/**/
+/*  Moving a node frees the old one, so every rb_red_blk_node* held */
+/*  outside the tree is invalid once its node has moved.  Relocated, */
+/*  if given, is called with the old and new address of each node as */
+/*  it moves (the old one only as an identity, it is already freed), */
+/*  so a caller keeping handles can update them.  Nodes whose keys */
+/*  hold pointers to themselves, other than through key and info, */
+/*  cannot be moved. */
+/**/
+/*  RBTreeCompactStart begins an incremental compaction and each */
+/*  RBTreeCompactStep moves at most maxNodes nodes, so a compaction */
+/*  can be spread over many short pauses.  Between steps the tree may */
+/*  be searched and changed as usual: inserted nodes are moved if the */
+/*  compaction has not got past them and the block has room, deleted */
+/*  ones are skipped.  One compaction at a time per tree, and only */
+/*  with the red-black engine. */
+
+typedef struct rb_compaction {
+  rb_red_blk_tree* tree;
+  rb_region* region; /* NULL for an empty tree */
+  long capacity; /* nodes the region holds */
+  long moved;
+  void (*Relocated)(rb_red_blk_node* from, rb_red_blk_node* to,
+		    void* context);
+  void* context;
+} rb_compaction;
+
+rb_compaction* RBTreeCompactStart(rb_red_blk_tree*,
+				  void (*Relocated)(rb_red_blk_node*,
+						    rb_red_blk_node*, void*),
+				  void* context);
+int RBTreeCompactStep(rb_compaction*, long maxNodes);
+void RBTreeCompactEnd(rb_compaction*);
+long RBTreeCompact(rb_red_blk_tree*,
+		   void (*Relocated)(rb_red_blk_node*, rb_red_blk_node*,
+				     void*),
+		   void* context);
+
+#endif
@@ -0,0 +1,213 @@
+#include "tree_frozen.h"
+#include <string.h>
+
+static const void* SlotKey(rb_frozen_tree* f, long slot) {
+  if (f->keySize) return(f->keys+slot*f->keySize);
+  return(((void**) f->keys)[slot]);
+}
+
+/*  puts the rank'th key in slot.  The slots past the last key in a */
+/*  padded layout get copies of the largest key, which keeps the array */
+/*  sorted, and since searches look for the leftmost match they are */
+/*  never the answer. */
+
+static void SetSlot(rb_frozen_tree* f, long slot, long rank) {
+  rb_red_blk_node* x=f->nodes[(rank < f->n) ? rank : f->n-1];
+
+  if (f->keySize) memcpy(f->keys+slot*f->keySize,x->key,f->keySize);
+  else ((void**) f->keys)[slot]=x->key;
+  f->slotNodes[slot]=x;
+  f->ranks[slot]= (rank < f->n) ? rank : f->n;
+}
+
+/*  fills the Eytzinger array in order: slot i's subtree holds its */
+/*  children 2i and 2i+1 */
+
+static void FillEytzinger(rb_frozen_tree* f, long i, long* rank) {
+  if (i > f->n) return;
+  FillEytzinger(f,2*i,rank);
+  SetSlot(f,i,(*rank)++);
+  FillEytzinger(f,2*i+1,rank);
+}
+
+/*  Fills in top, bottom and topDepth for a van Emde Boas layout of the */
+/*  perfect subtree of the given height whose root is at rootDepth. */
+/*  Each depth d is split from the one above it at exactly one level */
+/*  of the recursion, where the subtree rooted at topDepth[d] is cut */
+/*  into a top tree of top[d] nodes and bottom trees of bottom[d] */
+/*  nodes, stored one after another. */
+
+static void SplitVEB(rb_frozen_tree* f, int rootDepth, int height) {
+  int topHeight=height/2;
+  int d=rootDepth+topHeight;
+
+  if (height <= 1) return;
+  f->top[d]=(1L << topHeight)-1;
+  f->bottom[d]=(1L << (height-topHeight))-1;
+  f->topDepth[d]=rootDepth;
+  SplitVEB(f,rootDepth,topHeight);
+  SplitVEB(f,d,height-topHeight);
+}
+
+/*  the position of the node with heap index i at depth d, given the */
+/*  positions of its ancestors in pos */
+
+#define VEB_POSITION(f,pos,i,d) \
+  ((d) ? (pos)[(f)->topDepth[d]]+(f)->top[d]+ \
+   ((i) & (f)->top[d])*(f)->bottom[d] : 0)
+
+static void FillVEB(rb_frozen_tree* f, long i, int d, long* pos, long* rank) {
+  pos[d]=VEB_POSITION(f,pos,i,d);
+  if (d+1 < f->height) FillVEB(f,2*i,d+1,pos,rank);
+  SetSlot(f,pos[d],(*rank)++);
+  if (d+1 < f->height) FillVEB(f,2*i+1,d+1,pos,rank);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeFreeze */
+/**/
+/*    INPUTS:  tree is the tree to copy, layout is RB_FROZEN_EYTZINGER */
+/*             or RB_FROZEN_VEB and keySize is the number of bytes to */
+/*             copy from each key, or 0 to store key pointers */
+/**/
+/*    OUTPUT:  the frozen tree */
+/**/
+/*    EFFECT:  lists the tree's nodes in order, then fills the search */
+/*             array from that list in O(n) time */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+rb_frozen_tree* RBTreeFreeze(rb_red_blk_tree* tree, int layout,
+			     size_t keySize) {
+  rb_frozen_tree* f=(rb_frozen_tree*) SafeMalloc(sizeof(rb_frozen_tree));
+  rb_red_blk_node* x;
+  long pos[RB_FROZEN_MAX_HEIGHT];
+  long rank=0;
+
+  f->Compare=tree->Compare;
+  f->layout=layout;
+  f->n=(long) tree->count;
+  f->keySize=keySize;
+  f->nodes=(rb_red_blk_node**) SafeMalloc((f->n+1)*sizeof(rb_red_blk_node*));
+  for (x=tree->root->left; x != tree->nil && x->left != tree->nil; x=x->left);
+  for (; x != tree->nil; x=TreeSuccessor(tree,x)) f->nodes[rank++]=x;
+  f->height=0;
+  if (layout == RB_FROZEN_VEB) {
+    while ((1L << f->height)-1 < f->n) f->height++;
+    f->slots=(1L << f->height)-1;
+    SplitVEB(f,0,f->height);
+  } else {
+    f->slots=f->n+1; /* slot 0 is not used */
+  }
+  f->keys=(char*) SafeMalloc(f->slots*(keySize ? keySize : sizeof(void*))+1);
+  f->slotNodes=(rb_red_blk_node**) SafeMalloc(f->slots*
+					      sizeof(rb_red_blk_node*)+1);
+  f->ranks=(long*) SafeMalloc(f->slots*sizeof(long)+1);
+  rank=0;
+  if (layout == RB_FROZEN_VEB) {
+    if (f->height) FillVEB(f,1,0,pos,&rank);
+  } else {
+    FillEytzinger(f,1,&rank);
+  }
+  return(f);
+}
+
+void RBFrozenDestroy(rb_frozen_tree* f) {
+  free(f->keys);
+  free(f->slotNodes);
+  free(f->ranks);
+  free(f->nodes);
+  free(f);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  FrozenSearch */
+/**/
+/*    INPUTS:  f is the frozen tree, q the key to look for; upper is 0 */
+/*             for the first key >= q and 1 for the first key > q */
+/**/
+/*    OUTPUT:  the slot holding that key, or -1 if there is none */
+/**/
+/*    EFFECT:  descends the implicit tree without branching on the */
+/*             comparisons: each step computes the next slot from the */
+/*             result, and the answer is the last slot where the */
+/*             search went left.  The Eytzinger search keeps the */
+/*             whole path in the bits of i, so it recovers that slot by */
+/*             stripping the right turns taken after it. */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+static long FrozenSearch(rb_frozen_tree* f, const void* q, int upper) {
+  size_t stride= f->keySize ? f->keySize : sizeof(void*);
+  long pos[RB_FROZEN_MAX_HEIGHT];
+  long i=1;
+  long best=-1;
+  long p;
+  int d, right;
+
+  if (f->layout == RB_FROZEN_VEB) {
+    for (d=0; d<f->height; d++) {
+      p=pos[d]=VEB_POSITION(f,pos,i,d);
+      right= (f->Compare(SlotKey(f,p),q) < upper);
+      best= right ? best : p;
+      i=2*i+right;
+    }
+    return(best);
+  }
+  while (i <= f->n) {
+    PREFETCH(f->keys+16*i*stride);
+    i=2*i+(f->Compare(SlotKey(f,i),q) < upper);
+  }
+  while (i & 1) i>>=1;
+  i>>=1;
+  return(i ? i : -1);
+}
+
+/*  the rank of the first key >= key, or n if every key is smaller */
+
+long RBFrozenLowerBound(rb_frozen_tree* f, const void* key) {
+  long slot=FrozenSearch(f,key,0);
+
+  return( (slot < 0) ? f->n : f->ranks[slot]);
+}
+
+/*  the rank of the first key > key, or n if there is none */
+
+long RBFrozenUpperBound(rb_frozen_tree* f, const void* key) {
+  long slot=FrozenSearch(f,key,1);
+
+  return( (slot < 0) ? f->n : f->ranks[slot]);
+}
+
+/*  the same as RBExactQuery on the original tree, returning the first */
+/*  of several equal keys */
+
+rb_red_blk_node* RBFrozenExactQuery(rb_frozen_tree* f, const void* key) {
+  long slot=FrozenSearch(f,key,0);
+
+  if ( (slot < 0) || f->Compare(SlotKey(f,slot),key) ) return(0);
+  return(f->slotNodes[slot]);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBFrozenEnumerate */
+/**/
+/*    INPUTS:  f is the frozen tree to look for keys >= low and <= high */
+/**/
+/*    OUTPUT:  stack of the original tree's nodes in [low,high], which */
+/*             pop off in ascending order as with RBEnumerate */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+stk_stack* RBFrozenEnumerate(rb_frozen_tree* f, const void* low,
+			     const void* high) {
+  stk_stack* enumResultStack=StackCreate();
+  long first=RBFrozenLowerBound(f,low);
+  long end=RBFrozenUpperBound(f,high);
+
+  while (end > first) StackPush(enumResultStack,f->nodes[--end]);
+  return(enumResultStack);
+}
@@ -0,0 +1,59 @@
+#include"red_black_tree.h"
+
+#ifndef INC_TREE_FROZEN_
+#define INC_TREE_FROZEN_
+
+/*  A frozen tree is a read-only copy of a red-black tree's search */
+/*  structure laid out in one array, so a lookup walks memory in a */
+/*  predictable pattern instead of chasing node pointers.  The answers */
+/*  are the original tree's nodes, so the tree must outlive the frozen */
+/*  copy and must not change while it is in use. */
+/**/
+/*  With keySize > 0 the keys are copied into the array, which only */
+/*  works for flat keys (no pointers inside) that Compare can read in */
+/*  place, such as ints.  With keySize 0 the array holds the key */
+/*  pointers and each comparison follows one. */
+/**/
+/*  RB_FROZEN_EYTZINGER stores the implicit binary tree in breadth */
+/*  first order, so the children of slot i are 2i and 2i+1 and the */
+/*  search can prefetch the 16 descendants four levels down, which sit */
+/*  next to each other.  RB_FROZEN_VEB pads the tree to a perfect one */
+/*  and stores it in van Emde Boas order, recursively splitting it into */
+/*  a top half and bottom subtrees stored one after another, so every */
+/*  cache line or page holds a small subtree whatever its size. */
+
+#define RB_FROZEN_EYTZINGER 0
+#define RB_FROZEN_VEB 1
+
+#define RB_FROZEN_MAX_HEIGHT 64
+
+typedef struct rb_frozen_tree {
+  int (*Compare)(const void* a, const void* b);
+  int layout;
+  long n; /* number of keys */
+  long slots; /* size of the search array */
+  size_t keySize; /* bytes per key in keys, or 0 if keys holds pointers */
+  char* keys; /* the search array */
+  rb_red_blk_node** slotNodes; /* the node for each slot */
+  long* ranks; /* in-order position of the key in each slot */
+  rb_red_blk_node** nodes; /* the tree's nodes in key order */
+  /* for RB_FROZEN_VEB, where the subtree holding each depth starts */
+  int height;
+  long top[RB_FROZEN_MAX_HEIGHT];
+  long bottom[RB_FROZEN_MAX_HEIGHT];
+  int topDepth[RB_FROZEN_MAX_HEIGHT];
+} rb_frozen_tree;
+
+rb_frozen_tree* RBTreeFreeze(rb_red_blk_tree* tree, int layout,
+			     size_t keySize);
+void RBFrozenDestroy(rb_frozen_tree*);
+long RBFrozenLowerBound(rb_frozen_tree*, const void* key);
+long RBFrozenUpperBound(rb_frozen_tree*, const void* key);
+rb_red_blk_node* RBFrozenExactQuery(rb_frozen_tree*, const void* key);
+stk_stack* RBFrozenEnumerate(rb_frozen_tree*, const void* low,
+			     const void* high);
+
+/*  the node holding the rank'th smallest key */
+#define RBFrozenNode(frozen,rank) ((frozen)->nodes[rank])
+
+#endif
@@ -0,0 +1,84 @@
+#include "tree_inline.h"
+#include "tree_alloc.h"
+#include <string.h>
+
+static size_t InlineRound(size_t n) {
+  return( (n+RB_INLINE_ALIGN-1) & ~(size_t) (RB_INLINE_ALIGN-1));
+}
+
+/*  where the key starts in a node of tree: after the links, and the */
+/*  prefix if RBTreeUsePrefix made room for one */
+
+static size_t InlineHeader(rb_red_blk_tree* tree) {
+  return(tree->nodeSize-InlineRound(tree->extra->keySize)-
+	 tree->extra->valueSize);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeCreateInline */
+/**/
+/*    INPUTS:  Compare compares keys as for RBTreeCreate, keySize is */
+/*             the size of every key and valueSize of every value, or */
+/*             0 to keep values as pointers */
+/**/
+/*    OUTPUT:  an empty tree whose nodes carry their keys and values */
+/**/
+/*    EFFECT:  the tree has no destroy functions, since nothing it */
+/*             holds is allocated apart from its nodes */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+rb_red_blk_tree* RBTreeCreateInline(int (*Compare)(const void*, const void*),
+				    size_t keySize, size_t valueSize,
+				    void (*PrintKey)(const void*),
+				    void (*PrintInfo)(void*)) {
+  rb_red_blk_tree* tree;
+
+  Assert(keySize > 0,"inline keys must have a size");
+  tree=RBTreeCreate(Compare,NullFunction,NullFunction,PrintKey,PrintInfo);
+  RBTreeExtra(tree)->keySize=keySize;
+  tree->extra->valueSize=valueSize;
+  tree->nodeSize=InlineRound(sizeof(rb_red_blk_node))+InlineRound(keySize)+
+    valueSize;
+  return(tree);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBInlineInsert */
+/**/
+/*    INPUTS:  tree comes from RBTreeCreateInline, key points to */
+/*             keySize bytes and value to valueSize bytes (0 leaves */
+/*             them zero), or is the info itself if valueSize is 0 */
+/**/
+/*    OUTPUT:  the new node, or NULL if the tree's allocator or budget */
+/*             refused it */
+/**/
+/*    EFFECT:  copies key and value into a new node and inserts it */
+/**/
+/*    Modifies Input: tree */
+/***********************************************************************/
+
+rb_red_blk_node* RBInlineInsert(rb_red_blk_tree* tree, const void* key,
+				const void* value) {
+  rb_tree_extra* e=tree->extra;
+  rb_red_blk_node* x;
+  char* data;
+
+  if (!(x=RBNodeAlloc(tree))) return(NULL); /* assignment */
+  data=(char*) x+InlineHeader(tree);
+  memcpy(data,key,e->keySize);
+  RBNodeSetKey(tree,x,data);
+  if (e->valueSize) {
+    x->info=data+InlineRound(e->keySize);
+    if (value) memcpy(x->info,value,e->valueSize);
+    else memset(x->info,0,e->valueSize);
+  } else {
+    x->info=(void*) value;
+  }
+  if (!RBTreeInsertNode(tree,x)) {
+    RBNodeFree(tree,x);
+    return(NULL);
+  }
+  return(x);
+}
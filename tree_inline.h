@@ -0,0 +1,29 @@
+#include"red_black_tree.h"
+
+#ifndef INC_TREE_INLINE_
+#define INC_TREE_INLINE_
+
+/*  Trees whose keys, and optionally values, are fixed-size blocks of */
+/*  bytes copied into the node allocation, so inserting a key costs */
+/*  one allocation instead of three and nothing needs a DestroyKey. */
+/*  The key starts right after the rb_red_blk_node, or after its */
+/*  prefix if the tree keeps them, and the value after the key, each */
+/*  aligned to RB_INLINE_ALIGN bytes; x->key and x->info point at */
+/*  them, so Compare, PrintKey and code reading x->key work as they do */
+/*  for any tree. */
+/**/
+/*  With valueSize 0 only the key is copied and the value passed to */
+/*  RBInlineInsert is kept as x->info like RBTreeInsert keeps info. */
+/*  Nodes must be added with RBInlineInsert; RBDelete, RBTreeDestroy */
+/*  and the searches are the usual ones. */
+
+#define RB_INLINE_ALIGN 8
+
+rb_red_blk_tree* RBTreeCreateInline(int (*Compare)(const void*, const void*),
+				    size_t keySize, size_t valueSize,
+				    void (*PrintKey)(const void*),
+				    void (*PrintInfo)(void*));
+rb_red_blk_node* RBInlineInsert(rb_red_blk_tree*, const void* key,
+				const void* value);
+
+#endif
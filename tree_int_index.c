@@ -0,0 +1,220 @@
+#include "tree_int_index.h"
+#include <string.h>
+#include <limits.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RB_HAVE_X86
+#endif
+
+#define B RB_INT_INDEX_KEYS
+
+/*  node k's children are CHILD(k,0) to CHILD(k,B) */
+#define CHILD(k,i) ((k)*(B+1)+(i)+1)
+
+static int CountScalar(const int32_t* block, int32_t x, int upper) {
+  int count=0;
+  int j;
+
+  for (j=0; j<B; j++) count+= upper ? (block[j] <= x) : (block[j] < x);
+  return(count);
+}
+
+#ifdef RB_HAVE_X86
+
+/*  The SIMD versions compare x with four or eight keys at a time and */
+/*  count the lanes which came out true.  Keys <= x are counted as */
+/*  those not > x, since x+1 could overflow. */
+
+__attribute__((target("sse2")))
+static int CountSSE2(const int32_t* block, int32_t x, int upper) {
+  __m128i v=_mm_set1_epi32(x);
+  __m128i k[4];
+  int j;
+
+  for (j=0; j<4; j++) {
+    k[j]=_mm_load_si128((const __m128i*) (block+4*j));
+    k[j]= upper ? _mm_cmpgt_epi32(k[j],v) : _mm_cmpgt_epi32(v,k[j]);
+  }
+  /* narrow the 16 lane masks to bytes to move them out at once */
+  k[0]=_mm_packs_epi16(_mm_packs_epi32(k[0],k[1]),_mm_packs_epi32(k[2],k[3]));
+  j=__builtin_popcount(_mm_movemask_epi8(k[0]));
+  return(upper ? B-j : j);
+}
+
+__attribute__((target("avx2")))
+static int CountAVX2(const int32_t* block, int32_t x, int upper) {
+  __m256i v=_mm256_set1_epi32(x);
+  __m256i lo=_mm256_load_si256((const __m256i*) block);
+  __m256i hi=_mm256_load_si256((const __m256i*) (block+8));
+  int count;
+
+  if (upper) {
+    lo=_mm256_cmpgt_epi32(lo,v);
+    hi=_mm256_cmpgt_epi32(hi,v);
+  } else {
+    lo=_mm256_cmpgt_epi32(v,lo);
+    hi=_mm256_cmpgt_epi32(v,hi);
+  }
+  count=__builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lo)) |
+			   (_mm256_movemask_ps(_mm256_castsi256_ps(hi)) << 8));
+  return(upper ? B-count : count);
+}
+
+#endif
+
+/*  picks the engine to use: the one asked for, if the processor has */
+/*  it, or else the best one it has */
+
+static int ChooseEngine(rb_int_index* index, int engine) {
+#ifdef RB_HAVE_X86
+  __builtin_cpu_init();
+  if ( ((engine == RB_SIMD_AUTO) || (engine == RB_SIMD_AVX2)) &&
+       __builtin_cpu_supports("avx2") ) {
+    index->Count=CountAVX2;
+    return(RB_SIMD_AVX2);
+  }
+  if ( (engine != RB_SIMD_SCALAR) && __builtin_cpu_supports("sse2") ) {
+    index->Count=CountSSE2;
+    return(RB_SIMD_SSE2);
+  }
+#endif
+  index->Count=CountScalar;
+  return(RB_SIMD_SCALAR);
+}
+
+/*  fills node k and its subtrees in order, taking the next rank from */
+/*  *rank.  Slots past the last key get INT32_MAX and rank n, which */
+/*  keeps every node sorted; a real INT32_MAX key still comes first. */
+
+static void FillIndex(rb_int_index* index, long k,
+		      int32_t (*IntKey)(const void*), long* rank) {
+  long slot;
+  int i;
+
+  if (k >= index->nBlocks) return;
+  for (i=0; i<B; i++) {
+    FillIndex(index,CHILD(k,i),IntKey,rank);
+    slot=k*B+i;
+    if (*rank < index->n) {
+      index->keys[slot]=IntKey(index->nodes[*rank]->key);
+      index->slotNodes[slot]=index->nodes[*rank];
+      index->ranks[slot]=(*rank)++;
+    } else {
+      index->keys[slot]=INT32_MAX;
+      index->slotNodes[slot]=NULL;
+      index->ranks[slot]=index->n;
+    }
+  }
+  FillIndex(index,CHILD(k,B),IntKey,rank);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBIntIndexBuild */
+/**/
+/*    INPUTS:  tree is the tree to index, IntKey gives the int for one */
+/*             of its keys and engine is an RB_SIMD_ engine */
+/**/
+/*    OUTPUT:  the index.  index->engine is the engine asked for if */
+/*             the processor supports it, otherwise the best it does. */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+rb_int_index* RBIntIndexBuild(rb_red_blk_tree* tree,
+			      int32_t (*IntKey)(const void*), int engine) {
+  rb_int_index* index=(rb_int_index*) SafeMalloc(sizeof(rb_int_index));
+  rb_red_blk_node* x;
+  long rank=0;
+  void* keys=NULL;
+
+  index->n=(long) tree->count;
+  index->nBlocks=(index->n+B-1)/B;
+  index->nodes=(rb_red_blk_node**) SafeMalloc((index->n+1)*
+					      sizeof(rb_red_blk_node*));
+  for (x=tree->root->left; x != tree->nil && x->left != tree->nil; x=x->left);
+  for (; x != tree->nil; x=TreeSuccessor(tree,x)) index->nodes[rank++]=x;
+  if (posix_memalign(&keys,64,index->nBlocks*B*sizeof(int32_t)+64)) {
+    Assert(0,"posix_memalign failed in RBIntIndexBuild");
+  }
+  index->keys=(int32_t*) keys;
+  index->slotNodes=(rb_red_blk_node**) SafeMalloc(index->nBlocks*B*
+						  sizeof(rb_red_blk_node*)+1);
+  index->ranks=(long*) SafeMalloc(index->nBlocks*B*sizeof(long)+1);
+  rank=0;
+  FillIndex(index,0,IntKey,&rank);
+  index->engine=ChooseEngine(index,engine);
+  return(index);
+}
+
+void RBIntIndexDestroy(rb_int_index* index) {
+  free(index->keys);
+  free(index->slotNodes);
+  free(index->ranks);
+  free(index->nodes);
+  free(index);
+}
+
+/*  the slot of the first key >= x (> x if upper), or -1 if none.  Each */
+/*  node where some key qualifies may hold the answer; the last such */
+/*  node on the way down holds the leftmost one. */
+
+static long IndexSearch(rb_int_index* index, int32_t x, int upper) {
+  long best=-1;
+  long k=0;
+  int i;
+
+  while (k < index->nBlocks) {
+    i=index->Count(index->keys+k*B,x,upper);
+    best= (i < B) ? k*B+i : best;
+    k=CHILD(k,i);
+  }
+  return(best);
+}
+
+/*  the rank of the first key >= key, or n if every key is smaller */
+
+long RBIntIndexLowerBound(rb_int_index* index, int32_t key) {
+  long slot=IndexSearch(index,key,0);
+
+  return( (slot < 0) ? index->n : index->ranks[slot]);
+}
+
+/*  the rank of the first key > key, or n if there is none */
+
+long RBIntIndexUpperBound(rb_int_index* index, int32_t key) {
+  long slot=IndexSearch(index,key,1);
+
+  return( (slot < 0) ? index->n : index->ranks[slot]);
+}
+
+/*  the same as RBExactQuery on the original tree, returning the first */
+/*  of several equal keys */
+
+rb_red_blk_node* RBIntIndexExactQuery(rb_int_index* index, int32_t key) {
+  long slot=IndexSearch(index,key,0);
+
+  if ( (slot < 0) || (index->keys[slot] != key) ) return(0);
+  return(index->slotNodes[slot]);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBIntIndexEnumerate */
+/**/
+/*    INPUTS:  index is the index to look for keys >= low and <= high */
+/**/
+/*    OUTPUT:  stack of the original tree's nodes in [low,high], which */
+/*             pop off in ascending order as with RBEnumerate */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+stk_stack* RBIntIndexEnumerate(rb_int_index* index, int32_t low,
+			       int32_t high) {
+  stk_stack* enumResultStack=StackCreate();
+  long first=RBIntIndexLowerBound(index,low);
+  long end=RBIntIndexUpperBound(index,high);
+
+  while (end > first) StackPush(enumResultStack,index->nodes[--end]);
+  return(enumResultStack);
+}
@@ -0,0 +1,50 @@
+#include"red_black_tree.h"
+#include<stdint.h>
+
+#ifndef INC_TREE_INT_INDEX_
+#define INC_TREE_INT_INDEX_
+
+/*  A read-only index over a tree whose keys are (or map to) 32 bit */
+/*  ints, shaped as a static B-tree: each 64 byte node holds 16 sorted */
+/*  keys, and the children of node k are nodes k*17+1 to k*17+17, so no */
+/*  pointers are stored.  One compare of the search key against a whole */
+/*  node, using SSE2 or AVX2 where the processor has it, says which */
+/*  child to visit next, so a lookup touches one cache line per level */
+/*  of a tree of base 17. */
+/**/
+/*  Like the frozen trees in tree_frozen.h it answers with the original */
+/*  tree's nodes, so the tree must outlive the index and must not */
+/*  change while it is in use.  IntKey maps a key to its int, and must */
+/*  order ints the same way Compare orders keys. */
+
+#define RB_INT_INDEX_KEYS 16 /* 16 ints make one cache line */
+
+#define RB_SIMD_AUTO 0 /* the best the processor supports */
+#define RB_SIMD_SCALAR 1
+#define RB_SIMD_SSE2 2
+#define RB_SIMD_AVX2 3
+
+typedef struct rb_int_index {
+  long n; /* number of keys */
+  long nBlocks;
+  int32_t* keys; /* nBlocks nodes of RB_INT_INDEX_KEYS keys */
+  rb_red_blk_node** slotNodes; /* the node for each key slot */
+  long* ranks; /* in-order position of each key slot, n for padding */
+  rb_red_blk_node** nodes; /* the tree's nodes in key order */
+  int engine; /* the RB_SIMD_ engine in use */
+  /* how many keys in the node at block are < x, or <= x if upper */
+  int (*Count)(const int32_t* block, int32_t x, int upper);
+} rb_int_index;
+
+rb_int_index* RBIntIndexBuild(rb_red_blk_tree* tree,
+			      int32_t (*IntKey)(const void*), int engine);
+void RBIntIndexDestroy(rb_int_index*);
+long RBIntIndexLowerBound(rb_int_index*, int32_t key);
+long RBIntIndexUpperBound(rb_int_index*, int32_t key);
+rb_red_blk_node* RBIntIndexExactQuery(rb_int_index*, int32_t key);
+stk_stack* RBIntIndexEnumerate(rb_int_index*, int32_t low, int32_t high);
+
+/*  the node holding the rank'th smallest key */
+#define RBIntIndexNode(index,rank) ((index)->nodes[rank])
+
+#endif
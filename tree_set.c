@@ -0,0 +1,72 @@
+#include "tree_set.h"
+#include <string.h>
+
+/*  whether the set keeps its keys in the info field of its nodes */
+
+static int KeyInInfo(rb_red_blk_tree* set) {
+  return(set->extra->keySize <= sizeof(void*));
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBSetCreate */
+/**/
+/*    INPUTS:  Compare compares keys as for RBTreeCreate and keySize */
+/*             is the size of every key */
+/**/
+/*    OUTPUT:  an empty set */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+rb_red_blk_tree* RBSetCreate(int (*Compare)(const void*, const void*),
+			     size_t keySize, void (*PrintKey)(const void*)) {
+  rb_red_blk_tree* set;
+
+  set=RBTreeCreateInline(Compare,keySize,0,PrintKey,NullFunction);
+  if (keySize <= sizeof(void*)) set->nodeSize=sizeof(rb_red_blk_node);
+  return(set);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBSetInsert */
+/**/
+/*    INPUTS:  set comes from RBSetCreate and key points to keySize */
+/*             bytes */
+/**/
+/*    OUTPUT:  1 if key was added, 0 if the set already held it, -1 */
+/*             if the set's allocator or budget refused the node */
+/**/
+/*    Modifies Input: set */
+/***********************************************************************/
+
+int RBSetInsert(rb_red_blk_tree* set, const void* key) {
+  rb_red_blk_node* x;
+
+  if (RBExactQuery(set,(void*) key)) return(0);
+  if (!KeyInInfo(set)) {
+    return(RBInlineInsert(set,key,0) ? 1 : -1);
+  }
+  if (!(x=RBNodeAlloc(set))) return(-1); /* assignment */
+  x->info=0;
+  memcpy(&x->info,key,set->extra->keySize);
+  RBNodeSetKey(set,x,&x->info);
+  if (!RBTreeInsertNode(set,x)) {
+    RBNodeFree(set,x);
+    return(-1);
+  }
+  return(1);
+}
+
+int RBSetContains(rb_red_blk_tree* set, const void* key) {
+  return(RBExactQuery(set,(void*) key) != 0);
+}
+
+/*  removes key from the set, returning 0 if it was not there */
+
+int RBSetErase(rb_red_blk_tree* set, const void* key) {
+  rb_red_blk_node* x=RBExactQuery(set,(void*) key);
+
+  if (!x) return(0);
+  RBDelete(set,x);
+  return(1);
+}
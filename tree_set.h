@@ -0,0 +1,27 @@
+#include"tree_inline.h"
+
+#ifndef INC_TREE_SET_
+#define INC_TREE_SET_
+
+/*  Sets of fixed-size keys.  A set node has no info: a key of up to */
+/*  sizeof(void*) bytes is copied into the node's info field, so the */
+/*  node is a bare rb_red_blk_node with no allocation for the key. */
+/*  Only such sets save the info pointer's bytes.  The info field sits */
+/*  between the key pointer and the links, so a longer key cannot be */
+/*  laid over it; it is copied in after the node as RBTreeCreateInline */
+/*  does, and the node is as big as an inline tree's with valueSize 0. */
+/*  Sets have no destroy functions, so deleting a node makes no */
+/*  DestroyKey or DestroyInfo call.  x->key points at the node's copy */
+/*  of the key; x->info is not a value and must not be used. */
+/**/
+/*  A set holds each key once.  The usual searches, TreeSuccessor, */
+/*  RBDelete and RBTreeDestroy all work on it; nodes must be added */
+/*  with RBSetInsert. */
+
+rb_red_blk_tree* RBSetCreate(int (*Compare)(const void*, const void*),
+			     size_t keySize, void (*PrintKey)(const void*));
+int RBSetInsert(rb_red_blk_tree*, const void* key);
+int RBSetContains(rb_red_blk_tree*, const void* key);
+int RBSetErase(rb_red_blk_tree*, const void* key);
+
+#endif
@@ -0,0 +1,398 @@
+#include "tree_snapshot.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ALIGN8(n) (((n)+7) & ~(uint64_t)7)
+
+typedef struct rb_snap_writer {
+  rb_red_blk_tree* tree;
+  size_t (*KeySize)(const void*);
+  size_t (*InfoSize)(const void*);
+  char* base; /* the file, mapped for writing */
+  rb_snap_node* nodes;
+  uint64_t nextNode;
+  uint64_t nextData; /* file offset for the next key or info */
+} rb_snap_writer;
+
+/***********************************************************************/
+/*  FUNCTION:  FillNodes */
+/**/
+/*    INPUTS:  w is the writer and x the root of the subtree to write */
+/**/
+/*    OUTPUT:  the index given to x, or RB_SNAP_NIL if x is nil */
+/**/
+/*    EFFECT:  writes x's subtree in order, so a node's index is its */
+/*             rank, and copies the keys and infos after the nodes. */
+/*             A node learns its own index only after its left subtree */
+/*             is numbered, so it sets its children's parent fields */
+/*             rather than its own. */
+/**/
+/*    Modifies Input: w */
+/***********************************************************************/
+
+static uint32_t FillNodes(rb_snap_writer* w, rb_red_blk_node* x) {
+  rb_snap_node* record;
+  uint32_t left, right, me;
+  size_t size;
+
+  if (x == w->tree->nil) return(RB_SNAP_NIL);
+  left=FillNodes(w,x->left);
+  me=(uint32_t) w->nextNode++;
+  record=&w->nodes[me];
+  size=w->KeySize(x->key);
+  memcpy(w->base+w->nextData,x->key,size);
+  record->key=w->nextData;
+  w->nextData+=ALIGN8(size);
+  if (x->info && w->InfoSize) {
+    size=w->InfoSize(x->info);
+    memcpy(w->base+w->nextData,x->info,size);
+    record->info=w->nextData;
+    w->nextData+=ALIGN8(size);
+  } else {
+    record->info=0;
+  }
+  record->red=x->red ? 1 : 0;
+  record->parent=RB_SNAP_NIL;
+  right=FillNodes(w,x->right);
+  record->left=left;
+  record->right=right;
+  if (left != RB_SNAP_NIL) w->nodes[left].parent=me;
+  if (right != RB_SNAP_NIL) w->nodes[right].parent=me;
+  return(me);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeSaveFd */
+/**/
+/*    INPUTS:  tree is the tree to save, fd is an empty regular file */
+/*             open for reading and writing, and KeySize/InfoSize give */
+/*             the number of bytes in a key or a non-NULL info.  If */
+/*             InfoSize is NULL the infos are left out of the file. */
+/**/
+/*    OUTPUT:  1 on success, 0 if the file could not be sized, mapped */
+/*             or written, or the tree has too many nodes */
+/**/
+/*    EFFECT:  sizes the file in one pass over the tree, then maps it */
+/*             and writes the header, nodes and bytes straight into the */
+/*             mapping, and flushes it to disk. */
+/**/
+/*    Modifies Input: fd */
+/***********************************************************************/
+
+int RBTreeSaveFd(rb_red_blk_tree* tree, int fd,
+		 size_t (*KeySize)(const void*),
+		 size_t (*InfoSize)(const void*)) {
+  rb_snap_writer w;
+  rb_snap_header* header;
+  rb_red_blk_node* x;
+  uint64_t count=0;
+  uint64_t dataSize=0;
+  uint64_t keySize=0;
+  uint64_t infoSize=0;
+  uint64_t fileSize;
+  size_t size;
+  int ok;
+
+  for (x=tree->root->left; x != tree->nil && x->left != tree->nil; x=x->left);
+  for (; x != tree->nil; x=TreeSuccessor(tree,x)) {
+    count++;
+    size=KeySize(x->key);
+    if (size > keySize) keySize=size;
+    dataSize+=ALIGN8(size);
+    if (x->info && InfoSize) {
+      size=InfoSize(x->info);
+      if (size > infoSize) infoSize=size;
+      dataSize+=ALIGN8(size);
+    }
+  }
+  if (count >= RB_SNAP_NIL) return(0);
+  w.nextData=ALIGN8(sizeof(rb_snap_header)+count*sizeof(rb_snap_node));
+  /* the last key or info may be shorter than the largest one */
+  fileSize=w.nextData+dataSize+ALIGN8(keySize > infoSize ? keySize : infoSize);
+  if (ftruncate(fd,fileSize) != 0) return(0);
+  w.base=(char*) mmap(NULL,fileSize,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+  if (w.base == MAP_FAILED) return(0);
+
+  header=(rb_snap_header*) w.base;
+  memcpy(header->magic,RB_SNAP_MAGIC,8);
+  header->version=RB_SNAP_VERSION;
+  header->nodeSize=sizeof(rb_snap_node);
+  header->count=count;
+  header->nodesOffset=sizeof(rb_snap_header);
+  header->dataOffset=w.nextData;
+  header->fileSize=fileSize;
+  header->keySize=keySize;
+  header->infoSize=infoSize;
+  w.tree=tree;
+  w.KeySize=KeySize;
+  w.InfoSize=InfoSize;
+  w.nodes=(rb_snap_node*) (w.base+header->nodesOffset);
+  w.nextNode=0;
+  header->root=FillNodes(&w,tree->root->left);
+
+  ok= (msync(w.base,fileSize,MS_SYNC) == 0);
+  munmap(w.base,fileSize);
+  return(ok);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeSave */
+/**/
+/*    INPUTS:  as for RBTreeSaveFd, with path naming the snapshot file */
+/**/
+/*    OUTPUT:  1 on success, 0 on failure */
+/**/
+/*    EFFECT:  writes the snapshot to path.tmp and renames it over path */
+/*             once it is safely on disk, so a crash leaves either the */
+/*             old snapshot or the new one. */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+int RBTreeSave(rb_red_blk_tree* tree, const char* path,
+	       size_t (*KeySize)(const void*), size_t (*InfoSize)(const void*)) {
+  char* tmpPath;
+  int fd, ok;
+
+  tmpPath=(char*) SafeMalloc(strlen(path)+5);
+  strcpy(tmpPath,path);
+  strcat(tmpPath,".tmp");
+  if ( (fd=open(tmpPath,O_RDWR|O_CREAT|O_TRUNC,0644)) < 0) { /* assignment */
+    free(tmpPath);
+    return(0);
+  }
+  ok=RBTreeSaveFd(tree,fd,KeySize,InfoSize);
+  ok= (close(fd) == 0) && ok;
+  ok= ok && (rename(tmpPath,path) == 0);
+  if (!ok) unlink(tmpPath);
+  free(tmpPath);
+  return(ok);
+}
+
+/*  one node still to check in ValidNodes, with the range of indices */
+/*  its subtree must lie in */
+
+typedef struct rb_snap_check {
+  uint32_t node;
+  uint32_t lo;
+  uint32_t hi;
+} rb_snap_check;
+
+/***********************************************************************/
+/*  FUNCTION:  ValidNodes */
+/**/
+/*    INPUTS:  header heads a mapping of header->fileSize bytes whose */
+/*             header has been checked by RBTreeMapSnapshot */
+/**/
+/*    OUTPUT:  1 if the readers cannot go outside the mapping, 0 if not */
+/*             or if there was no memory to check */
+/**/
+/*    EFFECT:  checks that every key and info, taken to be as long as */
+/*             the largest one, lies in the data area and that the */
+/*             child indices, followed from the root, form a search */
+/*             tree over the array: a node's left subtree lies below */
+/*             it and its right subtree above, and no node is reached */
+/*             twice.  Every descent then ends, and after at most count */
+/*             steps. */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+static int ValidNodes(const rb_snap_header* header) {
+  const rb_snap_node* nodes=(const rb_snap_node*)
+    ((const char*) header+header->nodesOffset);
+  uint32_t count=(uint32_t) header->count;
+  rb_snap_check* stack;
+  rb_snap_check c;
+  unsigned char* seen;
+  uint64_t i;
+  long top=0;
+  int ok=1;
+
+  for (i=0; i<count; i++) {
+    if ( (nodes[i].key < header->dataOffset) ||
+	 (nodes[i].key > header->fileSize-header->keySize) ||
+	 ( nodes[i].info &&
+	   ( (nodes[i].info < header->dataOffset) ||
+	     (nodes[i].info > header->fileSize-header->infoSize) ) ) ||
+	 ( (nodes[i].parent != RB_SNAP_NIL) && (nodes[i].parent >= count) ) ) {
+      return(0);
+    }
+  }
+  if (header->root == RB_SNAP_NIL) return(count == 0);
+  if (header->root >= count) return(0);
+  stack=(rb_snap_check*) TryMalloc(count*sizeof(rb_snap_check));
+  seen=(unsigned char*) TryMalloc(count);
+  if (!stack || !seen) {
+    if (stack) SafeFree(stack,count*sizeof(rb_snap_check));
+    if (seen) SafeFree(seen,count);
+    return(0);
+  }
+  memset(seen,0,count);
+  stack[top].node=(uint32_t) header->root;
+  stack[top].lo=0;
+  stack[top++].hi=count;
+  while (ok && top) {
+    c=stack[--top];
+    if ( (c.node < c.lo) || (c.node >= c.hi) || seen[c.node] ) {
+      ok=0;
+      break;
+    }
+    seen[c.node]=1;
+    if (nodes[c.node].left != RB_SNAP_NIL) {
+      stack[top].node=nodes[c.node].left;
+      stack[top].lo=c.lo;
+      stack[top++].hi=c.node;
+    }
+    if (nodes[c.node].right != RB_SNAP_NIL) {
+      stack[top].node=nodes[c.node].right;
+      stack[top].lo=c.node+1;
+      stack[top++].hi=c.hi;
+    }
+  }
+  SafeFree(stack,count*sizeof(rb_snap_check));
+  SafeFree(seen,count);
+  return(ok);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeMapSnapshot */
+/**/
+/*    INPUTS:  path names a file written by RBTreeSave and CompFunc is */
+/*             the Compare function the tree was built with */
+/**/
+/*    OUTPUT:  the mapped snapshot, or NULL if the file cannot be */
+/*             opened or its header is not that of a snapshot */
+/**/
+/*    EFFECT:  maps the file read-only and checks that the header is */
+/*             consistent with the file's size.  The nodes are not */
+/*             read, so mapping takes the same time whatever the size; */
+/*             RBSnapshotValidate checks them. */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+rb_snapshot* RBTreeMapSnapshot(const char* path,
+			       int (*CompFunc)(const void*, const void*)) {
+  rb_snapshot* snap;
+  const rb_snap_header* header;
+  struct stat st;
+  void* base;
+  int fd;
+
+  if ( (fd=open(path,O_RDONLY)) < 0) return(NULL); /* assignment */
+  if ( (fstat(fd,&st) != 0) || (st.st_size < (off_t) sizeof(rb_snap_header)) ) {
+    close(fd);
+    return(NULL);
+  }
+  base=mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+  close(fd);
+  if (base == MAP_FAILED) return(NULL);
+  header=(const rb_snap_header*) base;
+  if ( memcmp(header->magic,RB_SNAP_MAGIC,8) ||
+       (header->version != RB_SNAP_VERSION) ||
+       (header->nodeSize != sizeof(rb_snap_node)) ||
+       (header->fileSize != (uint64_t) st.st_size) ||
+       (header->count >= RB_SNAP_NIL) ||
+       (header->nodesOffset < sizeof(rb_snap_header)) ||
+       (header->nodesOffset % 8) ||
+       (header->dataOffset > header->fileSize) ||
+       (header->nodesOffset > header->dataOffset) ||
+       (header->count > (header->dataOffset-header->nodesOffset)/
+	sizeof(rb_snap_node)) ||
+       (header->keySize > header->fileSize-header->dataOffset) ||
+       (header->infoSize > header->fileSize-header->dataOffset) ) {
+    munmap(base,st.st_size);
+    return(NULL);
+  }
+  snap=(rb_snapshot*) SafeMalloc(sizeof(rb_snapshot));
+  snap->Compare=CompFunc;
+  snap->base=(const char*) base;
+  snap->size=st.st_size;
+  snap->header=header;
+  snap->nodes=(const rb_snap_node*) (snap->base+header->nodesOffset);
+  return(snap);
+}
+
+/*  RBSnapshotValidate returns 1 if no index or offset in snap leads */
+/*  outside the mapping, so it is safe to search, and 0 if the file is */
+/*  corrupt or there was no memory to check it.  It reads every node. */
+
+int RBSnapshotValidate(rb_snapshot* snap) {
+  return(ValidNodes(snap->header));
+}
+
+void RBSnapshotClose(rb_snapshot* snap) {
+  munmap((void*) snap->base,snap->size);
+  free(snap);
+}
+
+const void* RBSnapKey(rb_snapshot* snap, const rb_snap_node* x) {
+  return(snap->base+x->key);
+}
+
+const void* RBSnapInfo(rb_snapshot* snap, const rb_snap_node* x) {
+  return(x->info ? snap->base+x->info : NULL);
+}
+
+/*  the snapshot versions of RBExactQuery, TreeSuccessor and */
+/*  TreePredecessor.  They return NULL where those return 0 or nil. */
+/*  Since the nodes are stored in key order the successor and */
+/*  predecessor of a node are simply its neighbours in the array. */
+
+const rb_snap_node* RBSnapExactQuery(rb_snapshot* snap, const void* q) {
+  uint32_t i=(uint32_t) snap->header->root;
+  int compVal;
+
+  while (i != RB_SNAP_NIL) {
+    compVal=snap->Compare(snap->base+snap->nodes[i].key,q);
+    if (0 == compVal) return(&snap->nodes[i]);
+    i= (1 == compVal) ? snap->nodes[i].left : snap->nodes[i].right;
+  }
+  return(NULL);
+}
+
+const rb_snap_node* RBSnapSuccessor(rb_snapshot* snap, const rb_snap_node* x) {
+  return( (x+1 < snap->nodes+snap->header->count) ? x+1 : NULL);
+}
+
+const rb_snap_node* RBSnapPredecessor(rb_snapshot* snap,
+				      const rb_snap_node* x) {
+  return( (x > snap->nodes) ? x-1 : NULL);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBSnapEnumerate */
+/**/
+/*    INPUTS:  snap is the snapshot to look for keys >= low and <= high */
+/**/
+/*    OUTPUT:  stack of pointers to the rb_snap_nodes in [low,high], */
+/*             which pop off in ascending order as with RBEnumerate */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+stk_stack* RBSnapEnumerate(rb_snapshot* snap, const void* low,
+			   const void* high) {
+  stk_stack* enumResultStack=StackCreate();
+  uint32_t i=(uint32_t) snap->header->root;
+  const rb_snap_node* lastBest=NULL;
+
+  while (i != RB_SNAP_NIL) {
+    if (1 == snap->Compare(snap->base+snap->nodes[i].key,high)) {
+      i=snap->nodes[i].left; /* key > high */
+    } else {
+      lastBest=&snap->nodes[i];
+      i=snap->nodes[i].right;
+    }
+  }
+  while (lastBest &&
+	 (1 != snap->Compare(low,snap->base+lastBest->key))) {
+    StackPush(enumResultStack,(void*) lastBest);
+    lastBest=RBSnapPredecessor(snap,lastBest);
+  }
+  return(enumResultStack);
+}
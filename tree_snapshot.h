@@ -0,0 +1,80 @@
+#include"red_black_tree.h"
+#include<stdint.h>
+
+#ifndef INC_TREE_SNAPSHOT_
+#define INC_TREE_SNAPSHOT_
+
+/*  A snapshot is a file holding a red-black tree in a form which can */
+/*  be searched in place after mmap, without deserializing anything. */
+/*  The nodes sit in one array, in key order, and refer to each other */
+/*  by index instead of by pointer, so the file works wherever it is */
+/*  mapped.  Keys and infos are copied into the file byte for byte; */
+/*  they must therefore be flat objects (no pointers inside) and the */
+/*  Compare function must work on those bytes, as IntComp does on an */
+/*  int.  A mapped snapshot is read-only. */
+/**/
+/*  Layout: an rb_snap_header, then header.count rb_snap_nodes, then the */
+/*  key and info bytes, each starting on an 8 byte boundary, then zero */
+/*  padding so that keySize bytes from any key, or infoSize bytes from */
+/*  any info, stay inside the file. */
+/**/
+/*  Mapping checks only the header, so it takes the same time whatever */
+/*  the size of the file.  A file which may be corrupt should be passed */
+/*  to RBSnapshotValidate, which reads every node once, before it is */
+/*  searched. */
+
+#define RB_SNAP_MAGIC "RBSNAP01"
+#define RB_SNAP_VERSION 2
+#define RB_SNAP_NIL 0xffffffffu /* node index meaning "no node" */
+
+typedef struct rb_snap_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t nodeSize; /* sizeof(rb_snap_node) when written */
+  uint64_t count; /* number of nodes */
+  uint64_t root; /* index of the root node, RB_SNAP_NIL if empty */
+  uint64_t nodesOffset; /* file offset of the node array */
+  uint64_t dataOffset; /* file offset of the key and info bytes */
+  uint64_t fileSize;
+  uint64_t keySize; /* bytes in the largest key */
+  uint64_t infoSize; /* bytes in the largest info */
+} rb_snap_header;
+
+typedef struct rb_snap_node {
+  uint64_t key; /* file offset of the key bytes */
+  uint64_t info; /* file offset of the info bytes, 0 if info was NULL */
+  uint32_t left; /* node indices, RB_SNAP_NIL if none */
+  uint32_t right;
+  uint32_t parent;
+  uint32_t red;
+} rb_snap_node;
+
+typedef struct rb_snapshot {
+  int (*Compare)(const void* a, const void* b);
+  const char* base; /* start of the mapping */
+  size_t size;
+  const rb_snap_header* header;
+  const rb_snap_node* nodes;
+} rb_snapshot;
+
+/*  KeySize(key) and InfoSize(info) give the number of bytes to copy */
+/*  from a key or (non-NULL) info pointer.  InfoSize may be NULL, in */
+/*  which case every info reads back as NULL. */
+int RBTreeSave(rb_red_blk_tree* tree, const char* path,
+	       size_t (*KeySize)(const void*), size_t (*InfoSize)(const void*));
+int RBTreeSaveFd(rb_red_blk_tree* tree, int fd,
+		 size_t (*KeySize)(const void*),
+		 size_t (*InfoSize)(const void*));
+rb_snapshot* RBTreeMapSnapshot(const char* path,
+			       int (*CompFunc)(const void*, const void*));
+int RBSnapshotValidate(rb_snapshot*);
+void RBSnapshotClose(rb_snapshot*);
+
+const rb_snap_node* RBSnapExactQuery(rb_snapshot*, const void* key);
+stk_stack* RBSnapEnumerate(rb_snapshot*, const void* low, const void* high);
+const rb_snap_node* RBSnapSuccessor(rb_snapshot*, const rb_snap_node*);
+const rb_snap_node* RBSnapPredecessor(rb_snapshot*, const rb_snap_node*);
+const void* RBSnapKey(rb_snapshot*, const rb_snap_node*);
+const void* RBSnapInfo(rb_snapshot*, const rb_snap_node*);
+
+#endif
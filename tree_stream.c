@@ -0,0 +1,241 @@
+#include "tree_stream.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+
+#define RB_RECORD_LENGTH sizeof(uint32_t)
+
+/***********************************************************************/
+/*  FUNCTION:  RBWriteAll */
+/**/
+/*    INPUTS:  fd, and the len bytes at buf to write to it */
+/**/
+/*    OUTPUT:  1 if every byte was written, 0 on an error */
+/**/
+/*    EFFECT:  keeps calling write until it has taken everything, since */
+/*             pipes and sockets may accept less than asked for */
+/**/
+/*    Modifies Input: fd */
+/***********************************************************************/
+
+int RBWriteAll(int fd, const char* buf, size_t len) {
+  ssize_t written;
+
+  while (len > 0) {
+    written=write(fd,buf,len);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return(0);
+    }
+    buf+=written;
+    len-=written;
+  }
+  return(1);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeExportBuffers */
+/**/
+/*    INPUTS:  tree is the tree to write, Serialize/context turn one */
+/*             key and info into bytes as described in the header, */
+/*             buf is the first buffer of size bytes to fill and */
+/*             Flush(sink,buf,used,last) takes a filled buffer */
+/**/
+/*    OUTPUT:  1 on success, 0 if Flush failed or a record did not fit */
+/*             in size bytes */
+/**/
+/*    EFFECT:  fills buffers with the stream for tree in ascending */
+/*             order and hands each one to Flush.  Unless last is set, */
+/*             Flush returns the buffer to fill next, which may be the */
+/*             same one, or NULL if it failed; records never straddle */
+/*             two buffers. */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+int RBTreeExportBuffers(rb_red_blk_tree* tree,
+			size_t (*Serialize)(const void*, const void*, char*,
+					    size_t, void*),
+			void* context,
+			char* (*Flush)(void*, char*, size_t, int), void* sink,
+			char* buf, size_t size) {
+  rb_stream_header header;
+  rb_red_blk_node* x;
+  size_t used=0;
+  size_t room, len;
+  uint32_t recordLen;
+
+  memcpy(header.magic,RB_STREAM_MAGIC,8);
+  header.count=tree->count;
+  memcpy(buf,&header,sizeof(header));
+  used=sizeof(header);
+  for (x=tree->root->left; x != tree->nil && x->left != tree->nil; x=x->left);
+  for (; x != tree->nil; x=TreeSuccessor(tree,x)) {
+    room=size-used;
+    room= (room > RB_RECORD_LENGTH) ? room-RB_RECORD_LENGTH : 0;
+    len= room ? Serialize(x->key,x->info,buf+used+RB_RECORD_LENGTH,room,
+			  context) : 1;
+    if (len > room) {
+      /* hand the buffer over and retry with a whole one */
+      if (!(buf=Flush(sink,buf,used,0))) return(0); /* assignment */
+      used=0;
+      room=size-RB_RECORD_LENGTH;
+      len=Serialize(x->key,x->info,buf+RB_RECORD_LENGTH,room,context);
+      if (len > room) return(0);
+    }
+    recordLen=(uint32_t) len;
+    memcpy(buf+used,&recordLen,RB_RECORD_LENGTH);
+    used+=RB_RECORD_LENGTH+len;
+  }
+  return(Flush(sink,buf,used,1) != NULL);
+}
+
+static char* WriteBuffer(void* sink, char* buf, size_t used, int last) {
+  return(RBWriteAll(*(int*) sink,buf,used) ? buf : NULL);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeExport */
+/**/
+/*    INPUTS:  tree is the tree to write to fd, Serialize/context turn */
+/*             one key and info into bytes as described in the header */
+/**/
+/*    OUTPUT:  1 on success, 0 if a write failed or a record did not */
+/*             fit in RB_STREAM_BUFFER bytes */
+/**/
+/*    EFFECT:  writes the tree's items in ascending order, gathering */
+/*             them into RB_STREAM_BUFFER sized writes */
+/**/
+/*    Modifies Input: fd */
+/***********************************************************************/
+
+int RBTreeExport(rb_red_blk_tree* tree, int fd,
+		 size_t (*Serialize)(const void*, const void*, char*, size_t,
+				     void*),
+		 void* context) {
+  char* buf=(char*) SafeMalloc(RB_STREAM_BUFFER);
+  int ok;
+
+  ok=RBTreeExportBuffers(tree,Serialize,context,WriteBuffer,&fd,buf,
+			 RB_STREAM_BUFFER);
+  free(buf);
+  return(ok);
+}
+
+typedef struct rb_stream_reader {
+  int fd;
+  char* buf;
+  size_t start; /* first unconsumed byte */
+  size_t end; /* one past the last byte read */
+  rb_red_blk_tree* tree;
+  int (*Deserialize)(const char*, size_t, void**, void**, void*);
+  void* context;
+  void* lastKey;
+  uint64_t remaining; /* records the header says are still to come */
+} rb_stream_reader;
+
+/***********************************************************************/
+/*  FUNCTION:  ReadAtLeast */
+/**/
+/*    INPUTS:  r is the reader and need how many unconsumed bytes the */
+/*             caller wants in r->buf */
+/**/
+/*    OUTPUT:  1 if they are there, 0 on an error, end of file or if */
+/*             need is more than the buffer holds */
+/**/
+/*    Modifies Input: r */
+/***********************************************************************/
+
+static int ReadAtLeast(rb_stream_reader* r, size_t need) {
+  ssize_t got;
+
+  if (r->end-r->start >= need) return(1);
+  if (need > RB_STREAM_BUFFER) return(0);
+  memmove(r->buf,r->buf+r->start,r->end-r->start);
+  r->end-=r->start;
+  r->start=0;
+  while (r->end < need) {
+    got=read(r->fd,r->buf+r->end,RB_STREAM_BUFFER-r->end);
+    if (got < 0 && errno == EINTR) continue;
+    if (got <= 0) return(0);
+    r->end+=got;
+  }
+  return(1);
+}
+
+/*  NextItem for RBTreeBuildSorted.  It also refuses records which are */
+/*  out of order, since they would silently break the tree, and fails */
+/*  on the last record if anything follows it in the stream. */
+
+static int StreamNextItem(void* context, void** key, void** info) {
+  rb_stream_reader* r=(rb_stream_reader*) context;
+  uint32_t recordLen;
+
+  if (!ReadAtLeast(r,RB_RECORD_LENGTH)) return(0);
+  memcpy(&recordLen,r->buf+r->start,RB_RECORD_LENGTH);
+  if (!ReadAtLeast(r,RB_RECORD_LENGTH+recordLen)) return(0);
+  if (!r->Deserialize(r->buf+r->start+RB_RECORD_LENGTH,recordLen,key,info,
+		      r->context)) {
+    return(0);
+  }
+  r->start+=RB_RECORD_LENGTH+recordLen;
+  if (r->lastKey && (1 == r->tree->Compare(r->lastKey,*key))) {
+    r->tree->DestroyKey(*key);
+    r->tree->DestroyInfo(*info);
+    return(0);
+  }
+  r->lastKey=*key;
+  if (!--r->remaining && ReadAtLeast(r,1)) {
+    r->tree->DestroyKey(*key);
+    r->tree->DestroyInfo(*info);
+    return(0);
+  }
+  return(1);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBTreeImport */
+/**/
+/*    INPUTS:  tree is an empty tree, fd holds a stream written by */
+/*             RBTreeExport and Deserialize/context rebuild its items */
+/**/
+/*    OUTPUT:  1 on success, 0 if the stream was short, malformed, out */
+/*             of order or had records beyond its count, in which case */
+/*             the tree is still empty */
+/**/
+/*    Modifies Input: tree, fd */
+/**/
+/*    EFFECT:  builds the tree in O(n) time as the records are read; */
+/*             only the stream header and one buffer are kept apart */
+/*             from the nodes themselves */
+/***********************************************************************/
+
+int RBTreeImport(rb_red_blk_tree* tree, int fd,
+		 int (*Deserialize)(const char*, size_t, void**, void**,
+				    void*),
+		 void* context) {
+  rb_stream_reader r;
+  rb_stream_header header;
+  int ok;
+
+  r.fd=fd;
+  r.buf=(char*) SafeMalloc(RB_STREAM_BUFFER);
+  r.start=r.end=0;
+  r.tree=tree;
+  r.Deserialize=Deserialize;
+  r.context=context;
+  r.lastKey=NULL;
+  ok=ReadAtLeast(&r,sizeof(header));
+  if (ok) {
+    memcpy(&header,r.buf,sizeof(header));
+    r.start=sizeof(header);
+    r.remaining=header.count;
+    ok= !memcmp(header.magic,RB_STREAM_MAGIC,8) &&
+      (header.count <= LONG_MAX) &&
+      (header.count || !ReadAtLeast(&r,1)) &&
+      RBTreeBuildSorted(tree,(long) header.count,StreamNextItem,&r);
+  }
+  free(r.buf);
+  return(ok);
+}
@@ -0,0 +1,51 @@
+#include"red_black_tree.h"
+#include<stdint.h>
+
+#ifndef INC_TREE_STREAM_
+#define INC_TREE_STREAM_
+
+/*  Streams a tree through a file descriptor in key order, for example */
+/*  to copy it to another process through a pipe or socket.  Unlike */
+/*  RBEnumerate neither side holds a list of the nodes: the exporter */
+/*  walks the tree with TreeSuccessor and the importer builds the tree */
+/*  with RBTreeBuildSorted as the records arrive, so apart from the */
+/*  tree itself each side only uses one RB_STREAM_BUFFER sized buffer. */
+/**/
+/*  Format: an rb_stream_header, then header.count records, each a */
+/*  uint32_t length followed by that many bytes written by Serialize. */
+/*  Lengths and the count are in the writer's byte order. */
+
+#define RB_STREAM_MAGIC "RBSTRM01"
+
+#ifndef RB_STREAM_BUFFER
+#define RB_STREAM_BUFFER (256*1024) /* also the largest record */
+#endif
+
+typedef struct rb_stream_header {
+  char magic[8];
+  uint64_t count;
+} rb_stream_header;
+
+/*  Serialize(key,info,buf,room,context) stores key and info in the */
+/*  room bytes at buf and returns how many it used, or any number */
+/*  larger than room if they do not fit, in which case it is called */
+/*  again with more room.  Deserialize(buf,len,&key,&info,context) */
+/*  rebuilds a key and info from one record and returns 0 if the */
+/*  record is malformed. */
+int RBTreeExport(rb_red_blk_tree* tree, int fd,
+		 size_t (*Serialize)(const void*, const void*, char*, size_t,
+				     void*),
+		 void* context);
+int RBTreeImport(rb_red_blk_tree* tree, int fd,
+		 int (*Deserialize)(const char*, size_t, void**, void**,
+				    void*),
+		 void* context);
+int RBTreeExportBuffers(rb_red_blk_tree* tree,
+			size_t (*Serialize)(const void*, const void*, char*,
+					    size_t, void*),
+			void* context,
+			char* (*Flush)(void*, char*, size_t, int), void* sink,
+			char* buf, size_t size);
+int RBWriteAll(int fd, const char* buf, size_t len);
+
+#endif
@@ -0,0 +1,147 @@
+#include "tree_string.h"
+#include <string.h>
+
+/*  reads 8 bytes as a big-endian number, so that comparing two such */
+/*  numbers compares the bytes as memcmp would */
+
+static uint64_t LoadBigEndian(const char* p) {
+  uint64_t w;
+
+  memcpy(&w,p,sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  w=__builtin_bswap64(w);
+#endif
+  return(w);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBStringCompare */
+/**/
+/*    INPUTS:  a and b point to rb_string_keys */
+/**/
+/*    OUTPUT:  1, -1 or 0 as a is greater than, less than or equal to */
+/*             b, comparing bytes as unsigned and a proper prefix of a */
+/*             string as less than the string */
+/**/
+/*    EFFECT:  compares a word at a time, then the last few bytes one */
+/*             at a time, never reading past either key */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+int RBStringCompare(const void* a, const void* b) {
+  const rb_string_key* x=(const rb_string_key*) a;
+  const rb_string_key* y=(const rb_string_key*) b;
+  const char* xd=RBStringData(x);
+  const char* yd=RBStringData(y);
+  size_t n= (x->len < y->len) ? x->len : y->len;
+  size_t i;
+  uint64_t wx, wy;
+
+  for (i=0; i+8<=n; i+=8) {
+    wx=LoadBigEndian(xd+i);
+    wy=LoadBigEndian(yd+i);
+    if (wx != wy) return( (wx > wy) ? 1 : -1);
+  }
+  for (; i<n; i++) {
+    if (xd[i] != yd[i]) {
+      return( ((unsigned char) xd[i] > (unsigned char) yd[i]) ? 1 : -1);
+    }
+  }
+  if (x->len == y->len) return(0);
+  return( (x->len > y->len) ? 1 : -1);
+}
+
+/*  the first 8 bytes, padded with zeros, as a big-endian number.  A */
+/*  greater string never gets a smaller prefix. */
+
+uint64_t RBStringPrefix(const void* key) {
+  const rb_string_key* k=(const rb_string_key*) key;
+  char bytes[8]={0};
+
+  memcpy(bytes,RBStringData(k),(k->len < 8) ? k->len : 8);
+  return(LoadBigEndian(bytes));
+}
+
+static void StringKeyDestroy(void* key) {
+  rb_string_key* k=(rb_string_key*) key;
+
+  free((char*) k->data);
+}
+
+static void StringKeyPrint(const void* key) {
+  const rb_string_key* k=(const rb_string_key*) key;
+
+  printf("%.*s",(int) k->len,RBStringData(k));
+}
+
+rb_red_blk_tree* RBStringTreeCreate(void (*DestroyInfo)(void*),
+				    void (*PrintInfo)(void*)) {
+  rb_red_blk_tree* tree;
+
+  tree=RBTreeCreate(RBStringCompare,StringKeyDestroy,DestroyInfo,
+		    StringKeyPrint,PrintInfo);
+  RBTreeUsePrefix(tree,RBStringPrefix);
+  tree->nodeSize=sizeof(rb_string_node);
+  return(tree);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBStringInsert */
+/**/
+/*    INPUTS:  tree comes from RBStringTreeCreate and the key is the */
+/*             len bytes at s */
+/**/
+/*    OUTPUT:  the new node, or NULL if the tree's allocator or budget */
+/*             refused it */
+/**/
+/*    EFFECT:  copies the key into the node, or if it is too long into */
+/*             a heap block which RBDelete and RBTreeDestroy free */
+/**/
+/*    Modifies Input: tree */
+/***********************************************************************/
+
+rb_red_blk_node* RBStringInsert(rb_red_blk_tree* tree, const char* s,
+				size_t len, void* info) {
+  rb_string_node* x=(rb_string_node*) RBNodeAlloc(tree);
+  char* copy;
+
+  if (!x) return(NULL);
+  copy= (len < RB_STRING_INLINE) ? x->key.buf : (char*) SafeMalloc(len+1);
+  memcpy(copy,s,len);
+  copy[len]=0;
+  x->key.len=len;
+  x->key.data= (copy == x->key.buf) ? NULL : copy;
+  RBNodeSetKey(tree,&x->node,&x->key);
+  x->node.info=info;
+  if (!RBTreeInsertNode(tree,&x->node)) {
+    free((char*) x->key.data);
+    RBNodeFree(tree,&x->node);
+    return(NULL);
+  }
+  return(&x->node);
+}
+
+/*  a key which views the caller's bytes instead of copying them */
+
+static void StringView(rb_string_key* k, const char* s, size_t len) {
+  k->len=len;
+  k->data=s;
+}
+
+rb_red_blk_node* RBStringQuery(rb_red_blk_tree* tree, const char* s,
+			       size_t len) {
+  rb_string_key q;
+
+  StringView(&q,s,len);
+  return(RBExactQuery(tree,&q));
+}
+
+stk_stack* RBStringEnumerate(rb_red_blk_tree* tree, const char* low,
+			     size_t lowLen, const char* high, size_t highLen) {
+  rb_string_key lowKey, highKey;
+
+  StringView(&lowKey,low,lowLen);
+  StringView(&highKey,high,highLen);
+  return(RBEnumerate(tree,&lowKey,&highKey));
+}
@@ -0,0 +1,50 @@
+#include"red_black_tree.h"
+
+#ifndef INC_TREE_STRING_
+#define INC_TREE_STRING_
+
+/*  A tree keyed by byte strings, which keeps each key in the same */
+/*  allocation as its node.  Keys of up to RB_STRING_INLINE-1 bytes are */
+/*  copied into the node (with a terminating 0), longer ones into one */
+/*  heap block of their own, so a short key costs no allocation and */
+/*  sits in the node's cache lines.  Keys are compared as by memcmp, */
+/*  then by length, eight bytes at a time, and the tree keeps their */
+/*  first eight bytes as the node prefix (see RBTreeUsePrefix), so */
+/*  most steps of a search never read the key at all. */
+/**/
+/*  The tree is an ordinary rb_red_blk_tree: RBDelete, TreeSuccessor, */
+/*  RBTreeDestroy and the rest work on it as usual.  Nodes must be */
+/*  added with RBStringInsert, and a node's key is RBStringKey(node). */
+/*  RBStringQuery and RBStringEnumerate take a pointer and a length, */
+/*  which need not be 0 terminated, and build no key object.  An */
+/*  inline key has no pointer to itself, so a node can be moved with */
+/*  memcpy (see tree_compact.h); read its bytes with RBStringData. */
+
+#define RB_STRING_INLINE 24
+
+typedef struct rb_string_key {
+  size_t len;
+  const char* data; /* NULL if in buf, a heap copy, or a query's bytes */
+  char buf[RB_STRING_INLINE];
+} rb_string_key;
+
+typedef struct rb_string_node { /* an rb_prefixed_node, then the key */
+  rb_red_blk_node node;
+  uint64_t prefix;
+  rb_string_key key;
+} rb_string_node;
+
+rb_red_blk_tree* RBStringTreeCreate(void (*DestroyInfo)(void*),
+				    void (*PrintInfo)(void*));
+rb_red_blk_node* RBStringInsert(rb_red_blk_tree*, const char* s, size_t len,
+				void* info);
+rb_red_blk_node* RBStringQuery(rb_red_blk_tree*, const char* s, size_t len);
+stk_stack* RBStringEnumerate(rb_red_blk_tree*, const char* low,
+			     size_t lowLen, const char* high, size_t highLen);
+int RBStringCompare(const void* a, const void* b);
+uint64_t RBStringPrefix(const void* key);
+
+#define RBStringKey(x) ((const rb_string_key*) (x)->key)
+#define RBStringData(k) ((k)->data ? (k)->data : (k)->buf)
+
+#endif
@@ -0,0 +1,417 @@
+#include "tree_wal.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+
+static uint32_t Checksum(uint32_t op, const char* p, size_t len) {
+  uint32_t hash=2166136261u ^ op; /* FNV-1a */
+
+  while (len--) hash=(hash ^ (unsigned char) *p++)*16777619u;
+  return(hash);
+}
+
+static char* AddSuffix(const char* path, const char* suffix) {
+  char* result=(char*) SafeMalloc(strlen(path)+strlen(suffix)+1);
+
+  strcpy(result,path);
+  strcat(result,suffix);
+  return(result);
+}
+
+/*  fsyncs the directory holding path, which makes a rename into it */
+/*  durable */
+
+static int SyncDir(const char* path) {
+  char* copy=AddSuffix(path,"");
+  int fd, ok;
+
+  fd=open(dirname(copy),O_RDONLY);
+  free(copy);
+  if (fd < 0) return(0);
+  ok= (fsync(fd) == 0);
+  close(fd);
+  return(ok);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  ReplaceFile */
+/**/
+/*    INPUTS:  path is the file to replace and generation/magic form */
+/*             the header of its new contents.  If tree is not NULL */
+/*             it is written after the header with RBTreeCheckpoint. */
+/**/
+/*    OUTPUT:  1 on success, 0 on failure */
+/**/
+/*    EFFECT:  writes path.tmp, fsyncs it and renames it over path, so */
+/*             path always holds either the old file or the new one */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+static int ReplaceFile(rb_durable_tree* d, const char* path,
+		       const char* magic, uint64_t generation,
+		       rb_red_blk_tree* tree) {
+  rb_wal_header header;
+  char* tmpPath=AddSuffix(path,".tmp");
+  int fd, ok;
+
+  memset(&header,0,sizeof(header));
+  memcpy(header.magic,magic,8);
+  header.generation=generation;
+  if ( (fd=open(tmpPath,O_WRONLY|O_CREAT|O_TRUNC,0644)) < 0) { /* assignment */
+    free(tmpPath);
+    return(0);
+  }
+  ok=RBWriteAll(fd,(char*) &header,sizeof(header));
+  ok= ok && (!tree || RBTreeCheckpoint(tree,fd,d->Serialize,d->context,
+					RB_CKPT_AUTO,2,NULL));
+  ok= ok && (fsync(fd) == 0);
+  ok= (close(fd) == 0) && ok;
+  ok= ok && (rename(tmpPath,path) == 0) && SyncDir(path);
+  if (!ok) unlink(tmpPath);
+  free(tmpPath);
+  return(ok);
+}
+
+/*  starts an empty log of the given generation and opens it */
+
+static int StartLog(rb_durable_tree* d, uint64_t generation) {
+  if (d->walFd >= 0) close(d->walFd);
+  d->walFd=-1;
+  if (!ReplaceFile(d,d->walPath,RB_WAL_MAGIC,generation,NULL)) return(0);
+  d->walFd=open(d->walPath,O_WRONLY|O_APPEND);
+  d->generation=generation;
+  d->logRecords=0;
+  return(d->walFd >= 0);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBDurableSync */
+/**/
+/*    INPUTS:  d is the durable tree */
+/**/
+/*    OUTPUT:  1 if every operation so far is on disk, 0 if a write or */
+/*             fsync has ever failed */
+/**/
+/*    EFFECT:  writes the buffered records and fsyncs the log, ending */
+/*             the current group early */
+/**/
+/*    Modifies Input: d */
+/***********************************************************************/
+
+int RBDurableSync(rb_durable_tree* d) {
+  if (d->failed) return(0);
+  if (d->pending) {
+    d->failed= !RBWriteAll(d->walFd,d->buf,d->used) || (fsync(d->walFd) != 0);
+    d->used=0;
+    d->pending=0;
+  }
+  return(!d->failed);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBDurableCheckpoint */
+/**/
+/*    INPUTS:  d is the durable tree */
+/**/
+/*    OUTPUT:  1 on success, 0 on failure */
+/**/
+/*    EFFECT:  commits the log, writes the whole tree as the next */
+/*             generation's checkpoint and starts an empty log for it */
+/**/
+/*    Modifies Input: d */
+/***********************************************************************/
+
+int RBDurableCheckpoint(rb_durable_tree* d) {
+  if (!RBDurableSync(d)) return(0);
+  d->failed= !ReplaceFile(d,d->checkpointPath,RB_CHECKPOINT_MAGIC,
+			  d->generation+1,d->tree) ||
+    !StartLog(d,d->generation+1);
+  return(!d->failed);
+}
+
+/*  adds a record for key and info to the buffer, then commits the */
+/*  group when it is full */
+
+static void LogRecord(rb_durable_tree* d, uint32_t op, const void* key,
+		      const void* info) {
+  rb_wal_record record;
+  char* payload;
+  size_t room, len;
+
+  if (d->failed) return;
+  room=RB_STREAM_BUFFER-d->used;
+  room= (room > sizeof(record)) ? room-sizeof(record) : 0;
+  payload=d->buf+d->used+sizeof(record);
+  len= room ? d->Serialize(key,info,payload,room,d->context) : 1;
+  if (len > room) {
+    if (!RBWriteAll(d->walFd,d->buf,d->used)) {
+      d->failed=1;
+      return;
+    }
+    d->used=0;
+    room=RB_STREAM_BUFFER-sizeof(record);
+    payload=d->buf+sizeof(record);
+    len=d->Serialize(key,info,payload,room,d->context);
+    if (len > room) {
+      d->failed=1;
+      return;
+    }
+  }
+  record.length=(uint32_t) len;
+  record.op=op;
+  record.checksum=Checksum(op,payload,len);
+  memcpy(d->buf+d->used,&record,sizeof(record));
+  d->used+=sizeof(record)+len;
+  d->logRecords++;
+  if (++d->pending >= d->groupSize) RBDurableSync(d);
+}
+
+/*  called after each operation is applied, since a checkpoint must */
+/*  include every record in the log it replaces */
+
+static void CheckpointIfDue(rb_durable_tree* d) {
+  if (d->checkpointEvery && (d->logRecords >= d->checkpointEvery)) {
+    RBDurableCheckpoint(d);
+  }
+}
+
+rb_red_blk_node* RBDurableInsert(rb_durable_tree* d, void* key, void* info) {
+  rb_red_blk_node* x;
+
+  /* a refused insert is not logged, or replay would apply it */
+  if ( (x=RBTreeInsert(d->tree,key,info)) ) { /* assignment */
+    LogRecord(d,RB_WAL_INSERT,key,info);
+    CheckpointIfDue(d);
+  }
+  return(x);
+}
+
+void RBDurableDelete(rb_durable_tree* d, rb_red_blk_node* z) {
+  LogRecord(d,RB_WAL_DELETE,z->key,z->info);
+  RBDelete(d->tree,z);
+  CheckpointIfDue(d);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  FindLogged */
+/**/
+/*    INPUTS:  d is the durable tree, and payload/length the record of */
+/*             a delete, whose key has been deserialized into key */
+/**/
+/*    OUTPUT:  the node the delete removed, or 0 if no node has its key */
+/**/
+/*    EFFECT:  among the nodes with keys equal to key, picks the first */
+/*             which serializes to the same bytes as the record, so */
+/*             that with equal keys the replay deletes the same item */
+/*             the original did.  If none does it falls back to any */
+/*             node with the key. */
+/**/
+/*    Modifies Input: none */
+/***********************************************************************/
+
+static rb_red_blk_node* FindLogged(rb_durable_tree* d, const void* key,
+				   const char* payload, size_t length,
+				   char* scratch) {
+  rb_red_blk_tree* tree=d->tree;
+  rb_red_blk_node* x;
+  rb_red_blk_node* y;
+  size_t len;
+
+  if (!(x=RBExactQuery(tree,(void*) key))) return(0); /* assignment */
+  while ( ((y=TreePredecessor(tree,x)) != tree->nil) && /* assignment */
+	  (tree->Compare(y->key,key) == 0) ) {
+    x=y;
+  }
+  for (y=x; (y != tree->nil) && (tree->Compare(y->key,key) == 0);
+       y=TreeSuccessor(tree,y)) {
+    len=d->Serialize(y->key,y->info,scratch,RB_STREAM_BUFFER,d->context);
+    if ( (len == length) && !memcmp(scratch,payload,len) ) return(y);
+  }
+  return(x);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  ReplayLog */
+/**/
+/*    INPUTS:  d is the durable tree and fd the log, positioned just */
+/*             after its header */
+/**/
+/*    OUTPUT:  the offset just past the last whole, valid record, or */
+/*             -1 if the tree refused a logged insert */
+/**/
+/*    EFFECT:  applies the log's records to d->tree in order, stopping */
+/*             at the end of the file or at a torn or corrupt record. */
+/*             An insert the tree refuses, say for its memory budget, */
+/*             stops the replay without cutting the log, since the */
+/*             records after it are good. */
+/**/
+/*    Modifies Input: d */
+/***********************************************************************/
+
+static off_t ReplayLog(rb_durable_tree* d, int fd) {
+  rb_wal_record record;
+  rb_red_blk_node* x;
+  off_t goodEnd=sizeof(rb_wal_header);
+  FILE* f=fdopen(dup(fd),"r");
+  char* payload=(char*) SafeMalloc(RB_STREAM_BUFFER);
+  char* scratch=(char*) SafeMalloc(RB_STREAM_BUFFER);
+  void* key;
+  void* info;
+
+  if (!f) {
+    free(payload);
+    free(scratch);
+    return(goodEnd);
+  }
+  fseek(f,goodEnd,SEEK_SET);
+  while (fread(&record,sizeof(record),1,f) == 1) {
+    if ( (record.length > RB_STREAM_BUFFER) ||
+	 ((record.op != RB_WAL_INSERT) && (record.op != RB_WAL_DELETE)) ||
+	 (fread(payload,1,record.length,f) != record.length) ||
+	 (record.checksum != Checksum(record.op,payload,record.length)) ||
+	 !d->Deserialize(payload,record.length,&key,&info,d->context) ) {
+      break;
+    }
+    if (record.op == RB_WAL_INSERT) {
+      if (!RBTreeInsert(d->tree,key,info)) {
+	d->tree->DestroyKey(key);
+	d->tree->DestroyInfo(info);
+	goodEnd=-1;
+	break;
+      }
+    } else {
+      x=FindLogged(d,key,payload,record.length,scratch);
+      if (x) RBDelete(d->tree,x);
+      d->tree->DestroyKey(key);
+      d->tree->DestroyInfo(info);
+    }
+    goodEnd+=sizeof(record)+record.length;
+    d->replayed++;
+  }
+  fclose(f);
+  free(payload);
+  free(scratch);
+  return(goodEnd);
+}
+
+/*  reads a header with the given magic from fd, returning 0 if it is */
+/*  missing or wrong */
+
+static int ReadHeader(int fd, const char* magic, uint64_t* generation) {
+  rb_wal_header header;
+
+  if (read(fd,&header,sizeof(header)) != sizeof(header)) return(0);
+  if (memcmp(header.magic,magic,8)) return(0);
+  *generation=header.generation;
+  return(1);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBDurableOpen */
+/**/
+/*    INPUTS:  tree is an empty tree.  path is the name the log and */
+/*             checkpoint are stored under, as path.wal and path.ckpt. */
+/*             Serialize, Deserialize and context convert keys and */
+/*             infos as in tree_stream.h.  groupSize is the number of */
+/*             records per fsync and checkpointEvery the number of log */
+/*             records which triggers a checkpoint, 0 for never. */
+/**/
+/*    OUTPUT:  the durable tree, or NULL if the files exist but cannot */
+/*             be read, are damaged beyond the log's tail, or hold */
+/*             more than tree will take */
+/**/
+/*    EFFECT:  loads the checkpoint and replays the log into tree.  A */
+/*             torn record at the end of the log is cut off, and new */
+/*             records are appended after the last good one. */
+/**/
+/*    Modifies Input: tree */
+/***********************************************************************/
+
+rb_durable_tree* RBDurableOpen(rb_red_blk_tree* tree, const char* path,
+			       size_t (*Serialize)(const void*, const void*,
+						   char*, size_t, void*),
+			       int (*Deserialize)(const char*, size_t, void**,
+						  void**, void*),
+			       void* context, int groupSize,
+			       long checkpointEvery) {
+  rb_durable_tree* d=(rb_durable_tree*) SafeMalloc(sizeof(rb_durable_tree));
+  uint64_t checkpointGeneration=0;
+  uint64_t logGeneration;
+  off_t goodEnd;
+  int fd;
+  int ok=1;
+
+  d->tree=tree;
+  d->walPath=AddSuffix(path,".wal");
+  d->checkpointPath=AddSuffix(path,".ckpt");
+  d->walFd=-1;
+  d->generation=0;
+  d->Serialize=Serialize;
+  d->Deserialize=Deserialize;
+  d->context=context;
+  d->buf=(char*) SafeMalloc(RB_STREAM_BUFFER);
+  d->used=0;
+  d->groupSize= (groupSize > 0) ? groupSize : 1;
+  d->pending=0;
+  d->checkpointEvery=checkpointEvery;
+  d->logRecords=0;
+  d->replayed=0;
+  d->failed=0;
+
+  if ( (fd=open(d->checkpointPath,O_RDONLY)) >= 0) { /* assignment */
+    ok= ReadHeader(fd,RB_CHECKPOINT_MAGIC,&checkpointGeneration) &&
+      RBTreeImport(tree,fd,Deserialize,context);
+    close(fd);
+  }
+  if (ok && ( (fd=open(d->walPath,O_RDWR)) >= 0) ) { /* assignment */
+    ok=ReadHeader(fd,RB_WAL_MAGIC,&logGeneration) &&
+      (logGeneration <= checkpointGeneration);
+    if (ok && (logGeneration == checkpointGeneration)) {
+      /* the log continues the checkpoint; an older one is obsolete */
+      goodEnd=ReplayLog(d,fd);
+      ok= (goodEnd >= 0) && (ftruncate(fd,goodEnd) == 0) &&
+	(fsync(fd) == 0);
+      d->walFd=open(d->walPath,O_WRONLY|O_APPEND);
+      d->generation=logGeneration;
+      d->logRecords=d->replayed;
+      ok= ok && (d->walFd >= 0);
+    }
+    close(fd);
+  }
+  if (ok && (d->walFd < 0)) ok=StartLog(d,checkpointGeneration);
+  if (!ok) {
+    if (d->walFd >= 0) close(d->walFd);
+    free(d->walPath);
+    free(d->checkpointPath);
+    free(d->buf);
+    free(d);
+    return(NULL);
+  }
+  return(d);
+}
+
+/***********************************************************************/
+/*  FUNCTION:  RBDurableClose */
+/**/
+/*    INPUTS:  d is the durable tree */
+/**/
+/*    OUTPUT:  1 if every operation made through d is on disk */
+/**/
+/*    EFFECT:  commits the log and frees d.  The tree is left to the */
+/*             caller. */
+/**/
+/*    Modifies Input: d */
+/***********************************************************************/
+
+int RBDurableClose(rb_durable_tree* d) {
+  int ok=RBDurableSync(d);
+
+  if (d->walFd >= 0) ok= (close(d->walFd) == 0) && ok;
+  free(d->walPath);
+  free(d->checkpointPath);
+  free(d->buf);
+  free(d);
+  return(ok);
+}
@@ -0,0 +1,79 @@
+#include"tree_checkpoint.h"
+
+#ifndef INC_TREE_WAL_
+#define INC_TREE_WAL_
+
+/*  A durable tree keeps a write-ahead log of every insert and delete */
+/*  made through it, plus a checkpoint: a copy of the whole tree in the */
+/*  format of tree_stream.h.  RBDurableOpen rebuilds the tree from the */
+/*  checkpoint and replays the log written since. */
+/**/
+/*  Records are buffered and written with one fsync per groupSize */
+/*  records (group commit), so an operation is only durable after the */
+/*  group it is in has been committed or RBDurableSync is called.  A */
+/*  crash loses at most the uncommitted group; a record torn by the */
+/*  crash fails its checksum and ends the replay. */
+/**/
+/*  Every checkpoint starts a new generation of the log.  The */
+/*  checkpoint is renamed into place before the new log is, and */
+/*  recovery ignores a log older than the checkpoint, so a crash during */
+/*  a checkpoint never replays records twice. */
+/**/
+/*  A delete is replayed on the node with the logged key whose key and */
+/*  info serialize to the logged bytes, so that of several equal keys */
+/*  it removes the same item the original did. */
+/**/
+/*  An insert the tree refuses is not logged.  If the tree given to */
+/*  RBDurableOpen refuses a logged insert, say for its budget, the */
+/*  open fails and leaves the log as it was. */
+
+#define RB_WAL_MAGIC "RBWAL001"
+#define RB_CHECKPOINT_MAGIC "RBCKPT01"
+
+#define RB_WAL_INSERT 1
+#define RB_WAL_DELETE 2
+
+typedef struct rb_wal_header { /* at the start of both files */
+  char magic[8];
+  uint64_t generation;
+} rb_wal_header;
+
+typedef struct rb_wal_record { /* followed by length bytes of payload */
+  uint32_t length;
+  uint32_t op; /* RB_WAL_INSERT or RB_WAL_DELETE */
+  uint32_t checksum; /* of op and the payload */
+} rb_wal_record;
+
+typedef struct rb_durable_tree {
+  rb_red_blk_tree* tree;
+  char* walPath;
+  char* checkpointPath;
+  int walFd;
+  uint64_t generation;
+  size_t (*Serialize)(const void*, const void*, char*, size_t, void*);
+  int (*Deserialize)(const char*, size_t, void**, void**, void*);
+  void* context;
+  char* buf; /* records not yet written */
+  size_t used;
+  int groupSize; /* records per fsync */
+  int pending; /* records since the last fsync */
+  long checkpointEvery; /* log records between checkpoints, 0 for never */
+  long logRecords; /* records in the current generation */
+  long replayed; /* records replayed by RBDurableOpen */
+  int failed; /* set once a write or fsync has failed */
+} rb_durable_tree;
+
+rb_durable_tree* RBDurableOpen(rb_red_blk_tree* tree, const char* path,
+			       size_t (*Serialize)(const void*, const void*,
+						   char*, size_t, void*),
+			       int (*Deserialize)(const char*, size_t, void**,
+						  void**, void*),
+			       void* context, int groupSize,
+			       long checkpointEvery);
+rb_red_blk_node* RBDurableInsert(rb_durable_tree*, void* key, void* info);
+void RBDurableDelete(rb_durable_tree*, rb_red_blk_node*);
+int RBDurableSync(rb_durable_tree*);
+int RBDurableCheckpoint(rb_durable_tree*);
+int RBDurableClose(rb_durable_tree*);
+
+#endif